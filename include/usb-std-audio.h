@@ -53,6 +53,180 @@ typedef struct __attribute__((packed)) {
     uint8_t  baInterfaceNr;
 } usb_audio_ctrl_header_t;
 
+/**
+ * @brief USB audio streaming class-specific interface descriptor type (UAC1).
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t  bLength;
+    uint8_t  bDescriptorType;
+    uint8_t  bDescriptorSubtype;
+    uint8_t  bTerminalLink;
+    uint8_t  bDelay;
+    uint16_t wFormatTag;
+} usb_audio_as_general_descriptor_t;
+
+/**
+ * @brief USB audio type I format descriptor type (UAC1), with a single sample rate.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint8_t bDescriptorSubtype;
+    uint8_t bFormatType;
+    uint8_t bNrChannels;
+    uint8_t bSubFrameSize;
+    uint8_t bBitResolution;
+    uint8_t bSamFreqType;
+    uint8_t tSamFreq[3];
+} usb_audio_format_type_i_descriptor_t;
+
+/**
+ * @brief USB audio streaming class-specific isochronous endpoint descriptor type (UAC1).
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t  bLength;
+    uint8_t  bDescriptorType;
+    uint8_t  bDescriptorSubtype;
+    uint8_t  bmAttributes;
+    uint8_t  bLockDelayUnits;
+    uint16_t wLockDelay;
+} usb_audio_cs_endpoint_descriptor_t;
+
+/**
+ * @brief USB audio clock source descriptor type (UAC2).
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint8_t bDescriptorSubtype;
+    uint8_t bClockID;
+    uint8_t bmAttributes;
+    uint8_t bmControls;
+    uint8_t bAssocTerminal;
+    uint8_t iClockSource;
+} usb_audio2_clock_source_descriptor_t;
+
+/**
+ * @brief USB audio clock selector descriptor type (UAC2), with a single input pin.
+ *
+ * Clock selectors with more input pins must be defined by the user, as the
+ * @c baCSourceID array is followed by the @c bmControls and @c iClockSelector fields.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint8_t bDescriptorSubtype;
+    uint8_t bClockID;
+    uint8_t bNrInPins;
+    uint8_t baCSourceID;
+    uint8_t bmControls;
+    uint8_t iClockSelector;
+} usb_audio2_clock_selector_descriptor_t;
+
+/**
+ * @brief USB audio streaming class-specific interface descriptor type (UAC2).
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t  bLength;
+    uint8_t  bDescriptorType;
+    uint8_t  bDescriptorSubtype;
+    uint8_t  bTerminalLink;
+    uint8_t  bmControls;
+    uint8_t  bFormatType;
+    uint32_t bmFormats;
+    uint8_t  bNrChannels;
+    uint32_t bmChannelConfig;
+    uint8_t  iChannelNames;
+} usb_audio2_as_general_descriptor_t;
+
+/**
+ * @brief USB audio type I format descriptor type (UAC2).
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint8_t bDescriptorSubtype;
+    uint8_t bFormatType;
+    uint8_t bSubslotSize;
+    uint8_t bBitResolution;
+} usb_audio2_format_type_i_descriptor_t;
+
+/**
+ * @brief USB audio streaming class-specific isochronous endpoint descriptor type (UAC2).
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t  bLength;
+    uint8_t  bDescriptorType;
+    uint8_t  bDescriptorSubtype;
+    uint8_t  bmAttributes;
+    uint8_t  bmControls;
+    uint8_t  bLockDelayUnits;
+    uint16_t wLockDelay;
+} usb_audio2_cs_endpoint_descriptor_t;
+
+/**
+ * @}
+ */
+
+/**
+ * @name USB audio request data types
+ *
+ * Data types to help building the parameter blocks of the audio class requests.
+ *
+ * @{
+ */
+
+/**
+ * @brief USB audio layout 1 RANGE subrange type (UAC2).
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t bMIN;
+    uint8_t bMAX;
+    uint8_t bRES;
+} usb_audio2_subrange_1_t;
+
+/**
+ * @brief USB audio layout 2 RANGE subrange type (UAC2).
+ */
+typedef struct __attribute__((packed)) {
+    uint16_t wMIN;
+    uint16_t wMAX;
+    uint16_t wRES;
+} usb_audio2_subrange_2_t;
+
+/**
+ * @brief USB audio layout 4 RANGE subrange type (UAC2).
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t dMIN;
+    uint32_t dMAX;
+    uint32_t dRES;
+} usb_audio2_subrange_4_t;
+
+/**
+ * @brief USB audio layout 1 RANGE parameter block type (UAC2).
+ */
+typedef struct __attribute__((packed)) {
+    uint16_t wNumSubRanges;
+    usb_audio2_subrange_1_t subranges[];
+} usb_audio2_range_1_t;
+
+/**
+ * @brief USB audio layout 2 RANGE parameter block type (UAC2).
+ */
+typedef struct __attribute__((packed)) {
+    uint16_t wNumSubRanges;
+    usb_audio2_subrange_2_t subranges[];
+} usb_audio2_range_2_t;
+
+/**
+ * @brief USB audio layout 4 RANGE parameter block type (UAC2).
+ */
+typedef struct __attribute__((packed)) {
+    uint16_t wNumSubRanges;
+    usb_audio2_subrange_4_t subranges[];
+} usb_audio2_range_4_t;
+
 /**
  * @}
  */
@@ -82,6 +256,69 @@ typedef struct __attribute__((packed)) {
 #define USB_AUDIO_DESCR_SUBTYPE_UAC1_PROCESSING_UNIT 0x07
 #define USB_AUDIO_DESCR_SUBTYPE_UAC1_EXTENSION_UNIT  0x08
 
+#define USB_AUDIO_DESCR_TYPE_CS_INTERFACE 0x24
+#define USB_AUDIO_DESCR_TYPE_CS_ENDPOINT  0x25
+
+#define USB_AUDIO_DESCR_SUBTYPE_UAC_AS_GENERAL  0x01
+#define USB_AUDIO_DESCR_SUBTYPE_UAC_FORMAT_TYPE 0x02
+#define USB_AUDIO_DESCR_SUBTYPE_UAC_EP_GENERAL  0x01
+
+#define USB_AUDIO_DESCR_FORMAT_TYPE_I  0x01
+#define USB_AUDIO_DESCR_FORMAT_TAG_PCM 0x0001
+
+#define USB_AUDIO_DESCR_EP_ATTR_UAC1_SAMPLING_FREQ    (1 << 0)
+#define USB_AUDIO_DESCR_EP_ATTR_UAC1_PITCH            (1 << 1)
+#define USB_AUDIO_DESCR_EP_ATTR_UAC1_MAX_PACKETS_ONLY (1 << 7)
+
+#define USB_AUDIO_DESCR_SAMPLE_FREQ(f) {(f) & 0xff, ((f) >> 8) & 0xff, ((f) >> 16) & 0xff}
+
+#define USB_REQ_AUDIO_UAC1_SET_CUR 0x01
+#define USB_REQ_AUDIO_UAC1_SET_MIN 0x02
+#define USB_REQ_AUDIO_UAC1_SET_MAX 0x03
+#define USB_REQ_AUDIO_UAC1_SET_RES 0x04
+#define USB_REQ_AUDIO_UAC1_GET_CUR 0x81
+#define USB_REQ_AUDIO_UAC1_GET_MIN 0x82
+#define USB_REQ_AUDIO_UAC1_GET_MAX 0x83
+#define USB_REQ_AUDIO_UAC1_GET_RES 0x84
+
+#define USB_AUDIO_UAC1_EP_CONTROL_SAMPLING_FREQ 0x01
+#define USB_AUDIO_UAC1_EP_CONTROL_PITCH         0x02
+
+#define USB_AUDIO_UAC1_FU_CONTROL_MUTE   0x01
+#define USB_AUDIO_UAC1_FU_CONTROL_VOLUME 0x02
+
+#define USB_AUDIO_DESCR_SUBTYPE_UAC2_EFFECT_UNIT           0x07
+#define USB_AUDIO_DESCR_SUBTYPE_UAC2_PROCESSING_UNIT       0x08
+#define USB_AUDIO_DESCR_SUBTYPE_UAC2_EXTENSION_UNIT        0x09
+#define USB_AUDIO_DESCR_SUBTYPE_UAC2_CLOCK_SOURCE          0x0a
+#define USB_AUDIO_DESCR_SUBTYPE_UAC2_CLOCK_SELECTOR        0x0b
+#define USB_AUDIO_DESCR_SUBTYPE_UAC2_CLOCK_MULTIPLIER      0x0c
+#define USB_AUDIO_DESCR_SUBTYPE_UAC2_SAMPLE_RATE_CONVERTER 0x0d
+
+#define USB_AUDIO_DESCR_FORMAT_UAC2_PCM (1 << 0)
+
+#define USB_AUDIO_DESCR_CLOCK_ATTR_UAC2_EXTERNAL              (0 << 0)
+#define USB_AUDIO_DESCR_CLOCK_ATTR_UAC2_INTERNAL_FIXED        (1 << 0)
+#define USB_AUDIO_DESCR_CLOCK_ATTR_UAC2_INTERNAL_VARIABLE     (2 << 0)
+#define USB_AUDIO_DESCR_CLOCK_ATTR_UAC2_INTERNAL_PROGRAMMABLE (3 << 0)
+#define USB_AUDIO_DESCR_CLOCK_ATTR_UAC2_SYNCED_TO_SOF         (1 << 2)
+
+// bmControls fields are 2 bits wide, for each control selector, starting from bit 0.
+#define USB_AUDIO_DESCR_CONTROL_UAC2_READ(n)         (1 << (2 * ((n) - 1)))
+#define USB_AUDIO_DESCR_CONTROL_UAC2_PROGRAMMABLE(n) (3 << (2 * ((n) - 1)))
+
+#define USB_REQ_AUDIO_UAC2_CUR   0x01
+#define USB_REQ_AUDIO_UAC2_RANGE 0x02
+#define USB_REQ_AUDIO_UAC2_MEM   0x03
+
+#define USB_AUDIO_UAC2_CS_CONTROL_SAM_FREQ    0x01
+#define USB_AUDIO_UAC2_CS_CONTROL_CLOCK_VALID 0x02
+
+#define USB_AUDIO_UAC2_CX_CONTROL_CLOCK_SELECTOR 0x01
+
+#define USB_AUDIO_UAC2_FU_CONTROL_MUTE   0x01
+#define USB_AUDIO_UAC2_FU_CONTROL_VOLUME 0x02
+
 /**
  * @}
  */
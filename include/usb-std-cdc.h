@@ -0,0 +1,257 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * @file usb-std-cdc.h
+ * @brief USB basic CDC-related descriptors header.
+ *
+ * This header defines some macros and types to help define the basic CDC-related
+ * (Communications Device Class) USB descriptors.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <usbd.h>
+
+/**
+ * @name USB CDC descriptor data types
+ *
+ * Data types to help defining the basic CDC-related USB descriptors.
+ *
+ * @{
+ */
+
+/**
+ * @brief USB CDC header functional descriptor type.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t  bFunctionLength;
+    uint8_t  bDescriptorType;
+    uint8_t  bDescriptorSubtype;
+    uint16_t bcdCDC;
+} usb_cdc_header_descriptor_t;
+
+/**
+ * @brief USB CDC call management functional descriptor type.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t bFunctionLength;
+    uint8_t bDescriptorType;
+    uint8_t bDescriptorSubtype;
+    uint8_t bmCapabilities;
+    uint8_t bDataInterface;
+} usb_cdc_call_management_descriptor_t;
+
+/**
+ * @brief USB CDC abstract control management functional descriptor type.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t bFunctionLength;
+    uint8_t bDescriptorType;
+    uint8_t bDescriptorSubtype;
+    uint8_t bmCapabilities;
+} usb_cdc_acm_descriptor_t;
+
+/**
+ * @brief USB CDC union functional descriptor type.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t bFunctionLength;
+    uint8_t bDescriptorType;
+    uint8_t bDescriptorSubtype;
+    uint8_t bControlInterface;
+    uint8_t bSubordinateInterface0;
+} usb_cdc_union_descriptor_t;
+
+/**
+ * @brief USB CDC line coding type, used by @c SET_LINE_CODING and @c GET_LINE_CODING requests.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t dwDTERate;
+    uint8_t  bCharFormat;
+    uint8_t  bParityType;
+    uint8_t  bDataBits;
+} usb_cdc_line_coding_t;
+
+/**
+ * @brief USB CDC notification header type, sent by the device over the notification endpoint.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t  bmRequestType;
+    uint8_t  bNotificationCode;
+    uint16_t wValue;
+    uint16_t wIndex;
+    uint16_t wLength;
+} usb_cdc_notification_t;
+
+/**
+ * @brief USB CDC ethernet networking functional descriptor type.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t  bFunctionLength;
+    uint8_t  bDescriptorType;
+    uint8_t  bDescriptorSubtype;
+    uint8_t  iMACAddress;
+    uint32_t bmEthernetStatistics;
+    uint16_t wMaxSegmentSize;
+    uint16_t wNumberMCFilters;
+    uint8_t  bNumberPowerFilters;
+} usb_cdc_ethernet_descriptor_t;
+
+/**
+ * @brief USB CDC NCM functional descriptor type.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t  bFunctionLength;
+    uint8_t  bDescriptorType;
+    uint8_t  bDescriptorSubtype;
+    uint16_t bcdNcmVersion;
+    uint8_t  bmNetworkCapabilities;
+} usb_cdc_ncm_descriptor_t;
+
+/**
+ * @brief USB CDC NCM NTB parameters type, returned by @c GET_NTB_PARAMETERS requests.
+ */
+typedef struct __attribute__((packed)) {
+    uint16_t wLength;
+    uint16_t bmNtbFormatsSupported;
+    uint32_t dwNtbInMaxSize;
+    uint16_t wNdpInDivisor;
+    uint16_t wNdpInPayloadRemainder;
+    uint16_t wNdpInAlignment;
+    uint16_t wReserved;
+    uint32_t dwNtbOutMaxSize;
+    uint16_t wNdpOutDivisor;
+    uint16_t wNdpOutPayloadRemainder;
+    uint16_t wNdpOutAlignment;
+    uint16_t wNtbOutMaxDatagrams;
+} usb_cdc_ncm_ntb_parameters_t;
+
+/**
+ * @brief USB CDC NCM 16-bit NTB header (NTH16) type.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t dwSignature;
+    uint16_t wHeaderLength;
+    uint16_t wSequence;
+    uint16_t wBlockLength;
+    uint16_t wNdpIndex;
+} usb_cdc_ncm_nth16_t;
+
+/**
+ * @brief USB CDC NCM 16-bit datagram pointer entry type.
+ */
+typedef struct __attribute__((packed)) {
+    uint16_t wDatagramIndex;
+    uint16_t wDatagramLength;
+} usb_cdc_ncm_dpe16_t;
+
+/**
+ * @brief USB CDC NCM 16-bit datagram pointer table (NDP16) type.
+ *
+ * The datagram pointer entries are terminated by an entry with both fields set to zero.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t dwSignature;
+    uint16_t wLength;
+    uint16_t wNextNdpIndex;
+    usb_cdc_ncm_dpe16_t datagrams[];
+} usb_cdc_ncm_ndp16_t;
+
+/**
+ * @}
+ */
+
+/**
+ * @name USB CDC descriptor macros
+ *
+ * Macros to help defining the basic CDC-related USB descriptors.
+ *
+ * @{
+ */
+
+#define USB_CDC_DESCR_VERSION 0x0120
+
+#define USB_CDC_DESCR_SUBCLASS_ACM 0x02
+#define USB_CDC_DESCR_SUBCLASS_NCM 0x0d
+
+#define USB_CDC_DESCR_PROTOCOL_NONE 0x00
+#define USB_CDC_DESCR_PROTOCOL_AT   0x01
+
+#define USB_CDC_DESCR_DATA_PROTOCOL_NCM_NTB 0x01
+
+#define USB_CDC_DESCR_TYPE_CS_INTERFACE 0x24
+#define USB_CDC_DESCR_TYPE_CS_ENDPOINT  0x25
+
+#define USB_CDC_DESCR_SUBTYPE_HEADER          0x00
+#define USB_CDC_DESCR_SUBTYPE_CALL_MANAGEMENT 0x01
+#define USB_CDC_DESCR_SUBTYPE_ACM             0x02
+#define USB_CDC_DESCR_SUBTYPE_UNION           0x06
+#define USB_CDC_DESCR_SUBTYPE_ETHERNET        0x0f
+#define USB_CDC_DESCR_SUBTYPE_NCM             0x1a
+
+#define USB_CDC_DESCR_ACM_CAP_COMM_FEATURE       (1 << 0)
+#define USB_CDC_DESCR_ACM_CAP_LINE_CODING        (1 << 1)
+#define USB_CDC_DESCR_ACM_CAP_SEND_BREAK         (1 << 2)
+#define USB_CDC_DESCR_ACM_CAP_NETWORK_CONNECTION (1 << 3)
+
+#define USB_REQ_CDC_SEND_ENCAPSULATED_COMMAND 0x00
+#define USB_REQ_CDC_GET_ENCAPSULATED_RESPONSE 0x01
+#define USB_REQ_CDC_SET_LINE_CODING           0x20
+#define USB_REQ_CDC_GET_LINE_CODING           0x21
+#define USB_REQ_CDC_SET_CONTROL_LINE_STATE    0x22
+#define USB_REQ_CDC_SEND_BREAK                0x23
+
+#define USB_REQ_CDC_SET_ETHERNET_MULTICAST_FILTERS 0x40
+#define USB_REQ_CDC_SET_ETHERNET_PACKET_FILTER     0x43
+#define USB_REQ_CDC_NCM_GET_NTB_PARAMETERS         0x80
+#define USB_REQ_CDC_NCM_GET_NET_ADDRESS            0x81
+#define USB_REQ_CDC_NCM_SET_NET_ADDRESS            0x82
+#define USB_REQ_CDC_NCM_GET_NTB_FORMAT             0x83
+#define USB_REQ_CDC_NCM_SET_NTB_FORMAT             0x84
+#define USB_REQ_CDC_NCM_GET_NTB_INPUT_SIZE         0x85
+#define USB_REQ_CDC_NCM_SET_NTB_INPUT_SIZE         0x86
+#define USB_REQ_CDC_NCM_GET_MAX_DATAGRAM_SIZE      0x87
+#define USB_REQ_CDC_NCM_SET_MAX_DATAGRAM_SIZE      0x88
+#define USB_REQ_CDC_NCM_GET_CRC_MODE               0x89
+#define USB_REQ_CDC_NCM_SET_CRC_MODE               0x8a
+
+#define USB_CDC_NOTIF_NETWORK_CONNECTION      0x00
+#define USB_CDC_NOTIF_RESPONSE_AVAILABLE      0x01
+#define USB_CDC_NOTIF_SERIAL_STATE            0x20
+#define USB_CDC_NOTIF_CONNECTION_SPEED_CHANGE 0x2a
+
+#define USB_CDC_CONTROL_LINE_STATE_DTR (1 << 0)
+#define USB_CDC_CONTROL_LINE_STATE_RTS (1 << 1)
+
+#define USB_CDC_SERIAL_STATE_DCD     (1 << 0)
+#define USB_CDC_SERIAL_STATE_DSR     (1 << 1)
+#define USB_CDC_SERIAL_STATE_BREAK   (1 << 2)
+#define USB_CDC_SERIAL_STATE_RING    (1 << 3)
+#define USB_CDC_SERIAL_STATE_FRAMING (1 << 4)
+#define USB_CDC_SERIAL_STATE_PARITY  (1 << 5)
+#define USB_CDC_SERIAL_STATE_OVERRUN (1 << 6)
+
+#define USB_CDC_NCM_VERSION 0x0100
+
+#define USB_CDC_NCM_CAP_PACKET_FILTER    (1 << 0)
+#define USB_CDC_NCM_CAP_NET_ADDRESS      (1 << 1)
+#define USB_CDC_NCM_CAP_ENCAPSULATED     (1 << 2)
+#define USB_CDC_NCM_CAP_MAX_DATAGRAM     (1 << 3)
+#define USB_CDC_NCM_CAP_CRC_MODE         (1 << 4)
+#define USB_CDC_NCM_CAP_NTB_INPUT_SIZE_8 (1 << 5)
+
+#define USB_CDC_NCM_NTB_FORMAT_16 (1 << 0)
+#define USB_CDC_NCM_NTB_FORMAT_32 (1 << 1)
+
+#define USB_CDC_NCM_NTH16_SIGNATURE 0x484d434e  // "NCMH"
+#define USB_CDC_NCM_NDP16_SIGNATURE 0x304d434e  // "NCM0"
+
+/**
+ * @}
+ */
@@ -0,0 +1,116 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * @file usb-std-dfu.h
+ * @brief Basic USB DFU descriptors header.
+ *
+ * This header defines some macros and types to help define the basic USB device
+ * firmware upgrade (DFU 1.1) descriptors.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <usbd.h>
+
+/**
+ * @name USB DFU descriptor data types
+ *
+ * Data types to help defining the basic USB DFU descriptors.
+ *
+ * @{
+ */
+
+/**
+ * @brief USB DFU functional descriptor type.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t  bLength;
+    uint8_t  bDescriptorType;
+    uint8_t  bmAttributes;
+    uint16_t wDetachTimeOut;
+    uint16_t wTransferSize;
+    uint16_t bcdDFUVersion;
+} usb_dfu_functional_descriptor_t;
+
+/**
+ * @brief USB DFU GETSTATUS response type.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t bStatus;
+    uint8_t bwPollTimeout[3];
+    uint8_t bState;
+    uint8_t iString;
+} usb_dfu_status_t;
+
+/**
+ * @}
+ */
+
+/**
+ * @name USB DFU descriptor macros
+ *
+ * Macros to help defining the basic USB DFU descriptors.
+ *
+ * @{
+ */
+
+#define USB_DFU_DESCR_VERSION 0x0110
+
+#define USB_DFU_DESCR_SUBCLASS 0x01
+
+#define USB_DFU_DESCR_PROTOCOL_RUNTIME 0x01
+#define USB_DFU_DESCR_PROTOCOL_DFU     0x02
+
+#define USB_DESCR_TYPE_DFU_FUNCTIONAL 0x21
+
+#define USB_DFU_DESCR_ATTR_CAN_DNLOAD             (1 << 0)
+#define USB_DFU_DESCR_ATTR_CAN_UPLOAD             (1 << 1)
+#define USB_DFU_DESCR_ATTR_MANIFESTATION_TOLERANT (1 << 2)
+#define USB_DFU_DESCR_ATTR_WILL_DETACH            (1 << 3)
+
+#define USB_REQ_DFU_DETACH    0x00
+#define USB_REQ_DFU_DNLOAD    0x01
+#define USB_REQ_DFU_UPLOAD    0x02
+#define USB_REQ_DFU_GETSTATUS 0x03
+#define USB_REQ_DFU_CLRSTATUS 0x04
+#define USB_REQ_DFU_GETSTATE  0x05
+#define USB_REQ_DFU_ABORT     0x06
+
+#define USB_DFU_STATE_APP_IDLE                0
+#define USB_DFU_STATE_APP_DETACH              1
+#define USB_DFU_STATE_DFU_IDLE                2
+#define USB_DFU_STATE_DFU_DNLOAD_SYNC         3
+#define USB_DFU_STATE_DFU_DNBUSY              4
+#define USB_DFU_STATE_DFU_DNLOAD_IDLE         5
+#define USB_DFU_STATE_DFU_MANIFEST_SYNC       6
+#define USB_DFU_STATE_DFU_MANIFEST            7
+#define USB_DFU_STATE_DFU_MANIFEST_WAIT_RESET 8
+#define USB_DFU_STATE_DFU_UPLOAD_IDLE         9
+#define USB_DFU_STATE_DFU_ERROR               10
+
+#define USB_DFU_STATUS_OK                0x00
+#define USB_DFU_STATUS_ERR_TARGET        0x01
+#define USB_DFU_STATUS_ERR_FILE          0x02
+#define USB_DFU_STATUS_ERR_WRITE         0x03
+#define USB_DFU_STATUS_ERR_ERASE         0x04
+#define USB_DFU_STATUS_ERR_CHECK_ERASED  0x05
+#define USB_DFU_STATUS_ERR_PROG          0x06
+#define USB_DFU_STATUS_ERR_VERIFY        0x07
+#define USB_DFU_STATUS_ERR_ADDRESS       0x08
+#define USB_DFU_STATUS_ERR_NOTDONE       0x09
+#define USB_DFU_STATUS_ERR_FIRMWARE      0x0a
+#define USB_DFU_STATUS_ERR_VENDOR        0x0b
+#define USB_DFU_STATUS_ERR_USBR          0x0c
+#define USB_DFU_STATUS_ERR_POR           0x0d
+#define USB_DFU_STATUS_ERR_UNKNOWN       0x0e
+#define USB_DFU_STATUS_ERR_STALLEDPKT    0x0f
+
+/**
+ * @}
+ */
@@ -62,6 +62,13 @@ typedef struct __attribute__((packed)) {
 #define USB_DESCR_TYPE_HID_REPORT 0x22
 #define USB_DESCR_TYPE_HID_PHYS   0x23
 
+#define USB_HID_REPORT_TYPE_INPUT   0x01
+#define USB_HID_REPORT_TYPE_OUTPUT  0x02
+#define USB_HID_REPORT_TYPE_FEATURE 0x03
+
+#define USB_HID_PROTOCOL_BOOT   0x00
+#define USB_HID_PROTOCOL_REPORT 0x01
+
 /**
  * @}
  */
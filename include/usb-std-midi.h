@@ -21,7 +21,7 @@
 /**
  * @name USB MIDI descriptor data types
  *
- * Data typeds to help defining the basic MIDI-related USB descriptors.
+ * Data types to help defining the basic MIDI-related USB descriptors.
  *
  * @{
  */
@@ -75,6 +75,58 @@ typedef struct __attribute__((packed)) {
     uint8_t baAssocJackID;
 } usb_midi_streaming_endpoint_descriptor_t;
 
+/**
+ * @brief USB MIDI 2.0 streaming endpoint descriptor type.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint8_t bDescriptorSubtype;
+    uint8_t bNumGrpTrmBlock;
+    uint8_t baAssoGrpTrmBlkID;
+} usb_midi2_streaming_endpoint_descriptor_t;
+
+/**
+ * @brief USB MIDI 2.0 group terminal block header descriptor type.
+ *
+ * Returned by class-specific GET_DESCRIPTOR requests, followed by the group terminal
+ * block descriptors, up to @c wTotalLength.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t  bLength;
+    uint8_t  bDescriptorType;
+    uint8_t  bDescriptorSubtype;
+    uint16_t wTotalLength;
+} usb_midi2_group_terminal_block_header_descriptor_t;
+
+/**
+ * @brief USB MIDI 2.0 group terminal block descriptor type.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t  bLength;
+    uint8_t  bDescriptorType;
+    uint8_t  bDescriptorSubtype;
+    uint8_t  bGrpTrmBlkID;
+    uint8_t  bGrpTrmBlkType;
+    uint8_t  nGroupTrm;
+    uint8_t  nNumGroupTrm;
+    uint8_t  iBlockItem;
+    uint8_t  bMIDIProtocol;
+    uint16_t wMaxInputBandwidth;
+    uint16_t wMaxOutputBandwidth;
+} usb_midi2_group_terminal_block_descriptor_t;
+
+/**
+ * @brief USB MIDI 1.0 event packet type.
+ *
+ * The header holds the cable number in the high nibble and the code index number
+ * in the low nibble.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t header;
+    uint8_t midi[3];
+} usb_midi_event_packet_t;
+
 /**
  * @}
  */
@@ -87,16 +139,73 @@ typedef struct __attribute__((packed)) {
  * @{
  */
 
+#define USB_MIDI_DESCR_MS_VERSION_1_0 0x0100
+#define USB_MIDI_DESCR_MS_VERSION_2_0 0x0200
+
+#define USB_MIDI_DESCR_TYPE_CS_INTERFACE    0x24
+#define USB_MIDI_DESCR_TYPE_CS_ENDPOINT     0x25
+#define USB_MIDI_DESCR_TYPE_CS_GR_TRM_BLOCK 0x26
+
 #define USB_MIDI_DESCR_SUBTYPE_MS_HEADER        0x01
 #define USB_MIDI_DESCR_SUBTYPE_MS_MIDI_IN_JACK  0x02
 #define USB_MIDI_DESCR_SUBTYPE_MS_MIDI_OUT_JACK 0x03
 #define USB_MIDI_DESCR_SUBTYPE_MS_ELEMENT       0x04
 
-#define USB_MIDI_DESCR_EPT_SUBTYPE_MS_GENERAL 0x01
+#define USB_MIDI_DESCR_EPT_SUBTYPE_MS_GENERAL     0x01
+#define USB_MIDI_DESCR_EPT_SUBTYPE_MS_GENERAL_2_0 0x02
+
+#define USB_MIDI_DESCR_SUBTYPE_GR_TRM_BLOCK_HEADER 0x01
+#define USB_MIDI_DESCR_SUBTYPE_GR_TRM_BLOCK        0x02
+
+#define USB_MIDI_DESCR_GR_TRM_BLOCK_TYPE_BIDIRECTIONAL 0x00
+#define USB_MIDI_DESCR_GR_TRM_BLOCK_TYPE_IN_ONLY       0x01
+#define USB_MIDI_DESCR_GR_TRM_BLOCK_TYPE_OUT_ONLY      0x02
+
+#define USB_MIDI_DESCR_PROTOCOL_UNKNOWN           0x00
+#define USB_MIDI_DESCR_PROTOCOL_MIDI_1_0_64       0x01
+#define USB_MIDI_DESCR_PROTOCOL_MIDI_1_0_64_JRTS  0x02
+#define USB_MIDI_DESCR_PROTOCOL_MIDI_1_0_128      0x03
+#define USB_MIDI_DESCR_PROTOCOL_MIDI_1_0_128_JRTS 0x04
+#define USB_MIDI_DESCR_PROTOCOL_MIDI_2_0          0x11
+#define USB_MIDI_DESCR_PROTOCOL_MIDI_2_0_JRTS     0x12
 
 #define USB_MIDI_DESCR_JACK_TYPE_MS_EMBEDDED 0x01
 #define USB_MIDI_DESCR_JACK_TYPE_MS_EXTERNAL 0x02
 
+#define USB_MIDI_CIN_MISC          0x0
+#define USB_MIDI_CIN_CABLE_EVENT   0x1
+#define USB_MIDI_CIN_SYSCOM_2      0x2
+#define USB_MIDI_CIN_SYSCOM_3      0x3
+#define USB_MIDI_CIN_SYSEX_START   0x4
+#define USB_MIDI_CIN_SYSEX_END_1   0x5
+#define USB_MIDI_CIN_SYSEX_END_2   0x6
+#define USB_MIDI_CIN_SYSEX_END_3   0x7
+#define USB_MIDI_CIN_NOTE_OFF      0x8
+#define USB_MIDI_CIN_NOTE_ON       0x9
+#define USB_MIDI_CIN_POLY_KEYPRESS 0xa
+#define USB_MIDI_CIN_CONTROL       0xb
+#define USB_MIDI_CIN_PROGRAM       0xc
+#define USB_MIDI_CIN_CHANNEL_PRESS 0xd
+#define USB_MIDI_CIN_PITCH_BEND    0xe
+#define USB_MIDI_CIN_SINGLE_BYTE   0xf
+
+#define USB_MIDI_EVENT_HEADER(cable, cin) ((uint8_t) ((((cable) & 0xf) << 4) | ((cin) & 0xf)))
+
+#define USB_MIDI_UMP_MT_UTILITY         0x0
+#define USB_MIDI_UMP_MT_SYSTEM          0x1
+#define USB_MIDI_UMP_MT_MIDI1_CHANNEL   0x2
+#define USB_MIDI_UMP_MT_DATA_64         0x3
+#define USB_MIDI_UMP_MT_MIDI2_CHANNEL   0x4
+#define USB_MIDI_UMP_MT_DATA_128        0x5
+#define USB_MIDI_UMP_MT_FLEX_DATA       0xd
+#define USB_MIDI_UMP_MT_STREAM          0xf
+
+#define USB_MIDI_UMP_MT(word0)    ((uint8_t) ((word0) >> 28))
+#define USB_MIDI_UMP_GROUP(word0) ((uint8_t) (((word0) >> 24) & 0xf))
+
+// number of 32-bit words of a universal midi packet, by message type
+#define USB_MIDI_UMP_WORDS(mt) ((uint8_t) ((0x4443322211422111ULL >> (((mt) & 0xf) * 4)) & 0xf))
+
 /**
  * @}
  */
@@ -0,0 +1,111 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * @file usb-std-msc.h
+ * @brief Basic USB mass storage descriptors header.
+ *
+ * This header defines some macros and types to help define the basic USB mass
+ * storage descriptors, and the Bulk-Only Transport (BOT) wrappers.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <usbd.h>
+
+/**
+ * @name USB mass storage data types
+ *
+ * Data types of the Bulk-Only Transport wrappers.
+ *
+ * @{
+ */
+
+/**
+ * @brief USB mass storage command block wrapper type.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t dCBWSignature;
+    uint32_t dCBWTag;
+    uint32_t dCBWDataTransferLength;
+    uint8_t  bmCBWFlags;
+    uint8_t  bCBWLUN;
+    uint8_t  bCBWCBLength;
+    uint8_t  CBWCB[16];
+} usb_msc_cbw_t;
+
+/**
+ * @brief USB mass storage command status wrapper type.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t dCSWSignature;
+    uint32_t dCSWTag;
+    uint32_t dCSWDataResidue;
+    uint8_t  bCSWStatus;
+} usb_msc_csw_t;
+
+/**
+ * @}
+ */
+
+/**
+ * @name USB mass storage macros
+ *
+ * Macros to help defining the basic USB mass storage descriptors, and handling the
+ * SCSI commands.
+ *
+ * @{
+ */
+
+#define USB_MSC_DESCR_SUBCLASS_SCSI 0x06
+
+#define USB_MSC_DESCR_PROTOCOL_BOT 0x50
+
+#define USB_REQ_MSC_GET_MAX_LUN 0xfe
+#define USB_REQ_MSC_BOT_RESET   0xff
+
+#define USB_MSC_CBW_SIGNATURE 0x43425355
+#define USB_MSC_CSW_SIGNATURE 0x53425355
+
+#define USB_MSC_CBW_FLAGS_DATA_IN (1 << 7)
+
+#define USB_MSC_CSW_STATUS_PASSED      0x00
+#define USB_MSC_CSW_STATUS_FAILED      0x01
+#define USB_MSC_CSW_STATUS_PHASE_ERROR 0x02
+
+#define USB_MSC_SCSI_TEST_UNIT_READY          0x00
+#define USB_MSC_SCSI_REQUEST_SENSE            0x03
+#define USB_MSC_SCSI_INQUIRY                  0x12
+#define USB_MSC_SCSI_MODE_SENSE_6             0x1a
+#define USB_MSC_SCSI_START_STOP_UNIT          0x1b
+#define USB_MSC_SCSI_PREVENT_ALLOW_REMOVAL    0x1e
+#define USB_MSC_SCSI_READ_FORMAT_CAPACITIES   0x23
+#define USB_MSC_SCSI_READ_CAPACITY_10         0x25
+#define USB_MSC_SCSI_READ_10                  0x28
+#define USB_MSC_SCSI_WRITE_10                 0x2a
+#define USB_MSC_SCSI_VERIFY_10                0x2f
+#define USB_MSC_SCSI_SYNCHRONIZE_CACHE_10     0x35
+#define USB_MSC_SCSI_MODE_SENSE_10            0x5a
+
+#define USB_MSC_SCSI_SENSE_NO_SENSE        0x00
+#define USB_MSC_SCSI_SENSE_NOT_READY       0x02
+#define USB_MSC_SCSI_SENSE_MEDIUM_ERROR    0x03
+#define USB_MSC_SCSI_SENSE_ILLEGAL_REQUEST 0x05
+#define USB_MSC_SCSI_SENSE_DATA_PROTECT    0x07
+
+#define USB_MSC_SCSI_ASC_WRITE_FAULT                0x03
+#define USB_MSC_SCSI_ASC_UNRECOVERED_READ_ERROR     0x11
+#define USB_MSC_SCSI_ASC_INVALID_COMMAND            0x20
+#define USB_MSC_SCSI_ASC_LBA_OUT_OF_RANGE           0x21
+#define USB_MSC_SCSI_ASC_INVALID_FIELD_IN_CDB       0x24
+#define USB_MSC_SCSI_ASC_WRITE_PROTECTED            0x27
+#define USB_MSC_SCSI_ASC_MEDIUM_NOT_PRESENT         0x3a
+
+/**
+ * @}
+ */
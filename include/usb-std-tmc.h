@@ -0,0 +1,129 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * @file usb-std-tmc.h
+ * @brief Basic USB test and measurement class descriptors header.
+ *
+ * This header defines some macros and types to help define the basic USB test and
+ * measurement class (USBTMC and USB488) descriptors, and the bulk transfer headers.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <usbd.h>
+
+/**
+ * @name USB test and measurement data types
+ *
+ * Data types of the bulk transfer headers and class request responses.
+ *
+ * @{
+ */
+
+/**
+ * @brief USB test and measurement Bulk-OUT and Bulk-IN header type.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t  MsgID;
+    uint8_t  bTag;
+    uint8_t  bTagInverse;
+    uint8_t  Reserved;
+    uint32_t TransferSize;
+    uint8_t  bmTransferAttributes;
+    uint8_t  TermChar;
+    uint8_t  Reserved2[2];
+} usb_tmc_bulk_header_t;
+
+/**
+ * @brief USB test and measurement GET_CAPABILITIES response type.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t  USBTMC_status;
+    uint8_t  Reserved;
+    uint16_t bcdUSBTMC;
+    uint8_t  bmInterfaceCapabilities;
+    uint8_t  bmDeviceCapabilities;
+    uint8_t  Reserved2[6];
+    uint16_t bcdUSB488;
+    uint8_t  bmInterfaceCapabilities488;
+    uint8_t  bmDeviceCapabilities488;
+    uint8_t  Reserved3[8];
+} usb_tmc_capabilities_t;
+
+/**
+ * @}
+ */
+
+/**
+ * @name USB test and measurement macros
+ *
+ * Macros to help defining the basic USB test and measurement descriptors, and
+ * handling the bulk transfers and class requests.
+ *
+ * @{
+ */
+
+#define USB_TMC_DESCR_SUBCLASS 0x03
+
+#define USB_TMC_DESCR_PROTOCOL_TMC    0x00
+#define USB_TMC_DESCR_PROTOCOL_USB488 0x01
+
+#define USB_TMC_VERSION        0x0100
+#define USB_TMC_USB488_VERSION 0x0100
+
+#define USB_TMC_MSGID_DEV_DEP_MSG_OUT         1
+#define USB_TMC_MSGID_REQUEST_DEV_DEP_MSG_IN  2
+#define USB_TMC_MSGID_DEV_DEP_MSG_IN          2
+#define USB_TMC_MSGID_USB488_TRIGGER          128
+
+#define USB_TMC_TRANSFER_ATTR_EOM          (1 << 0)
+#define USB_TMC_TRANSFER_ATTR_TERM_CHAR_EN (1 << 1)
+
+#define USB_REQ_TMC_INITIATE_ABORT_BULK_OUT     1
+#define USB_REQ_TMC_CHECK_ABORT_BULK_OUT_STATUS 2
+#define USB_REQ_TMC_INITIATE_ABORT_BULK_IN      3
+#define USB_REQ_TMC_CHECK_ABORT_BULK_IN_STATUS  4
+#define USB_REQ_TMC_INITIATE_CLEAR              5
+#define USB_REQ_TMC_CHECK_CLEAR_STATUS          6
+#define USB_REQ_TMC_GET_CAPABILITIES            7
+#define USB_REQ_TMC_INDICATOR_PULSE             64
+#define USB_REQ_TMC_USB488_READ_STATUS_BYTE     128
+#define USB_REQ_TMC_USB488_REN_CONTROL          160
+#define USB_REQ_TMC_USB488_GO_TO_LOCAL          161
+#define USB_REQ_TMC_USB488_LOCAL_LOCKOUT        162
+
+#define USB_TMC_STATUS_SUCCESS                  0x01
+#define USB_TMC_STATUS_PENDING                  0x02
+#define USB_TMC_STATUS_USB488_INTERRUPT_IN_BUSY 0x20
+#define USB_TMC_STATUS_FAILED                   0x80
+#define USB_TMC_STATUS_TRANSFER_NOT_IN_PROGRESS 0x81
+#define USB_TMC_STATUS_SPLIT_NOT_IN_PROGRESS    0x82
+#define USB_TMC_STATUS_SPLIT_IN_PROGRESS        0x83
+
+#define USB_TMC_ITF_CAP_INDICATOR_PULSE (1 << 2)
+#define USB_TMC_ITF_CAP_TALK_ONLY       (1 << 1)
+#define USB_TMC_ITF_CAP_LISTEN_ONLY     (1 << 0)
+
+#define USB_TMC_DEV_CAP_TERM_CHAR (1 << 0)
+
+#define USB_TMC_USB488_ITF_CAP_488_2       (1 << 2)
+#define USB_TMC_USB488_ITF_CAP_REN_CONTROL (1 << 1)
+#define USB_TMC_USB488_ITF_CAP_TRIGGER     (1 << 0)
+
+#define USB_TMC_USB488_DEV_CAP_SCPI (1 << 3)
+#define USB_TMC_USB488_DEV_CAP_SR1  (1 << 2)
+#define USB_TMC_USB488_DEV_CAP_RL1  (1 << 1)
+#define USB_TMC_USB488_DEV_CAP_DT1  (1 << 0)
+
+#define USB_TMC_USB488_NOTIFY_STATUS_BYTE (1 << 7)
+#define USB_TMC_USB488_NOTIFY_SRQ         0x81
+
+/**
+ * @}
+ */
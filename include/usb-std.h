@@ -107,6 +107,150 @@ typedef struct __attribute__((packed)) {
     uint8_t  bInterval;
 } usb_endpoint_descriptor_t;
 
+/**
+ * @brief USB binary device object store (BOS) descriptor type.
+ *
+ * Device capability descriptors must follow this header, and @c wTotalLength must
+ * include all of them.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t  bLength;
+    uint8_t  bDescriptorType;
+    uint16_t wTotalLength;
+    uint8_t  bNumDeviceCaps;
+} usb_bos_descriptor_t;
+
+/**
+ * @brief USB 2.0 extension device capability descriptor type.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t  bLength;
+    uint8_t  bDescriptorType;
+    uint8_t  bDevCapabilityType;
+    uint32_t bmAttributes;
+} usb_bos_usb20_ext_descriptor_t;
+
+/**
+ * @brief USB platform device capability descriptor type.
+ *
+ * Header of the platform-specific device capability descriptors. The capability data
+ * defined by the platform identified by @c PlatformCapabilityUUID follows.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t  bLength;
+    uint8_t  bDescriptorType;
+    uint8_t  bDevCapabilityType;
+    uint8_t  bReserved;
+    uint8_t  PlatformCapabilityUUID[16];
+} usb_bos_platform_descriptor_t;
+
+/**
+ * @brief WebUSB platform device capability descriptor type.
+ *
+ * @c PlatformCapabilityUUID must be set to @ref USB_BOS_PLATFORM_UUID_WEBUSB.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t  bLength;
+    uint8_t  bDescriptorType;
+    uint8_t  bDevCapabilityType;
+    uint8_t  bReserved;
+    uint8_t  PlatformCapabilityUUID[16];
+    uint16_t bcdVersion;
+    uint8_t  bVendorCode;
+    uint8_t  iLandingPage;
+} usb_bos_platform_webusb_descriptor_t;
+
+/**
+ * @brief Microsoft OS 2.0 platform device capability descriptor type.
+ *
+ * @c PlatformCapabilityUUID must be set to @ref USB_BOS_PLATFORM_UUID_MSOS20, and
+ * @c wMSOSDescriptorSetTotalLength must match the @c wTotalLength of the descriptor
+ * set returned by @ref usbd_get_msos20_descriptor_set_cb.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t  bLength;
+    uint8_t  bDescriptorType;
+    uint8_t  bDevCapabilityType;
+    uint8_t  bReserved;
+    uint8_t  PlatformCapabilityUUID[16];
+    uint32_t dwWindowsVersion;
+    uint16_t wMSOSDescriptorSetTotalLength;
+    uint8_t  bMS_VendorCode;
+    uint8_t  bAltEnumCode;
+} usb_bos_platform_msos20_descriptor_t;
+
+/**
+ * @brief WebUSB URL descriptor type.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint8_t bScheme;
+    uint8_t URL[];
+} usb_webusb_url_descriptor_t;
+
+/**
+ * @brief Microsoft OS 2.0 descriptor set header type.
+ *
+ * @c wTotalLength includes the whole descriptor set (this header, all the subset
+ * headers and feature descriptors).
+ */
+typedef struct __attribute__((packed)) {
+    uint16_t wLength;
+    uint16_t wDescriptorType;
+    uint32_t dwWindowsVersion;
+    uint16_t wTotalLength;
+} usb_msos20_set_header_descriptor_t;
+
+/**
+ * @brief Microsoft OS 2.0 configuration subset header type.
+ */
+typedef struct __attribute__((packed)) {
+    uint16_t wLength;
+    uint16_t wDescriptorType;
+    uint8_t  bConfigurationValue;
+    uint8_t  bReserved;
+    uint16_t wTotalLength;
+} usb_msos20_subset_header_configuration_descriptor_t;
+
+/**
+ * @brief Microsoft OS 2.0 function subset header type.
+ */
+typedef struct __attribute__((packed)) {
+    uint16_t wLength;
+    uint16_t wDescriptorType;
+    uint8_t  bFirstInterface;
+    uint8_t  bReserved;
+    uint16_t wSubsetLength;
+} usb_msos20_subset_header_function_descriptor_t;
+
+/**
+ * @brief Microsoft OS 2.0 compatible ID feature descriptor type.
+ */
+typedef struct __attribute__((packed)) {
+    uint16_t wLength;
+    uint16_t wDescriptorType;
+    uint8_t  CompatibleID[8];
+    uint8_t  SubCompatibleID[8];
+} usb_msos20_feature_compatible_id_descriptor_t;
+
+/**
+ * @brief Microsoft OS 2.0 registry property feature descriptor type, for @c DeviceInterfaceGUIDs.
+ *
+ * The most common registry property, required by WinUSB to expose the device to
+ * applications. Both @c PropertyName and @c PropertyData may be initialized with
+ * @c u"" string literals.
+ */
+typedef struct __attribute__((packed)) {
+    uint16_t wLength;
+    uint16_t wDescriptorType;
+    uint16_t wPropertyDataType;
+    uint16_t wPropertyNameLength;
+    uint16_t PropertyName[21];
+    uint16_t wPropertyDataLength;
+    uint16_t PropertyData[40];
+} usb_msos20_feature_reg_property_device_interface_guids_descriptor_t;
+
 /**
  * @}
  */
@@ -166,6 +310,12 @@ typedef struct __attribute__((packed)) {
 #define USB_DESCR_TYPE_ENDPOINT                  0x05
 #define USB_DESCR_TYPE_DEVICE_QUALIFIER          0x06
 #define USB_DESCR_TYPE_OTHER_SPEED_CONFIGURATION 0x07
+#define USB_DESCR_TYPE_INTERFACE_POWER           0x08
+#define USB_DESCR_TYPE_OTG                       0x09
+#define USB_DESCR_TYPE_DEBUG                     0x0a
+#define USB_DESCR_TYPE_INTERFACE_ASSOCIATION     0x0b
+#define USB_DESCR_TYPE_BOS                       0x0f
+#define USB_DESCR_TYPE_DEVICE_CAPABILITY         0x10
 
 #define USB_DESCR_CONFIG_ATTR_RESERVED      (1 << 7)
 #define USB_DESCR_CONFIG_ATTR_SELF_POWERED  (1 << 6)
@@ -207,8 +357,8 @@ typedef struct __attribute__((packed)) {
 #define USB_DESCR_EPT_ATTR_ADAPTIVE               (2 << 2)
 #define USB_DESCR_EPT_ATTR_SYNC                   (3 << 2)
 #define USB_DESCR_EPT_ATTR_DATA                   (0 << 4)
-#define USB_DESCR_EPT_ATTR_FEEDBACK               (1 << 2)
-#define USB_DESCR_EPT_ATTR_IMPLICIT_FEEDBACK_DATA (2 << 2)
+#define USB_DESCR_EPT_ATTR_FEEDBACK               (1 << 4)
+#define USB_DESCR_EPT_ATTR_IMPLICIT_FEEDBACK_DATA (2 << 4)
 
 #define USB_DESCR_FEAT_ENDPOINT_HALT        0x00
 #define USB_DESCR_FEAT_DEVICE_REMOTE_WAKEUP 0x01
@@ -217,3 +367,62 @@ typedef struct __attribute__((packed)) {
 /**
  * @}
  */
+
+
+/**
+ * @name USB BOS descriptor macros
+ *
+ * Macros to help defining the USB binary device object store (BOS) descriptor and its
+ * device capabilities, including the WebUSB and Microsoft OS 2.0 platform capabilities.
+ *
+ * @{
+ */
+
+#define USB_BOS_DEV_CAP_TYPE_WIRELESS_USB  0x01
+#define USB_BOS_DEV_CAP_TYPE_USB_20_EXT    0x02
+#define USB_BOS_DEV_CAP_TYPE_SUPERSPEED    0x03
+#define USB_BOS_DEV_CAP_TYPE_CONTAINER_ID  0x04
+#define USB_BOS_DEV_CAP_TYPE_PLATFORM      0x05
+
+#define USB_BOS_USB20_EXT_ATTR_LPM                 (1 << 1)
+#define USB_BOS_USB20_EXT_ATTR_BESL                (1 << 2)
+#define USB_BOS_USB20_EXT_ATTR_BASELINE_BESL_VALID (1 << 3)
+#define USB_BOS_USB20_EXT_ATTR_DEEP_BESL_VALID     (1 << 4)
+#define USB_BOS_USB20_EXT_ATTR_BASELINE_BESL(b)    (((b) & 0xf) << 8)
+#define USB_BOS_USB20_EXT_ATTR_DEEP_BESL(b)        (((b) & 0xf) << 12)
+
+#define USB_BOS_PLATFORM_UUID_WEBUSB                                              \
+    {0x38, 0xb6, 0x08, 0x34, 0xa9, 0x09, 0xa0, 0x47, 0x8b, 0xfd, 0xa0, 0x76, 0x88, \
+     0x15, 0xb6, 0x65}
+#define USB_BOS_PLATFORM_UUID_MSOS20                                              \
+    {0xdf, 0x60, 0xdd, 0xd8, 0x89, 0x45, 0xc7, 0x4c, 0x9c, 0xd2, 0x65, 0x9d, 0x9e, \
+     0x64, 0x8a, 0x9f}
+
+#define USB_WEBUSB_VERSION          0x0100
+#define USB_WEBUSB_REQ_GET_URL      0x02
+#define USB_WEBUSB_DESCR_TYPE_URL   0x03
+#define USB_WEBUSB_URL_SCHEME_HTTP  0x00
+#define USB_WEBUSB_URL_SCHEME_HTTPS 0x01
+#define USB_WEBUSB_URL_SCHEME_NONE  0xff
+
+#define USB_MSOS20_WINDOWS_VERSION_8_1 0x06030000
+
+#define USB_MSOS20_DESCRIPTOR_INDEX    0x07
+#define USB_MSOS20_SET_ALT_ENUMERATION 0x08
+
+#define USB_MSOS20_SET_HEADER_DESCRIPTOR       0x00
+#define USB_MSOS20_SUBSET_HEADER_CONFIGURATION 0x01
+#define USB_MSOS20_SUBSET_HEADER_FUNCTION      0x02
+#define USB_MSOS20_FEATURE_COMPATIBLE_ID       0x03
+#define USB_MSOS20_FEATURE_REG_PROPERTY        0x04
+#define USB_MSOS20_FEATURE_MIN_RESUME_TIME     0x05
+#define USB_MSOS20_FEATURE_MODEL_ID            0x06
+#define USB_MSOS20_FEATURE_CCGP_DEVICE         0x07
+#define USB_MSOS20_FEATURE_VENDOR_REVISION     0x08
+
+#define USB_MSOS20_PROPERTY_DATA_TYPE_REG_SZ       0x01
+#define USB_MSOS20_PROPERTY_DATA_TYPE_REG_MULTI_SZ 0x07
+
+/**
+ * @}
+ */
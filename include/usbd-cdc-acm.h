@@ -0,0 +1,165 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * @file usbd-cdc-acm.h
+ * @brief Optional CDC-ACM (virtual serial port) class driver header.
+ *
+ * This header defines the functions and callbacks implemented by the optional
+ * CDC-ACM class driver, available from the @c usbd-fs-stm32-cdc-acm CMake target.
+ *
+ * The driver is configured at build time with the following definitions:
+ *
+ * - @c USBD_CDC_ACM_ITF: Communications interface number (default: @c 0).
+ * - @c USBD_CDC_ACM_NOTIF_EPT: Interrupt IN notification endpoint number (default: @c 1).
+ * - @c USBD_CDC_ACM_DATA_EPT: Bulk IN/OUT data endpoint number (default: @c 2).
+ * - @c USBD_CDC_ACM_DATA_SIZE: Data endpoint size, in bytes (default: @c 64).
+ * - @c USBD_CDC_ACM_TX_BUFFER_SIZE: Transmit ring buffer size, power of 2 (default: @c 256).
+ * - @c USBD_CDC_ACM_RX_BUFFER_SIZE: Receive ring buffer size, power of 2 (default: @c 256).
+ * - @c USBD_CDC_ACM_FLUSH_TIMEOUT: Number of frames (ms) that a partial packet waits to
+ *   be filled before being transmitted, counted since the previous packet or since data
+ *   was queued to an empty buffer, and not restarted by further writes (default: @c 2).
+ *
+ * The endpoints must be configured accordingly (@c USBD_EPn_IN_SIZE, @c USBD_EPn_OUT_SIZE
+ * and @c USBD_EPn_TYPE), and the descriptors are still defined by the user.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <usbd.h>
+#include <usb-std-cdc.h>
+
+/**
+ * @name Public API
+ * Functions to be called by the user to exchange data with the host.
+ *
+ * @{
+ */
+
+/**
+ * @brief Queue data to be transmitted to the host.
+ * @param[in] buf    Pointer to a buffer containing data to be transmitted to the host.
+ * @param[in] buflen Size of the @c buf buffer, in bytes.
+ * @returns The number of bytes queued, that may be smaller than @c buflen if the
+ *          transmit buffer is full.
+ *
+ * Small writes are coalesced into full packets. A partial packet is transmitted
+ * @c USBD_CDC_ACM_FLUSH_TIMEOUT frames after the previous packet, or after its data was
+ * queued to an empty buffer, or when @ref usbd_cdc_acm_flush is called.
+ */
+uint16_t usbd_cdc_acm_write(const void *buf, uint16_t buflen);
+
+/**
+ * @brief Transmit any partial packet queued, without waiting for the flush timeout.
+ */
+void usbd_cdc_acm_flush(void);
+
+/**
+ * @brief Read data received from the host.
+ * @param[out] buf    Pointer to a buffer to receive the data transmitted by the host.
+ * @param[in]  buflen Size of the @c buf buffer, in bytes.
+ * @returns The number of bytes read.
+ *
+ * The host is held off (NAK) while the receive buffer can't fit a full packet.
+ */
+uint16_t usbd_cdc_acm_read(void *buf, uint16_t buflen);
+
+/**
+ * @brief Get the number of bytes available to be read.
+ * @returns The number of bytes available in the receive buffer.
+ */
+uint16_t usbd_cdc_acm_available(void);
+
+/**
+ * @brief Notify the host about a serial state change.
+ * @param[in] state Bitmask of @c USB_CDC_SERIAL_STATE_* values.
+ *
+ * The notification is sent over the notification endpoint at the next frame. If called
+ * again before that, only the most recent state is sent.
+ */
+void usbd_cdc_acm_set_serial_state(uint16_t state);
+
+/**
+ * @brief Get the line coding set by the host.
+ * @returns A reference to the current @ref usb_cdc_line_coding_t.
+ */
+const usb_cdc_line_coding_t* usbd_cdc_acm_get_line_coding(void);
+
+/**
+ * @brief Get the control line state set by the host.
+ * @returns Bitmask of @c USB_CDC_CONTROL_LINE_STATE_* values.
+ */
+uint16_t usbd_cdc_acm_get_control_line_state(void);
+
+/**
+ * @}
+ */
+
+/**
+ * @name Library callback handlers
+ * Functions to be called by the user from the corresponding @c usbd-fs-stm32 callbacks.
+ *
+ * @{
+ */
+
+/**
+ * @brief Handler for @ref usbd_ctrl_request_handle_class_cb.
+ * @param[in] req A reference to a @ref usb_ctrl_request_t.
+ * @returns A boolean indicating that the request was handled.
+ */
+bool usbd_cdc_acm_handle_ctrl_request(usb_ctrl_request_t *req);
+
+/**
+ * @brief Handler for @ref usbd_in_cb.
+ * @param[in] ept Endpoint number.
+ */
+void usbd_cdc_acm_handle_in(uint8_t ept);
+
+/**
+ * @brief Handler for @ref usbd_out_cb.
+ * @param[in] ept Endpoint number.
+ */
+void usbd_cdc_acm_handle_out(uint8_t ept);
+
+/**
+ * @brief Handler for @ref usbd_sof_hook_cb.
+ */
+void usbd_cdc_acm_handle_sof(void);
+
+/**
+ * @brief Handler for @ref usbd_reset_hook_cb.
+ */
+void usbd_cdc_acm_handle_reset(void);
+
+/**
+ * @}
+ */
+
+/**
+ * @name Callbacks
+ * Function callbacks that may be implemented by the user.
+ *
+ * @{
+ */
+
+/**
+ * @brief Optional callback for CDC SET_LINE_CODING requests.
+ * @param[in] coding A reference to the new @ref usb_cdc_line_coding_t.
+ */
+void usbd_cdc_acm_set_line_coding_cb(const usb_cdc_line_coding_t *coding) __attribute__((weak));
+
+/**
+ * @brief Optional callback for CDC SET_CONTROL_LINE_STATE requests.
+ * @param[in] state Bitmask of @c USB_CDC_CONTROL_LINE_STATE_* values.
+ */
+void usbd_cdc_acm_set_control_line_state_cb(uint16_t state) __attribute__((weak));
+
+/**
+ * @}
+ */
@@ -0,0 +1,174 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * @file usbd-cdc-ncm.h
+ * @brief Optional CDC-NCM (network control model) class driver header.
+ *
+ * This header defines the functions and callbacks implemented by the optional
+ * CDC-NCM class driver, available from the @c usbd-fs-stm32-cdc-ncm CMake target.
+ *
+ * Ethernet frames transmitted to the host are batched into 16-bit NCM transfer blocks
+ * (NTB16), that are sent as a single bulk transfer. Transfer blocks received from the
+ * host are reassembled from multiple packets and the datagrams are handed to the user
+ * in place, without additional copies.
+ *
+ * The driver is configured at build time with the following definitions:
+ *
+ * - @c USBD_CDC_NCM_ITF: Communications interface number (default: @c 0).
+ * - @c USBD_CDC_NCM_DATA_ITF: Data interface number (default: @c USBD_CDC_NCM_ITF + 1).
+ * - @c USBD_CDC_NCM_NOTIF_EPT: Interrupt IN notification endpoint number (default: @c 1).
+ * - @c USBD_CDC_NCM_DATA_EPT: Bulk IN/OUT data endpoint number (default: @c 2).
+ * - @c USBD_CDC_NCM_DATA_SIZE: Data endpoint size, in bytes (default: @c 64).
+ * - @c USBD_CDC_NCM_NTB_IN_SIZE: Maximum size of transfer blocks sent to the host. Two
+ *   buffers of this size are allocated (default: @c 2048).
+ * - @c USBD_CDC_NCM_NTB_OUT_SIZE: Maximum size of transfer blocks received from the
+ *   host, multiple of @c USBD_CDC_NCM_DATA_SIZE (default: @c 2048).
+ * - @c USBD_CDC_NCM_DATAGRAM_ALIGNMENT: Alignment of the datagrams inside the transfer
+ *   blocks, in both directions, power of 2 (default: @c 4).
+ * - @c USBD_CDC_NCM_MAX_DATAGRAMS: Maximum number of datagrams batched into a transfer
+ *   block sent to the host (default: @c 8).
+ * - @c USBD_CDC_NCM_MAX_DATAGRAM_SIZE: Maximum ethernet frame size, without CRC
+ *   (default: @c 1514).
+ * - @c USBD_CDC_NCM_FLUSH_TIMEOUT: Number of frames (ms) that a transfer block waits
+ *   for more datagrams before being transmitted. Datagrams are always batched while a
+ *   previous transfer block is in flight (default: @c 0).
+ *
+ * The data interface must provide an alternate setting @c 0 without endpoints, and an
+ * alternate setting @c 1 with the data endpoints. The endpoints must be configured
+ * accordingly (@c USBD_EPn_IN_SIZE, @c USBD_EPn_OUT_SIZE and @c USBD_EPn_TYPE), and the
+ * descriptors are still defined by the user.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <usbd.h>
+#include <usb-std-cdc.h>
+
+/**
+ * @name Public API
+ * Functions to be called by the user to exchange data with the host.
+ *
+ * @{
+ */
+
+/**
+ * @brief Allocate space for an ethernet frame in the transfer block being filled.
+ * @param[in] len Size of the ethernet frame, in bytes.
+ * @returns A pointer to where the frame must be written, or @c NULL if the frame does
+ *          not fit the current transfer block, or the host did not enable the data
+ *          interface yet.
+ *
+ * The frame is only queued for transmission after @ref usbd_cdc_ncm_commit is called.
+ * No other frame can be allocated before that.
+ */
+void* usbd_cdc_ncm_alloc(uint16_t len);
+
+/**
+ * @brief Queue the frame allocated with @ref usbd_cdc_ncm_alloc for transmission.
+ */
+void usbd_cdc_ncm_commit(void);
+
+/**
+ * @brief Queue an ethernet frame to be transmitted to the host.
+ * @param[in] buf Pointer to a buffer containing the ethernet frame, without CRC.
+ * @param[in] len Size of the ethernet frame, in bytes.
+ * @returns A boolean indicating that the frame was queued.
+ *
+ * This is a shortcut for @ref usbd_cdc_ncm_alloc, followed by a copy and
+ * @ref usbd_cdc_ncm_commit.
+ */
+bool usbd_cdc_ncm_send(const void *buf, uint16_t len);
+
+/**
+ * @brief Notify the host about the network connection state.
+ * @param[in] connected Boolean indicating that the network is connected.
+ *
+ * The notification is sent over the notification endpoint as soon as possible, and
+ * again every time the host enables the data interface.
+ */
+void usbd_cdc_ncm_set_connected(bool connected);
+
+/**
+ * @brief Get the ethernet packet filter set by the host.
+ * @returns Bitmask of packet filters, as defined by the CDC ECM specification.
+ */
+uint16_t usbd_cdc_ncm_get_packet_filter(void);
+
+/**
+ * @}
+ */
+
+/**
+ * @name Library callback handlers
+ * Functions to be called by the user from the corresponding @c usbd-fs-stm32 callbacks.
+ *
+ * @{
+ */
+
+/**
+ * @brief Handler for @ref usbd_ctrl_request_handle_class_cb.
+ * @param[in] req A reference to a @ref usb_ctrl_request_t.
+ * @returns A boolean indicating that the request was handled.
+ */
+bool usbd_cdc_ncm_handle_ctrl_request(usb_ctrl_request_t *req);
+
+/**
+ * @brief Handler for @ref usbd_set_interface_hook_cb.
+ * @param[in] itf Interface number.
+ * @param[in] alt Alternate setting number.
+ */
+void usbd_cdc_ncm_handle_set_interface(uint8_t itf, uint8_t alt);
+
+/**
+ * @brief Handler for @ref usbd_in_cb.
+ * @param[in] ept Endpoint number.
+ */
+void usbd_cdc_ncm_handle_in(uint8_t ept);
+
+/**
+ * @brief Handler for @ref usbd_out_cb.
+ * @param[in] ept Endpoint number.
+ */
+void usbd_cdc_ncm_handle_out(uint8_t ept);
+
+/**
+ * @brief Handler for @ref usbd_sof_hook_cb.
+ */
+void usbd_cdc_ncm_handle_sof(void);
+
+/**
+ * @brief Handler for @ref usbd_reset_hook_cb.
+ */
+void usbd_cdc_ncm_handle_reset(void);
+
+/**
+ * @}
+ */
+
+/**
+ * @name Callbacks
+ * Function callbacks that may be implemented by the user.
+ *
+ * @{
+ */
+
+/**
+ * @brief Callback for ethernet frames received from the host.
+ * @param[in] buf Pointer to the ethernet frame, inside the transfer block buffer.
+ * @param[in] len Size of the ethernet frame, in bytes.
+ *
+ * The frame is only valid until the callback returns. It is aligned to
+ * @c USBD_CDC_NCM_DATAGRAM_ALIGNMENT, if the host honours the alignment requested.
+ */
+void usbd_cdc_ncm_recv_cb(const void *buf, uint16_t len) __attribute__((weak));
+
+/**
+ * @}
+ */
@@ -0,0 +1,166 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * @file usbd-dfu.h
+ * @brief Optional USB DFU 1.1 class driver header.
+ *
+ * This header defines the functions and callbacks implemented by the optional USB
+ * device firmware upgrade (DFU 1.1) class driver, available from the
+ * @c usbd-fs-stm32-dfu CMake target.
+ *
+ * The driver implements either the run-time interface, that only handles the DETACH
+ * request, or the DFU mode interface, selected at build time.
+ *
+ * In DFU mode, the firmware blocks are programmed from @ref usbd_dfu_task, out of the
+ * USB interrupt context. Two block buffers are used, so that the host sends the next
+ * block while the previous one is being programmed: the host is only told to wait
+ * (@c dfuDNBUSY) when both buffers are taken, with a @c bwPollTimeout that covers the
+ * time left to program the oldest block, estimated by @ref usbd_dfu_get_poll_timeout_cb
+ * or from the time taken by the previous block. Programming errors are reported by the
+ * next GETSTATUS request.
+ *
+ * The driver is configured at build time with the following definitions:
+ *
+ * - @c USBD_DFU_ITF: DFU interface number (default: @c 0).
+ * - @c USBD_DFU_RUNTIME: Set to @c 1 to implement the run-time interface, instead of
+ *   the DFU mode interface (default: @c 0).
+ * - @c USBD_DFU_TRANSFER_SIZE: Maximum block size, matching the @c wTransferSize of the
+ *   functional descriptor (default: @c 1024).
+ * - @c USBD_DFU_POLL_TIMEOUT: Estimated time to program the first block, in
+ *   milliseconds (default: @c 10).
+ * - @c USBD_DFU_MANIFESTATION_TOLERANT: Set to @c 0 if the device can't answer requests
+ *   after the manifestation phase, matching the @c bmAttributes of the functional
+ *   descriptor (default: @c 1).
+ *
+ * The descriptors are still defined by the user.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <usbd.h>
+#include <usb-std-dfu.h>
+
+/**
+ * @name Public API
+ * Functions to be called by the user to run the firmware upgrade.
+ *
+ * @{
+ */
+
+/**
+ * @brief DFU main loop task.
+ *
+ * Programs the firmware blocks received, calling @ref usbd_dfu_download_cb, and runs
+ * the manifestation phase, calling @ref usbd_dfu_manifest_cb. Must be called
+ * periodically from the firmware main loop, in DFU mode.
+ */
+void usbd_dfu_task(void);
+
+/**
+ * @brief Get the current DFU state.
+ * @returns One of the @c USB_DFU_STATE_* values.
+ */
+uint8_t usbd_dfu_get_state(void);
+
+/**
+ * @}
+ */
+
+/**
+ * @name Library callback handlers
+ * Functions to be called by the user from the corresponding @c usbd-fs-stm32 callbacks.
+ *
+ * @{
+ */
+
+/**
+ * @brief Handler for @ref usbd_ctrl_request_handle_class_cb.
+ * @param[in] req A reference to a @ref usb_ctrl_request_t.
+ * @returns A boolean indicating that the request was handled.
+ */
+bool usbd_dfu_handle_ctrl_request(usb_ctrl_request_t *req);
+
+/**
+ * @brief Handler for @ref usbd_sof_hook_cb.
+ */
+void usbd_dfu_handle_sof(void);
+
+/**
+ * @brief Handler for @ref usbd_reset_hook_cb.
+ */
+void usbd_dfu_handle_reset(void);
+
+/**
+ * @}
+ */
+
+/**
+ * @name Callbacks
+ * Function callbacks that may be implemented by the user.
+ *
+ * @{
+ */
+
+/**
+ * @brief Optional callback for DFU DETACH requests, in run-time mode.
+ * @param[in] timeout Time to wait for the USB reset, in milliseconds, from the
+ *                    request.
+ *
+ * Usually the firmware reboots into the DFU mode firmware, e.g. a bootloader.
+ */
+void usbd_dfu_detach_cb(uint16_t timeout) __attribute__((weak));
+
+/**
+ * @brief Optional callback to program a firmware block.
+ * @param[in] block Block number, as sent by the host.
+ * @param[in] buf   Pointer to the block data.
+ * @param[in] len   Size of the block, in bytes.
+ * @returns @c USB_DFU_STATUS_OK, or one of the @c USB_DFU_STATUS_ERR_* values.
+ *
+ * Called from @ref usbd_dfu_task, and may erase and program flash memory.
+ */
+uint8_t usbd_dfu_download_cb(uint16_t block, const void *buf, uint16_t len) __attribute__((weak));
+
+/**
+ * @brief Optional callback to estimate the time needed to program a firmware block.
+ * @param[in] block Block number, as sent by the host.
+ * @param[in] len   Size of the block, in bytes.
+ * @returns The estimated time, in milliseconds, including any erase needed.
+ *
+ * Called from the USB interrupt context. If not implemented, the time taken by the
+ * previous block is used.
+ */
+uint32_t usbd_dfu_get_poll_timeout_cb(uint16_t block, uint16_t len) __attribute__((weak));
+
+/**
+ * @brief Optional callback to read a firmware block.
+ * @param[in]  block  Block number, as sent by the host.
+ * @param[out] buf    Pointer to a buffer to receive the block data.
+ * @param[in]  buflen Size of the @c buf buffer, in bytes.
+ * @returns The size of the block, in bytes. Blocks shorter than @c buflen finish the
+ *          upload.
+ *
+ * Called from the USB interrupt context.
+ */
+uint16_t usbd_dfu_upload_cb(uint16_t block, void *buf, uint16_t buflen) __attribute__((weak));
+
+/**
+ * @brief Optional callback for the manifestation phase, after the last block is
+ *        programmed.
+ * @returns @c USB_DFU_STATUS_OK, or one of the @c USB_DFU_STATUS_ERR_* values.
+ *
+ * Called from @ref usbd_dfu_task. Devices that are not manifestation tolerant
+ * usually reboot into the new firmware from here.
+ */
+uint8_t usbd_dfu_manifest_cb(void) __attribute__((weak));
+
+/**
+ * @}
+ */
@@ -0,0 +1,601 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * @file usbd-ept.h
+ * @brief Endpoint configuration and fast-path endpoint operations header.
+ *
+ * This header defines the build time endpoint configuration used by the
+ * @c usbd-fs-stm32 library (@c USBD_EPn_IN_SIZE, @c USBD_EPn_OUT_SIZE and
+ * @c USBD_EPn_TYPE, for @c n from 1 to 7), the resulting packet memory layout, the
+ * endpoint register and packet memory access layer of the supported USB peripherals
+ * (USB FS and USB DRD), and inline variants of @ref usbd_in and @ref usbd_out for
+ * endpoint numbers known at build time.
+ *
+ * The fast-path operations skip the endpoint table lookups and runtime checks: the
+ * endpoint register, packet memory address and buffer descriptor are folded into
+ * constants, and invalid endpoints are rejected by the compiler. They must be built
+ * with the same endpoint configuration as the library, and include the CMSIS device
+ * header of the STM32 series.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <usbd.h>
+
+#if defined(STM32F0) || defined(STM32F0xx)
+#include <stm32f0xx.h>
+#elif defined(STM32F1) || defined(STM32F1xx)
+#include <stm32f1xx.h>
+#define USBD_PMA_2X16
+#elif defined(STM32F3) || defined(STM32F3xx)
+#include <stm32f3xx.h>
+// STM32F302x6/x8, STM32F302xD/xE, STM32F303xD/xE and STM32F398xx have 1 KB of packet
+// memory with the 1x16 bit access scheme
+#if !defined(STM32F302x8) && !defined(STM32F302xE) && !defined(STM32F303xE) && !defined(STM32F398xx)
+#define USBD_PMA_2X16
+#endif
+#elif defined(STM32G4) || defined(STM32G4xx)
+#include <stm32g4xx.h>
+#elif defined(STM32L0) || defined(STM32L0xx)
+#include <stm32l0xx.h>
+#elif defined(STM32L4) || defined(STM32L4xx)
+#include <stm32l4xx.h>
+#elif defined(STM32L5) || defined(STM32L5xx)
+#include <stm32l5xx.h>
+#elif defined(STM32C0) || defined(STM32C0xx)
+#include <stm32c0xx.h>
+#define USBD_DRD
+#elif defined(STM32G0) || defined(STM32G0xx)
+#include <stm32g0xx.h>
+#define USBD_DRD
+#elif defined(STM32H5) || defined(STM32H5xx)
+#include <stm32h5xx.h>
+#define USBD_DRD
+#elif defined(STM32U5) || defined(STM32U5xx)
+#include <stm32u5xx.h>
+#define USBD_DRD
+#else
+#error "Unsupported STM32 series"
+#endif
+
+// the USB DRD peripheral works as the USB FS peripheral in device mode, with 32-bit
+// registers, a 32-bit accessed packet memory and 32-bit buffer descriptors. some
+// register bits are named after the host mode features.
+#ifdef USBD_DRD
+#ifdef USB_DRD_FS
+#define USB         USB_DRD_FS
+#define USB_PMAADDR USB_DRD_PMAADDR
+#endif
+#ifndef USB_EPREG_MASK
+#define USB_EPREG_MASK      USB_CHEP_REG_MASK
+#endif
+#ifndef USB_CNTR_RESETM
+#define USB_CNTR_RESETM     USB_CNTR_DCON
+#endif
+#ifndef USB_CNTR_FSUSP
+#define USB_CNTR_FSUSP      USB_CNTR_SUSPEN
+#endif
+#ifndef USB_CNTR_RESUME
+#define USB_CNTR_RESUME     USB_CNTR_L2RES
+#endif
+#ifndef USB_CNTR_L1RESUME
+#define USB_CNTR_L1RESUME   USB_CNTR_L1RES
+#endif
+#ifndef USB_CNTR_LPMODE
+#define USB_CNTR_LPMODE     0  // the transceiver is put in low power mode by SUSPEN
+#endif
+#ifndef USB_ISTR_RESET
+#define USB_ISTR_RESET      USB_ISTR_DCON
+#endif
+#ifndef USB_ISTR_EP_ID
+#define USB_ISTR_EP_ID      USB_ISTR_IDN
+#endif
+#endif
+
+#ifndef USB
+#error "No supported USB device available"
+#endif
+
+#ifndef USB_COUNT0_RX_BLSIZE
+#define USB_COUNT0_RX_BLSIZE        (0x1UL << (15U))
+#endif
+#ifndef USB_COUNT1_RX_0_COUNT1_RX_0
+#define USB_COUNT1_RX_0_COUNT1_RX_0 (0x000003FFU)
+#endif
+
+#ifndef USBD_EP1_IN_SIZE
+#define USBD_EP1_IN_SIZE 0
+#endif
+#ifndef USBD_EP1_OUT_SIZE
+#define USBD_EP1_OUT_SIZE 0
+#endif
+#ifndef USBD_EP2_IN_SIZE
+#define USBD_EP2_IN_SIZE 0
+#endif
+#ifndef USBD_EP2_OUT_SIZE
+#define USBD_EP2_OUT_SIZE 0
+#endif
+#ifndef USBD_EP3_IN_SIZE
+#define USBD_EP3_IN_SIZE 0
+#endif
+#ifndef USBD_EP3_OUT_SIZE
+#define USBD_EP3_OUT_SIZE 0
+#endif
+#ifndef USBD_EP4_IN_SIZE
+#define USBD_EP4_IN_SIZE 0
+#endif
+#ifndef USBD_EP4_OUT_SIZE
+#define USBD_EP4_OUT_SIZE 0
+#endif
+#ifndef USBD_EP5_IN_SIZE
+#define USBD_EP5_IN_SIZE 0
+#endif
+#ifndef USBD_EP5_OUT_SIZE
+#define USBD_EP5_OUT_SIZE 0
+#endif
+#ifndef USBD_EP6_IN_SIZE
+#define USBD_EP6_IN_SIZE 0
+#endif
+#ifndef USBD_EP6_OUT_SIZE
+#define USBD_EP6_OUT_SIZE 0
+#endif
+#ifndef USBD_EP7_IN_SIZE
+#define USBD_EP7_IN_SIZE 0
+#endif
+#ifndef USBD_EP7_OUT_SIZE
+#define USBD_EP7_OUT_SIZE 0
+#endif
+
+#ifndef USBD_EP1_TYPE
+#define USBD_EP1_TYPE BULK
+#endif
+#ifndef USBD_EP2_TYPE
+#define USBD_EP2_TYPE BULK
+#endif
+#ifndef USBD_EP3_TYPE
+#define USBD_EP3_TYPE BULK
+#endif
+#ifndef USBD_EP4_TYPE
+#define USBD_EP4_TYPE BULK
+#endif
+#ifndef USBD_EP5_TYPE
+#define USBD_EP5_TYPE BULK
+#endif
+#ifndef USBD_EP6_TYPE
+#define USBD_EP6_TYPE BULK
+#endif
+#ifndef USBD_EP7_TYPE
+#define USBD_EP7_TYPE BULK
+#endif
+
+/**
+ * @name Packet memory layout
+ * Build time layout of the USB packet memory.
+ *
+ * @{
+ */
+
+#define USBD_EP_ISO_CONTROL     0
+#define USBD_EP_ISO_BULK        0
+#define USBD_EP_ISO_INTERRUPT   0
+#define USBD_EP_ISO_ISOCHRONOUS 1
+#define __USBD_EP_IS_ISO(TYP)   USBD_EP_ISO_ ## TYP
+#define _USBD_EP_IS_ISO(TYP)    __USBD_EP_IS_ISO(TYP)
+
+/**
+ * @brief Evaluates to 1 if the endpoint is isochronous, 0 otherwise.
+ * @param EPT Endpoint number, from 1 to 7.
+ */
+#define USBD_EP_IS_ISO(EPT) _USBD_EP_IS_ISO(USBD_EP ## EPT ## _TYPE)
+
+#if defined(USBD_DRD)
+#define USBD_PMA_SIZE  2048
+#define USBD_PMA_ALIGN 4
+#elif defined(USBD_PMA_2X16)
+#define USBD_PMA_SIZE  512
+#define USBD_PMA_ALIGN 2
+#else
+
+/**
+ * @brief Size of the USB packet memory, in bytes.
+ */
+#define USBD_PMA_SIZE  1024
+
+/**
+ * @brief Alignment of the packet memory buffers, in bytes.
+ *
+ * Buffers are aligned to the packet memory access width.
+ */
+#define USBD_PMA_ALIGN 2
+#endif
+
+/**
+ * @brief Packet memory allocated for a transmission buffer, in bytes.
+ * @param size Buffer size, in bytes.
+ */
+#define USBD_PMA_TX_SIZE(size) (((size) + USBD_PMA_ALIGN - 1) & ~(USBD_PMA_ALIGN - 1))
+
+/**
+ * @brief Packet memory allocated for a reception buffer, in bytes.
+ * @param size Buffer size, in bytes.
+ *
+ * Reception buffers are allocated by the hardware in blocks of 2 bytes, up to 62
+ * bytes, and in blocks of 32 bytes above that.
+ */
+#define USBD_PMA_RX_SIZE(size) ((size) > 62 ? (((size) + 31) & ~31) : USBD_PMA_TX_SIZE(size))
+
+// isochronous endpoints are always double buffered, using both buffer descriptors for
+// a single direction. they can't be bidirectional, so one of the sizes is always 0.
+#define USBD_EP_PMA_IN_SIZE(EPT)  (USBD_PMA_TX_SIZE(USBD_EP ## EPT ## _IN_SIZE) +        \
+                                   USBD_EP_IS_ISO(EPT) * USBD_PMA_RX_SIZE(USBD_EP ## EPT ## _OUT_SIZE))
+#define USBD_EP_PMA_OUT_SIZE(EPT) (USBD_PMA_RX_SIZE(USBD_EP ## EPT ## _OUT_SIZE) +       \
+                                   USBD_EP_IS_ISO(EPT) * USBD_PMA_TX_SIZE(USBD_EP ## EPT ## _IN_SIZE))
+
+// endpoint buffers are allocated in order, right after the buffer descriptor table.
+// the OUT buffer follows the IN buffer. isochronous endpoints use the IN and OUT buffers
+// for the buffer descriptors 0 and 1, regardless of direction.
+#define USBD_EP0_PMA_IN_ADDR  (16 * 4)
+#define USBD_EP0_PMA_OUT_ADDR (USBD_EP0_PMA_IN_ADDR + USBD_EP0_SIZE)
+#define USBD_EP1_PMA_IN_ADDR  (USBD_EP0_PMA_OUT_ADDR + USBD_EP0_SIZE)
+#define USBD_EP1_PMA_OUT_ADDR (USBD_EP1_PMA_IN_ADDR + USBD_EP_PMA_IN_SIZE(1))
+#define USBD_EP2_PMA_IN_ADDR  (USBD_EP1_PMA_OUT_ADDR + USBD_EP_PMA_OUT_SIZE(1))
+#define USBD_EP2_PMA_OUT_ADDR (USBD_EP2_PMA_IN_ADDR + USBD_EP_PMA_IN_SIZE(2))
+#define USBD_EP3_PMA_IN_ADDR  (USBD_EP2_PMA_OUT_ADDR + USBD_EP_PMA_OUT_SIZE(2))
+#define USBD_EP3_PMA_OUT_ADDR (USBD_EP3_PMA_IN_ADDR + USBD_EP_PMA_IN_SIZE(3))
+#define USBD_EP4_PMA_IN_ADDR  (USBD_EP3_PMA_OUT_ADDR + USBD_EP_PMA_OUT_SIZE(3))
+#define USBD_EP4_PMA_OUT_ADDR (USBD_EP4_PMA_IN_ADDR + USBD_EP_PMA_IN_SIZE(4))
+#define USBD_EP5_PMA_IN_ADDR  (USBD_EP4_PMA_OUT_ADDR + USBD_EP_PMA_OUT_SIZE(4))
+#define USBD_EP5_PMA_OUT_ADDR (USBD_EP5_PMA_IN_ADDR + USBD_EP_PMA_IN_SIZE(5))
+#define USBD_EP6_PMA_IN_ADDR  (USBD_EP5_PMA_OUT_ADDR + USBD_EP_PMA_OUT_SIZE(5))
+#define USBD_EP6_PMA_OUT_ADDR (USBD_EP6_PMA_IN_ADDR + USBD_EP_PMA_IN_SIZE(6))
+#define USBD_EP7_PMA_IN_ADDR  (USBD_EP6_PMA_OUT_ADDR + USBD_EP_PMA_OUT_SIZE(6))
+#define USBD_EP7_PMA_OUT_ADDR (USBD_EP7_PMA_IN_ADDR + USBD_EP_PMA_IN_SIZE(7))
+
+/**
+ * @brief End of the packet memory used by the endpoint buffers, in bytes.
+ */
+#define USBD_PMA_END (USBD_EP7_PMA_OUT_ADDR + USBD_EP_PMA_OUT_SIZE(7))
+
+/**
+ * @}
+ */
+
+/**
+ * @name Hardware access layer
+ * Endpoint register and packet memory primitives, shared by the library and the
+ * fast-path operations. Not meant to be used directly.
+ *
+ * @{
+ */
+
+#ifdef USBD_DRD
+typedef uint32_t usbd_epr_t;
+#define USBD_EPR(EPT) (&(USB->CHEP0R) + (EPT))
+#else
+
+/**
+ * @brief Endpoint register type.
+ */
+typedef uint16_t usbd_epr_t;
+
+/**
+ * @brief Pointer to an endpoint register.
+ * @param EPT Endpoint number.
+ *
+ * The endpoint registers are 32-bit spaced, even when 16-bit wide.
+ */
+#define USBD_EPR(EPT) (&(USB->EP0R) + ((EPT) << 1))
+#endif
+
+// each endpoint has 2 buffer descriptors at the start of the packet memory, IN (or
+// isochronous buffer 0) first, with the buffer address in the low halfword and the
+// count in the high halfword. descriptors are indexed as (ept << 1) + direction.
+#ifdef USBD_DRD
+
+static inline void
+usbd_pma_set(uint8_t descr, uint16_t addr, uint16_t cnt)
+{
+    ((__IO uint32_t*) USB_PMAADDR)[descr] = addr | (((uint32_t) cnt) << 16);
+}
+
+static inline void
+usbd_pma_set_count(uint8_t descr, uint16_t addr, uint16_t cnt)
+{
+    // descriptors are a single word, written at once
+    usbd_pma_set(descr, addr, cnt);
+}
+
+static inline uint16_t
+usbd_pma_get_count(uint8_t descr)
+{
+    return (((__IO uint32_t*) USB_PMAADDR)[descr] >> 16) & USB_COUNT1_RX_0_COUNT1_RX_0;
+}
+
+// packet memory buffers are word aligned. words are moved with single loads and
+// stores from word aligned buffers, and assembled byte by byte otherwise.
+static inline uint16_t
+usbd_pma_write_words(__IO uint32_t **dst, const uint8_t *src, uint16_t len)
+{
+    __IO uint32_t *d = *dst;
+    uint16_t i = 0;
+
+    if ((((uint32_t) src) & 3) == 0) {
+        const uint32_t *s = (const uint32_t*) __builtin_assume_aligned(src, 4);
+        for (; i + 3 < len; i += 4)
+            *(d++) = *(s++);
+    }
+    else {
+        for (; i + 3 < len; i += 4)
+            *(d++) = src[i] | (((uint32_t) src[i + 1]) << 8) |
+                (((uint32_t) src[i + 2]) << 16) | (((uint32_t) src[i + 3]) << 24);
+    }
+
+    *dst = d;
+    return i;
+}
+
+static inline void
+usbd_pma_write(uint16_t addr, const void *buf1, uint16_t len1, const void *buf2, uint16_t len2)
+{
+    __IO uint32_t *dst = (__IO uint32_t*) (USB_PMAADDR + addr);
+    const uint8_t *src1 = buf1;
+    const uint8_t *src2 = buf2;
+
+    uint16_t i = usbd_pma_write_words(&dst, src1, len1);
+
+    // trailing bytes of the first buffer share a word with the second one
+    uint32_t tmp = 0;
+    uint8_t shift = 0;
+    for (; i < len1; i++, shift += 8)
+        tmp |= ((uint32_t) src1[i]) << shift;
+
+    uint16_t j = 0;
+    if (shift == 0)
+        j = usbd_pma_write_words(&dst, src2, len2);
+    for (; j < len2; j++) {
+        tmp |= ((uint32_t) src2[j]) << shift;
+        shift += 8;
+        if (shift == 32) {
+            *(dst++) = tmp;
+            tmp = 0;
+            shift = 0;
+        }
+    }
+    if (shift != 0)
+        *dst = tmp;
+}
+
+static inline uint16_t
+usbd_pma_read_words(const __IO uint32_t **src, uint8_t *dst, uint16_t len)
+{
+    const __IO uint32_t *s = *src;
+    uint16_t i = 0;
+
+    if ((((uint32_t) dst) & 3) == 0) {
+        uint32_t *d = (uint32_t*) __builtin_assume_aligned(dst, 4);
+        for (; i + 3 < len; i += 4)
+            *(d++) = *(s++);
+    }
+    else {
+        for (; i + 3 < len; i += 4) {
+            uint32_t tmp = *(s++);
+            dst[i] = tmp;
+            dst[i + 1] = tmp >> 8;
+            dst[i + 2] = tmp >> 16;
+            dst[i + 3] = tmp >> 24;
+        }
+    }
+
+    *src = s;
+    return i;
+}
+
+static inline void
+usbd_pma_read(uint16_t addr, void *buf1, uint16_t len1, void *buf2, uint16_t len2)
+{
+    const __IO uint32_t *src = (const __IO uint32_t*) (USB_PMAADDR + addr);
+    uint8_t *dst1 = buf1;
+    uint8_t *dst2 = buf2;
+
+    uint16_t i = usbd_pma_read_words(&src, dst1, len1);
+
+    // trailing bytes of the first buffer share a word with the second one
+    uint32_t tmp = 0;
+    uint8_t avail = 0;
+    for (; i < len1; i++, avail--, tmp >>= 8) {
+        if (avail == 0) {
+            tmp = *(src++);
+            avail = 4;
+        }
+        dst1[i] = tmp;
+    }
+
+    uint16_t j = 0;
+    if (avail == 0)
+        j = usbd_pma_read_words(&src, dst2, len2);
+    for (; j < len2; j++, avail--, tmp >>= 8) {
+        if (avail == 0) {
+            tmp = *(src++);
+            avail = 4;
+        }
+        dst2[j] = tmp;
+    }
+}
+
+#else
+
+// the packet memory is accessed as halfwords. on STM32F1 and most STM32F3 devices each
+// halfword is mapped to a 32-bit word of the address space (2x16 bit access scheme),
+// so the pointers into the packet memory move by 2 halfwords.
+#ifdef USBD_PMA_2X16
+#define USBD_PMA_STRIDE 2
+#else
+#define USBD_PMA_STRIDE 1
+#endif
+#define USBD_PMA_PTR(offset) ((__IO uint16_t*) (USB_PMAADDR + (offset) * USBD_PMA_STRIDE))
+
+static inline void
+usbd_pma_set(uint8_t descr, uint16_t addr, uint16_t cnt)
+{
+    USBD_PMA_PTR(descr << 2)[0] = addr;
+    USBD_PMA_PTR(descr << 2)[USBD_PMA_STRIDE] = cnt;
+}
+
+static inline void
+usbd_pma_set_count(uint8_t descr, uint16_t addr, uint16_t cnt)
+{
+    // the buffer address never changes, only the count is written
+    (void) addr;
+    USBD_PMA_PTR(descr << 2)[USBD_PMA_STRIDE] = cnt;
+}
+
+static inline uint16_t
+usbd_pma_get_count(uint8_t descr)
+{
+    return USBD_PMA_PTR(descr << 2)[USBD_PMA_STRIDE] & USB_COUNT1_RX_0_COUNT1_RX_0;
+}
+
+static inline void
+usbd_pma_write(uint16_t addr, const void *buf1, uint16_t len1, const void *buf2, uint16_t len2)
+{
+    __IO uint16_t *dst = USBD_PMA_PTR(addr);
+    const uint8_t *src1 = buf1;
+    const uint8_t *src2 = buf2;
+
+    uint16_t i;
+    for (i = 0; i + 1 < len1; i += 2, dst += USBD_PMA_STRIDE)
+        *dst = src1[i] | (((uint16_t) src1[i + 1]) << 8);
+
+    // an odd trailing byte of the first buffer shares a halfword with the second one
+    uint16_t j = 0;
+    if (i < len1) {
+        uint16_t tmp = src1[i];
+        if (len2 > 0)
+            tmp |= ((uint16_t) src2[j++]) << 8;
+        *dst = tmp;
+        dst += USBD_PMA_STRIDE;
+    }
+
+    for (; j + 1 < len2; j += 2, dst += USBD_PMA_STRIDE)
+        *dst = src2[j] | (((uint16_t) src2[j + 1]) << 8);
+    if (j < len2)
+        *dst = src2[j];
+}
+
+static inline void
+usbd_pma_read(uint16_t addr, void *buf1, uint16_t len1, void *buf2, uint16_t len2)
+{
+    const __IO uint16_t *src = USBD_PMA_PTR(addr);
+    uint8_t *dst1 = buf1;
+    uint8_t *dst2 = buf2;
+
+    uint16_t i;
+    for (i = 0; i + 1 < len1; i += 2, src += USBD_PMA_STRIDE) {
+        uint16_t tmp = *src;
+        dst1[i] = tmp;
+        dst1[i + 1] = tmp >> 8;
+    }
+
+    // an odd trailing byte of the first buffer shares a halfword with the second one
+    uint16_t j = 0;
+    if (i < len1) {
+        uint16_t tmp = *src;
+        src += USBD_PMA_STRIDE;
+        dst1[i] = tmp;
+        if (len2 > 0)
+            dst2[j++] = tmp >> 8;
+    }
+
+    for (; j + 1 < len2; j += 2, src += USBD_PMA_STRIDE) {
+        uint16_t tmp = *src;
+        dst2[j] = tmp;
+        dst2[j + 1] = tmp >> 8;
+    }
+    if (j < len2)
+        dst2[j] = *src;
+}
+
+#endif
+
+/**
+ * @}
+ */
+
+/**
+ * @name Fast-path API
+ * Inline endpoint operations, for endpoint numbers known at build time.
+ *
+ * These operations don't support isochronous endpoints, and must not be mixed with
+ * the streams or DMA-assisted copies on the same endpoint.
+ *
+ * @{
+ */
+
+/**
+ * @brief Transmit data to the host in response to a USB IN request.
+ * @param EPT    Endpoint number, from 1 to 7, as an integer literal or a macro
+ *               expanding to one.
+ * @param buf    Pointer to a buffer containing data to be transmitted to the host.
+ * @param buflen Size of the @c buf buffer, in bytes, up to the endpoint size.
+ *
+ * Same as @ref usbd_in, with the endpoint validated by the compiler.
+ */
+#define USBD_FAST_IN(EPT, buf, buflen) _USBD_FAST_IN(EPT, buf, buflen)
+
+/**
+ * @brief Receive data from the host in response to a USB OUT request.
+ * @param EPT    Endpoint number, from 1 to 7, as an integer literal or a macro
+ *               expanding to one.
+ * @param buf    Pointer to a buffer to store the data received from the host.
+ * @param buflen Size of the @c buf buffer, in bytes.
+ * @returns Number of bytes received and stored into @c buf.
+ *
+ * Same as @ref usbd_out, with the endpoint validated by the compiler.
+ */
+#define USBD_FAST_OUT(EPT, buf, buflen) _USBD_FAST_OUT(EPT, buf, buflen)
+
+/**
+ * @}
+ */
+
+#define _USBD_FAST_IN(EPT, buf, buflen) do {                                            \
+    _Static_assert((EPT) >= 1 && (EPT) <= 7, "Invalid endpoint " #EPT);                 \
+    _Static_assert(USBD_EP ## EPT ## _IN_SIZE != 0, "Endpoint " #EPT " has no IN buffer"); \
+    _Static_assert(!USBD_EP_IS_ISO(EPT), "Endpoint " #EPT " is isochronous");           \
+    usbd_fast_in_(EPT, USBD_EP ## EPT ## _PMA_IN_ADDR, buf, buflen);                    \
+} while (0)
+
+#define _USBD_FAST_OUT(EPT, buf, buflen) ({                                             \
+    _Static_assert((EPT) >= 1 && (EPT) <= 7, "Invalid endpoint " #EPT);                 \
+    _Static_assert(USBD_EP ## EPT ## _OUT_SIZE != 0, "Endpoint " #EPT " has no OUT buffer"); \
+    _Static_assert(!USBD_EP_IS_ISO(EPT), "Endpoint " #EPT " is isochronous");           \
+    usbd_fast_out_(EPT, USBD_EP ## EPT ## _PMA_OUT_ADDR, buf, buflen);                  \
+})
+
+static inline void
+usbd_fast_in_(uint8_t ept, uint16_t addr, const void *buf, uint16_t buflen)
+{
+    __IO usbd_epr_t *ep = USBD_EPR(ept);
+    usbd_pma_write(addr, buf, buflen, NULL, 0);
+    usbd_pma_set_count(ept << 1, addr, buflen);
+    *ep = (*ep ^ USB_EP_TX_VALID) & (USB_EPREG_MASK | USB_EPTX_STAT);
+}
+
+static inline uint16_t
+usbd_fast_out_(uint8_t ept, uint16_t addr, void *buf, uint16_t buflen)
+{
+    __IO usbd_epr_t *ep = USBD_EPR(ept);
+    uint16_t len = usbd_pma_get_count((ept << 1) + 1);
+    if (len > buflen)
+        len = buflen;
+    usbd_pma_read(addr, buf, len, NULL, 0);
+    *ep = (*ep ^ USB_EP_RX_VALID) & (USB_EPREG_MASK | USB_EPRX_STAT);
+    return len;
+}
@@ -0,0 +1,159 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * @file usbd-hid.h
+ * @brief Optional HID class driver header.
+ *
+ * This header defines the functions and callbacks implemented by the optional HID
+ * class driver, available from the @c usbd-fs-stm32-hid CMake target.
+ *
+ * The driver keeps the last value of each input report. A report that changes again
+ * before being sent to the host replaces the pending value, and the next pending report
+ * is loaded to the interrupt endpoint as soon as the previous one is taken by the host.
+ *
+ * The driver is configured at build time with the following definitions:
+ *
+ * - @c USBD_HID_ITF: HID interface number (default: @c 0).
+ * - @c USBD_HID_EPT: Interrupt IN endpoint number (default: @c 1).
+ * - @c USBD_HID_OUT_EPT: Optional interrupt OUT endpoint number, @c 0 if output reports
+ *   are only received with SET_REPORT requests (default: @c 0).
+ * - @c USBD_HID_EPT_SIZE: Interrupt endpoints size, in bytes (default: @c 64).
+ * - @c USBD_HID_REPORT_IDS: Number of input report IDs, numbered from @c 1. @c 0 if the
+ *   report descriptor does not use report IDs (default: @c 0).
+ * - @c USBD_HID_REPORT_SIZE: Maximum report size, in bytes, without the report ID
+ *   (default: @c USBD_HID_EPT_SIZE, minus 1 if report IDs are used).
+ * - @c USBD_HID_DEFAULT_IDLE: Idle rate set after reset, in 4ms units (default: @c 0).
+ *
+ * The endpoints must be configured accordingly (@c USBD_EPn_IN_SIZE, @c USBD_EPn_OUT_SIZE
+ * and @c USBD_EPn_TYPE), and the descriptors are still defined by the user.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <usbd.h>
+#include <usb-std-hid.h>
+
+/**
+ * @name Public API
+ * Functions to be called by the user to exchange reports with the host.
+ *
+ * @{
+ */
+
+/**
+ * @brief Update an input report to be sent to the host.
+ * @param[in] id  Report ID, or @c 0 if report IDs are not used.
+ * @param[in] buf Pointer to a buffer containing the report, without the report ID.
+ * @param[in] len Size of the report, in bytes.
+ * @returns A boolean indicating that the report was updated.
+ *
+ * If a previous value of the same report is still waiting to be sent, it is replaced,
+ * and only the most recent value is sent.
+ */
+bool usbd_hid_report(uint8_t id, const void *buf, uint16_t len);
+
+/**
+ * @brief Check if all the input reports updated were sent to the host.
+ * @returns A boolean indicating that no report is waiting to be sent.
+ */
+bool usbd_hid_idle(void);
+
+/**
+ * @brief Get the protocol set by the host.
+ * @returns @c USB_HID_PROTOCOL_BOOT or @c USB_HID_PROTOCOL_REPORT.
+ */
+uint8_t usbd_hid_get_protocol(void);
+
+/**
+ * @}
+ */
+
+/**
+ * @name Library callback handlers
+ * Functions to be called by the user from the corresponding @c usbd-fs-stm32 callbacks.
+ *
+ * @{
+ */
+
+/**
+ * @brief Handler for @ref usbd_ctrl_request_handle_class_cb.
+ * @param[in] req A reference to a @ref usb_ctrl_request_t.
+ * @returns A boolean indicating that the request was handled.
+ */
+bool usbd_hid_handle_ctrl_request(usb_ctrl_request_t *req);
+
+/**
+ * @brief Handler for @ref usbd_in_cb.
+ * @param[in] ept Endpoint number.
+ */
+void usbd_hid_handle_in(uint8_t ept);
+
+/**
+ * @brief Handler for @ref usbd_out_cb.
+ * @param[in] ept Endpoint number.
+ */
+void usbd_hid_handle_out(uint8_t ept);
+
+/**
+ * @brief Handler for @ref usbd_sof_hook_cb.
+ */
+void usbd_hid_handle_sof(void);
+
+/**
+ * @brief Handler for @ref usbd_reset_hook_cb.
+ */
+void usbd_hid_handle_reset(void);
+
+/**
+ * @}
+ */
+
+/**
+ * @name Callbacks
+ * Function callbacks that may be implemented by the user.
+ *
+ * @{
+ */
+
+/**
+ * @brief Optional callback for HID GET_REPORT requests of output and feature reports.
+ * @param[in]  type   @c USB_HID_REPORT_TYPE_OUTPUT or @c USB_HID_REPORT_TYPE_FEATURE.
+ * @param[in]  id     Report ID, or @c 0 if report IDs are not used.
+ * @param[out] buf    Pointer to a buffer to receive the report, without the report ID.
+ * @param[in]  buflen Size of the @c buf buffer, in bytes.
+ * @returns The size of the report, or @c 0 to stall the request.
+ *
+ * GET_REPORT requests of input reports are answered by the driver, with the last
+ * value of the report.
+ */
+uint16_t usbd_hid_get_report_cb(uint8_t type, uint8_t id, void *buf, uint16_t buflen) __attribute__((weak));
+
+/**
+ * @brief Optional callback for output and feature reports received from the host.
+ * @param[in] type @c USB_HID_REPORT_TYPE_OUTPUT or @c USB_HID_REPORT_TYPE_FEATURE.
+ * @param[in] id   Report ID, or @c 0 if report IDs are not used.
+ * @param[in] buf  Pointer to the report, without the report ID.
+ * @param[in] len  Size of the report, in bytes.
+ * @returns A boolean indicating that the report was accepted.
+ *
+ * Called for SET_REPORT requests and for reports received by the interrupt OUT endpoint,
+ * if enabled.
+ */
+bool usbd_hid_set_report_cb(uint8_t type, uint8_t id, const void *buf, uint16_t len) __attribute__((weak));
+
+/**
+ * @brief Optional callback for HID SET_PROTOCOL requests.
+ * @param[in] protocol @c USB_HID_PROTOCOL_BOOT or @c USB_HID_PROTOCOL_REPORT.
+ */
+void usbd_hid_set_protocol_cb(uint8_t protocol) __attribute__((weak));
+
+/**
+ * @}
+ */
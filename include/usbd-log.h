@@ -0,0 +1,120 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * @file usbd-log.h
+ * @brief Optional binary logging driver header.
+ *
+ * This header defines the functions and macros implemented by the optional binary
+ * logging driver, available from the @c usbd-fs-stm32-log CMake target.
+ *
+ * Log records are not formatted by the firmware. @ref USBD_LOG stores the address of
+ * the format string and the raw arguments into a ring buffer, and the ring buffer is
+ * streamed to the host by a bulk or interrupt IN endpoint, in full packets whenever
+ * possible. The host formats the records, reading the format strings from the ELF file
+ * of the firmware, e.g. with @c tools/usbd-log-decode.py.
+ *
+ * The ring buffer is a stream of 32-bit little-endian words. Each record starts with a
+ * header word, containing the number of arguments in the 4 most significant bits and
+ * the address of the format string in the 28 least significant bits, followed by the
+ * arguments, one word each. Records may be split between packets.
+ *
+ * Records may be written from any context, including interrupt handlers. Records that
+ * don't fit the free space of the ring buffer are dropped. Records written before the
+ * host configures the device, e.g. while booting, are kept in the ring buffer, and
+ * their space is only freed after the host reads them.
+ *
+ * The driver is configured at build time with the following definitions:
+ *
+ * - @c USBD_LOG_EPT: IN endpoint number (default: @c 1).
+ * - @c USBD_LOG_EPT_SIZE: IN endpoint size, in bytes, multiple of 4 (default: @c 64).
+ * - @c USBD_LOG_BUFFER_WORDS: Size of the ring buffer, in 32-bit words, power of 2
+ *   (default: @c 256).
+ * - @c USBD_LOG_FLUSH_FRAMES: Time to wait for a full packet before sending a short
+ *   one, in USB frames (default: @c 10).
+ *
+ * The endpoint must be configured accordingly (@c USBD_EPn_IN_SIZE and
+ * @c USBD_EPn_TYPE), and the descriptors are still defined by the user.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <usbd.h>
+
+/**
+ * @name Public API
+ * Functions and macros to be called by the user to write log records.
+ *
+ * @{
+ */
+
+/**
+ * @brief Maximum number of arguments of a log record.
+ */
+#define USBD_LOG_MAX_ARGS 15
+
+/**
+ * @brief Write a log record.
+ * @param fmt A string literal with the format string.
+ * @param ... Up to @ref USBD_LOG_MAX_ARGS integer arguments, converted to @c uint32_t.
+ */
+#define USBD_LOG(fmt, ...) do {                                                 \
+    static const char usbd_log_fmt_[] = fmt;                                    \
+    const uint32_t usbd_log_args_[] = {0, ##__VA_ARGS__};                       \
+    usbd_log_write(usbd_log_fmt_, usbd_log_args_ + 1,                           \
+        sizeof(usbd_log_args_) / sizeof(usbd_log_args_[0]) - 1);                \
+} while (0)
+
+/**
+ * @brief Write a log record, with the arguments in an array.
+ * @param[in] fmt   Pointer to the format string, in flash memory.
+ * @param[in] args  Pointer to an array with the arguments.
+ * @param[in] nargs Number of arguments, up to @ref USBD_LOG_MAX_ARGS.
+ * @returns A boolean indicating that the record was written, @c false if it was dropped.
+ *
+ * Usually called by @ref USBD_LOG.
+ */
+bool usbd_log_write(const char *fmt, const uint32_t *args, uint8_t nargs);
+
+/**
+ * @brief Get the number of log records dropped because the ring buffer was full.
+ * @returns The number of records.
+ */
+uint32_t usbd_log_get_dropped(void);
+
+/**
+ * @}
+ */
+
+/**
+ * @name Library callback handlers
+ * Functions to be called by the user from the corresponding @c usbd-fs-stm32 callbacks.
+ *
+ * @{
+ */
+
+/**
+ * @brief Handler for @ref usbd_in_cb.
+ * @param[in] ept Endpoint number.
+ */
+void usbd_log_handle_in(uint8_t ept);
+
+/**
+ * @brief Handler for @ref usbd_sof_hook_cb.
+ */
+void usbd_log_handle_sof(void);
+
+/**
+ * @brief Handler for @ref usbd_reset_hook_cb.
+ */
+void usbd_log_handle_reset(void);
+
+/**
+ * @}
+ */
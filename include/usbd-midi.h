@@ -0,0 +1,191 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * @file usbd-midi.h
+ * @brief Optional USB-MIDI class driver header.
+ *
+ * This header defines the functions and callbacks implemented by the optional USB-MIDI
+ * class driver, available from the @c usbd-fs-stm32-midi CMake target.
+ *
+ * MIDI messages sent to the host are converted to USB-MIDI event packets, that are
+ * batched into full bulk packets while the latency budget allows. Event packets received
+ * from the host are parsed in place, from the packet memory.
+ *
+ * USB-MIDI 2.0 hosts may select the alternate setting @c 1 of the MIDIStreaming
+ * interface, that carries universal MIDI packets (UMP) instead of event packets. The
+ * driver switches between both formats following the alternate setting selected.
+ *
+ * Messages are routed by embedded jack ID. The cable numbers of each jack are read from
+ * the class-specific MIDIStreaming endpoint descriptors (@c baAssocJackID) of the
+ * configuration descriptor, when the device is reset.
+ *
+ * The driver is configured at build time with the following definitions:
+ *
+ * - @c USBD_MIDI_ITF: MIDIStreaming interface number (default: @c 1).
+ * - @c USBD_MIDI_EPT: Bulk IN/OUT endpoint number (default: @c 1).
+ * - @c USBD_MIDI_DATA_SIZE: Bulk endpoint size, in bytes (default: @c 64).
+ * - @c USBD_MIDI_TX_BUFFER_SIZE: Transmit ring buffer size, power of 2 (default: @c 256).
+ * - @c USBD_MIDI_LATENCY: Number of frames (ms) that event packets wait for more events
+ *   before being transmitted in a partial bulk packet (default: @c 1).
+ * - @c USBD_MIDI_SYSEX_BUFFER_SIZE: Size of the buffer used to reassemble received
+ *   system exclusive messages, per cable (default: @c 64).
+ * - @c USBD_MIDI_CABLES: Number of cables supported in each direction, up to 16
+ *   (default: @c 1).
+ *
+ * The endpoint must be configured accordingly (@c USBD_EPn_IN_SIZE, @c USBD_EPn_OUT_SIZE
+ * and @c USBD_EPn_TYPE), and the descriptors are still defined by the user.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <usbd.h>
+#include <usb-std-midi.h>
+
+/**
+ * @name Public API
+ * Functions to be called by the user to exchange MIDI messages with the host.
+ *
+ * @{
+ */
+
+/**
+ * @brief Queue a MIDI message to be transmitted to the host.
+ * @param[in] jack Embedded MIDI OUT jack ID, associated to the bulk IN endpoint.
+ * @param[in] msg  Pointer to a buffer containing a complete MIDI message, including the
+ *                 status byte. System exclusive messages must start with @c 0xf0 and
+ *                 end with @c 0xf7.
+ * @param[in] len  Size of the @c msg buffer, in bytes.
+ * @returns A boolean indicating that the message was queued. Messages are queued
+ *          completely or not at all.
+ *
+ * Running status is not supported. System exclusive messages are split into as many
+ * event packets as needed, and must fit the transmit buffer.
+ */
+bool usbd_midi_send(uint8_t jack, const uint8_t *msg, uint16_t len);
+
+/**
+ * @brief Queue a universal MIDI packet to be transmitted to the host.
+ * @param[in] ump Pointer to the 1 to 4 32-bit words of the packet. The size is given
+ *                by the message type, in the first word.
+ * @returns A boolean indicating that the packet was queued.
+ *
+ * Only available while the host selects the alternate setting @c 1 of the
+ * MIDIStreaming interface.
+ */
+bool usbd_midi_ump_send(const uint32_t *ump);
+
+/**
+ * @brief Transmit any event packets queued, without waiting for the latency budget.
+ */
+void usbd_midi_flush(void);
+
+/**
+ * @}
+ */
+
+/**
+ * @name Library callback handlers
+ * Functions to be called by the user from the corresponding @c usbd-fs-stm32 callbacks.
+ *
+ * @{
+ */
+
+/**
+ * @brief Handler for @ref usbd_ctrl_request_get_descriptor_interface_cb.
+ * @param[in] req A reference to a @ref usb_ctrl_request_t.
+ * @returns A boolean indicating that the request was handled.
+ *
+ * Answers the requests for group terminal block descriptors, using
+ * @ref usbd_midi_get_group_terminal_blocks_cb.
+ */
+bool usbd_midi_handle_get_descriptor(usb_ctrl_request_t *req);
+
+/**
+ * @brief Handler for @ref usbd_set_interface_hook_cb.
+ * @param[in] itf Interface number.
+ * @param[in] alt Alternate setting number.
+ */
+void usbd_midi_handle_set_interface(uint8_t itf, uint8_t alt);
+
+/**
+ * @brief Handler for @ref usbd_in_cb.
+ * @param[in] ept Endpoint number.
+ */
+void usbd_midi_handle_in(uint8_t ept);
+
+/**
+ * @brief Handler for @ref usbd_out_cb.
+ * @param[in] ept Endpoint number.
+ */
+void usbd_midi_handle_out(uint8_t ept);
+
+/**
+ * @brief Handler for @ref usbd_sof_hook_cb.
+ */
+void usbd_midi_handle_sof(void);
+
+/**
+ * @brief Handler for @ref usbd_reset_hook_cb.
+ */
+void usbd_midi_handle_reset(void);
+
+/**
+ * @}
+ */
+
+/**
+ * @name Callbacks
+ * Function callbacks that may be implemented by the user.
+ *
+ * @{
+ */
+
+/**
+ * @brief Optional callback for MIDI messages received from the host.
+ * @param[in] jack Embedded MIDI IN jack ID, associated to the bulk OUT endpoint.
+ * @param[in] msg  Pointer to the MIDI message, inside the packet memory.
+ * @param[in] len  Size of the MIDI message, in bytes (1 to 3).
+ *
+ * Called for every message, except system exclusive messages.
+ */
+void usbd_midi_recv_cb(uint8_t jack, const uint8_t *msg, uint8_t len) __attribute__((weak));
+
+/**
+ * @brief Optional callback for system exclusive messages received from the host.
+ * @param[in] jack Embedded MIDI IN jack ID, associated to the bulk OUT endpoint.
+ * @param[in] buf  Pointer to the reassembled message data.
+ * @param[in] len  Size of the message data, in bytes.
+ * @param[in] end  Boolean indicating that this is the last chunk of the message.
+ *
+ * Messages bigger than @c USBD_MIDI_SYSEX_BUFFER_SIZE are delivered in chunks. The
+ * first chunk starts with @c 0xf0 and the last one ends with @c 0xf7.
+ */
+void usbd_midi_sysex_cb(uint8_t jack, const uint8_t *buf, uint16_t len, bool end) __attribute__((weak));
+
+/**
+ * @brief Optional callback for universal MIDI packets received from the host.
+ * @param[in] ump   Pointer to the words of the packet.
+ * @param[in] words Number of 32-bit words of the packet (1 to 4).
+ *
+ * Utility NOOP messages are not reported.
+ */
+void usbd_midi_ump_recv_cb(const uint32_t *ump, uint8_t words) __attribute__((weak));
+
+/**
+ * @brief Optional callback to get the group terminal block descriptors.
+ * @returns A reference to a @ref usb_midi2_group_terminal_block_header_descriptor_t,
+ *          followed by the @ref usb_midi2_group_terminal_block_descriptor_t, up to
+ *          @c wTotalLength bytes.
+ */
+const usb_midi2_group_terminal_block_header_descriptor_t* usbd_midi_get_group_terminal_blocks_cb(void) __attribute__((weak));
+
+/**
+ * @}
+ */
@@ -0,0 +1,159 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * @file usbd-msc.h
+ * @brief Optional USB mass storage class driver header.
+ *
+ * This header defines the functions and callbacks implemented by the optional USB mass
+ * storage class driver, available from the @c usbd-fs-stm32-msc CMake target.
+ *
+ * The driver implements the Bulk-Only Transport, with the minimal SCSI command set
+ * required by the usual hosts, on top of a block device defined by callbacks.
+ *
+ * The block device callbacks are called from @ref usbd_msc_task, out of the USB
+ * interrupt context, while the data is exchanged with the host from a ring of block
+ * buffers. The media is accessed in runs of up to half of the buffers, so that the
+ * bulk transfers continue from the other half meanwhile: blocks are read ahead of the
+ * bulk IN transfers, and the blocks received from the host are coalesced into runs of
+ * consecutive blocks before being written. The command status is only sent after the
+ * blocks reach the media.
+ *
+ * The driver is configured at build time with the following definitions:
+ *
+ * - @c USBD_MSC_ITF: Mass storage interface number (default: @c 0).
+ * - @c USBD_MSC_EPT: Bulk IN/OUT endpoint number (default: @c 1).
+ * - @c USBD_MSC_EPT_SIZE: Bulk endpoint size, in bytes (default: @c 64).
+ * - @c USBD_MSC_BLOCK_SIZE: Block size of the media, in bytes, multiple of the
+ *   endpoint size (default: @c 512).
+ * - @c USBD_MSC_BUFFER_BLOCKS: Number of block buffers, power of 2 (default: @c 4).
+ * - @c USBD_MSC_VENDOR: Vendor identification string, up to 8 characters (default:
+ *   @c "usbd-fs").
+ * - @c USBD_MSC_PRODUCT: Product identification string, up to 16 characters (default:
+ *   @c "Mass Storage").
+ * - @c USBD_MSC_REVISION: Product revision string, up to 4 characters (default:
+ *   @c "1.0").
+ *
+ * The endpoint must be configured accordingly (@c USBD_EPn_IN_SIZE, @c USBD_EPn_OUT_SIZE
+ * and @c USBD_EPn_TYPE), and the descriptors are still defined by the user. Only a
+ * single logical unit is supported.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <usbd.h>
+#include <usb-std-msc.h>
+
+/**
+ * @name Public API
+ * Functions to be called by the user to run the block device operations.
+ *
+ * @{
+ */
+
+/**
+ * @brief Mass storage main loop task.
+ *
+ * Runs the pending block device operations, calling @ref usbd_msc_read_cb and
+ * @ref usbd_msc_write_cb. Must be called periodically from the firmware main loop.
+ */
+void usbd_msc_task(void);
+
+/**
+ * @}
+ */
+
+/**
+ * @name Library callback handlers
+ * Functions to be called by the user from the corresponding @c usbd-fs-stm32 callbacks.
+ *
+ * @{
+ */
+
+/**
+ * @brief Handler for @ref usbd_ctrl_request_handle_class_cb.
+ * @param[in] req A reference to a @ref usb_ctrl_request_t.
+ * @returns A boolean indicating that the request was handled.
+ */
+bool usbd_msc_handle_ctrl_request(usb_ctrl_request_t *req);
+
+/**
+ * @brief Handler for @ref usbd_in_cb.
+ * @param[in] ept Endpoint number.
+ */
+void usbd_msc_handle_in(uint8_t ept);
+
+/**
+ * @brief Handler for @ref usbd_out_cb.
+ * @param[in] ept Endpoint number.
+ */
+void usbd_msc_handle_out(uint8_t ept);
+
+/**
+ * @brief Handler for @ref usbd_sof_hook_cb.
+ */
+void usbd_msc_handle_sof(void);
+
+/**
+ * @brief Handler for @ref usbd_reset_hook_cb.
+ */
+void usbd_msc_handle_reset(void);
+
+/**
+ * @}
+ */
+
+/**
+ * @name Callbacks
+ * Function callbacks that may be implemented by the user.
+ *
+ * @{
+ */
+
+/**
+ * @brief Optional callback to get the size of the media.
+ * @returns The number of blocks of the media, or @c 0 if no media is present.
+ *
+ * Called from the USB interrupt context, and must not block.
+ */
+uint32_t usbd_msc_get_block_count_cb(void) __attribute__((weak));
+
+/**
+ * @brief Optional callback to check if the media is write protected.
+ * @returns A boolean indicating that the media is read-only.
+ *
+ * Called from the USB interrupt context, and must not block.
+ */
+bool usbd_msc_is_write_protected_cb(void) __attribute__((weak));
+
+/**
+ * @brief Optional callback to read blocks from the media.
+ * @param[in]  lba    Address of the first block.
+ * @param[out] buf    Pointer to a buffer to receive the blocks.
+ * @param[in]  blocks Number of consecutive blocks to read.
+ * @returns A boolean indicating that the blocks were read.
+ *
+ * Called from @ref usbd_msc_task.
+ */
+bool usbd_msc_read_cb(uint32_t lba, void *buf, uint16_t blocks) __attribute__((weak));
+
+/**
+ * @brief Optional callback to write blocks to the media.
+ * @param[in] lba    Address of the first block.
+ * @param[in] buf    Pointer to the blocks.
+ * @param[in] blocks Number of consecutive blocks to write.
+ * @returns A boolean indicating that the blocks were written.
+ *
+ * Called from @ref usbd_msc_task.
+ */
+bool usbd_msc_write_cb(uint32_t lba, const void *buf, uint16_t blocks) __attribute__((weak));
+
+/**
+ * @}
+ */
@@ -0,0 +1,140 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * @file usbd-rpc.h
+ * @brief Optional request/response framing driver header.
+ *
+ * This header defines the functions and types implemented by the optional
+ * request/response framing driver, available from the @c usbd-fs-stm32-rpc CMake
+ * target, meant to be used on top of a vendor-specific bulk interface.
+ *
+ * Each frame starts with a @ref usbd_rpc_header_t, followed by the payload. Request
+ * frames must fit a single packet, and may be packed together. They are dispatched to
+ * the handler registered for their channel straight from the endpoint buffer, and
+ * answered by @ref usbd_rpc_respond, right away or later, from the main loop. Up to
+ * @c USBD_RPC_MAX_OUTSTANDING requests may wait for responses, and the host is NAKed
+ * while all of them are in use.
+ *
+ * Each response frame is sent as a separate bulk transfer, with the header gathered
+ * into the first packet, straight from the response buffer. Requests for channels
+ * without handlers, or rejected by their handlers, are answered with an empty frame,
+ * with @ref USBD_RPC_CHANNEL_ERROR set in the channel.
+ *
+ * The driver is configured at build time with the following definitions:
+ *
+ * - @c USBD_RPC_EPT: Bulk IN/OUT endpoint number (default: @c 1).
+ * - @c USBD_RPC_EPT_SIZE: Bulk endpoint size, in bytes (default: @c 64).
+ * - @c USBD_RPC_CHANNELS: Number of channels, up to @c 128 (default: @c 8).
+ * - @c USBD_RPC_MAX_OUTSTANDING: Maximum number of requests waiting for responses
+ *   (default: @c 4).
+ *
+ * The endpoint must be configured accordingly (@c USBD_EPn_IN_SIZE, @c USBD_EPn_OUT_SIZE
+ * and @c USBD_EPn_TYPE), and the descriptors are still defined by the user.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <usbd.h>
+
+/**
+ * @name Public API
+ * Types and functions to be used by the user to handle the requests.
+ *
+ * @{
+ */
+
+/**
+ * @brief Frame header type.
+ */
+typedef struct __attribute__((packed)) {
+    uint16_t wLength;
+    uint8_t  bChannel;
+    uint8_t  bId;
+} usbd_rpc_header_t;
+
+/**
+ * @brief Channel bit set in error response frames.
+ */
+#define USBD_RPC_CHANNEL_ERROR (1 << 7)
+
+/**
+ * @brief Request handler type.
+ * @param[in] id  Request identifier, to be passed to @ref usbd_rpc_respond.
+ * @param[in] buf Pointer to the request payload, in the endpoint buffer.
+ * @param[in] len Size of the request payload, in bytes.
+ * @returns A boolean indicating that the request was accepted, and will be answered
+ *          by @ref usbd_rpc_respond.
+ *
+ * Called from the USB interrupt context. The payload is only valid until the handler
+ * returns.
+ */
+typedef bool (*usbd_rpc_handler_t)(uint8_t id, const void *buf, uint16_t len);
+
+/**
+ * @brief Register the request handler of a channel.
+ * @param[in] channel Channel number.
+ * @param[in] handler Request handler, or @c NULL to unregister.
+ * @returns A boolean indicating that the handler was registered.
+ */
+bool usbd_rpc_register(uint8_t channel, usbd_rpc_handler_t handler);
+
+/**
+ * @brief Answer a request.
+ * @param[in] channel Channel number of the request.
+ * @param[in] id      Request identifier.
+ * @param[in] buf     Pointer to a buffer containing the response payload.
+ * @param[in] len     Size of the @c buf buffer, in bytes.
+ * @returns A boolean indicating that the response was queued.
+ *
+ * The buffer is not copied, and must stay valid until @ref usbd_rpc_is_pending returns
+ * @c false for the request. May be called from the request handler or from the main
+ * loop.
+ */
+bool usbd_rpc_respond(uint8_t channel, uint8_t id, const void *buf, uint16_t len);
+
+/**
+ * @brief Check if a request is still waiting for its response to be sent.
+ * @param[in] channel Channel number of the request.
+ * @param[in] id      Request identifier.
+ * @returns A boolean indicating that the request is pending.
+ */
+bool usbd_rpc_is_pending(uint8_t channel, uint8_t id);
+
+/**
+ * @}
+ */
+
+/**
+ * @name Library callback handlers
+ * Functions to be called by the user from the corresponding @c usbd-fs-stm32 callbacks.
+ *
+ * @{
+ */
+
+/**
+ * @brief Handler for @ref usbd_in_cb.
+ * @param[in] ept Endpoint number.
+ */
+void usbd_rpc_handle_in(uint8_t ept);
+
+/**
+ * @brief Handler for @ref usbd_out_cb.
+ * @param[in] ept Endpoint number.
+ */
+void usbd_rpc_handle_out(uint8_t ept);
+
+/**
+ * @brief Handler for @ref usbd_reset_hook_cb.
+ */
+void usbd_rpc_handle_reset(void);
+
+/**
+ * @}
+ */
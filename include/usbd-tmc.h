@@ -0,0 +1,162 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * @file usbd-tmc.h
+ * @brief Optional USB test and measurement class driver header.
+ *
+ * This header defines the functions and callbacks implemented by the optional USB test
+ * and measurement class (USBTMC, with the USB488 subclass) driver, available from the
+ * @c usbd-fs-stm32-tmc CMake target.
+ *
+ * The message data sent by the host is delivered to @ref usbd_tmc_recv_cb straight
+ * from the endpoint buffer, without the transfer headers. Responses are queued with
+ * @ref usbd_tmc_respond, and sent from the user buffer when the host requests them,
+ * without being copied: the header is gathered into the first packet, and the
+ * alignment bytes into the last one.
+ *
+ * The driver is configured at build time with the following definitions:
+ *
+ * - @c USBD_TMC_ITF: Test and measurement interface number (default: @c 0).
+ * - @c USBD_TMC_EPT: Bulk IN/OUT endpoint number (default: @c 1).
+ * - @c USBD_TMC_EPT_SIZE: Bulk endpoint size, in bytes (default: @c 64).
+ * - @c USBD_TMC_INT_EPT: Interrupt IN endpoint number, used for the USB488 status byte
+ *   and service requests, or @c 0 for none (default: @c 0).
+ * - @c USBD_TMC_USB488: Set to @c 0 to implement plain USBTMC, without the USB488
+ *   subclass requests and capabilities (default: @c 1).
+ *
+ * The endpoints must be configured accordingly (@c USBD_EPn_IN_SIZE,
+ * @c USBD_EPn_OUT_SIZE and @c USBD_EPn_TYPE, the interrupt endpoint is 2 bytes long),
+ * and the descriptors are still defined by the user.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <usbd.h>
+#include <usb-std-tmc.h>
+
+/**
+ * @name Public API
+ * Functions to be called by the user to answer the host.
+ *
+ * @{
+ */
+
+/**
+ * @brief Queue a response message to the host.
+ * @param[in] buf Pointer to a buffer containing the response.
+ * @param[in] len Size of the @c buf buffer, in bytes.
+ * @param[in] eom Whether the buffer ends the response message.
+ * @returns A boolean indicating that the response was queued, @c false if a previous
+ *          response is still pending.
+ *
+ * The buffer is not copied, and must stay valid while @ref usbd_tmc_response_pending
+ * returns @c true. Responses longer than requested by the host are split between
+ * requests. Pending responses are dropped by abort and clear requests.
+ */
+bool usbd_tmc_respond(const void *buf, uint32_t len, bool eom);
+
+/**
+ * @brief Check if a response queued by @ref usbd_tmc_respond is still pending.
+ * @returns A boolean indicating that the response buffer is in use.
+ */
+bool usbd_tmc_response_pending(void);
+
+/**
+ * @brief Send a USB488 service request to the host, using the interrupt endpoint.
+ * @param[in] status_byte The status byte.
+ * @returns A boolean indicating that the service request was queued.
+ */
+bool usbd_tmc_srq(uint8_t status_byte);
+
+/**
+ * @}
+ */
+
+/**
+ * @name Library callback handlers
+ * Functions to be called by the user from the corresponding @c usbd-fs-stm32 callbacks.
+ *
+ * @{
+ */
+
+/**
+ * @brief Handler for @ref usbd_ctrl_request_handle_class_cb.
+ * @param[in] req A reference to a @ref usb_ctrl_request_t.
+ * @returns A boolean indicating that the request was handled.
+ */
+bool usbd_tmc_handle_ctrl_request(usb_ctrl_request_t *req);
+
+/**
+ * @brief Handler for @ref usbd_in_cb.
+ * @param[in] ept Endpoint number.
+ */
+void usbd_tmc_handle_in(uint8_t ept);
+
+/**
+ * @brief Handler for @ref usbd_out_cb.
+ * @param[in] ept Endpoint number.
+ */
+void usbd_tmc_handle_out(uint8_t ept);
+
+/**
+ * @brief Handler for @ref usbd_reset_hook_cb.
+ */
+void usbd_tmc_handle_reset(void);
+
+/**
+ * @}
+ */
+
+/**
+ * @name Callbacks
+ * Function callbacks that may be implemented by the user.
+ *
+ * @{
+ */
+
+/**
+ * @brief Optional callback to receive message data from the host.
+ * @param[in] buf Pointer to the data, in the endpoint buffer.
+ * @param[in] len Size of the data, in bytes.
+ * @param[in] eom Whether the data ends the message.
+ *
+ * Called from the USB interrupt context. The data is only valid until the callback
+ * returns.
+ */
+void usbd_tmc_recv_cb(const void *buf, uint16_t len, bool eom) __attribute__((weak));
+
+/**
+ * @brief Optional callback for device clear requests.
+ *
+ * Called from the USB interrupt context, after the pending transfers are aborted.
+ */
+void usbd_tmc_clear_cb(void) __attribute__((weak));
+
+/**
+ * @brief Optional callback for indicator pulse requests, advertised when implemented.
+ */
+void usbd_tmc_indicator_pulse_cb(void) __attribute__((weak));
+
+/**
+ * @brief Optional callback for USB488 trigger messages, advertised when implemented.
+ */
+void usbd_tmc_trigger_cb(void) __attribute__((weak));
+
+/**
+ * @brief Optional callback to get the USB488 status byte.
+ * @returns The status byte.
+ *
+ * Called from the USB interrupt context.
+ */
+uint8_t usbd_tmc_get_status_byte_cb(void) __attribute__((weak));
+
+/**
+ * @}
+ */
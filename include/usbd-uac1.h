@@ -0,0 +1,193 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * @file usbd-uac1.h
+ * @brief Optional USB Audio Class 1 streaming driver header.
+ *
+ * This header defines the functions and callbacks implemented by the optional USB Audio
+ * Class 1 streaming driver, available from the @c usbd-fs-stm32-uac1 CMake target.
+ *
+ * The driver streams PCM samples from an asynchronous isochronous OUT endpoint
+ * (speaker) and to an isochronous IN endpoint (microphone). Both streams are optional.
+ *
+ * The speaker stream is kept locked to the DAC/I2S clock by an explicit feedback
+ * endpoint. The number of samples consumed by the DAC is sampled at every SOF, and the
+ * 10.14 fixed-point samples-per-frame value sent to the host is computed from the
+ * samples consumed every @c 2^USBD_UAC1_FEEDBACK_REFRESH frames. The samples received
+ * are handed to the user in place, from the packet memory.
+ *
+ * The microphone stream sends the number of samples that match the current sample rate
+ * for each frame, e.g. 9 frames of 44 samples and 1 frame of 45 samples at 44.1kHz.
+ *
+ * The sample rates are selected by the host with the sampling frequency endpoint
+ * control.
+ *
+ * The driver is configured at build time with the following definitions:
+ *
+ * - @c USBD_UAC1_SPEAKER_ITF: Speaker AudioStreaming interface number (default: @c 1).
+ * - @c USBD_UAC1_SPEAKER_EPT: Speaker isochronous OUT endpoint number, @c 0 to disable
+ *   the speaker stream (default: @c 1).
+ * - @c USBD_UAC1_SPEAKER_FRAME_SIZE: Speaker audio frame size (all the channels of one
+ *   sample), in bytes (default: @c 4).
+ * - @c USBD_UAC1_FEEDBACK_EPT: Feedback isochronous IN endpoint number, @c 0 if the
+ *   speaker endpoint is adaptive instead of asynchronous (default: @c 2).
+ * - @c USBD_UAC1_FEEDBACK_REFRESH: Feedback refresh period, as a power of 2 frames, from
+ *   @c 1 to @c 9. Must match the @c bRefresh field of the feedback endpoint descriptor
+ *   (default: @c 5).
+ * - @c USBD_UAC1_FEEDBACK_COUNT_SHIFT: Number of fractional bits of the sample counter
+ *   returned by @ref usbd_uac1_get_sample_count_cb (default: @c 0).
+ * - @c USBD_UAC1_MIC_ITF: Microphone AudioStreaming interface number (default: @c 2).
+ * - @c USBD_UAC1_MIC_EPT: Microphone isochronous IN endpoint number, @c 0 to disable the
+ *   microphone stream (default: @c 3).
+ * - @c USBD_UAC1_MIC_FRAME_SIZE: Microphone audio frame size, in bytes (default: @c 2).
+ * - @c USBD_UAC1_SAMPLE_RATE: Sample rate set after reset, in Hz (default: @c 48000).
+ * - @c USBD_UAC1_MAX_SAMPLE_RATE: Highest sample rate supported, in Hz (default:
+ *   @c USBD_UAC1_SAMPLE_RATE).
+ *
+ * The endpoints must be configured accordingly (@c USBD_EPn_IN_SIZE, @c USBD_EPn_OUT_SIZE
+ * and @c USBD_EPn_TYPE, with @c ISOCHRONOUS), and the descriptors are still defined by
+ * the user. The microphone endpoint must fit one audio frame more than the samples of a
+ * frame at @c USBD_UAC1_MAX_SAMPLE_RATE, and the feedback endpoint must fit 3 bytes.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <usbd.h>
+#include <usb-std-audio.h>
+
+/**
+ * @name Public API
+ * Functions to be called by the user to follow the audio streams.
+ *
+ * @{
+ */
+
+/**
+ * @brief Get the sample rate set by the host for an audio stream.
+ * @param[in] ept Speaker or microphone endpoint number.
+ * @returns The sample rate, in Hz, or @c 0 if the endpoint is not an audio stream.
+ */
+uint32_t usbd_uac1_get_sample_rate(uint8_t ept);
+
+/**
+ * @brief Get the last feedback value computed for the speaker stream.
+ * @returns The number of samples per frame, in 10.14 fixed-point format.
+ */
+uint32_t usbd_uac1_get_feedback(void);
+
+/**
+ * @}
+ */
+
+/**
+ * @name Library callback handlers
+ * Functions to be called by the user from the corresponding @c usbd-fs-stm32 callbacks.
+ *
+ * @{
+ */
+
+/**
+ * @brief Handler for @ref usbd_ctrl_request_handle_class_cb.
+ * @param[in] req A reference to a @ref usb_ctrl_request_t.
+ * @returns A boolean indicating that the request was handled.
+ */
+bool usbd_uac1_handle_ctrl_request(usb_ctrl_request_t *req);
+
+/**
+ * @brief Handler for @ref usbd_set_interface_hook_cb.
+ * @param[in] itf Interface number.
+ * @param[in] alt Alternate setting number.
+ */
+void usbd_uac1_handle_set_interface(uint8_t itf, uint8_t alt);
+
+/**
+ * @brief Handler for @ref usbd_in_cb.
+ * @param[in] ept Endpoint number.
+ */
+void usbd_uac1_handle_in(uint8_t ept);
+
+/**
+ * @brief Handler for @ref usbd_out_cb.
+ * @param[in] ept Endpoint number.
+ */
+void usbd_uac1_handle_out(uint8_t ept);
+
+/**
+ * @brief Handler for @ref usbd_sof_hook_cb.
+ */
+void usbd_uac1_handle_sof(void);
+
+/**
+ * @brief Handler for @ref usbd_reset_hook_cb.
+ */
+void usbd_uac1_handle_reset(void);
+
+/**
+ * @}
+ */
+
+/**
+ * @name Callbacks
+ * Function callbacks that may be implemented by the user.
+ *
+ * @{
+ */
+
+/**
+ * @brief Optional callback for speaker samples received from the host.
+ * @param[in] samples Pointer to the samples, inside the packet memory.
+ * @param[in] len     Size of the samples, in bytes.
+ *
+ * Called once per frame, while the speaker stream is active. The samples must be
+ * copied before returning.
+ */
+void usbd_uac1_speaker_cb(const void *samples, uint16_t len) __attribute__((weak));
+
+/**
+ * @brief Optional callback to get the microphone samples to be sent to the host.
+ * @param[out] buf    Pointer to a buffer to receive the samples.
+ * @param[in]  frames Number of audio frames expected for this frame.
+ * @returns The number of audio frames written to @c buf, up to @c frames.
+ *
+ * Called once per frame, while the microphone stream is active. If not implemented,
+ * silence is sent.
+ */
+uint16_t usbd_uac1_mic_cb(void *buf, uint16_t frames) __attribute__((weak));
+
+/**
+ * @brief Optional callback to get the number of speaker samples consumed by the DAC.
+ * @returns A free-running counter of audio frames consumed, with
+ *          @c USBD_UAC1_FEEDBACK_COUNT_SHIFT fractional bits.
+ *
+ * Called from the SOF handler, and should be cheap, e.g. reading a DMA transfer counter.
+ * If not implemented, the nominal sample rate is reported to the host.
+ */
+uint32_t usbd_uac1_get_sample_count_cb(void) __attribute__((weak));
+
+/**
+ * @brief Optional callback for sample rates set by the host.
+ * @param[in] ept  Speaker or microphone endpoint number.
+ * @param[in] rate Sample rate, in Hz.
+ * @returns A boolean indicating that the sample rate was accepted.
+ *
+ * If not implemented, any sample rate up to @c USBD_UAC1_MAX_SAMPLE_RATE is accepted.
+ */
+bool usbd_uac1_set_sample_rate_cb(uint8_t ept, uint32_t rate) __attribute__((weak));
+
+/**
+ * @brief Optional callback for audio streams started or stopped by the host.
+ * @param[in] ept    Speaker or microphone endpoint number.
+ * @param[in] active Boolean indicating that the stream was started.
+ */
+void usbd_uac1_stream_cb(uint8_t ept, bool active) __attribute__((weak));
+
+/**
+ * @}
+ */
@@ -0,0 +1,196 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * @file usbd-uac2.h
+ * @brief Optional USB Audio Class 2 streaming driver header.
+ *
+ * This header defines the functions and callbacks implemented by the optional USB Audio
+ * Class 2 streaming driver, available from the @c usbd-fs-stm32-uac2 CMake target.
+ *
+ * The driver streams PCM samples from an asynchronous isochronous OUT endpoint
+ * (speaker) and to an isochronous IN endpoint (microphone), at full speed. Both streams
+ * are optional, and share a single programmable clock source entity.
+ *
+ * The sample rate is selected by the host with the sampling frequency control of the
+ * clock source (SET CUR), from the list of sample rates reported by its RANGE request.
+ * Each non-zero alternate setting of the AudioStreaming interfaces may use a different
+ * audio frame size (e.g. 16-bit and 24-bit samples), that the driver follows.
+ *
+ * The speaker stream is kept locked to the DAC/I2S clock by an explicit feedback
+ * endpoint, reporting the samples per frame consumed by the DAC in 16.16 fixed-point
+ * format, as expected by most UAC2 hosts, or optionally in the 10.14 format defined by
+ * the USB specification for full speed.
+ *
+ * The driver is configured at build time with the following definitions:
+ *
+ * - @c USBD_UAC2_AC_ITF: AudioControl interface number (default: @c 0).
+ * - @c USBD_UAC2_CLOCK_ID: Clock source entity ID (default: @c 1).
+ * - @c USBD_UAC2_SAMPLE_RATES: Comma-separated list of supported sample rates, in Hz.
+ *   The first one is selected after reset (default: @c 48000).
+ * - @c USBD_UAC2_SPEAKER_ITF: Speaker AudioStreaming interface number (default: @c 1).
+ * - @c USBD_UAC2_SPEAKER_EPT: Speaker isochronous OUT endpoint number, @c 0 to disable
+ *   the speaker stream (default: @c 1).
+ * - @c USBD_UAC2_SPEAKER_FRAME_SIZES: Comma-separated list of speaker audio frame sizes
+ *   (all the channels of one sample), in bytes, for each non-zero alternate setting
+ *   (default: @c 4).
+ * - @c USBD_UAC2_FEEDBACK_EPT: Feedback isochronous IN endpoint number, @c 0 if the
+ *   speaker endpoint is adaptive instead of asynchronous (default: @c 2).
+ * - @c USBD_UAC2_FEEDBACK_10_14: Set to @c 1 to send the feedback in the 3 bytes 10.14
+ *   format instead of the 4 bytes 16.16 format (default: @c 0).
+ * - @c USBD_UAC2_FEEDBACK_REFRESH: Feedback measurement period, as a power of 2 frames,
+ *   from @c 1 to @c 9 (default: @c 5).
+ * - @c USBD_UAC2_FEEDBACK_COUNT_SHIFT: Number of fractional bits of the sample counter
+ *   returned by @ref usbd_uac2_get_sample_count_cb (default: @c 0).
+ * - @c USBD_UAC2_MIC_ITF: Microphone AudioStreaming interface number (default: @c 2).
+ * - @c USBD_UAC2_MIC_EPT: Microphone isochronous IN endpoint number, @c 0 to disable the
+ *   microphone stream (default: @c 3).
+ * - @c USBD_UAC2_MIC_FRAME_SIZES: Comma-separated list of microphone audio frame sizes,
+ *   in bytes, for each non-zero alternate setting (default: @c 2).
+ * - @c USBD_UAC2_MIC_EPT_SIZE: Microphone endpoint size, in bytes. Must fit one audio
+ *   frame more than the samples of a frame at the highest sample rate (default: @c 98).
+ *
+ * The endpoints must be configured accordingly (@c USBD_EPn_IN_SIZE, @c USBD_EPn_OUT_SIZE
+ * and @c USBD_EPn_TYPE, with @c ISOCHRONOUS), and the descriptors are still defined by
+ * the user.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <usbd.h>
+#include <usb-std-audio.h>
+
+/**
+ * @name Public API
+ * Functions to be called by the user to follow the audio streams.
+ *
+ * @{
+ */
+
+/**
+ * @brief Get the sample rate set by the host.
+ * @returns The sample rate of the clock source, in Hz.
+ */
+uint32_t usbd_uac2_get_sample_rate(void);
+
+/**
+ * @brief Get the last feedback value computed for the speaker stream.
+ * @returns The number of samples per frame, in 16.16 or 10.14 fixed-point format.
+ */
+uint32_t usbd_uac2_get_feedback(void);
+
+/**
+ * @}
+ */
+
+/**
+ * @name Library callback handlers
+ * Functions to be called by the user from the corresponding @c usbd-fs-stm32 callbacks.
+ *
+ * @{
+ */
+
+/**
+ * @brief Handler for @ref usbd_ctrl_request_handle_class_cb.
+ * @param[in] req A reference to a @ref usb_ctrl_request_t.
+ * @returns A boolean indicating that the request was handled.
+ *
+ * Answers the requests addressed to the clock source entity.
+ */
+bool usbd_uac2_handle_ctrl_request(usb_ctrl_request_t *req);
+
+/**
+ * @brief Handler for @ref usbd_set_interface_hook_cb.
+ * @param[in] itf Interface number.
+ * @param[in] alt Alternate setting number.
+ */
+void usbd_uac2_handle_set_interface(uint8_t itf, uint8_t alt);
+
+/**
+ * @brief Handler for @ref usbd_in_cb.
+ * @param[in] ept Endpoint number.
+ */
+void usbd_uac2_handle_in(uint8_t ept);
+
+/**
+ * @brief Handler for @ref usbd_out_cb.
+ * @param[in] ept Endpoint number.
+ */
+void usbd_uac2_handle_out(uint8_t ept);
+
+/**
+ * @brief Handler for @ref usbd_sof_hook_cb.
+ */
+void usbd_uac2_handle_sof(void);
+
+/**
+ * @brief Handler for @ref usbd_reset_hook_cb.
+ */
+void usbd_uac2_handle_reset(void);
+
+/**
+ * @}
+ */
+
+/**
+ * @name Callbacks
+ * Function callbacks that may be implemented by the user.
+ *
+ * @{
+ */
+
+/**
+ * @brief Optional callback for speaker samples received from the host.
+ * @param[in] samples Pointer to the samples, inside the packet memory.
+ * @param[in] len     Size of the samples, in bytes.
+ *
+ * Called once per frame, while the speaker stream is active. The samples must be
+ * copied before returning.
+ */
+void usbd_uac2_speaker_cb(const void *samples, uint16_t len) __attribute__((weak));
+
+/**
+ * @brief Optional callback to get the microphone samples to be sent to the host.
+ * @param[out] buf    Pointer to a buffer to receive the samples.
+ * @param[in]  frames Number of audio frames expected for this frame.
+ * @returns The number of audio frames written to @c buf, up to @c frames.
+ *
+ * Called once per frame, while the microphone stream is active. If not implemented,
+ * silence is sent.
+ */
+uint16_t usbd_uac2_mic_cb(void *buf, uint16_t frames) __attribute__((weak));
+
+/**
+ * @brief Optional callback to get the number of speaker samples consumed by the DAC.
+ * @returns A free-running counter of audio frames consumed, with
+ *          @c USBD_UAC2_FEEDBACK_COUNT_SHIFT fractional bits.
+ *
+ * Called from the SOF handler. If not implemented, the nominal sample rate is reported
+ * to the host.
+ */
+uint32_t usbd_uac2_get_sample_count_cb(void) __attribute__((weak));
+
+/**
+ * @brief Optional callback for sample rates set by the host.
+ * @param[in] rate Sample rate, in Hz, from @c USBD_UAC2_SAMPLE_RATES.
+ * @returns A boolean indicating that the sample rate was accepted.
+ */
+bool usbd_uac2_set_sample_rate_cb(uint32_t rate) __attribute__((weak));
+
+/**
+ * @brief Optional callback for audio streams started, changed or stopped by the host.
+ * @param[in] ept        Speaker or microphone endpoint number.
+ * @param[in] alt        Alternate setting selected, @c 0 if the stream was stopped.
+ * @param[in] frame_size Audio frame size of the alternate setting, in bytes.
+ */
+void usbd_uac2_stream_cb(uint8_t ept, uint8_t alt, uint8_t frame_size) __attribute__((weak));
+
+/**
+ * @}
+ */
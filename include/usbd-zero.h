@@ -0,0 +1,117 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * @file usbd-zero.h
+ * @brief Optional source/sink and loopback test function header.
+ *
+ * This header defines the functions and callbacks implemented by the optional test
+ * function, compatible with the Linux gadget zero, available from the
+ * @c usbd-fs-stm32-zero CMake target.
+ *
+ * The function is meant to be tested with the Linux @c usbtest driver and the
+ * @c testusb tool, that recognize the device by @ref USBD_ZERO_VID and
+ * @ref USBD_ZERO_PID. The descriptors are still defined by the user: a single
+ * vendor-specific interface, whose alternate setting 0 contains the bulk IN/OUT
+ * endpoints and, optionally, the interrupt IN/OUT endpoints.
+ *
+ * In source/sink mode, the IN endpoints send full packets of the test pattern
+ * continuously, and the data received by the OUT endpoints is checked against the test
+ * pattern and dropped. In loopback mode, the packets received by the OUT endpoints are
+ * sent back by the IN endpoint with the same number, straight from the endpoint buffer.
+ * The control write/read test requests (@c 0x5b and @c 0x5c) are handled in both modes.
+ *
+ * The driver is configured at build time with the following definitions:
+ *
+ * - @c USBD_ZERO_BULK_EPT: Bulk IN/OUT endpoint number (default: @c 1).
+ * - @c USBD_ZERO_BULK_EPT_SIZE: Bulk endpoint size, in bytes (default: @c 64).
+ * - @c USBD_ZERO_INT_EPT: Interrupt IN/OUT endpoint number, or @c 0 for none
+ *   (default: @c 0).
+ * - @c USBD_ZERO_INT_EPT_SIZE: Interrupt endpoint size, in bytes (default: @c 64).
+ * - @c USBD_ZERO_LOOPBACK: Set to @c 1 to implement loopback, instead of source/sink
+ *   (default: @c 0).
+ * - @c USBD_ZERO_PATTERN: Test pattern, matching the @c pattern parameter of the Linux
+ *   modules: @c 0 for zeros, @c 1 for bytes modulo 63 (default: @c 0).
+ * - @c USBD_ZERO_CTRL_BUFFER_SIZE: Size of the control write/read test buffer, in bytes
+ *   (default: @c 256).
+ *
+ * The endpoints must be configured accordingly (@c USBD_EPn_IN_SIZE,
+ * @c USBD_EPn_OUT_SIZE and @c USBD_EPn_TYPE).
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <usbd.h>
+
+/**
+ * @name Test function identification
+ * USB vendor and product identifiers of the Linux gadget zero.
+ *
+ * @{
+ */
+
+#define USBD_ZERO_VID 0x0525
+#define USBD_ZERO_PID 0xa4a0
+
+/**
+ * @}
+ */
+
+/**
+ * @name Public API
+ * Functions to be called by the user to check the test results.
+ *
+ * @{
+ */
+
+/**
+ * @brief Get the number of packets received by the sink that did not match the test
+ *        pattern.
+ * @returns The number of packets.
+ */
+uint32_t usbd_zero_get_errors(void);
+
+/**
+ * @}
+ */
+
+/**
+ * @name Library callback handlers
+ * Functions to be called by the user from the corresponding @c usbd-fs-stm32 callbacks.
+ *
+ * @{
+ */
+
+/**
+ * @brief Handler for @ref usbd_ctrl_request_handle_vendor_cb.
+ * @param[in] req A reference to a @ref usb_ctrl_request_t.
+ * @returns A boolean indicating that the request was handled.
+ */
+bool usbd_zero_handle_ctrl_request(usb_ctrl_request_t *req);
+
+/**
+ * @brief Handler for @ref usbd_in_cb.
+ * @param[in] ept Endpoint number.
+ */
+void usbd_zero_handle_in(uint8_t ept);
+
+/**
+ * @brief Handler for @ref usbd_out_cb.
+ * @param[in] ept Endpoint number.
+ */
+void usbd_zero_handle_out(uint8_t ept);
+
+/**
+ * @brief Handler for @ref usbd_reset_hook_cb.
+ */
+void usbd_zero_handle_reset(void);
+
+/**
+ * @}
+ */
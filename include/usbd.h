@@ -83,12 +83,66 @@ const usb_string_descriptor_t* usbd_serial_internal_string_descriptor(void);
  * of data, the caller must split the data and call the function multiple times, in
  * response to multiple IN requests.
  *
+ * Endpoints other than endpoint 0 can only be used after the host configures the
+ * device. Before that, or if @c ept is not an IN endpoint, nothing is sent and
+ * @c false is returned, and the caller must keep the data to send it again later,
+ * e.g. from @ref usbd_in_cb.
+ *
  * Usually if the final chunk of data sent has the same size of the endpoint buffer,
  * a zero length packet must be also transmitted to the host, to inform it that
  * transmission is complete. This is NOT handled automatically by the library.
  */
 bool usbd_in(uint8_t ept, const void *buf, uint16_t buflen);
 
+/**
+ * @brief Transmit data from two buffers to the host, in a single USB IN packet.
+ * @param[in] ept  Endpoint number.
+ * @param[in] buf1 Pointer to a buffer containing the first part of the packet.
+ * @param[in] len1 Size of the @c buf1 buffer, in bytes.
+ * @param[in] buf2 Pointer to a buffer containing the second part of the packet.
+ * @param[in] len2 Size of the @c buf2 buffer, in bytes.
+ * @returns A boolean indicating that the data was written to the endpoint buffer.
+ *
+ * Same as @ref usbd_in, but gathers the packet from two buffers, e.g. a protocol header
+ * and the payload, without copying them to an intermediate buffer.
+ */
+bool usbd_in_gather(uint8_t ept, const void *buf1, uint16_t len1, const void *buf2, uint16_t len2);
+
+/**
+ * @brief Transmit data to the host in response to a USB IN request, copying it to the
+ *        packet memory with the DMA.
+ * @param[in] ept    Endpoint number.
+ * @param[in] buf    Pointer to a buffer containing data to be transmitted to the host.
+ * @param[in] buflen Size of the @c buf buffer, in bytes.
+ * @returns A boolean indicating that the data was successfully scheduled for transmission.
+ *
+ * Only available when the library is built with @c USBD_ENABLE_DMA defined, on
+ * STM32G4. Same as @ref usbd_in, but packets of at least @c USBD_DMA_MIN_SIZE bytes
+ * (default: @c 32) from halfword aligned buffers are copied to the packet memory by
+ * the DMA1 channel @c USBD_DMA_CHANNEL (default: @c 1), and the endpoint is only
+ * validated by @ref usbd_dma_irq_handler, when the copy completes. Short packets,
+ * unaligned buffers, endpoint 0 and packets sent while the channel is busy are copied
+ * by the CPU before returning.
+ *
+ * The buffer must stay valid and unchanged until @ref usbd_in_cb is called for the
+ * endpoint.
+ */
+bool usbd_in_dma(uint8_t ept, const void *buf, uint16_t buflen);
+
+/**
+ * @brief DMA channel interrupt handler.
+ *
+ * Only available when the library is built with @c USBD_ENABLE_DMA defined, on
+ * STM32G4. Validates the endpoint of the packet copied by @ref usbd_in_dma. Packets
+ * not copied due to DMA transfer errors are dropped, and the endpoint is reported as
+ * idle to @ref usbd_in_cb again.
+ *
+ * This function must be called from the interrupt handler of the DMA channel, with
+ * the same priority of the context that calls @ref usbd_task, or polled from the same
+ * context.
+ */
+void usbd_dma_irq_handler(void);
+
 /**
  * @brief Receive data from the host following a USB OUT request.
  * @param[in]  ept    Endpoint number.
@@ -107,6 +161,120 @@ bool usbd_in(uint8_t ept, const void *buf, uint16_t buflen);
  */
 uint16_t usbd_out(uint8_t ept, void *buf, uint16_t buflen);
 
+/**
+ * @brief Access the data received from the host following a USB OUT request, in place.
+ * @param[in]  ept Endpoint number.
+ * @param[out] buf Pointer to receive the address of the data, inside the packet memory.
+ * @returns The number of bytes received from the host.
+ *
+ * The data is not copied, and stays valid until @ref usbd_out_release is called. The
+ * host is NAKed until then.
+ *
+ * On devices with the USB DRD peripheral, whose packet memory only supports word
+ * accesses, and on devices with the 2x16 bit packet memory access scheme (STM32F1 and
+ * most STM32F3), the data is copied to an internal buffer shared by all the endpoints,
+ * and only stays valid until the next call.
+ */
+uint16_t usbd_out_peek(uint8_t ept, const void **buf);
+
+/**
+ * @brief Release the data accessed with @ref usbd_out_peek, and accept the next USB OUT
+ *        request.
+ * @param[in] ept Endpoint number.
+ */
+void usbd_out_release(uint8_t ept);
+
+/**
+ * @brief Stall a bulk or interrupt endpoint, as if halted by a SET_FEATURE request.
+ * @param[in] addr Endpoint address, including the direction bit
+ *                 (@c USB_DESCR_EPT_ADDR_DIR_IN).
+ * @returns A boolean indicating that the endpoint was stalled.
+ *
+ * The endpoint stays stalled until the host clears the halt feature with a
+ * CLEAR_FEATURE request. IN endpoints are reported as idle to @ref usbd_in_cb after
+ * that.
+ */
+bool usbd_stall(uint8_t addr);
+
+/**
+ * @brief Stream index getter type.
+ * @returns The index of the stream buffer where the producer writes next, for IN
+ *          streams, or where the consumer reads next, for OUT streams.
+ */
+typedef uint32_t (*usbd_stream_index_cb_t)(void);
+
+/**
+ * @brief Stream a circular buffer to the host, using a bulk or isochronous IN endpoint.
+ * @param[in] ept       Endpoint number.
+ * @param[in] buf       Pointer to the circular buffer.
+ * @param[in] buflen    Size of the @c buf buffer, in bytes.
+ * @param[in] get_index Function that returns the producer index, e.g. computed from the
+ *                      DMA transfer counter.
+ * @returns A boolean indicating that the stream was started.
+ *
+ * Only available when the library is built with @c USBD_ENABLE_STREAM defined. The
+ * data written by the producer after this call is sent by the library, from the
+ * transfer completion interrupt, straight from the circular buffer, and
+ * @ref usbd_in_cb is not called for the endpoint. The producer must not move further
+ * than the whole buffer between packets, and the data overwritten before being sent
+ * is dropped and counted as an overrun. Streams are stopped by bus resets.
+ */
+bool usbd_stream_in_start(uint8_t ept, const void *buf, uint32_t buflen, usbd_stream_index_cb_t get_index);
+
+/**
+ * @brief Stop streaming a circular buffer to the host.
+ * @param[in] ept Endpoint number.
+ *
+ * Only available when the library is built with @c USBD_ENABLE_STREAM defined.
+ */
+void usbd_stream_in_stop(uint8_t ept);
+
+/**
+ * @brief Get the number of overruns of a stream since it was started.
+ * @param[in] ept Endpoint number.
+ * @returns The number of overruns.
+ *
+ * Only available when the library is built with @c USBD_ENABLE_STREAM defined.
+ */
+uint32_t usbd_stream_in_get_overruns(uint8_t ept);
+
+/**
+ * @brief Stream data from the host to a circular buffer, using a bulk or interrupt OUT
+ *        endpoint.
+ * @param[in] ept       Endpoint number.
+ * @param[in] buf       Pointer to the circular buffer.
+ * @param[in] buflen    Size of the @c buf buffer, in bytes, larger than the endpoint
+ *                      size.
+ * @param[in] get_index Function that returns the consumer index, e.g. computed from the
+ *                      DMA transfer counter.
+ * @returns A boolean indicating that the stream was started.
+ *
+ * Only available when the library is built with @c USBD_ENABLE_STREAM defined. The
+ * packets received after this call are written by the library to the circular buffer,
+ * starting at the consumer index, and @ref usbd_out_cb is not called for the endpoint.
+ * The host is NAKed while the buffer lacks space for a packet, and resumed when the
+ * consumer frees enough space, checked every frame. Streams are stopped by bus resets.
+ */
+bool usbd_stream_out_start(uint8_t ept, void *buf, uint32_t buflen, usbd_stream_index_cb_t get_index);
+
+/**
+ * @brief Stop streaming data from the host to a circular buffer.
+ * @param[in] ept Endpoint number.
+ *
+ * Only available when the library is built with @c USBD_ENABLE_STREAM defined. A
+ * packet waiting for space in the buffer is dropped.
+ */
+void usbd_stream_out_stop(uint8_t ept);
+
+/**
+ * @brief Get the producer index of a stream from the host.
+ * @param[in] ept Endpoint number.
+ * @returns The index of the circular buffer where the next packet is written.
+ *
+ * Only available when the library is built with @c USBD_ENABLE_STREAM defined.
+ */
+uint32_t usbd_stream_out_get_index(uint8_t ept);
+
 /**
  * @brief Transmit data to the host in response to a CONTROL USB IN request on endpoint 0.
  * @param[in] buf    Pointer to a buffer containing data to be transmitted to the host.
@@ -115,13 +283,55 @@ uint16_t usbd_out(uint8_t ept, void *buf, uint16_t buflen);
  *
  * The buffer may exceed the size of the endpoint 0 (64 bytes), because the function
  * will handle the transmission of the whole buffer automatically.
- *
- * @warning This function exists only because some standard requests are frequently
- * larger than the endpoint 0 size. There's no @c usbd_control_out counterpart, please
- * use @ref usbd_out instead, by passing @c 0 as the endpoint number argument.
  */
 void usbd_control_in(const void *buf, uint16_t buflen, uint16_t reqlen);
 
+/**
+ * @brief Callback type for the completion of a CONTROL USB OUT data stage.
+ * @param[in] req A reference to the @ref usb_ctrl_request_t that started the transfer.
+ * @param[in] len Number of bytes received from the host.
+ * @returns A boolean indicating that the data was accepted. If @c false, the status
+ *          stage is stalled.
+ */
+typedef bool (*usbd_control_out_cb_t)(usb_ctrl_request_t *req, uint16_t len);
+
+/**
+ * @brief Receive data from the host following a CONTROL USB OUT request on endpoint 0.
+ * @param[out] buf    Pointer to a buffer to receive the data transmitted by the host.
+ * @param[in]  buflen Size of the @c buf buffer, in bytes.
+ * @param[in]  reqlen Size of the CONTROL USB OUT request data.
+ * @param[in]  cb     Function called when the data stage is completed.
+ *
+ * Must be called from a CONTROL request callback (e.g. @ref usbd_ctrl_request_handle_class_cb)
+ * that returns @c true, to request the data stage of the transfer. The buffer may exceed the
+ * size of the endpoint 0 (64 bytes), and must stay valid until @c cb is called. The status
+ * stage is sent automatically, depending on the value returned by @c cb. If there's no
+ * data to receive (@c reqlen or @c buflen is zero), @c cb is called with @c len set to
+ * zero as soon as the request callback returns.
+ */
+void usbd_control_out(void *buf, uint16_t buflen, uint16_t reqlen, usbd_control_out_cb_t cb);
+
+/**
+ * @brief Wake up the host from suspension (remote wakeup).
+ * @returns A boolean indicating that the resume signalling was started.
+ *
+ * The device must be suspended, and the host must have enabled the remote wakeup
+ * feature (@c SET_FEATURE @c DEVICE_REMOTE_WAKEUP), which is only accepted if
+ * @c USB_DESCR_CONFIG_ATTR_REMOTE_WAKEUP is set in the configuration descriptor
+ * @c bmAttributes.
+ *
+ * The resume signalling is timed by the library, from @ref usbd_task, and the
+ * function returns immediately. @ref usbd_resume_hook_cb is called when the
+ * signalling completes. The peripheral clocks disabled by
+ * @ref usbd_suspend_hook_cb must be re-enabled before calling this function.
+ *
+ * If the device is in L1 sleep (Link Power Management), the host allows the remote
+ * wakeup in the LPM token itself, and the feature set by the host is ignored. The
+ * resume signalling is timed by the hardware, and @ref usbd_l1_resume_hook_cb is
+ * called before returning.
+ */
+bool usbd_remote_wakeup(void);
+
 /**
  * @}
  */
@@ -153,6 +363,9 @@ const usb_config_descriptor_t* usbd_get_config_descriptor_cb(void);
  * @brief Required callback to define USB interface descriptor.
  * @param[in] itf Interface number.
  * @returns A reference to a constant @ref usb_interface_descriptor_t.
+ *
+ * Only used to validate the interface number. Alternate settings are looked up in the
+ * configuration descriptor.
  */
 const usb_interface_descriptor_t* usbd_get_interface_descriptor_cb(uint16_t itf);
 
@@ -164,6 +377,39 @@ const usb_interface_descriptor_t* usbd_get_interface_descriptor_cb(uint16_t itf)
  */
 const usb_string_descriptor_t* usbd_get_string_descriptor_cb(uint16_t lang, uint8_t idx);
 
+/**
+ * @brief Optional callback to define USB binary device object store (BOS) descriptor.
+ * @returns A reference to a constant @ref usb_bos_descriptor_t, followed by its device
+ *          capability descriptors.
+ *
+ * Hosts only request the BOS descriptor when @c bcdUSB is set to @c 0x0201 or higher in
+ * the device descriptor. If this callback is not implemented the request is stalled.
+ */
+const usb_bos_descriptor_t* usbd_get_bos_descriptor_cb(void) __attribute__((weak));
+
+/**
+ * @brief Optional callback to define Microsoft OS 2.0 descriptor set.
+ * @returns A reference to a constant @ref usb_msos20_set_header_descriptor_t, followed by
+ *          the rest of the descriptor set.
+ *
+ * The library answers the Microsoft OS 2.0 vendor request (@c wIndex 7) by itself, using
+ * the vendor code from the Microsoft OS 2.0 platform capability found in the descriptor
+ * returned by @ref usbd_get_bos_descriptor_cb.
+ */
+const usb_msos20_set_header_descriptor_t* usbd_get_msos20_descriptor_set_cb(void) __attribute__((weak));
+
+/**
+ * @brief Optional callback to define WebUSB URL descriptors.
+ * @param[in] idx The index of the URL descriptor to be returned, as defined in the WebUSB
+ *                platform capability descriptor (@c iLandingPage).
+ * @returns A reference to a constant @ref usb_webusb_url_descriptor_t.
+ *
+ * The library answers the WebUSB GET_URL vendor request by itself, using the vendor code
+ * from the WebUSB platform capability found in the descriptor returned by
+ * @ref usbd_get_bos_descriptor_cb.
+ */
+const usb_webusb_url_descriptor_t* usbd_get_webusb_url_descriptor_cb(uint8_t idx) __attribute__((weak));
+
 /**
  * @brief Optional hook callback for USB RESET requests.
  * @param[in] before Notifies if the callback call is happening before or after the device reset.
@@ -179,6 +425,18 @@ void usbd_reset_hook_cb(bool before) __attribute__((weak));
  */
 void usbd_set_address_hook_cb(uint8_t addr) __attribute__((weak));
 
+/**
+ * @brief Optional hook callback for USB SET_INTERFACE control requests.
+ * @param[in] itf The interface number.
+ * @param[in] alt The alternate setting selected by the host.
+ *
+ * The alternate setting is validated against the configuration descriptor, and the
+ * endpoints listed for it are reset (data toggle) and enabled before this hook is called.
+ * The endpoints of the previous alternate setting are set to NAK. The library supports up
+ * to @c USBD_MAX_INTERFACES interfaces (default: @c 8).
+ */
+void usbd_set_interface_hook_cb(uint8_t itf, uint8_t alt) __attribute__((weak));
+
 /**
  * @brief Optional hook callback for USB SUSPEND requests.
  *
@@ -197,6 +455,37 @@ void usbd_suspend_hook_cb(void) __attribute__((weak));
  */
 void usbd_resume_hook_cb(void) __attribute__((weak));
 
+/**
+ * @brief Optional hook callback for USB Link Power Management L1 sleep requests.
+ * @param[in] besl Best Effort Service Latency value sent by the host (0 to 15).
+ *
+ * Only available when the library is built with @c USBD_ENABLE_LPM defined. The LPM
+ * capability must be advertised in the USB 2.0 extension capability of the BOS descriptor
+ * (@ref usb_bos_usb20_ext_descriptor_t) and @c bcdUSB must be set to @c 0x0201.
+ *
+ * The host may resume the link as soon as the latency encoded by @c besl (from 125us to
+ * 10ms) is elapsed, so this function should only disable what can be re-enabled by
+ * @ref usbd_l1_resume_hook_cb in time. The library will enable the internal STM32 low
+ * power mode automatically.
+ */
+void usbd_l1_suspend_hook_cb(uint8_t besl) __attribute__((weak));
+
+/**
+ * @brief Optional hook callback for USB Link Power Management L1 resume.
+ *
+ * Called instead of @ref usbd_resume_hook_cb when the device leaves L1 sleep. It should
+ * re-enable whatever was disabled by @ref usbd_l1_suspend_hook_cb.
+ */
+void usbd_l1_resume_hook_cb(void) __attribute__((weak));
+
+/**
+ * @brief Optional hook callback for USB start of frame (SOF) events.
+ * @param[in] frame The 11 bits frame number sent by the host.
+ *
+ * Called once per frame (1ms), while the bus is not suspended.
+ */
+void usbd_sof_hook_cb(uint16_t frame) __attribute__((weak));
+
 /**
  * @brief Optional callback for USB OUT requests.
  * @param[in] ept Endpoint number.
@@ -206,6 +495,11 @@ void usbd_out_cb(uint8_t ept) __attribute__((weak));
 /**
  * @brief Optional callback for USB IN requests.
  * @param[in] ept Endpoint number.
+ *
+ * Called when the endpoint is ready to accept more data: right after the previous
+ * transmission is completed, and periodically (on SOF) while the endpoint is idle,
+ * including after the host clears a halt. Either way, there's nothing in flight, and
+ * the next packet may be sent with @ref usbd_in.
  */
 void usbd_in_cb(uint8_t ept) __attribute__((weak));
 
@@ -218,6 +512,9 @@ bool usbd_ctrl_request_handle_class_cb(usb_ctrl_request_t *req) __attribute__((w
 /**
  * @brief Optional callback for USB CONTROL vendor requests.
  * @param[in] req A reference to a @ref usb_ctrl_request_t.
+ *
+ * Microsoft OS 2.0 and WebUSB vendor requests are handled by the library when the
+ * respective descriptor callbacks are implemented, and won't reach this callback.
  */
 bool usbd_ctrl_request_handle_vendor_cb(usb_ctrl_request_t *req) __attribute__((weak));
 
@@ -0,0 +1,324 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <usbd.h>
+#include <usbd-cdc-acm.h>
+
+#ifndef USBD_CDC_ACM_ITF
+#define USBD_CDC_ACM_ITF 0
+#endif
+#ifndef USBD_CDC_ACM_NOTIF_EPT
+#define USBD_CDC_ACM_NOTIF_EPT 1
+#endif
+#ifndef USBD_CDC_ACM_DATA_EPT
+#define USBD_CDC_ACM_DATA_EPT 2
+#endif
+#ifndef USBD_CDC_ACM_DATA_SIZE
+#define USBD_CDC_ACM_DATA_SIZE 64
+#endif
+#ifndef USBD_CDC_ACM_TX_BUFFER_SIZE
+#define USBD_CDC_ACM_TX_BUFFER_SIZE 256
+#endif
+#ifndef USBD_CDC_ACM_RX_BUFFER_SIZE
+#define USBD_CDC_ACM_RX_BUFFER_SIZE 256
+#endif
+#ifndef USBD_CDC_ACM_FLUSH_TIMEOUT
+#define USBD_CDC_ACM_FLUSH_TIMEOUT 2
+#endif
+
+#if (USBD_CDC_ACM_TX_BUFFER_SIZE & (USBD_CDC_ACM_TX_BUFFER_SIZE - 1)) || \
+    (USBD_CDC_ACM_RX_BUFFER_SIZE & (USBD_CDC_ACM_RX_BUFFER_SIZE - 1))
+#error "CDC-ACM buffer sizes must be powers of 2"
+#endif
+
+#if (USBD_CDC_ACM_TX_BUFFER_SIZE < USBD_CDC_ACM_DATA_SIZE) || \
+    (USBD_CDC_ACM_RX_BUFFER_SIZE < USBD_CDC_ACM_DATA_SIZE)
+#error "CDC-ACM buffers must fit at least one data packet"
+#endif
+
+// ring indexes are free running, and only masked when accessing the buffers. the
+// producer owns the head, the consumer owns the tail.
+static struct {
+    uint8_t buf[USBD_CDC_ACM_TX_BUFFER_SIZE];
+    volatile uint16_t head;
+    volatile uint16_t tail;
+    volatile bool flush;
+    bool busy;
+    bool zlp;
+    uint8_t frames;
+} tx;
+
+static struct {
+    uint8_t buf[USBD_CDC_ACM_RX_BUFFER_SIZE];
+    volatile uint16_t head;
+    volatile uint16_t tail;
+    bool pending;
+} rx;
+
+static struct {
+    volatile bool pending;
+    bool busy;
+    volatile uint16_t state;
+} notif;
+
+static usb_cdc_line_coding_t line_coding = {
+    .dwDTERate   = 115200,
+    .bCharFormat = 0,
+    .bParityType = 0,
+    .bDataBits   = 8,
+};
+static usb_cdc_line_coding_t line_coding_req;
+static uint16_t control_line_state = 0;
+
+
+uint16_t
+usbd_cdc_acm_write(const void *buf, uint16_t buflen)
+{
+    const uint8_t *b = buf;
+    uint16_t head = tx.head;
+    uint16_t free = USBD_CDC_ACM_TX_BUFFER_SIZE - (uint16_t) (head - tx.tail);
+    uint16_t l = buflen < free ? buflen : free;
+
+    for (uint16_t i = 0; i < l; i++)
+        tx.buf[(head + i) & (USBD_CDC_ACM_TX_BUFFER_SIZE - 1)] = b[i];
+
+    tx.head = head + l;
+    return l;
+}
+
+void
+usbd_cdc_acm_flush(void)
+{
+    tx.flush = true;
+}
+
+uint16_t
+usbd_cdc_acm_read(void *buf, uint16_t buflen)
+{
+    uint8_t *b = buf;
+    uint16_t tail = rx.tail;
+    uint16_t avail = rx.head - tail;
+    uint16_t l = buflen < avail ? buflen : avail;
+
+    for (uint16_t i = 0; i < l; i++)
+        b[i] = rx.buf[(tail + i) & (USBD_CDC_ACM_RX_BUFFER_SIZE - 1)];
+
+    rx.tail = tail + l;
+    return l;
+}
+
+uint16_t
+usbd_cdc_acm_available(void)
+{
+    return rx.head - rx.tail;
+}
+
+void
+usbd_cdc_acm_set_serial_state(uint16_t state)
+{
+    notif.state = state;
+    notif.pending = true;
+}
+
+const usb_cdc_line_coding_t*
+usbd_cdc_acm_get_line_coding(void)
+{
+    return &line_coding;
+}
+
+uint16_t
+usbd_cdc_acm_get_control_line_state(void)
+{
+    return control_line_state;
+}
+
+
+static void
+tx_task(void)
+{
+    if (tx.busy)
+        return;
+
+    uint16_t tail = tx.tail;
+    uint16_t pending = tx.head - tail;
+
+    if (pending == 0) {
+        // a transfer ending with a full packet must be terminated with a zero length
+        // packet, otherwise the host keeps waiting for more data.
+        if (tx.zlp && tx.frames >= USBD_CDC_ACM_FLUSH_TIMEOUT) {
+            tx.busy = usbd_in(USBD_CDC_ACM_DATA_EPT, NULL, 0);
+            if (tx.busy)
+                tx.zlp = false;
+        }
+        return;
+    }
+
+    if ((pending < USBD_CDC_ACM_DATA_SIZE) && !tx.flush && (tx.frames < USBD_CDC_ACM_FLUSH_TIMEOUT))
+        return;
+
+    uint16_t l = pending < USBD_CDC_ACM_DATA_SIZE ? pending : USBD_CDC_ACM_DATA_SIZE;
+    uint16_t idx = tail & (USBD_CDC_ACM_TX_BUFFER_SIZE - 1);
+
+    if (idx + l <= USBD_CDC_ACM_TX_BUFFER_SIZE)
+        tx.busy = usbd_in(USBD_CDC_ACM_DATA_EPT, tx.buf + idx, l);
+    else {
+        uint8_t tmp[USBD_CDC_ACM_DATA_SIZE];
+        uint16_t first = USBD_CDC_ACM_TX_BUFFER_SIZE - idx;
+        memcpy(tmp, tx.buf + idx, first);
+        memcpy(tmp + first, tx.buf, l - first);
+        tx.busy = usbd_in(USBD_CDC_ACM_DATA_EPT, tmp, l);
+    }
+
+    if (!tx.busy)
+        return;
+
+    tx.tail = tail + l;
+    tx.zlp = l == USBD_CDC_ACM_DATA_SIZE;
+    tx.frames = 0;
+    if (tx.head == tx.tail)
+        tx.flush = false;
+}
+
+static void
+rx_task(void)
+{
+    if ((USBD_CDC_ACM_RX_BUFFER_SIZE - (uint16_t) (rx.head - rx.tail)) < USBD_CDC_ACM_DATA_SIZE) {
+        // leave the packet in the endpoint buffer, the host gets NAKs until there's space
+        rx.pending = true;
+        return;
+    }
+    rx.pending = false;
+
+    uint8_t tmp[USBD_CDC_ACM_DATA_SIZE];
+    uint16_t l = usbd_out(USBD_CDC_ACM_DATA_EPT, tmp, sizeof(tmp));
+
+    uint16_t head = rx.head;
+    for (uint16_t i = 0; i < l; i++)
+        rx.buf[(head + i) & (USBD_CDC_ACM_RX_BUFFER_SIZE - 1)] = tmp[i];
+    rx.head = head + l;
+}
+
+static void
+notif_task(void)
+{
+    if (notif.busy || !notif.pending)
+        return;
+
+    struct __attribute__((packed)) {
+        usb_cdc_notification_t hdr;
+        uint16_t state;
+    } n = {
+        .hdr = {
+            .bmRequestType     = USB_REQ_DIR_DEVICE_TO_HOST | USB_REQ_TYPE_CLASS | USB_REQ_RCPT_INTERFACE,
+            .bNotificationCode = USB_CDC_NOTIF_SERIAL_STATE,
+            .wValue            = 0,
+            .wIndex            = USBD_CDC_ACM_ITF,
+            .wLength           = sizeof(uint16_t),
+        },
+    };
+
+    // the notification is sent again if the endpoint is not ready yet
+    notif.pending = false;
+    n.state = notif.state;
+    notif.busy = usbd_in(USBD_CDC_ACM_NOTIF_EPT, &n, sizeof(n));
+    if (!notif.busy)
+        notif.pending = true;
+}
+
+
+static bool
+set_line_coding(usb_ctrl_request_t *req, uint16_t len)
+{
+    (void) req;
+    if (len != sizeof(usb_cdc_line_coding_t))
+        return false;
+
+    line_coding = line_coding_req;
+    if (usbd_cdc_acm_set_line_coding_cb)
+        usbd_cdc_acm_set_line_coding_cb(&line_coding);
+    return true;
+}
+
+bool
+usbd_cdc_acm_handle_ctrl_request(usb_ctrl_request_t *req)
+{
+    if (((req->bmRequestType & USB_REQ_RCPT_MASK) != USB_REQ_RCPT_INTERFACE) ||
+        (req->wIndex != USBD_CDC_ACM_ITF))
+        return false;
+
+    switch (req->bRequest) {
+    case USB_REQ_CDC_SET_LINE_CODING:
+        usbd_control_out(&line_coding_req, sizeof(line_coding_req), req->wLength, set_line_coding);
+        return true;
+
+    case USB_REQ_CDC_GET_LINE_CODING:
+        usbd_control_in(&line_coding, sizeof(line_coding), req->wLength);
+        return true;
+
+    case USB_REQ_CDC_SET_CONTROL_LINE_STATE:
+        control_line_state = req->wValue;
+        if (usbd_cdc_acm_set_control_line_state_cb)
+            usbd_cdc_acm_set_control_line_state_cb(control_line_state);
+        return true;
+
+    case USB_REQ_CDC_SEND_BREAK:
+        return true;
+    }
+
+    return false;
+}
+
+void
+usbd_cdc_acm_handle_in(uint8_t ept)
+{
+    if (ept == USBD_CDC_ACM_NOTIF_EPT) {
+        notif.busy = false;
+        notif_task();
+    }
+    else if (ept == USBD_CDC_ACM_DATA_EPT) {
+        tx.busy = false;
+        tx_task();
+    }
+}
+
+void
+usbd_cdc_acm_handle_out(uint8_t ept)
+{
+    if (ept == USBD_CDC_ACM_DATA_EPT)
+        rx_task();
+}
+
+void
+usbd_cdc_acm_handle_sof(void)
+{
+    // counts the frames since the last packet, while something is waiting to be sent
+    if ((tx.head == tx.tail) && !tx.zlp)
+        tx.frames = 0;
+    else if (tx.frames < UINT8_MAX)
+        tx.frames++;
+
+    tx_task();
+    notif_task();
+
+    if (rx.pending)
+        rx_task();
+}
+
+void
+usbd_cdc_acm_handle_reset(void)
+{
+    tx.head = tx.tail = 0;
+    tx.flush = tx.busy = tx.zlp = false;
+    tx.frames = 0;
+    rx.head = rx.tail = 0;
+    rx.pending = false;
+    notif.pending = notif.busy = false;
+    control_line_state = 0;
+}
@@ -0,0 +1,546 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <usbd.h>
+#include <usbd-cdc-ncm.h>
+
+#ifndef USBD_CDC_NCM_ITF
+#define USBD_CDC_NCM_ITF 0
+#endif
+#ifndef USBD_CDC_NCM_DATA_ITF
+#define USBD_CDC_NCM_DATA_ITF (USBD_CDC_NCM_ITF + 1)
+#endif
+#ifndef USBD_CDC_NCM_NOTIF_EPT
+#define USBD_CDC_NCM_NOTIF_EPT 1
+#endif
+#ifndef USBD_CDC_NCM_DATA_EPT
+#define USBD_CDC_NCM_DATA_EPT 2
+#endif
+#ifndef USBD_CDC_NCM_DATA_SIZE
+#define USBD_CDC_NCM_DATA_SIZE 64
+#endif
+#ifndef USBD_CDC_NCM_NTB_IN_SIZE
+#define USBD_CDC_NCM_NTB_IN_SIZE 2048
+#endif
+#ifndef USBD_CDC_NCM_NTB_OUT_SIZE
+#define USBD_CDC_NCM_NTB_OUT_SIZE 2048
+#endif
+#ifndef USBD_CDC_NCM_DATAGRAM_ALIGNMENT
+#define USBD_CDC_NCM_DATAGRAM_ALIGNMENT 4
+#endif
+#ifndef USBD_CDC_NCM_MAX_DATAGRAMS
+#define USBD_CDC_NCM_MAX_DATAGRAMS 8
+#endif
+#ifndef USBD_CDC_NCM_MAX_DATAGRAM_SIZE
+#define USBD_CDC_NCM_MAX_DATAGRAM_SIZE 1514
+#endif
+#ifndef USBD_CDC_NCM_FLUSH_TIMEOUT
+#define USBD_CDC_NCM_FLUSH_TIMEOUT 0
+#endif
+
+#if (USBD_CDC_NCM_DATAGRAM_ALIGNMENT < 4) || \
+    (USBD_CDC_NCM_DATAGRAM_ALIGNMENT & (USBD_CDC_NCM_DATAGRAM_ALIGNMENT - 1))
+#error "CDC-NCM datagram alignment must be a power of 2, at least 4"
+#endif
+
+#if (USBD_CDC_NCM_NTB_IN_SIZE > 0xffff) || (USBD_CDC_NCM_NTB_OUT_SIZE > 0xffff)
+#error "CDC-NCM transfer blocks are limited to 65535 bytes (NTB16)"
+#endif
+
+#if USBD_CDC_NCM_NTB_OUT_SIZE % USBD_CDC_NCM_DATA_SIZE
+#error "CDC-NCM output transfer block size must be a multiple of the data endpoint size"
+#endif
+
+#define ALIGN(v, a) (((v) + (a) - 1) & ~((a) - 1))
+
+// ndp16 header, entries and null terminator
+#define NDP16_SIZE(n) (sizeof(usb_cdc_ncm_ndp16_t) + ((n) + 1) * sizeof(usb_cdc_ncm_dpe16_t))
+
+// smallest block that fits a datagram of maximum size: nth16 (12 bytes), datagram,
+// ndp16 alignment and ndp16 with a single entry (16 bytes).
+#define NTB_IN_MIN_SIZE (ALIGN(12, USBD_CDC_NCM_DATAGRAM_ALIGNMENT) + USBD_CDC_NCM_MAX_DATAGRAM_SIZE + 4 + 16)
+
+#if USBD_CDC_NCM_NTB_IN_SIZE < NTB_IN_MIN_SIZE
+#error "CDC-NCM input transfer block size must fit at least one datagram"
+#endif
+
+#define NOTIF_SPEED      (1 << 0)
+#define NOTIF_CONNECTION (1 << 1)
+
+static const usb_cdc_ncm_ntb_parameters_t ntb_parameters = {
+    .wLength                 = sizeof(usb_cdc_ncm_ntb_parameters_t),
+    .bmNtbFormatsSupported   = USB_CDC_NCM_NTB_FORMAT_16,
+    .dwNtbInMaxSize          = USBD_CDC_NCM_NTB_IN_SIZE,
+    .wNdpInDivisor           = USBD_CDC_NCM_DATAGRAM_ALIGNMENT,
+    .wNdpInPayloadRemainder  = 0,
+    .wNdpInAlignment         = 4,
+    .dwNtbOutMaxSize         = USBD_CDC_NCM_NTB_OUT_SIZE,
+    .wNdpOutDivisor          = USBD_CDC_NCM_DATAGRAM_ALIGNMENT,
+    .wNdpOutPayloadRemainder = 0,
+    .wNdpOutAlignment        = 4,
+    .wNtbOutMaxDatagrams     = 0,
+};
+
+// the producer fills one transfer block while the other one is in flight. the usb side
+// only swaps them while the producer is not holding an allocation.
+static struct {
+    uint8_t buf[2][USBD_CDC_NCM_NTB_IN_SIZE] __attribute__((aligned(4)));
+    usb_cdc_ncm_dpe16_t dpe[2][USBD_CDC_NCM_MAX_DATAGRAMS];
+    volatile uint16_t len[2];
+    volatile uint16_t count[2];
+    volatile uint8_t fill;
+    volatile bool lock;
+    volatile bool full;
+    uint16_t alloc_idx;
+    uint16_t alloc_len;
+    const uint8_t *ptr;
+    uint16_t remaining;
+    uint16_t sequence;
+    bool busy;
+    bool zlp;
+    uint8_t frames;
+} tx;
+
+static struct {
+    uint8_t buf[USBD_CDC_NCM_NTB_OUT_SIZE] __attribute__((aligned(4)));
+    uint16_t len;
+} rx;
+
+static struct {
+    volatile uint8_t pending;
+    volatile bool connected;
+    bool busy;
+} notif;
+
+static volatile bool active = false;
+static uint32_t ntb_input_size = USBD_CDC_NCM_NTB_IN_SIZE;
+static uint16_t ntb_input_datagrams = USBD_CDC_NCM_MAX_DATAGRAMS;
+static uint16_t max_datagram_size = USBD_CDC_NCM_MAX_DATAGRAM_SIZE;
+static uint16_t packet_filter = 0;
+
+static struct __attribute__((packed)) {
+    uint32_t dwNtbInMaxSize;
+    uint16_t wNtbInMaxDatagrams;
+    uint16_t wReserved;
+} ntb_input_size_req;
+static uint16_t max_datagram_size_req;
+
+
+void*
+usbd_cdc_ncm_alloc(uint16_t len)
+{
+    if (!active || tx.lock || len == 0 || len > max_datagram_size)
+        return NULL;
+
+    tx.lock = true;
+
+    uint8_t f = tx.fill;
+    uint16_t count = tx.count[f];
+    uint16_t start = tx.len[f] != 0 ? tx.len[f] : sizeof(usb_cdc_ncm_nth16_t);
+    uint16_t idx = ALIGN(start, USBD_CDC_NCM_DATAGRAM_ALIGNMENT);
+
+    if ((count >= ntb_input_datagrams) ||
+        ((ALIGN(idx + len, 4) + NDP16_SIZE(count + 1)) > ntb_input_size)) {
+        tx.full = count > 0;
+        tx.lock = false;
+        return NULL;
+    }
+
+    tx.alloc_idx = idx;
+    tx.alloc_len = len;
+    return tx.buf[f] + idx;
+}
+
+void
+usbd_cdc_ncm_commit(void)
+{
+    if (!tx.lock)
+        return;
+
+    uint8_t f = tx.fill;
+    uint16_t count = tx.count[f];
+
+    tx.dpe[f][count].wDatagramIndex = tx.alloc_idx;
+    tx.dpe[f][count].wDatagramLength = tx.alloc_len;
+    tx.len[f] = tx.alloc_idx + tx.alloc_len;
+    tx.count[f] = count + 1;
+    tx.lock = false;
+}
+
+bool
+usbd_cdc_ncm_send(const void *buf, uint16_t len)
+{
+    void *dst = usbd_cdc_ncm_alloc(len);
+    if (dst == NULL)
+        return false;
+
+    memcpy(dst, buf, len);
+    usbd_cdc_ncm_commit();
+    return true;
+}
+
+void
+usbd_cdc_ncm_set_connected(bool connected)
+{
+    notif.connected = connected;
+    notif.pending |= NOTIF_CONNECTION;
+}
+
+uint16_t
+usbd_cdc_ncm_get_packet_filter(void)
+{
+    return packet_filter;
+}
+
+
+static bool
+tx_finalize(void)
+{
+    uint8_t f = tx.fill;
+    uint16_t count = tx.count[f];
+    if (count == 0)
+        return false;
+
+    uint8_t *b = tx.buf[f];
+    uint16_t ndp_idx = ALIGN(tx.len[f], 4);
+    uint16_t ndp_len = NDP16_SIZE(count);
+
+    usb_cdc_ncm_ndp16_t *ndp = (usb_cdc_ncm_ndp16_t*) (b + ndp_idx);
+    ndp->dwSignature = USB_CDC_NCM_NDP16_SIGNATURE;
+    ndp->wLength = ndp_len;
+    ndp->wNextNdpIndex = 0;
+    memcpy(ndp->datagrams, tx.dpe[f], count * sizeof(usb_cdc_ncm_dpe16_t));
+    ndp->datagrams[count].wDatagramIndex = 0;
+    ndp->datagrams[count].wDatagramLength = 0;
+
+    usb_cdc_ncm_nth16_t *nth = (usb_cdc_ncm_nth16_t*) b;
+    nth->dwSignature = USB_CDC_NCM_NTH16_SIGNATURE;
+    nth->wHeaderLength = sizeof(usb_cdc_ncm_nth16_t);
+    nth->wSequence = tx.sequence++;
+    nth->wBlockLength = ndp_idx + ndp_len;
+    nth->wNdpIndex = ndp_idx;
+
+    tx.ptr = b;
+    tx.remaining = nth->wBlockLength;
+
+    // a block that ends with a full packet must be terminated with a zero length packet,
+    // unless it has the maximum size negotiated with the host.
+    tx.zlp = ((tx.remaining % USBD_CDC_NCM_DATA_SIZE) == 0) && (tx.remaining < ntb_input_size);
+
+    f ^= 1;
+    tx.len[f] = 0;
+    tx.count[f] = 0;
+    tx.full = false;
+    tx.fill = f;
+    return true;
+}
+
+static void
+tx_task(void)
+{
+    if (!active || tx.busy)
+        return;
+
+    if (tx.remaining == 0) {
+        if (tx.zlp) {
+            tx.busy = usbd_in(USBD_CDC_NCM_DATA_EPT, NULL, 0);
+            if (tx.busy)
+                tx.zlp = false;
+            return;
+        }
+
+        // the producer may be writing to the block right now, try again later
+        if (tx.lock)
+            return;
+
+#if USBD_CDC_NCM_FLUSH_TIMEOUT > 0
+        if (!tx.full && (tx.frames < USBD_CDC_NCM_FLUSH_TIMEOUT))
+            return;
+#endif
+
+        if (!tx_finalize())
+            return;
+        tx.frames = 0;
+    }
+
+    uint16_t l = tx.remaining < USBD_CDC_NCM_DATA_SIZE ? tx.remaining : USBD_CDC_NCM_DATA_SIZE;
+    tx.busy = usbd_in(USBD_CDC_NCM_DATA_EPT, tx.ptr, l);
+    if (!tx.busy)
+        return;
+
+    tx.ptr += l;
+    tx.remaining -= l;
+}
+
+static void
+rx_parse(void)
+{
+    const usb_cdc_ncm_nth16_t *nth = (const usb_cdc_ncm_nth16_t*) rx.buf;
+
+    if ((rx.len < sizeof(usb_cdc_ncm_nth16_t)) ||
+        (nth->dwSignature != USB_CDC_NCM_NTH16_SIGNATURE) ||
+        (nth->wHeaderLength != sizeof(usb_cdc_ncm_nth16_t)) ||
+        (nth->wBlockLength > rx.len))
+        return;
+
+    uint16_t block_len = nth->wBlockLength != 0 ? nth->wBlockLength : rx.len;
+    uint16_t ndp_idx = nth->wNdpIndex;
+
+    // each ndp16 takes at least 16 bytes, this bounds malformed chains
+    for (uint16_t n = 0; (ndp_idx != 0) && (n < block_len / NDP16_SIZE(1)); n++) {
+        if ((ndp_idx & 3) || ((ndp_idx + NDP16_SIZE(1)) > block_len))
+            return;
+
+        const usb_cdc_ncm_ndp16_t *ndp = (const usb_cdc_ncm_ndp16_t*) (rx.buf + ndp_idx);
+        if ((ndp->dwSignature != USB_CDC_NCM_NDP16_SIGNATURE) ||
+            (ndp->wLength < NDP16_SIZE(1)) || ((ndp_idx + ndp->wLength) > block_len))
+            return;
+
+        uint16_t entries = (ndp->wLength - sizeof(usb_cdc_ncm_ndp16_t)) / sizeof(usb_cdc_ncm_dpe16_t);
+        for (uint16_t i = 0; i < entries; i++) {
+            uint16_t idx = ndp->datagrams[i].wDatagramIndex;
+            uint16_t len = ndp->datagrams[i].wDatagramLength;
+            if (idx == 0 || len == 0)
+                break;
+
+            if (((uint32_t) idx + len) <= block_len && usbd_cdc_ncm_recv_cb)
+                usbd_cdc_ncm_recv_cb(rx.buf + idx, len);
+        }
+
+        ndp_idx = ndp->wNextNdpIndex;
+    }
+}
+
+static void
+rx_task(void)
+{
+    // the buffer size is a multiple of the endpoint size, a packet always fits
+    uint16_t l = usbd_out(USBD_CDC_NCM_DATA_EPT, rx.buf + rx.len, USBD_CDC_NCM_DATA_SIZE);
+    rx.len += l;
+
+    // the block ends with a short packet, or when the length announced by the header
+    // is reached. the host skips the zero length packet for blocks of maximum size.
+    const usb_cdc_ncm_nth16_t *nth = (const usb_cdc_ncm_nth16_t*) rx.buf;
+    bool done = (l < USBD_CDC_NCM_DATA_SIZE) || (rx.len == USBD_CDC_NCM_NTB_OUT_SIZE) ||
+        ((rx.len >= sizeof(usb_cdc_ncm_nth16_t)) &&
+         (nth->dwSignature == USB_CDC_NCM_NTH16_SIGNATURE) &&
+         (nth->wBlockLength != 0) && (rx.len >= nth->wBlockLength));
+
+    if (!done)
+        return;
+
+    if (active)
+        rx_parse();
+    rx.len = 0;
+}
+
+static void
+notif_task(void)
+{
+    if (notif.busy)
+        return;
+
+    if (notif.pending & NOTIF_SPEED) {
+        struct __attribute__((packed)) {
+            usb_cdc_notification_t hdr;
+            uint32_t DLBitRate;
+            uint32_t ULBitRate;
+        } n = {
+            .hdr = {
+                .bmRequestType     = USB_REQ_DIR_DEVICE_TO_HOST | USB_REQ_TYPE_CLASS | USB_REQ_RCPT_INTERFACE,
+                .bNotificationCode = USB_CDC_NOTIF_CONNECTION_SPEED_CHANGE,
+                .wValue            = 0,
+                .wIndex            = USBD_CDC_NCM_ITF,
+                .wLength           = 2 * sizeof(uint32_t),
+            },
+            .DLBitRate = 12000000,
+            .ULBitRate = 12000000,
+        };
+
+        notif.pending &= ~NOTIF_SPEED;
+        notif.busy = usbd_in(USBD_CDC_NCM_NOTIF_EPT, &n, sizeof(n));
+        if (!notif.busy)
+            notif.pending |= NOTIF_SPEED;
+        return;
+    }
+
+    if (notif.pending & NOTIF_CONNECTION) {
+        usb_cdc_notification_t n = {
+            .bmRequestType     = USB_REQ_DIR_DEVICE_TO_HOST | USB_REQ_TYPE_CLASS | USB_REQ_RCPT_INTERFACE,
+            .bNotificationCode = USB_CDC_NOTIF_NETWORK_CONNECTION,
+            .wValue            = notif.connected ? 1 : 0,
+            .wIndex            = USBD_CDC_NCM_ITF,
+            .wLength           = 0,
+        };
+
+        notif.pending &= ~NOTIF_CONNECTION;
+        notif.busy = usbd_in(USBD_CDC_NCM_NOTIF_EPT, &n, sizeof(n));
+        if (!notif.busy)
+            notif.pending |= NOTIF_CONNECTION;
+    }
+}
+
+
+static void
+reset_data(void)
+{
+    tx.len[0] = tx.len[1] = 0;
+    tx.count[0] = tx.count[1] = 0;
+    tx.fill = 0;
+    tx.lock = false;
+    tx.full = tx.busy = tx.zlp = false;
+    tx.remaining = 0;
+    tx.frames = 0;
+    rx.len = 0;
+}
+
+static bool
+set_ntb_input_size(usb_ctrl_request_t *req, uint16_t len)
+{
+    (void) req;
+    if ((ntb_input_size_req.dwNtbInMaxSize > USBD_CDC_NCM_NTB_IN_SIZE) ||
+        (ntb_input_size_req.dwNtbInMaxSize < NTB_IN_MIN_SIZE))
+        return false;
+
+    ntb_input_size = ntb_input_size_req.dwNtbInMaxSize;
+    ntb_input_datagrams = USBD_CDC_NCM_MAX_DATAGRAMS;
+    if ((len == sizeof(ntb_input_size_req)) && (ntb_input_size_req.wNtbInMaxDatagrams != 0) &&
+        (ntb_input_size_req.wNtbInMaxDatagrams < USBD_CDC_NCM_MAX_DATAGRAMS))
+        ntb_input_datagrams = ntb_input_size_req.wNtbInMaxDatagrams;
+    return true;
+}
+
+static bool
+set_max_datagram_size(usb_ctrl_request_t *req, uint16_t len)
+{
+    (void) req;
+    if ((len != sizeof(max_datagram_size_req)) || (max_datagram_size_req > USBD_CDC_NCM_MAX_DATAGRAM_SIZE))
+        return false;
+
+    max_datagram_size = max_datagram_size_req;
+    return true;
+}
+
+bool
+usbd_cdc_ncm_handle_ctrl_request(usb_ctrl_request_t *req)
+{
+    if (((req->bmRequestType & USB_REQ_RCPT_MASK) != USB_REQ_RCPT_INTERFACE) ||
+        (req->wIndex != USBD_CDC_NCM_ITF))
+        return false;
+
+    switch (req->bRequest) {
+    case USB_REQ_CDC_NCM_GET_NTB_PARAMETERS:
+        usbd_control_in(&ntb_parameters, sizeof(ntb_parameters), req->wLength);
+        return true;
+
+    case USB_REQ_CDC_NCM_GET_NTB_FORMAT:
+        {
+            static const uint16_t format = 0;
+            usbd_control_in(&format, sizeof(format), req->wLength);
+            return true;
+        }
+
+    case USB_REQ_CDC_NCM_SET_NTB_FORMAT:
+        return req->wValue == 0;
+
+    case USB_REQ_CDC_NCM_GET_NTB_INPUT_SIZE:
+        ntb_input_size_req.dwNtbInMaxSize = ntb_input_size;
+        ntb_input_size_req.wNtbInMaxDatagrams = ntb_input_datagrams;
+        ntb_input_size_req.wReserved = 0;
+        usbd_control_in(&ntb_input_size_req, sizeof(ntb_input_size_req), req->wLength);
+        return true;
+
+    case USB_REQ_CDC_NCM_SET_NTB_INPUT_SIZE:
+        if ((req->wLength != sizeof(uint32_t)) && (req->wLength != sizeof(ntb_input_size_req)))
+            return false;
+        usbd_control_out(&ntb_input_size_req, sizeof(ntb_input_size_req), req->wLength, set_ntb_input_size);
+        return true;
+
+    case USB_REQ_CDC_NCM_GET_MAX_DATAGRAM_SIZE:
+        usbd_control_in(&max_datagram_size, sizeof(max_datagram_size), req->wLength);
+        return true;
+
+    case USB_REQ_CDC_NCM_SET_MAX_DATAGRAM_SIZE:
+        usbd_control_out(&max_datagram_size_req, sizeof(max_datagram_size_req), req->wLength, set_max_datagram_size);
+        return true;
+
+    case USB_REQ_CDC_SET_ETHERNET_PACKET_FILTER:
+        packet_filter = req->wValue;
+        return true;
+    }
+
+    return false;
+}
+
+void
+usbd_cdc_ncm_handle_set_interface(uint8_t itf, uint8_t alt)
+{
+    if (itf != USBD_CDC_NCM_DATA_ITF)
+        return;
+
+    // selecting any alternate setting resets the data interface, and whatever was
+    // in flight is gone.
+    active = false;
+    reset_data();
+    tx.sequence = 0;
+
+    if (alt == 1) {
+        notif.pending |= NOTIF_SPEED | NOTIF_CONNECTION;
+        active = true;
+    }
+}
+
+void
+usbd_cdc_ncm_handle_in(uint8_t ept)
+{
+    if (ept == USBD_CDC_NCM_NOTIF_EPT) {
+        notif.busy = false;
+        notif_task();
+    }
+    else if (ept == USBD_CDC_NCM_DATA_EPT) {
+        tx.busy = false;
+        tx_task();
+    }
+}
+
+void
+usbd_cdc_ncm_handle_out(uint8_t ept)
+{
+    if (ept == USBD_CDC_NCM_DATA_EPT)
+        rx_task();
+}
+
+void
+usbd_cdc_ncm_handle_sof(void)
+{
+    // counts the frames since the last transfer block, while datagrams are waiting
+    if (tx.count[tx.fill] == 0)
+        tx.frames = 0;
+    else if (tx.frames < UINT8_MAX)
+        tx.frames++;
+
+    tx_task();
+    notif_task();
+}
+
+void
+usbd_cdc_ncm_handle_reset(void)
+{
+    active = false;
+    reset_data();
+    tx.sequence = 0;
+    notif.pending = 0;
+    notif.busy = false;
+    ntb_input_size = USBD_CDC_NCM_NTB_IN_SIZE;
+    ntb_input_datagrams = USBD_CDC_NCM_MAX_DATAGRAMS;
+    max_datagram_size = USBD_CDC_NCM_MAX_DATAGRAM_SIZE;
+    packet_filter = 0;
+}
@@ -0,0 +1,351 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <usbd.h>
+#include <usbd-dfu.h>
+
+#ifndef USBD_DFU_ITF
+#define USBD_DFU_ITF 0
+#endif
+#ifndef USBD_DFU_RUNTIME
+#define USBD_DFU_RUNTIME 0
+#endif
+#ifndef USBD_DFU_TRANSFER_SIZE
+#define USBD_DFU_TRANSFER_SIZE 1024
+#endif
+#ifndef USBD_DFU_POLL_TIMEOUT
+#define USBD_DFU_POLL_TIMEOUT 10
+#endif
+#ifndef USBD_DFU_MANIFESTATION_TOLERANT
+#define USBD_DFU_MANIFESTATION_TOLERANT 1
+#endif
+
+#if USBD_DFU_RUNTIME
+static uint8_t state = USB_DFU_STATE_APP_IDLE;
+#else
+static uint8_t state = USB_DFU_STATE_DFU_IDLE;
+#endif
+
+static usb_dfu_status_t status;
+
+#if !USBD_DFU_RUNTIME
+// block buffers are filled by the usb interrupt (wr) and programmed by the main loop
+// task (rd). the task owns everything it writes to, and the interrupt asks it to drop
+// the pending blocks with reset_req.
+static struct {
+    uint8_t data[USBD_DFU_TRANSFER_SIZE];
+    uint16_t block;
+    uint16_t len;
+    uint32_t estimate;
+    volatile bool full;
+} bufs[2];
+
+static uint8_t wr = 0;
+static volatile uint8_t rd = 0;
+
+static volatile bool reset_req = false;
+static volatile bool manifest_req = false;
+static volatile bool manifest_done = false;
+static volatile bool programming = false;
+static volatile uint8_t prog_status = USB_DFU_STATUS_OK;
+
+static volatile uint16_t frames = 0;
+static volatile uint16_t prog_start = 0;
+static volatile uint32_t last_duration = USBD_DFU_POLL_TIMEOUT;
+
+static uint8_t status_code = USB_DFU_STATUS_OK;
+#endif
+
+
+uint8_t
+usbd_dfu_get_state(void)
+{
+    return state;
+}
+
+void
+usbd_dfu_task(void)
+{
+#if !USBD_DFU_RUNTIME
+    if (reset_req) {
+        // no blocks are accepted until this is done, wr is stable
+        bufs[0].full = false;
+        bufs[1].full = false;
+        rd = wr;
+        manifest_done = false;
+        reset_req = false;
+        return;
+    }
+
+    uint8_t i = rd;
+    if (bufs[i].full) {
+        prog_start = frames;
+        programming = true;
+
+        uint8_t st = USB_DFU_STATUS_ERR_TARGET;
+        if (usbd_dfu_download_cb)
+            st = usbd_dfu_download_cb(bufs[i].block, bufs[i].data, bufs[i].len);
+
+        uint16_t d = frames - prog_start;
+        last_duration = d > 0 ? d : 1;
+        programming = false;
+
+        if (st != USB_DFU_STATUS_OK && prog_status == USB_DFU_STATUS_OK)
+            prog_status = st;
+
+        bufs[i].full = false;
+        rd = i ^ 1;
+        return;
+    }
+
+    if (manifest_req && !manifest_done) {
+        uint8_t st = usbd_dfu_manifest_cb ? usbd_dfu_manifest_cb() : USB_DFU_STATUS_OK;
+        if (st != USB_DFU_STATUS_OK && prog_status == USB_DFU_STATUS_OK)
+            prog_status = st;
+        manifest_done = true;
+    }
+#endif
+}
+
+
+#if !USBD_DFU_RUNTIME
+static uint32_t
+poll_timeout(bool all)
+{
+    // time left to program the oldest block, that frees one of the buffers, or all
+    // the pending blocks
+    uint32_t rv = 0;
+    uint8_t i = rd;
+
+    for (uint8_t j = 0; j < 2; j++, i ^= 1) {
+        if (!bufs[i].full)
+            break;
+
+        uint32_t est = bufs[i].estimate;
+        if (j == 0 && programming) {
+            uint16_t elapsed = frames - prog_start;
+            est = est > elapsed ? est - elapsed : 1;
+        }
+        rv += est;
+
+        if (!all)
+            break;
+    }
+    return rv;
+}
+
+static bool
+error(uint8_t code)
+{
+    state = USB_DFU_STATE_DFU_ERROR;
+    status_code = code;
+    return false;
+}
+
+static bool
+dnload_done(usb_ctrl_request_t *req, uint16_t len)
+{
+    if (len != req->wLength)
+        return error(USB_DFU_STATUS_ERR_STALLEDPKT);
+
+    bufs[wr].block = req->wValue;
+    bufs[wr].len = len;
+    bufs[wr].estimate = usbd_dfu_get_poll_timeout_cb ?
+        usbd_dfu_get_poll_timeout_cb(req->wValue, len) : last_duration;
+    bufs[wr].full = true;
+    wr ^= 1;
+    state = USB_DFU_STATE_DFU_DNLOAD_SYNC;
+    return true;
+}
+
+static bool
+dnload(usb_ctrl_request_t *req)
+{
+    if (req->wLength == 0) {
+        if (state != USB_DFU_STATE_DFU_DNLOAD_IDLE)
+            return error(USB_DFU_STATUS_ERR_STALLEDPKT);
+
+        manifest_req = true;
+        state = USB_DFU_STATE_DFU_MANIFEST_SYNC;
+        return true;
+    }
+
+    if ((state != USB_DFU_STATE_DFU_IDLE && state != USB_DFU_STATE_DFU_DNLOAD_IDLE) ||
+        req->wLength > USBD_DFU_TRANSFER_SIZE || bufs[wr].full || reset_req)
+        return error(USB_DFU_STATUS_ERR_STALLEDPKT);
+
+    usbd_control_out(bufs[wr].data, USBD_DFU_TRANSFER_SIZE, req->wLength, dnload_done);
+    return true;
+}
+
+static bool
+upload(usb_ctrl_request_t *req)
+{
+    if ((state != USB_DFU_STATE_DFU_IDLE && state != USB_DFU_STATE_DFU_UPLOAD_IDLE) ||
+        bufs[wr].full || !usbd_dfu_upload_cb)
+        return error(USB_DFU_STATUS_ERR_STALLEDPKT);
+
+    uint16_t l = req->wLength < USBD_DFU_TRANSFER_SIZE ? req->wLength : USBD_DFU_TRANSFER_SIZE;
+    uint16_t len = usbd_dfu_upload_cb(req->wValue, bufs[wr].data, l);
+    if (len > l)
+        len = l;
+
+    state = len < req->wLength ? USB_DFU_STATE_DFU_IDLE : USB_DFU_STATE_DFU_UPLOAD_IDLE;
+    usbd_control_in(bufs[wr].data, len, req->wLength);
+    return true;
+}
+
+static void
+get_status(void)
+{
+    uint8_t bstate = state;
+    uint32_t poll = 0;
+
+    if (prog_status != USB_DFU_STATUS_OK && state != USB_DFU_STATE_DFU_ERROR) {
+        state = USB_DFU_STATE_DFU_ERROR;
+        status_code = prog_status;
+        bstate = state;
+    }
+
+    switch (state) {
+    case USB_DFU_STATE_DFU_DNLOAD_SYNC:
+        // the next block can be received while the previous one is programmed
+        if (!bufs[wr].full) {
+            state = USB_DFU_STATE_DFU_DNLOAD_IDLE;
+            bstate = state;
+            break;
+        }
+        bstate = USB_DFU_STATE_DFU_DNBUSY;
+        poll = poll_timeout(false);
+        break;
+
+    case USB_DFU_STATE_DFU_MANIFEST_SYNC:
+    case USB_DFU_STATE_DFU_MANIFEST:
+        bstate = USB_DFU_STATE_DFU_MANIFEST;
+        if (!manifest_done) {
+            state = USB_DFU_STATE_DFU_MANIFEST;
+            poll = poll_timeout(true) + USBD_DFU_POLL_TIMEOUT;
+            break;
+        }
+#if USBD_DFU_MANIFESTATION_TOLERANT
+        state = USB_DFU_STATE_DFU_IDLE;
+        bstate = state;
+        manifest_req = false;
+        reset_req = true;
+#else
+        state = USB_DFU_STATE_DFU_MANIFEST_WAIT_RESET;
+#endif
+        break;
+    }
+
+    status.bStatus = status_code;
+    status.bwPollTimeout[0] = poll;
+    status.bwPollTimeout[1] = poll >> 8;
+    status.bwPollTimeout[2] = poll >> 16;
+    status.bState = bstate;
+}
+#endif
+
+bool
+usbd_dfu_handle_ctrl_request(usb_ctrl_request_t *req)
+{
+    if (((req->bmRequestType & USB_REQ_RCPT_MASK) != USB_REQ_RCPT_INTERFACE) ||
+        (req->wIndex != USBD_DFU_ITF))
+        return false;
+
+#if USBD_DFU_RUNTIME
+    switch (req->bRequest) {
+    case USB_REQ_DFU_DETACH:
+        state = USB_DFU_STATE_APP_DETACH;
+        if (usbd_dfu_detach_cb)
+            usbd_dfu_detach_cb(req->wValue);
+        return true;
+
+    case USB_REQ_DFU_GETSTATUS:
+        memset(&status, 0, sizeof(status));
+        status.bState = state;
+        usbd_control_in(&status, sizeof(status), req->wLength);
+        return true;
+
+    case USB_REQ_DFU_GETSTATE:
+        usbd_control_in(&state, sizeof(state), req->wLength);
+        return true;
+    }
+
+    return false;
+#else
+    switch (req->bRequest) {
+    case USB_REQ_DFU_DNLOAD:
+        return dnload(req);
+
+    case USB_REQ_DFU_UPLOAD:
+        return upload(req);
+
+    case USB_REQ_DFU_GETSTATUS:
+        get_status();
+        usbd_control_in(&status, sizeof(status), req->wLength);
+        return true;
+
+    case USB_REQ_DFU_CLRSTATUS:
+        if (state != USB_DFU_STATE_DFU_ERROR)
+            return error(USB_DFU_STATUS_ERR_STALLEDPKT);
+
+        state = USB_DFU_STATE_DFU_IDLE;
+        status_code = USB_DFU_STATUS_OK;
+        prog_status = USB_DFU_STATUS_OK;
+        manifest_req = false;
+        reset_req = true;
+        return true;
+
+    case USB_REQ_DFU_GETSTATE:
+        usbd_control_in(&state, sizeof(state), req->wLength);
+        return true;
+
+    case USB_REQ_DFU_ABORT:
+        switch (state) {
+        case USB_DFU_STATE_DFU_IDLE:
+        case USB_DFU_STATE_DFU_DNLOAD_SYNC:
+        case USB_DFU_STATE_DFU_DNLOAD_IDLE:
+        case USB_DFU_STATE_DFU_MANIFEST_SYNC:
+        case USB_DFU_STATE_DFU_UPLOAD_IDLE:
+            // the block being programmed, if any, is still completed by the task
+            state = USB_DFU_STATE_DFU_IDLE;
+            manifest_req = false;
+            reset_req = true;
+            return true;
+        }
+        return error(USB_DFU_STATUS_ERR_STALLEDPKT);
+    }
+
+    return error(USB_DFU_STATUS_ERR_STALLEDPKT);
+#endif
+}
+
+void
+usbd_dfu_handle_sof(void)
+{
+#if !USBD_DFU_RUNTIME
+    frames++;
+#endif
+}
+
+void
+usbd_dfu_handle_reset(void)
+{
+#if USBD_DFU_RUNTIME
+    state = USB_DFU_STATE_APP_IDLE;
+#else
+    state = USB_DFU_STATE_DFU_IDLE;
+    status_code = USB_DFU_STATUS_OK;
+    prog_status = USB_DFU_STATUS_OK;
+    manifest_req = false;
+    reset_req = true;
+#endif
+}
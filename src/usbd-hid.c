@@ -0,0 +1,291 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <usbd.h>
+#include <usbd-hid.h>
+
+#ifndef USBD_HID_ITF
+#define USBD_HID_ITF 0
+#endif
+#ifndef USBD_HID_EPT
+#define USBD_HID_EPT 1
+#endif
+#ifndef USBD_HID_OUT_EPT
+#define USBD_HID_OUT_EPT 0
+#endif
+#ifndef USBD_HID_EPT_SIZE
+#define USBD_HID_EPT_SIZE 64
+#endif
+#ifndef USBD_HID_REPORT_IDS
+#define USBD_HID_REPORT_IDS 0
+#endif
+#ifndef USBD_HID_REPORT_SIZE
+#define USBD_HID_REPORT_SIZE (USBD_HID_EPT_SIZE - (USBD_HID_REPORT_IDS > 0 ? 1 : 0))
+#endif
+#ifndef USBD_HID_DEFAULT_IDLE
+#define USBD_HID_DEFAULT_IDLE 0
+#endif
+
+#if USBD_HID_REPORT_IDS > 0
+#define ID_SIZE   1
+#define NUM_SLOTS USBD_HID_REPORT_IDS
+#else
+#define ID_SIZE   0
+#define NUM_SLOTS 1
+#endif
+
+#if (USBD_HID_REPORT_SIZE + ID_SIZE) > USBD_HID_EPT_SIZE
+#error "HID reports must fit a single interrupt packet"
+#endif
+
+#if USBD_HID_REPORT_IDS > 255
+#error "HID report IDs are limited to 255"
+#endif
+
+// slots hold the last value of each input report, already prefixed with the report ID,
+// so that they can be copied to the packet memory as is.
+static struct {
+    uint8_t buf[ID_SIZE + USBD_HID_REPORT_SIZE];
+    uint16_t len;
+    volatile bool dirty;
+    uint8_t idle;
+    uint16_t frames;
+} slots[NUM_SLOTS];
+
+static volatile bool lock = false;
+static bool busy = false;
+static uint8_t next = 0;
+static uint8_t protocol = USB_HID_PROTOCOL_REPORT;
+
+static uint8_t ctrl_buf[1 + USBD_HID_REPORT_SIZE];
+
+
+static int16_t
+slot_index(uint8_t id)
+{
+#if USBD_HID_REPORT_IDS > 0
+    if (id == 0 || id > USBD_HID_REPORT_IDS)
+        return -1;
+    return id - 1;
+#else
+    return id == 0 ? 0 : -1;
+#endif
+}
+
+bool
+usbd_hid_report(uint8_t id, const void *buf, uint16_t len)
+{
+    int16_t idx = slot_index(id);
+    if (idx < 0 || len > USBD_HID_REPORT_SIZE || lock)
+        return false;
+
+    lock = true;
+    if (ID_SIZE)
+        slots[idx].buf[0] = id;
+    memcpy(slots[idx].buf + ID_SIZE, buf, len);
+    slots[idx].len = ID_SIZE + len;
+    slots[idx].dirty = true;
+    lock = false;
+    return true;
+}
+
+bool
+usbd_hid_idle(void)
+{
+    if (busy)
+        return false;
+
+    for (uint8_t i = 0; i < NUM_SLOTS; i++)
+        if (slots[i].dirty)
+            return false;
+    return true;
+}
+
+uint8_t
+usbd_hid_get_protocol(void)
+{
+    return protocol;
+}
+
+
+static void
+in_task(void)
+{
+    // the producer may be writing to a slot right now, try again at the next frame
+    if (busy || lock)
+        return;
+
+    for (uint8_t i = 0; i < NUM_SLOTS; i++) {
+        uint8_t s = (next + i) % NUM_SLOTS;
+        if (!slots[s].dirty)
+            continue;
+
+        busy = usbd_in(USBD_HID_EPT, slots[s].buf, slots[s].len);
+        if (busy) {
+            slots[s].dirty = false;
+            slots[s].frames = 0;
+            next = (s + 1) % NUM_SLOTS;
+        }
+        return;
+    }
+}
+
+
+static bool
+set_report(usb_ctrl_request_t *req, uint16_t len)
+{
+    uint8_t id = req->wValue;
+    uint8_t off = id != 0 ? 1 : 0;
+    if (len < off || (off && ctrl_buf[0] != id) || !usbd_hid_set_report_cb)
+        return false;
+
+    return usbd_hid_set_report_cb(req->wValue >> 8, id, ctrl_buf + off, len - off);
+}
+
+static bool
+get_report(usb_ctrl_request_t *req)
+{
+    uint8_t type = req->wValue >> 8;
+    uint8_t id = req->wValue;
+
+    if (type == USB_HID_REPORT_TYPE_INPUT) {
+        int16_t idx = slot_index(id);
+        if (idx < 0 || slots[idx].len == 0)
+            return false;
+
+        usbd_control_in(slots[idx].buf, slots[idx].len, req->wLength);
+        return true;
+    }
+
+    if (!usbd_hid_get_report_cb)
+        return false;
+
+    uint8_t off = id != 0 ? 1 : 0;
+    uint16_t len = usbd_hid_get_report_cb(type, id, ctrl_buf + off, sizeof(ctrl_buf) - off);
+    if (len == 0)
+        return false;
+
+    ctrl_buf[0] = id;
+    usbd_control_in(ctrl_buf, len + off, req->wLength);
+    return true;
+}
+
+bool
+usbd_hid_handle_ctrl_request(usb_ctrl_request_t *req)
+{
+    if (((req->bmRequestType & USB_REQ_RCPT_MASK) != USB_REQ_RCPT_INTERFACE) ||
+        (req->wIndex != USBD_HID_ITF))
+        return false;
+
+    switch (req->bRequest) {
+    case USB_REQ_HID_GET_REPORT:
+        return get_report(req);
+
+    case USB_REQ_HID_SET_REPORT:
+        usbd_control_out(ctrl_buf, sizeof(ctrl_buf), req->wLength, set_report);
+        return true;
+
+    case USB_REQ_HID_GET_IDLE:
+        {
+            int16_t idx = slot_index(req->wValue);
+            if (idx < 0)
+                idx = 0;
+            usbd_control_in(&slots[idx].idle, sizeof(uint8_t), req->wLength);
+            return true;
+        }
+
+    case USB_REQ_HID_SET_IDLE:
+        {
+            // report ID 0 applies the idle rate to all the reports
+            uint8_t id = req->wValue;
+            int16_t idx = slot_index(id);
+            if (id != 0 && idx < 0)
+                return false;
+
+            for (uint8_t i = 0; i < NUM_SLOTS; i++)
+                if (id == 0 || i == idx)
+                    slots[i].idle = req->wValue >> 8;
+            return true;
+        }
+
+    case USB_REQ_HID_GET_PROTOCOL:
+        usbd_control_in(&protocol, sizeof(protocol), req->wLength);
+        return true;
+
+    case USB_REQ_HID_SET_PROTOCOL:
+        if (req->wValue > USB_HID_PROTOCOL_REPORT)
+            return false;
+
+        protocol = req->wValue;
+        if (usbd_hid_set_protocol_cb)
+            usbd_hid_set_protocol_cb(protocol);
+        return true;
+    }
+
+    return false;
+}
+
+void
+usbd_hid_handle_in(uint8_t ept)
+{
+    // the next report is loaded right away, to be sent at the next poll
+    if (ept == USBD_HID_EPT) {
+        busy = false;
+        in_task();
+    }
+}
+
+void
+usbd_hid_handle_out(uint8_t ept)
+{
+#if USBD_HID_OUT_EPT > 0
+    if (ept != USBD_HID_OUT_EPT)
+        return;
+
+    uint8_t buf[USBD_HID_EPT_SIZE];
+    uint16_t len = usbd_out(ept, buf, sizeof(buf));
+    if (len < ID_SIZE || !usbd_hid_set_report_cb)
+        return;
+
+    usbd_hid_set_report_cb(USB_HID_REPORT_TYPE_OUTPUT, ID_SIZE ? buf[0] : 0, buf + ID_SIZE, len - ID_SIZE);
+#else
+    (void) ept;
+#endif
+}
+
+void
+usbd_hid_handle_sof(void)
+{
+    // idle rates are in 4ms units, and the last value of the report is sent again when
+    // the host doesn't get a new one for that long.
+    for (uint8_t i = 0; i < NUM_SLOTS; i++) {
+        if (slots[i].idle == 0 || slots[i].len == 0 || slots[i].dirty)
+            continue;
+
+        if (++slots[i].frames >= ((uint16_t) slots[i].idle) * 4)
+            slots[i].dirty = true;
+    }
+
+    in_task();
+}
+
+void
+usbd_hid_handle_reset(void)
+{
+    for (uint8_t i = 0; i < NUM_SLOTS; i++) {
+        slots[i].len = 0;
+        slots[i].dirty = false;
+        slots[i].idle = USBD_HID_DEFAULT_IDLE;
+        slots[i].frames = 0;
+    }
+    busy = false;
+    next = 0;
+    protocol = USB_HID_PROTOCOL_REPORT;
+}
@@ -0,0 +1,181 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdbool.h>
+
+#include <usbd.h>
+#include <usbd-ept.h>
+#include <usbd-log.h>
+
+#ifndef USBD_LOG_EPT
+#define USBD_LOG_EPT 1
+#endif
+#ifndef USBD_LOG_EPT_SIZE
+#define USBD_LOG_EPT_SIZE 64
+#endif
+#ifndef USBD_LOG_BUFFER_WORDS
+#define USBD_LOG_BUFFER_WORDS 256
+#endif
+#ifndef USBD_LOG_FLUSH_FRAMES
+#define USBD_LOG_FLUSH_FRAMES 10
+#endif
+
+#if (USBD_LOG_EPT_SIZE % 4) != 0
+#error "Log endpoint size must be a multiple of 4"
+#endif
+
+#if (USBD_LOG_BUFFER_WORDS & (USBD_LOG_BUFFER_WORDS - 1)) != 0
+#error "Log buffer words must be a power of 2"
+#endif
+
+#if USBD_LOG_BUFFER_WORDS < (USBD_LOG_EPT_SIZE / 4)
+#error "Log buffer must fit at least one packet"
+#endif
+
+#define PACKET_WORDS (USBD_LOG_EPT_SIZE / 4)
+#define MASK         (USBD_LOG_BUFFER_WORDS - 1)
+
+// records are reserved by moving head, and committed by writing their header word,
+// that is never zero, last. the usb interrupt owns tail, and clears the words it sent
+// before moving tail.
+static uint32_t ring[USBD_LOG_BUFFER_WORDS];
+static volatile uint32_t head = 0;
+static volatile uint32_t tail = 0;
+static volatile uint32_t dropped = 0;
+
+static uint32_t scan = 0;
+static uint16_t sent = 0;
+static uint16_t age = 0;
+static bool busy = false;
+
+
+static bool
+reserve(uint32_t n, uint32_t *idx)
+{
+#ifdef __ARM_ARCH_6M__
+    // cortex-m0 and cortex-m0+ have no exclusive access instructions
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t h = head;
+    bool rv = (h + n - tail) <= USBD_LOG_BUFFER_WORDS;
+    if (rv)
+        head = h + n;
+    else
+        dropped++;
+    __set_PRIMASK(primask);
+    *idx = h;
+    return rv;
+#else
+    uint32_t h = head;
+    do {
+        if ((h + n - tail) > USBD_LOG_BUFFER_WORDS) {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&head, &h, h + n, true, __ATOMIC_RELAXED,
+        __ATOMIC_RELAXED));
+    *idx = h;
+    return true;
+#endif
+}
+
+bool
+usbd_log_write(const char *fmt, const uint32_t *args, uint8_t nargs)
+{
+    if (nargs > USBD_LOG_MAX_ARGS)
+        return false;
+
+    uint32_t idx;
+    if (!reserve(nargs + 1, &idx))
+        return false;
+
+    for (uint8_t i = 0; i < nargs; i++)
+        ring[(idx + 1 + i) & MASK] = args[i];
+
+    __atomic_store_n(&ring[idx & MASK], ((uint32_t) nargs << 28) | ((uint32_t) fmt & 0x0fffffff),
+        __ATOMIC_RELEASE);
+    return true;
+}
+
+uint32_t
+usbd_log_get_dropped(void)
+{
+    return dropped;
+}
+
+
+static void
+in_task(void)
+{
+    if (busy)
+        return;
+
+    // find the committed records
+    uint32_t h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    while (scan != h) {
+        uint32_t hdr = __atomic_load_n(&ring[scan & MASK], __ATOMIC_ACQUIRE);
+        if (hdr == 0)
+            break;
+        scan += 1 + (hdr >> 28);
+    }
+
+    uint32_t n = scan - tail;
+    if (n == 0) {
+        age = 0;
+        return;
+    }
+    if (n < PACKET_WORDS && age < USBD_LOG_FLUSH_FRAMES)
+        return;
+    if (n > PACKET_WORDS)
+        n = PACKET_WORDS;
+
+    // packets are sent straight from the ring buffer, in two parts when wrapping
+    uint32_t t = tail & MASK;
+    uint32_t first = USBD_LOG_BUFFER_WORDS - t;
+    if (first > n)
+        first = n;
+    if (!usbd_in_gather(USBD_LOG_EPT, &ring[t], first * 4, ring, (n - first) * 4))
+        return;
+
+    sent = n;
+    age = 0;
+    busy = true;
+}
+
+void
+usbd_log_handle_in(uint8_t ept)
+{
+    if (ept != USBD_LOG_EPT)
+        return;
+
+    // the words of the packet are only freed after the host reads it
+    if (busy) {
+        for (uint16_t i = 0; i < sent; i++)
+            ring[(tail + i) & MASK] = 0;
+        __atomic_store_n(&tail, tail + sent, __ATOMIC_RELEASE);
+        sent = 0;
+        busy = false;
+    }
+    in_task();
+}
+
+void
+usbd_log_handle_sof(void)
+{
+    if (age < USBD_LOG_FLUSH_FRAMES)
+        age++;
+    in_task();
+}
+
+void
+usbd_log_handle_reset(void)
+{
+    // the packet being sent, if any, is sent again after the reset
+    busy = false;
+    sent = 0;
+    age = 0;
+}
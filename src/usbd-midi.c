@@ -0,0 +1,496 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <usbd.h>
+#include <usbd-midi.h>
+
+#ifndef USBD_MIDI_ITF
+#define USBD_MIDI_ITF 1
+#endif
+#ifndef USBD_MIDI_EPT
+#define USBD_MIDI_EPT 1
+#endif
+#ifndef USBD_MIDI_DATA_SIZE
+#define USBD_MIDI_DATA_SIZE 64
+#endif
+#ifndef USBD_MIDI_TX_BUFFER_SIZE
+#define USBD_MIDI_TX_BUFFER_SIZE 256
+#endif
+#ifndef USBD_MIDI_LATENCY
+#define USBD_MIDI_LATENCY 1
+#endif
+#ifndef USBD_MIDI_SYSEX_BUFFER_SIZE
+#define USBD_MIDI_SYSEX_BUFFER_SIZE 64
+#endif
+#ifndef USBD_MIDI_CABLES
+#define USBD_MIDI_CABLES 1
+#endif
+
+#if USBD_MIDI_TX_BUFFER_SIZE & (USBD_MIDI_TX_BUFFER_SIZE - 1)
+#error "USB-MIDI transmit buffer size must be a power of 2"
+#endif
+
+#if (USBD_MIDI_TX_BUFFER_SIZE < USBD_MIDI_DATA_SIZE) || (USBD_MIDI_DATA_SIZE % 4)
+#error "USB-MIDI transmit buffer must fit at least one data packet, of whole event packets"
+#endif
+
+#if (USBD_MIDI_CABLES < 1) || (USBD_MIDI_CABLES > 16)
+#error "USB-MIDI supports 1 to 16 cables"
+#endif
+
+// ring indexes are free running, and only masked when accessing the buffer. event
+// packets never wrap around the end of the buffer.
+static struct {
+    uint8_t buf[USBD_MIDI_TX_BUFFER_SIZE];
+    volatile uint16_t head;
+    volatile uint16_t tail;
+    volatile bool flush;
+    bool busy;
+    uint8_t frames;
+} tx;
+
+static struct {
+    uint8_t buf[USBD_MIDI_SYSEX_BUFFER_SIZE];
+    uint16_t len;
+} sysex[USBD_MIDI_CABLES];
+
+// cable number to embedded jack ID, read from the class-specific endpoint descriptors
+static struct {
+    uint8_t jacks[USBD_MIDI_CABLES];
+    uint8_t cables;
+} routes_in, routes_out;
+
+// alternate setting 0 carries usb-midi 1.0 event packets, alternate setting 1 carries
+// universal midi packets.
+static uint8_t alt = 0;
+
+
+static int8_t
+jack_to_cable(uint8_t jack)
+{
+    // without routes in the descriptors, jack IDs are used as cable numbers
+    if (routes_in.cables == 0)
+        return jack < USBD_MIDI_CABLES ? jack : -1;
+
+    for (uint8_t i = 0; i < routes_in.cables; i++)
+        if (routes_in.jacks[i] == jack)
+            return i;
+    return -1;
+}
+
+static int16_t
+cable_to_jack(uint8_t cable)
+{
+    if (routes_out.cables == 0)
+        return cable < USBD_MIDI_CABLES ? cable : -1;
+
+    return cable < routes_out.cables ? routes_out.jacks[cable] : -1;
+}
+
+static void
+tx_push(uint8_t cable, uint8_t cin, const uint8_t *msg, uint8_t len)
+{
+    uint8_t *p = tx.buf + (tx.head & (USBD_MIDI_TX_BUFFER_SIZE - 1));
+    p[0] = USB_MIDI_EVENT_HEADER(cable, cin);
+    for (uint8_t i = 0; i < 3; i++)
+        p[i + 1] = i < len ? msg[i] : 0;
+    tx.head += 4;
+}
+
+bool
+usbd_midi_send(uint8_t jack, const uint8_t *msg, uint16_t len)
+{
+    int8_t cable = jack_to_cable(jack);
+    if (alt != 0 || cable < 0 || msg == NULL || len == 0 || !(msg[0] & 0x80))
+        return false;
+
+    uint16_t free = USBD_MIDI_TX_BUFFER_SIZE - (uint16_t) (tx.head - tx.tail);
+
+    if (msg[0] == 0xf0) {
+        if (len < 2 || msg[len - 1] != 0xf7 || (((len + 2) / 3) * 4) > free)
+            return false;
+
+        uint16_t i = 0;
+        for (; len - i > 3; i += 3)
+            tx_push(cable, USB_MIDI_CIN_SYSEX_START, msg + i, 3);
+
+        // the remaining 1 to 3 bytes map to code index numbers 5 to 7
+        tx_push(cable, USB_MIDI_CIN_SYSEX_START + len - i, msg + i, len - i);
+        return true;
+    }
+
+    uint8_t cin;
+    uint8_t n;
+
+    if (msg[0] < 0xf0) {
+        cin = msg[0] >> 4;
+        n = (cin == USB_MIDI_CIN_PROGRAM || cin == USB_MIDI_CIN_CHANNEL_PRESS) ? 2 : 3;
+    }
+    else {
+        switch (msg[0]) {
+        case 0xf1:
+        case 0xf3:
+            cin = USB_MIDI_CIN_SYSCOM_2;
+            n = 2;
+            break;
+
+        case 0xf2:
+            cin = USB_MIDI_CIN_SYSCOM_3;
+            n = 3;
+            break;
+
+        case 0xf6:
+            cin = USB_MIDI_CIN_SYSEX_END_1;
+            n = 1;
+            break;
+
+        case 0xf8:
+        case 0xfa:
+        case 0xfb:
+        case 0xfc:
+        case 0xfe:
+        case 0xff:
+            cin = USB_MIDI_CIN_SINGLE_BYTE;
+            n = 1;
+            break;
+
+        default:
+            return false;
+        }
+    }
+
+    if (len != n || free < 4)
+        return false;
+
+    tx_push(cable, cin, msg, n);
+    return true;
+}
+
+bool
+usbd_midi_ump_send(const uint32_t *ump)
+{
+    if (alt != 1 || ump == NULL)
+        return false;
+
+    uint8_t words = USB_MIDI_UMP_WORDS(USB_MIDI_UMP_MT(ump[0]));
+    uint16_t head = tx.head;
+    uint16_t idx = head & (USBD_MIDI_TX_BUFFER_SIZE - 1);
+    uint16_t free = USBD_MIDI_TX_BUFFER_SIZE - (uint16_t) (head - tx.tail);
+
+    // packets never wrap around the end of the buffer, the remaining space is filled
+    // with utility NOOP messages (zeros) instead.
+    uint16_t pad = (idx + words * 4 > USBD_MIDI_TX_BUFFER_SIZE) ? USBD_MIDI_TX_BUFFER_SIZE - idx : 0;
+    if (free < pad + words * 4)
+        return false;
+
+    memset(tx.buf + idx, 0, pad);
+    idx = (idx + pad) & (USBD_MIDI_TX_BUFFER_SIZE - 1);
+
+    // words are sent little endian, as stored by the cpu
+    memcpy(tx.buf + idx, ump, words * 4);
+    tx.head = head + pad + words * 4;
+    return true;
+}
+
+void
+usbd_midi_flush(void)
+{
+    tx.flush = true;
+}
+
+
+static void
+tx_task(void)
+{
+    if (tx.busy)
+        return;
+
+    uint16_t tail = tx.tail;
+    uint16_t pending = tx.head - tail;
+    if (pending == 0)
+        return;
+
+    if ((pending < USBD_MIDI_DATA_SIZE) && !tx.flush && (tx.frames < USBD_MIDI_LATENCY))
+        return;
+
+    // the packet is cut short at the end of the buffer, the host takes event packets
+    // from short bulk packets just fine.
+    uint16_t idx = tail & (USBD_MIDI_TX_BUFFER_SIZE - 1);
+    uint16_t l = pending < USBD_MIDI_DATA_SIZE ? pending : USBD_MIDI_DATA_SIZE;
+    if (idx + l > USBD_MIDI_TX_BUFFER_SIZE)
+        l = USBD_MIDI_TX_BUFFER_SIZE - idx;
+
+    // universal midi packets can't be split between bulk packets
+    if (alt == 1) {
+        uint16_t m = 0;
+        while (m < l) {
+            uint32_t w;
+            memcpy(&w, tx.buf + idx + m, sizeof(w));
+            uint16_t n = USB_MIDI_UMP_WORDS(USB_MIDI_UMP_MT(w)) * 4;
+            if (m + n > l)
+                break;
+            m += n;
+        }
+        l = m;
+    }
+
+    tx.busy = usbd_in(USBD_MIDI_EPT, tx.buf + idx, l);
+    if (!tx.busy)
+        return;
+
+    tx.tail = tail + l;
+    tx.frames = 0;
+    if (tx.head == tx.tail)
+        tx.flush = false;
+}
+
+static void
+rx_sysex(uint8_t cable, uint8_t jack, const uint8_t *buf, uint8_t len, bool end)
+{
+    for (uint8_t i = 0; i < len; i++) {
+        if (sysex[cable].len == USBD_MIDI_SYSEX_BUFFER_SIZE) {
+            if (usbd_midi_sysex_cb)
+                usbd_midi_sysex_cb(jack, sysex[cable].buf, sysex[cable].len, false);
+            sysex[cable].len = 0;
+        }
+        sysex[cable].buf[sysex[cable].len++] = buf[i];
+    }
+
+    if (end) {
+        if (usbd_midi_sysex_cb)
+            usbd_midi_sysex_cb(jack, sysex[cable].buf, sysex[cable].len, true);
+        sysex[cable].len = 0;
+    }
+}
+
+static void
+rx_event(const uint8_t *p)
+{
+    uint8_t cable = p[0] >> 4;
+    int16_t jack = cable_to_jack(cable);
+    if (jack < 0 || cable >= USBD_MIDI_CABLES)
+        return;
+
+    uint8_t n = 0;
+
+    switch (p[0] & 0xf) {
+    case USB_MIDI_CIN_SYSEX_START:
+        rx_sysex(cable, jack, p + 1, 3, false);
+        return;
+
+    case USB_MIDI_CIN_SYSEX_END_1:
+        if (p[1] == 0xf7) {
+            rx_sysex(cable, jack, p + 1, 1, true);
+            return;
+        }
+        n = 1;  // single byte system common
+        break;
+
+    case USB_MIDI_CIN_SYSEX_END_2:
+        rx_sysex(cable, jack, p + 1, 2, true);
+        return;
+
+    case USB_MIDI_CIN_SYSEX_END_3:
+        rx_sysex(cable, jack, p + 1, 3, true);
+        return;
+
+    case USB_MIDI_CIN_SINGLE_BYTE:
+        n = 1;
+        break;
+
+    case USB_MIDI_CIN_SYSCOM_2:
+    case USB_MIDI_CIN_PROGRAM:
+    case USB_MIDI_CIN_CHANNEL_PRESS:
+        n = 2;
+        break;
+
+    case USB_MIDI_CIN_SYSCOM_3:
+    case USB_MIDI_CIN_NOTE_OFF:
+    case USB_MIDI_CIN_NOTE_ON:
+    case USB_MIDI_CIN_POLY_KEYPRESS:
+    case USB_MIDI_CIN_CONTROL:
+    case USB_MIDI_CIN_PITCH_BEND:
+        n = 3;
+        break;
+
+    default:
+        // reserved codes, including empty padding packets
+        return;
+    }
+
+    if (usbd_midi_recv_cb)
+        usbd_midi_recv_cb(jack, p + 1, n);
+}
+
+static void
+rx_ump(const uint8_t *p, uint16_t len)
+{
+    for (uint16_t i = 0; i + 4 <= len;) {
+        // words are copied out of the packet memory one message at a time, to get
+        // aligned 32-bit access.
+        uint32_t ump[4];
+        memcpy(ump, p + i, sizeof(uint32_t));
+
+        uint8_t words = USB_MIDI_UMP_WORDS(USB_MIDI_UMP_MT(ump[0]));
+        if (i + words * 4 > len)
+            return;
+
+        memcpy(ump + 1, p + i + 4, (words - 1) * 4);
+        i += words * 4;
+
+        // utility NOOP messages are padding
+        if (ump[0] != 0 && usbd_midi_ump_recv_cb)
+            usbd_midi_ump_recv_cb(ump, words);
+    }
+}
+
+static void
+rx_task(void)
+{
+    // packets are parsed straight from the packet memory, and the endpoint is only
+    // released for the next packet when done.
+    const uint8_t *p;
+    uint16_t len = usbd_out_peek(USBD_MIDI_EPT, (const void**) &p);
+
+    if (alt == 0) {
+        for (uint16_t i = 0; i + 4 <= len; i += 4)
+            rx_event(p + i);
+    }
+    else
+        rx_ump(p, len);
+
+    usbd_out_release(USBD_MIDI_EPT);
+}
+
+
+static void
+parse_routes(void)
+{
+    routes_in.cables = routes_out.cables = 0;
+
+    const usb_config_descriptor_t *cfg = usbd_get_config_descriptor_cb();
+    if (cfg == NULL)
+        return;
+
+    const uint8_t *p = (const uint8_t*) cfg + cfg->bLength;
+    const uint8_t *end = (const uint8_t*) cfg + cfg->wTotalLength;
+    bool match = false;
+    uint8_t ept = 0;
+
+    // the class-specific endpoint descriptor follows its standard endpoint descriptor,
+    // and lists the embedded jacks of each cable, in order.
+    for (; (p + 2 <= end) && (p[0] != 0); p += p[0]) {
+        switch (p[1]) {
+        case USB_DESCR_TYPE_INTERFACE:
+            {
+                const usb_interface_descriptor_t *d = (const usb_interface_descriptor_t*) p;
+                match = (d->bInterfaceNumber == USBD_MIDI_ITF) && (d->bAlternateSetting == 0);
+                ept = 0;
+                break;
+            }
+
+        case USB_DESCR_TYPE_ENDPOINT:
+            if (match)
+                ept = ((const usb_endpoint_descriptor_t*) p)->bEndpointAddress;
+            break;
+
+        case USB_MIDI_DESCR_TYPE_CS_ENDPOINT:
+            {
+                if (!match || ept == 0 || p[0] < 4 || p[2] != USB_MIDI_DESCR_EPT_SUBTYPE_MS_GENERAL)
+                    break;
+
+                // IN endpoints carry the embedded OUT jacks, and vice versa
+                bool in = ept & USB_DESCR_EPT_ADDR_DIR_IN;
+                uint8_t n = p[3];
+                if (n > USBD_MIDI_CABLES)
+                    n = USBD_MIDI_CABLES;
+                if (4 + n > p[0])
+                    n = p[0] - 4;
+
+                for (uint8_t i = 0; i < n; i++) {
+                    if (in)
+                        routes_in.jacks[i] = p[4 + i];
+                    else
+                        routes_out.jacks[i] = p[4 + i];
+                }
+                if (in)
+                    routes_in.cables = n;
+                else
+                    routes_out.cables = n;
+                break;
+            }
+        }
+    }
+}
+
+bool
+usbd_midi_handle_get_descriptor(usb_ctrl_request_t *req)
+{
+    if (((req->bmRequestType & USB_REQ_RCPT_MASK) != USB_REQ_RCPT_INTERFACE) ||
+        (req->wIndex != USBD_MIDI_ITF) || ((req->wValue >> 8) != USB_MIDI_DESCR_TYPE_CS_GR_TRM_BLOCK) ||
+        ((req->wValue & 0xff) != 1) || !usbd_midi_get_group_terminal_blocks_cb)
+        return false;
+
+    const usb_midi2_group_terminal_block_header_descriptor_t *d = usbd_midi_get_group_terminal_blocks_cb();
+    if (d == NULL)
+        return false;
+
+    usbd_control_in(d, d->wTotalLength, req->wLength);
+    return true;
+}
+
+void
+usbd_midi_handle_set_interface(uint8_t itf, uint8_t a)
+{
+    if (itf != USBD_MIDI_ITF)
+        return;
+
+    alt = a;
+    tx.head = tx.tail = 0;
+    tx.flush = tx.busy = false;
+    tx.frames = 0;
+    for (uint8_t i = 0; i < USBD_MIDI_CABLES; i++)
+        sysex[i].len = 0;
+}
+
+void
+usbd_midi_handle_in(uint8_t ept)
+{
+    if (ept == USBD_MIDI_EPT) {
+        tx.busy = false;
+        tx_task();
+    }
+}
+
+void
+usbd_midi_handle_out(uint8_t ept)
+{
+    if (ept == USBD_MIDI_EPT)
+        rx_task();
+}
+
+void
+usbd_midi_handle_sof(void)
+{
+    // counts the frames since the last packet, while events are waiting to be sent
+    if (tx.head == tx.tail)
+        tx.frames = 0;
+    else if (tx.frames < UINT8_MAX)
+        tx.frames++;
+
+    tx_task();
+}
+
+void
+usbd_midi_handle_reset(void)
+{
+    usbd_midi_handle_set_interface(USBD_MIDI_ITF, 0);
+    parse_routes();
+}
@@ -0,0 +1,623 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <usbd.h>
+#include <usbd-msc.h>
+
+#ifndef USBD_MSC_ITF
+#define USBD_MSC_ITF 0
+#endif
+#ifndef USBD_MSC_EPT
+#define USBD_MSC_EPT 1
+#endif
+#ifndef USBD_MSC_EPT_SIZE
+#define USBD_MSC_EPT_SIZE 64
+#endif
+#ifndef USBD_MSC_BLOCK_SIZE
+#define USBD_MSC_BLOCK_SIZE 512
+#endif
+#ifndef USBD_MSC_BUFFER_BLOCKS
+#define USBD_MSC_BUFFER_BLOCKS 4
+#endif
+#ifndef USBD_MSC_VENDOR
+#define USBD_MSC_VENDOR "usbd-fs"
+#endif
+#ifndef USBD_MSC_PRODUCT
+#define USBD_MSC_PRODUCT "Mass Storage"
+#endif
+#ifndef USBD_MSC_REVISION
+#define USBD_MSC_REVISION "1.0"
+#endif
+
+#if (USBD_MSC_BLOCK_SIZE % USBD_MSC_EPT_SIZE) != 0
+#error "MSC block size must be a multiple of the endpoint size"
+#endif
+
+#if (USBD_MSC_BUFFER_BLOCKS & (USBD_MSC_BUFFER_BLOCKS - 1)) != 0
+#error "MSC buffer blocks must be a power of 2"
+#endif
+
+// media operations are limited to half of the buffers, so that the other half is
+// exchanged with the host meanwhile.
+#if USBD_MSC_BUFFER_BLOCKS > 1
+#define RUN_BLOCKS (USBD_MSC_BUFFER_BLOCKS / 2)
+#else
+#define RUN_BLOCKS 1
+#endif
+
+typedef enum {
+    STATE_CBW = 1,
+    STATE_DATA_IN,
+    STATE_DATA_OUT,
+    STATE_WRITE_WAIT,
+    STATE_CSW,
+    STATE_ERROR,
+} state_t;
+
+typedef enum {
+    OP_NONE = 0,
+    OP_READ,
+    OP_WRITE,
+} op_t;
+
+// block buffers are shared with the main loop task. the side filling the buffers (the
+// task while reading, the usb interrupt while writing) owns head, the other one owns
+// tail.
+static uint8_t blocks[USBD_MSC_BUFFER_BLOCKS][USBD_MSC_BLOCK_SIZE];
+static volatile uint16_t head = 0;
+static volatile uint16_t tail = 0;
+static uint16_t offset = 0;
+
+static volatile struct {
+    op_t op;
+    uint32_t lba;
+    uint32_t blocks;
+    bool error;
+} job;
+
+// incremented by resets, so that the task drops the results of operations that were
+// running while the state was reset.
+static volatile uint8_t gen = 0;
+
+static state_t state = STATE_CBW;
+static bool busy = false;
+static bool stalled = false;
+static bool out_pending = false;
+
+static usb_msc_csw_t csw;
+static uint32_t expected;
+static uint32_t xferred;
+static bool dir_in;
+
+static const uint8_t *resp_ptr;
+static uint32_t data_len;
+
+static struct {
+    uint8_t key;
+    uint8_t asc;
+} sense;
+
+static uint8_t resp[36];
+
+
+static uint16_t
+min16(uint32_t a, uint32_t b)
+{
+    return a < b ? a : b;
+}
+
+static uint32_t
+get_be32(const uint8_t *b)
+{
+    return ((uint32_t) b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+}
+
+static void
+put_be32(uint8_t *b, uint32_t v)
+{
+    b[0] = v >> 24;
+    b[1] = v >> 16;
+    b[2] = v >> 8;
+    b[3] = v;
+}
+
+static void
+put_str(uint8_t *b, const char *s, uint8_t len)
+{
+    memset(b, ' ', len);
+    for (uint8_t i = 0; i < len && s[i] != 0; i++)
+        b[i] = s[i];
+}
+
+
+void
+usbd_msc_task(void)
+{
+    op_t op = job.op;
+    if (op == OP_NONE)
+        return;
+
+    uint8_t g = gen;
+    uint16_t idx;
+    uint16_t n;
+    bool ok;
+
+    if (op == OP_READ) {
+        // read ahead while there are free buffers
+        idx = head % USBD_MSC_BUFFER_BLOCKS;
+        n = min16(USBD_MSC_BUFFER_BLOCKS - (uint16_t) (head - tail), RUN_BLOCKS);
+        n = min16(n, job.blocks);
+        if (n == 0)
+            return;
+
+        ok = usbd_msc_read_cb && usbd_msc_read_cb(job.lba, blocks[idx], n);
+        if (g != gen)
+            return;
+        if (ok)
+            head += n;
+    }
+    else {
+        // shorter runs wait for more blocks, unless they complete the transfer
+        idx = tail % USBD_MSC_BUFFER_BLOCKS;
+        n = min16((uint16_t) (head - tail), RUN_BLOCKS);
+        if (n == 0 || (n < RUN_BLOCKS && n < job.blocks))
+            return;
+
+        ok = usbd_msc_write_cb && usbd_msc_write_cb(job.lba, blocks[idx], n);
+        if (g != gen)
+            return;
+        if (ok)
+            tail += n;
+    }
+
+    if (!ok) {
+        job.error = true;
+        job.op = OP_NONE;
+        return;
+    }
+
+    job.lba += n;
+    job.blocks -= n;
+    if (job.blocks == 0)
+        job.op = OP_NONE;
+}
+
+
+static void
+fail(uint8_t key, uint8_t asc)
+{
+    sense.key = key;
+    sense.asc = asc;
+    csw.bCSWStatus = USB_MSC_CSW_STATUS_FAILED;
+}
+
+static void
+finish(void)
+{
+    // the data pipe is stalled when the host expected more data than transferred, and
+    // the status is sent after the host clears the halt.
+    csw.dCSWDataResidue = expected - xferred;
+    state = STATE_CSW;
+
+    if (csw.dCSWDataResidue != 0) {
+        if (dir_in)
+            stalled = usbd_stall(USB_DESCR_EPT_ADDR_DIR_IN | USBD_MSC_EPT);
+        else
+            usbd_stall(USBD_MSC_EPT);
+    }
+}
+
+static void
+send_data(void)
+{
+    const uint8_t *p;
+    uint16_t n;
+
+    if (resp_ptr != NULL) {
+        p = resp_ptr;
+        n = min16(data_len, USBD_MSC_EPT_SIZE);
+    }
+    else {
+        if (head == tail) {
+            if (job.error) {
+                fail(USB_MSC_SCSI_SENSE_MEDIUM_ERROR, USB_MSC_SCSI_ASC_UNRECOVERED_READ_ERROR);
+                data_len = 0;
+                finish();
+            }
+            return;
+        }
+        p = blocks[tail % USBD_MSC_BUFFER_BLOCKS] + offset;
+        n = USBD_MSC_EPT_SIZE;
+    }
+
+    busy = usbd_in(USBD_MSC_EPT, p, n);
+    if (!busy)
+        return;
+
+    // usbd_in copies the packet right away, the buffer can be released already
+    if (resp_ptr != NULL) {
+        resp_ptr += n;
+    }
+    else {
+        offset += n;
+        if (offset == USBD_MSC_BLOCK_SIZE) {
+            offset = 0;
+            tail++;
+        }
+    }
+    data_len -= n;
+    xferred += n;
+}
+
+static void
+in_task(void)
+{
+    if (busy || stalled)
+        return;
+
+    switch (state) {
+    case STATE_DATA_IN:
+        if (data_len != 0) {
+            send_data();
+            return;
+        }
+        finish();
+        break;
+
+    case STATE_ERROR:
+        // the host cleared the halt before resetting the interface
+        stalled = usbd_stall(USB_DESCR_EPT_ADDR_DIR_IN | USBD_MSC_EPT);
+        return;
+
+    case STATE_WRITE_WAIT:
+        if (job.op != OP_NONE)
+            return;
+        if (job.error)
+            fail(USB_MSC_SCSI_SENSE_MEDIUM_ERROR, USB_MSC_SCSI_ASC_WRITE_FAULT);
+        finish();
+        break;
+
+    default:
+        break;
+    }
+
+    if (state != STATE_CSW || stalled)
+        return;
+
+    // the host only sends the next command after reading the status
+    busy = usbd_in(USBD_MSC_EPT, &csw, sizeof(csw));
+    if (busy)
+        state = STATE_CBW;
+}
+
+
+static void
+data_in(const void *buf, uint32_t len)
+{
+    if (!dir_in && expected != 0) {
+        csw.bCSWStatus = USB_MSC_CSW_STATUS_PHASE_ERROR;
+        return;
+    }
+
+    resp_ptr = buf;
+    data_len = len < expected ? len : expected;
+    state = STATE_DATA_IN;
+}
+
+static bool
+media_ready(uint32_t *count)
+{
+    *count = usbd_msc_get_block_count_cb ? usbd_msc_get_block_count_cb() : 0;
+    if (*count == 0) {
+        fail(USB_MSC_SCSI_SENSE_NOT_READY, USB_MSC_SCSI_ASC_MEDIUM_NOT_PRESENT);
+        return false;
+    }
+    return true;
+}
+
+static void
+scsi_rw(const uint8_t *cb, bool write)
+{
+    uint32_t count;
+    if (!media_ready(&count))
+        return;
+
+    uint32_t lba = get_be32(cb + 2);
+    uint16_t n = (cb[7] << 8) | cb[8];
+
+    if ((lba >= count) || (n > count - lba)) {
+        fail(USB_MSC_SCSI_SENSE_ILLEGAL_REQUEST, USB_MSC_SCSI_ASC_LBA_OUT_OF_RANGE);
+        return;
+    }
+
+    if (write && usbd_msc_is_write_protected_cb && usbd_msc_is_write_protected_cb()) {
+        fail(USB_MSC_SCSI_SENSE_DATA_PROTECT, USB_MSC_SCSI_ASC_WRITE_PROTECTED);
+        return;
+    }
+
+    // the host and the device must agree on the size and direction of the transfer
+    uint32_t len = (uint32_t) n * USBD_MSC_BLOCK_SIZE;
+    if ((len != expected) || (len != 0 && dir_in == write)) {
+        csw.bCSWStatus = USB_MSC_CSW_STATUS_PHASE_ERROR;
+        return;
+    }
+    if (len == 0)
+        return;
+
+    head = 0;
+    tail = 0;
+    offset = 0;
+    resp_ptr = NULL;
+    data_len = len;
+    state = write ? STATE_DATA_OUT : STATE_DATA_IN;
+
+    job.lba = lba;
+    job.blocks = n;
+    job.error = false;
+    job.op = write ? OP_WRITE : OP_READ;
+}
+
+static void
+scsi_command(const uint8_t *cb)
+{
+    uint32_t count;
+
+    switch (cb[0]) {
+    case USB_MSC_SCSI_TEST_UNIT_READY:
+        media_ready(&count);
+        return;
+
+    case USB_MSC_SCSI_REQUEST_SENSE:
+        memset(resp, 0, 18);
+        resp[0] = 0x70;
+        resp[2] = sense.key;
+        resp[7] = 10;
+        resp[12] = sense.asc;
+        sense.key = USB_MSC_SCSI_SENSE_NO_SENSE;
+        sense.asc = 0;
+        data_in(resp, 18);
+        return;
+
+    case USB_MSC_SCSI_INQUIRY:
+        if (cb[1] & (1 << 0)) {
+            fail(USB_MSC_SCSI_SENSE_ILLEGAL_REQUEST, USB_MSC_SCSI_ASC_INVALID_FIELD_IN_CDB);
+            return;
+        }
+        memset(resp, 0, 36);
+        resp[1] = 0x80;  // removable
+        resp[2] = 0x02;
+        resp[3] = 0x02;
+        resp[4] = 36 - 5;
+        put_str(resp + 8, USBD_MSC_VENDOR, 8);
+        put_str(resp + 16, USBD_MSC_PRODUCT, 16);
+        put_str(resp + 32, USBD_MSC_REVISION, 4);
+        data_in(resp, 36);
+        return;
+
+    case USB_MSC_SCSI_MODE_SENSE_6:
+    case USB_MSC_SCSI_MODE_SENSE_10:
+        {
+            // header only, without block descriptors or mode pages
+            bool wp = usbd_msc_is_write_protected_cb && usbd_msc_is_write_protected_cb();
+            if (cb[0] == USB_MSC_SCSI_MODE_SENSE_6) {
+                memset(resp, 0, 4);
+                resp[0] = 3;
+                resp[2] = wp ? 0x80 : 0;
+                data_in(resp, 4);
+                return;
+            }
+            memset(resp, 0, 8);
+            resp[1] = 6;
+            resp[3] = wp ? 0x80 : 0;
+            data_in(resp, 8);
+            return;
+        }
+
+    case USB_MSC_SCSI_READ_FORMAT_CAPACITIES:
+        if (!media_ready(&count))
+            return;
+        memset(resp, 0, 12);
+        resp[3] = 8;
+        put_be32(resp + 4, count);
+        put_be32(resp + 8, USBD_MSC_BLOCK_SIZE);
+        resp[8] = 0x02;  // formatted media
+        data_in(resp, 12);
+        return;
+
+    case USB_MSC_SCSI_READ_CAPACITY_10:
+        if (!media_ready(&count))
+            return;
+        put_be32(resp, count - 1);
+        put_be32(resp + 4, USBD_MSC_BLOCK_SIZE);
+        data_in(resp, 8);
+        return;
+
+    case USB_MSC_SCSI_READ_10:
+        scsi_rw(cb, false);
+        return;
+
+    case USB_MSC_SCSI_WRITE_10:
+        scsi_rw(cb, true);
+        return;
+
+    case USB_MSC_SCSI_START_STOP_UNIT:
+    case USB_MSC_SCSI_PREVENT_ALLOW_REMOVAL:
+    case USB_MSC_SCSI_VERIFY_10:
+    case USB_MSC_SCSI_SYNCHRONIZE_CACHE_10:
+        // blocks are already on the media when the write command completes
+        return;
+    }
+
+    fail(USB_MSC_SCSI_SENSE_ILLEGAL_REQUEST, USB_MSC_SCSI_ASC_INVALID_COMMAND);
+}
+
+static void
+cbw_task(const usb_msc_cbw_t *cbw)
+{
+    csw.dCSWSignature = USB_MSC_CSW_SIGNATURE;
+    csw.dCSWTag = cbw->dCBWTag;
+    csw.bCSWStatus = USB_MSC_CSW_STATUS_PASSED;
+    expected = cbw->dCBWDataTransferLength;
+    xferred = 0;
+    dir_in = (cbw->bmCBWFlags & USB_MSC_CBW_FLAGS_DATA_IN) != 0;
+    state = STATE_CSW;
+
+    if (cbw->bCBWLUN != 0)
+        fail(USB_MSC_SCSI_SENSE_ILLEGAL_REQUEST, USB_MSC_SCSI_ASC_INVALID_COMMAND);
+    else
+        scsi_command(cbw->CBWCB);
+
+    // commands that failed or that have no data stage go straight to the status
+    if (state == STATE_CSW || csw.bCSWStatus != USB_MSC_CSW_STATUS_PASSED)
+        finish();
+}
+
+static void
+out_task(void)
+{
+    const void *buf;
+    uint16_t len = usbd_out_peek(USBD_MSC_EPT, &buf);
+
+    switch (state) {
+    case STATE_CBW:
+        {
+            usb_msc_cbw_t cbw;
+            if (len == sizeof(cbw))
+                memcpy(&cbw, buf, sizeof(cbw));
+
+            if (len != sizeof(cbw) || cbw.dCBWSignature != USB_MSC_CBW_SIGNATURE ||
+                cbw.bCBWCBLength == 0 || cbw.bCBWCBLength > sizeof(cbw.CBWCB)) {
+                // invalid command blocks stall both pipes until the host resets the
+                // interface. the packet is not released, to keep the out pipe stalled.
+                state = STATE_ERROR;
+                stalled = usbd_stall(USB_DESCR_EPT_ADDR_DIR_IN | USBD_MSC_EPT);
+                usbd_stall(USBD_MSC_EPT);
+                return;
+            }
+
+            // released before running the command, that may stall the out pipe
+            usbd_out_release(USBD_MSC_EPT);
+            cbw_task(&cbw);
+            in_task();
+            return;
+        }
+
+    case STATE_DATA_OUT:
+        if (!job.error) {
+            if ((uint16_t) (head - tail) == USBD_MSC_BUFFER_BLOCKS) {
+                // no free buffers, the host is NAKed until the task writes some blocks
+                out_pending = true;
+                return;
+            }
+
+            len = min16(len, USBD_MSC_BLOCK_SIZE - offset);
+            memcpy(blocks[head % USBD_MSC_BUFFER_BLOCKS] + offset, buf, len);
+            offset += len;
+            if (offset == USBD_MSC_BLOCK_SIZE) {
+                offset = 0;
+                head++;
+            }
+        }
+
+        len = min16(len, data_len);
+        data_len -= len;
+        xferred += len;
+        if (data_len == 0)
+            state = STATE_WRITE_WAIT;
+        break;
+
+    case STATE_ERROR:
+        usbd_stall(USBD_MSC_EPT);
+        return;
+
+    default:
+        // the previous command is still running
+        out_pending = true;
+        return;
+    }
+
+    usbd_out_release(USBD_MSC_EPT);
+    in_task();
+}
+
+
+static void
+reset(void)
+{
+    gen++;
+    job.op = OP_NONE;
+    head = 0;
+    tail = 0;
+    offset = 0;
+    state = STATE_CBW;
+    stalled = false;
+    out_pending = false;
+    sense.key = USB_MSC_SCSI_SENSE_NO_SENSE;
+    sense.asc = 0;
+}
+
+bool
+usbd_msc_handle_ctrl_request(usb_ctrl_request_t *req)
+{
+    if (((req->bmRequestType & USB_REQ_RCPT_MASK) != USB_REQ_RCPT_INTERFACE) ||
+        (req->wIndex != USBD_MSC_ITF))
+        return false;
+
+    switch (req->bRequest) {
+    case USB_REQ_MSC_GET_MAX_LUN:
+        {
+            static const uint8_t max_lun = 0;
+            usbd_control_in(&max_lun, sizeof(max_lun), req->wLength);
+            return true;
+        }
+
+    case USB_REQ_MSC_BOT_RESET:
+        // the host clears the halt of both pipes right after this request
+        reset();
+        return true;
+    }
+
+    return false;
+}
+
+void
+usbd_msc_handle_in(uint8_t ept)
+{
+    if (ept == USBD_MSC_EPT) {
+        busy = false;
+        stalled = false;
+        in_task();
+    }
+}
+
+void
+usbd_msc_handle_out(uint8_t ept)
+{
+    if (ept == USBD_MSC_EPT)
+        out_task();
+}
+
+void
+usbd_msc_handle_sof(void)
+{
+    // resume the transfers waiting for the main loop task
+    if (out_pending) {
+        out_pending = false;
+        out_task();
+    }
+    in_task();
+}
+
+void
+usbd_msc_handle_reset(void)
+{
+    reset();
+    busy = false;
+}
@@ -0,0 +1,251 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <usbd.h>
+#include <usbd-rpc.h>
+
+#ifndef USBD_RPC_EPT
+#define USBD_RPC_EPT 1
+#endif
+#ifndef USBD_RPC_EPT_SIZE
+#define USBD_RPC_EPT_SIZE 64
+#endif
+#ifndef USBD_RPC_CHANNELS
+#define USBD_RPC_CHANNELS 8
+#endif
+#ifndef USBD_RPC_MAX_OUTSTANDING
+#define USBD_RPC_MAX_OUTSTANDING 4
+#endif
+
+#if (USBD_RPC_CHANNELS < 1) || (USBD_RPC_CHANNELS > 128)
+#error "RPC channels must be between 1 and 128"
+#endif
+
+#if USBD_RPC_MAX_OUTSTANDING < 1
+#error "RPC must allow at least one outstanding request"
+#endif
+
+#define HEADER_SIZE (sizeof(usbd_rpc_header_t))
+
+typedef enum {
+    SLOT_FREE = 0,
+    SLOT_PENDING,
+    SLOT_READY,
+    SLOT_SENDING,
+} slot_state_t;
+
+// slots are allocated and freed by the usb interrupt, and filled by usbd_rpc_respond
+// while pending.
+static struct {
+    volatile slot_state_t state;
+    uint8_t channel;
+    uint8_t id;
+    const uint8_t *buf;
+    uint16_t len;
+} slots[USBD_RPC_MAX_OUTSTANDING];
+
+static usbd_rpc_handler_t handlers[USBD_RPC_CHANNELS];
+
+static usbd_rpc_header_t hdr;
+static uint8_t cur;
+static uint16_t pos;
+static bool active = false;
+static bool busy = false;
+static bool zlp = false;
+
+static uint16_t out_pos = 0;
+static bool out_pending = false;
+
+
+bool
+usbd_rpc_register(uint8_t channel, usbd_rpc_handler_t handler)
+{
+    if (channel >= USBD_RPC_CHANNELS)
+        return false;
+
+    handlers[channel] = handler;
+    return true;
+}
+
+static int8_t
+find(uint8_t channel, uint8_t id)
+{
+    for (uint8_t i = 0; i < USBD_RPC_MAX_OUTSTANDING; i++)
+        if ((slots[i].state != SLOT_FREE) && (slots[i].channel == channel) &&
+            (slots[i].id == id))
+            return i;
+    return -1;
+}
+
+bool
+usbd_rpc_respond(uint8_t channel, uint8_t id, const void *buf, uint16_t len)
+{
+    int8_t i = find(channel, id);
+    if ((i < 0) || (slots[i].state != SLOT_PENDING))
+        return false;
+
+    slots[i].buf = buf;
+    slots[i].len = len;
+    slots[i].state = SLOT_READY;
+    return true;
+}
+
+bool
+usbd_rpc_is_pending(uint8_t channel, uint8_t id)
+{
+    return find(channel, id) >= 0;
+}
+
+
+static bool
+send(const void *buf1, uint16_t len1, const void *buf2, uint16_t len2)
+{
+    if (!usbd_in_gather(USBD_RPC_EPT, buf1, len1, buf2, len2))
+        return false;
+
+    zlp = (len1 + len2) == USBD_RPC_EPT_SIZE;
+    busy = true;
+    return true;
+}
+
+static void out_task(void);
+
+static void
+in_task(void)
+{
+    if (busy)
+        return;
+
+    if (active) {
+        if (pos < slots[cur].len) {
+            uint16_t n = slots[cur].len - pos;
+            if (n > USBD_RPC_EPT_SIZE)
+                n = USBD_RPC_EPT_SIZE;
+            if (send(slots[cur].buf + pos, n, NULL, 0))
+                pos += n;
+            return;
+        }
+
+        // each frame is a transfer, terminated by a short packet
+        if (zlp) {
+            send(NULL, 0, NULL, 0);
+            return;
+        }
+
+        active = false;
+        slots[cur].state = SLOT_FREE;
+        if (out_pending) {
+            out_pending = false;
+            out_task();
+            return;
+        }
+    }
+
+    // responses are sent in slot order, starting after the last one sent
+    for (uint8_t j = 1; j <= USBD_RPC_MAX_OUTSTANDING; j++) {
+        uint8_t i = (cur + j) % USBD_RPC_MAX_OUTSTANDING;
+        if (slots[i].state != SLOT_READY)
+            continue;
+
+        hdr.wLength = slots[i].len;
+        hdr.bChannel = slots[i].channel;
+        hdr.bId = slots[i].id;
+        pos = slots[i].len < USBD_RPC_EPT_SIZE - HEADER_SIZE ? slots[i].len :
+            USBD_RPC_EPT_SIZE - HEADER_SIZE;
+        if (!send(&hdr, HEADER_SIZE, slots[i].buf, pos))
+            return;
+
+        slots[i].state = SLOT_SENDING;
+        cur = i;
+        active = true;
+        return;
+    }
+}
+
+static int8_t
+alloc(void)
+{
+    for (uint8_t i = 0; i < USBD_RPC_MAX_OUTSTANDING; i++)
+        if (slots[i].state == SLOT_FREE)
+            return i;
+    return -1;
+}
+
+static void
+out_task(void)
+{
+    const uint8_t *buf;
+    uint16_t len = usbd_out_peek(USBD_RPC_EPT, (const void**) &buf);
+
+    while (out_pos + HEADER_SIZE <= len) {
+        usbd_rpc_header_t h;
+        memcpy(&h, buf + out_pos, HEADER_SIZE);
+
+        // frames crossing the packet boundary are dropped, with the rest of the packet
+        if (out_pos + HEADER_SIZE + h.wLength > len)
+            break;
+
+        // the packet is held until a slot is freed by a response
+        int8_t i = alloc();
+        if (i < 0) {
+            out_pending = true;
+            in_task();
+            return;
+        }
+
+        slots[i].channel = h.bChannel;
+        slots[i].id = h.bId;
+        slots[i].state = SLOT_PENDING;
+
+        usbd_rpc_handler_t handler = h.bChannel < USBD_RPC_CHANNELS ? handlers[h.bChannel] : NULL;
+        if ((handler == NULL) || !handler(h.bId, buf + out_pos + HEADER_SIZE, h.wLength)) {
+            slots[i].channel = h.bChannel | USBD_RPC_CHANNEL_ERROR;
+            slots[i].len = 0;
+            slots[i].state = SLOT_READY;
+        }
+
+        out_pos += HEADER_SIZE + h.wLength;
+    }
+
+    out_pos = 0;
+    usbd_out_release(USBD_RPC_EPT);
+
+    // responses given by the handlers are sent right away
+    in_task();
+}
+
+void
+usbd_rpc_handle_in(uint8_t ept)
+{
+    if (ept == USBD_RPC_EPT) {
+        busy = false;
+        in_task();
+    }
+}
+
+void
+usbd_rpc_handle_out(uint8_t ept)
+{
+    if (ept == USBD_RPC_EPT)
+        out_task();
+}
+
+void
+usbd_rpc_handle_reset(void)
+{
+    for (uint8_t i = 0; i < USBD_RPC_MAX_OUTSTANDING; i++)
+        slots[i].state = SLOT_FREE;
+
+    active = false;
+    busy = false;
+    out_pos = 0;
+    out_pending = false;
+}
@@ -0,0 +1,526 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <usbd.h>
+#include <usbd-tmc.h>
+
+#ifndef USBD_TMC_ITF
+#define USBD_TMC_ITF 0
+#endif
+#ifndef USBD_TMC_EPT
+#define USBD_TMC_EPT 1
+#endif
+#ifndef USBD_TMC_EPT_SIZE
+#define USBD_TMC_EPT_SIZE 64
+#endif
+#ifndef USBD_TMC_INT_EPT
+#define USBD_TMC_INT_EPT 0
+#endif
+#ifndef USBD_TMC_USB488
+#define USBD_TMC_USB488 1
+#endif
+
+#if USBD_TMC_EPT_SIZE < 16
+#error "TMC endpoint size must be at least 16 bytes"
+#endif
+
+#if (USBD_TMC_INT_EPT > 0) && !USBD_TMC_USB488
+#error "TMC interrupt endpoint requires USB488"
+#endif
+
+#if USBD_TMC_INT_EPT == USBD_TMC_EPT
+#error "TMC interrupt endpoint must not be the bulk endpoint"
+#endif
+
+#define HEADER_SIZE (sizeof(usb_tmc_bulk_header_t))
+
+static struct {
+    uint32_t remaining;
+    uint32_t received;
+    uint8_t pad;
+    uint8_t tag;
+    bool eom;
+} out;
+
+// the response buffer is owned by the usb interrupt while ready is set
+static struct {
+    const uint8_t *buf;
+    uint32_t len;
+    bool eom;
+    volatile bool ready;
+
+    bool requested;
+    uint8_t tag;
+    uint32_t max;
+
+    bool active;
+    bool busy;
+    bool zlp;
+    uint32_t size;
+    uint32_t total;
+    uint32_t pos;
+} in;
+
+static usb_tmc_bulk_header_t hdr;
+static uint8_t pkt[USBD_TMC_EPT_SIZE];
+static const uint8_t zeros[3] = {0};
+
+static usb_tmc_capabilities_t caps;
+static uint8_t rsp[8];
+
+#if USBD_TMC_INT_EPT > 0
+static bool int_busy = false;
+static bool int_pending = false;
+static uint8_t int_msg[2];
+static volatile bool srq_pending = false;
+static volatile uint8_t srq_status;
+#endif
+
+
+bool
+usbd_tmc_respond(const void *buf, uint32_t len, bool eom)
+{
+    if (in.ready)
+        return false;
+
+    in.buf = buf;
+    in.len = len;
+    in.eom = eom;
+    in.ready = true;
+    return true;
+}
+
+bool
+usbd_tmc_response_pending(void)
+{
+    return in.ready;
+}
+
+bool
+usbd_tmc_srq(uint8_t status_byte)
+{
+#if USBD_TMC_INT_EPT > 0
+    if (srq_pending)
+        return false;
+
+    srq_status = status_byte;
+    srq_pending = true;
+    return true;
+#else
+    (void) status_byte;
+    return false;
+#endif
+}
+
+
+static bool
+send(const void *buf1, uint16_t len1, const void *buf2, uint16_t len2)
+{
+    if (!usbd_in_gather(USBD_TMC_EPT, buf1, len1, buf2, len2))
+        return false;
+
+    in.zlp = (len1 + len2) == USBD_TMC_EPT_SIZE;
+    in.busy = true;
+    return true;
+}
+
+static void
+begin(void)
+{
+    in.size = in.len < in.max ? in.len : in.max;
+    in.total = (in.size + 3) & ~3;
+    in.pos = in.total < USBD_TMC_EPT_SIZE - HEADER_SIZE ? in.total : USBD_TMC_EPT_SIZE - HEADER_SIZE;
+
+    hdr.MsgID = USB_TMC_MSGID_DEV_DEP_MSG_IN;
+    hdr.bTag = in.tag;
+    hdr.bTagInverse = ~in.tag;
+    hdr.Reserved = 0;
+    hdr.TransferSize = in.size;
+    hdr.bmTransferAttributes = (in.eom && in.size == in.len) ? USB_TMC_TRANSFER_ATTR_EOM : 0;
+    hdr.TermChar = 0;
+    hdr.Reserved2[0] = 0;
+    hdr.Reserved2[1] = 0;
+
+    if (in.pos > in.size) {
+        // the alignment bytes make a third segment, only for transfers that fit a
+        // single packet.
+        memcpy(pkt, &hdr, HEADER_SIZE);
+        memcpy(pkt + HEADER_SIZE, in.buf, in.size);
+        memset(pkt + HEADER_SIZE + in.size, 0, in.pos - in.size);
+        in.active = send(pkt, HEADER_SIZE + in.pos, NULL, 0);
+        return;
+    }
+
+    // the transfer is started again by the next call if the endpoint is not ready
+    in.active = send(&hdr, HEADER_SIZE, in.buf, in.pos);
+}
+
+static void
+finish(void)
+{
+    in.active = false;
+    in.requested = false;
+
+    // responses longer than the host request are sent by the following requests
+    in.buf += in.size;
+    in.len -= in.size;
+    if (in.len == 0)
+        in.ready = false;
+}
+
+static void
+in_task(void)
+{
+    if (in.busy)
+        return;
+
+    if (!in.active) {
+        if (in.requested && in.ready)
+            begin();
+        return;
+    }
+
+    if (in.pos < in.total) {
+        uint16_t n = in.total - in.pos < USBD_TMC_EPT_SIZE ? in.total - in.pos : USBD_TMC_EPT_SIZE;
+        uint16_t d = in.pos < in.size ? (in.size - in.pos < n ? in.size - in.pos : n) : 0;
+        if (send(in.buf + in.pos, d, zeros, n - d))
+            in.pos += n;
+        return;
+    }
+
+    // transfers ending with a full packet are terminated by a zero length packet
+    if (in.zlp) {
+        send(NULL, 0, NULL, 0);
+        return;
+    }
+
+    finish();
+}
+
+static void
+abort_in(void)
+{
+    // the transfer is terminated with a short packet, if one was not sent already
+    if (in.active) {
+        in.total = in.pos;
+        in.len = in.size;
+    }
+    else
+        in.ready = false;
+
+    in.requested = false;
+}
+
+static void
+abort_out(void)
+{
+    out.remaining = 0;
+    out.pad = 0;
+}
+
+static bool
+parse_header(const uint8_t *buf, uint16_t len)
+{
+    if (len < HEADER_SIZE)
+        return false;
+
+    usb_tmc_bulk_header_t h;
+    memcpy(&h, buf, HEADER_SIZE);
+    if (h.bTag == 0 || (h.bTag ^ h.bTagInverse) != 0xff)
+        return false;
+
+    switch (h.MsgID) {
+    case USB_TMC_MSGID_DEV_DEP_MSG_OUT:
+        out.tag = h.bTag;
+        out.remaining = h.TransferSize;
+        out.received = 0;
+        out.pad = (4 - (h.TransferSize & 3)) & 3;
+        out.eom = h.bmTransferAttributes & USB_TMC_TRANSFER_ATTR_EOM;
+        return true;
+
+    case USB_TMC_MSGID_REQUEST_DEV_DEP_MSG_IN:
+        // requests received while a response is being sent are ignored
+        if (!in.active) {
+            in.tag = h.bTag;
+            in.max = h.TransferSize;
+            in.requested = true;
+            in_task();
+        }
+        return true;
+
+#if USBD_TMC_USB488
+    case USB_TMC_MSGID_USB488_TRIGGER:
+        if (usbd_tmc_trigger_cb)
+            usbd_tmc_trigger_cb();
+        return true;
+#endif
+    }
+
+    return false;
+}
+
+static void
+out_task(void)
+{
+    const uint8_t *buf;
+    uint16_t len = usbd_out_peek(USBD_TMC_EPT, (const void**) &buf);
+    uint16_t pos = 0;
+
+    if (out.remaining == 0 && out.pad == 0) {
+        if (!parse_header(buf, len)) {
+            // the endpoint stays halted until the host clears it, the packet must not
+            // be released.
+            abort_out();
+            usbd_stall(USBD_TMC_EPT);
+            return;
+        }
+        pos = HEADER_SIZE;
+    }
+
+    // the message data is delivered straight from the endpoint buffer
+    uint16_t n = len - pos;
+    if (n > out.remaining)
+        n = out.remaining;
+    if (n > 0) {
+        out.remaining -= n;
+        out.received += n;
+        if (usbd_tmc_recv_cb)
+            usbd_tmc_recv_cb(buf + pos, n, out.eom && out.remaining == 0);
+        pos += n;
+    }
+
+    n = len - pos;
+    out.pad -= n < out.pad ? n : out.pad;
+
+    usbd_out_release(USBD_TMC_EPT);
+}
+
+#if USBD_TMC_INT_EPT > 0
+static void
+int_task(void)
+{
+    if (int_busy)
+        return;
+
+    if (!int_pending && srq_pending) {
+        int_msg[0] = USB_TMC_USB488_NOTIFY_SRQ;
+        int_msg[1] = srq_status;
+        srq_pending = false;
+        int_pending = true;
+    }
+
+    if (int_pending) {
+        int_busy = usbd_in(USBD_TMC_INT_EPT, int_msg, sizeof(int_msg));
+        if (int_busy)
+            int_pending = false;
+    }
+}
+#endif
+
+static void
+reset(void)
+{
+    abort_out();
+    in.ready = false;
+    in.requested = false;
+    in.active = false;
+    in.busy = false;
+#if USBD_TMC_INT_EPT > 0
+    int_busy = false;
+    int_pending = false;
+    srq_pending = false;
+#endif
+}
+
+static void
+put_le32(uint8_t *b, uint32_t v)
+{
+    b[0] = v;
+    b[1] = v >> 8;
+    b[2] = v >> 16;
+    b[3] = v >> 24;
+}
+
+static bool
+handle_ept_request(usb_ctrl_request_t *req)
+{
+    memset(rsp, 0, sizeof(rsp));
+
+    switch (req->bRequest) {
+    case USB_REQ_TMC_INITIATE_ABORT_BULK_OUT:
+        if (req->wIndex != USBD_TMC_EPT)
+            return false;
+
+        if (out.remaining == 0 && out.pad == 0)
+            rsp[0] = USB_TMC_STATUS_FAILED;
+        else if (out.tag != (uint8_t) req->wValue)
+            rsp[0] = USB_TMC_STATUS_TRANSFER_NOT_IN_PROGRESS;
+        else {
+            abort_out();
+            usbd_stall(USBD_TMC_EPT);
+            rsp[0] = USB_TMC_STATUS_SUCCESS;
+        }
+        rsp[1] = out.tag;
+        usbd_control_in(rsp, 2, req->wLength);
+        return true;
+
+    case USB_REQ_TMC_CHECK_ABORT_BULK_OUT_STATUS:
+        if (req->wIndex != USBD_TMC_EPT)
+            return false;
+
+        rsp[0] = USB_TMC_STATUS_SUCCESS;
+        put_le32(rsp + 4, out.received);
+        usbd_control_in(rsp, 8, req->wLength);
+        return true;
+
+    case USB_REQ_TMC_INITIATE_ABORT_BULK_IN:
+        if (req->wIndex != (USB_DESCR_EPT_ADDR_DIR_IN | USBD_TMC_EPT))
+            return false;
+
+        if (!in.active && !in.requested)
+            rsp[0] = USB_TMC_STATUS_FAILED;
+        else if (in.tag != (uint8_t) req->wValue)
+            rsp[0] = USB_TMC_STATUS_TRANSFER_NOT_IN_PROGRESS;
+        else {
+            abort_in();
+            rsp[0] = USB_TMC_STATUS_SUCCESS;
+        }
+        rsp[1] = in.tag;
+        usbd_control_in(rsp, 2, req->wLength);
+        return true;
+
+    case USB_REQ_TMC_CHECK_ABORT_BULK_IN_STATUS:
+        if (req->wIndex != (USB_DESCR_EPT_ADDR_DIR_IN | USBD_TMC_EPT))
+            return false;
+
+        // the host reads the bulk endpoint until the short packet while pending
+        rsp[0] = in.active ? USB_TMC_STATUS_PENDING : USB_TMC_STATUS_SUCCESS;
+        rsp[1] = in.active ? 1 : 0;
+        put_le32(rsp + 4, in.pos < in.size ? in.pos : in.size);
+        usbd_control_in(rsp, 8, req->wLength);
+        return true;
+    }
+
+    return false;
+}
+
+bool
+usbd_tmc_handle_ctrl_request(usb_ctrl_request_t *req)
+{
+    if ((req->bmRequestType & USB_REQ_RCPT_MASK) == USB_REQ_RCPT_ENDPOINT)
+        return handle_ept_request(req);
+
+    if (((req->bmRequestType & USB_REQ_RCPT_MASK) != USB_REQ_RCPT_INTERFACE) ||
+        (req->wIndex != USBD_TMC_ITF))
+        return false;
+
+    memset(rsp, 0, sizeof(rsp));
+
+    switch (req->bRequest) {
+    case USB_REQ_TMC_INITIATE_CLEAR:
+        abort_out();
+        abort_in();
+        if (usbd_tmc_clear_cb)
+            usbd_tmc_clear_cb();
+        rsp[0] = USB_TMC_STATUS_SUCCESS;
+        usbd_control_in(rsp, 1, req->wLength);
+        return true;
+
+    case USB_REQ_TMC_CHECK_CLEAR_STATUS:
+        rsp[0] = in.active ? USB_TMC_STATUS_PENDING : USB_TMC_STATUS_SUCCESS;
+        rsp[1] = in.active ? 1 : 0;
+        usbd_control_in(rsp, 2, req->wLength);
+        return true;
+
+    case USB_REQ_TMC_GET_CAPABILITIES:
+        memset(&caps, 0, sizeof(caps));
+        caps.USBTMC_status = USB_TMC_STATUS_SUCCESS;
+        caps.bcdUSBTMC = USB_TMC_VERSION;
+        if (usbd_tmc_indicator_pulse_cb)
+            caps.bmInterfaceCapabilities = USB_TMC_ITF_CAP_INDICATOR_PULSE;
+#if USBD_TMC_USB488
+        caps.bcdUSB488 = USB_TMC_USB488_VERSION;
+        caps.bmInterfaceCapabilities488 = USB_TMC_USB488_ITF_CAP_488_2;
+        caps.bmDeviceCapabilities488 = USB_TMC_USB488_DEV_CAP_SCPI;
+        if (usbd_tmc_trigger_cb) {
+            caps.bmInterfaceCapabilities488 |= USB_TMC_USB488_ITF_CAP_TRIGGER;
+            caps.bmDeviceCapabilities488 |= USB_TMC_USB488_DEV_CAP_DT1;
+        }
+#if USBD_TMC_INT_EPT > 0
+        caps.bmDeviceCapabilities488 |= USB_TMC_USB488_DEV_CAP_SR1;
+#endif
+#endif
+        usbd_control_in(&caps, sizeof(caps), req->wLength);
+        return true;
+
+    case USB_REQ_TMC_INDICATOR_PULSE:
+        if (!usbd_tmc_indicator_pulse_cb)
+            return false;
+        usbd_tmc_indicator_pulse_cb();
+        rsp[0] = USB_TMC_STATUS_SUCCESS;
+        usbd_control_in(rsp, 1, req->wLength);
+        return true;
+
+#if USBD_TMC_USB488
+    case USB_REQ_TMC_USB488_READ_STATUS_BYTE:
+        {
+            uint8_t tag = req->wValue & 0x7f;
+            uint8_t sb = usbd_tmc_get_status_byte_cb ? usbd_tmc_get_status_byte_cb() : 0;
+            rsp[0] = USB_TMC_STATUS_SUCCESS;
+            rsp[1] = tag;
+#if USBD_TMC_INT_EPT > 0
+            // the status byte is sent by the interrupt endpoint instead
+            if (int_pending)
+                rsp[0] = USB_TMC_STATUS_USB488_INTERRUPT_IN_BUSY;
+            else {
+                int_msg[0] = USB_TMC_USB488_NOTIFY_STATUS_BYTE | tag;
+                int_msg[1] = sb;
+                int_pending = true;
+                int_task();
+            }
+#else
+            rsp[2] = sb;
+#endif
+            usbd_control_in(rsp, 3, req->wLength);
+            return true;
+        }
+#endif
+    }
+
+    return false;
+}
+
+void
+usbd_tmc_handle_in(uint8_t ept)
+{
+    if (ept == USBD_TMC_EPT) {
+        in.busy = false;
+        in_task();
+    }
+#if USBD_TMC_INT_EPT > 0
+    else if (ept == USBD_TMC_INT_EPT) {
+        int_busy = false;
+        int_task();
+    }
+#endif
+}
+
+void
+usbd_tmc_handle_out(uint8_t ept)
+{
+    if (ept == USBD_TMC_EPT)
+        out_task();
+}
+
+void
+usbd_tmc_handle_reset(void)
+{
+    reset();
+}
@@ -0,0 +1,341 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <usbd.h>
+#include <usbd-uac1.h>
+
+#ifndef USBD_UAC1_SPEAKER_ITF
+#define USBD_UAC1_SPEAKER_ITF 1
+#endif
+#ifndef USBD_UAC1_SPEAKER_EPT
+#define USBD_UAC1_SPEAKER_EPT 1
+#endif
+#ifndef USBD_UAC1_SPEAKER_FRAME_SIZE
+#define USBD_UAC1_SPEAKER_FRAME_SIZE 4
+#endif
+#ifndef USBD_UAC1_FEEDBACK_EPT
+#define USBD_UAC1_FEEDBACK_EPT 2
+#endif
+#ifndef USBD_UAC1_FEEDBACK_REFRESH
+#define USBD_UAC1_FEEDBACK_REFRESH 5
+#endif
+#ifndef USBD_UAC1_FEEDBACK_COUNT_SHIFT
+#define USBD_UAC1_FEEDBACK_COUNT_SHIFT 0
+#endif
+#ifndef USBD_UAC1_MIC_ITF
+#define USBD_UAC1_MIC_ITF 2
+#endif
+#ifndef USBD_UAC1_MIC_EPT
+#define USBD_UAC1_MIC_EPT 3
+#endif
+#ifndef USBD_UAC1_MIC_FRAME_SIZE
+#define USBD_UAC1_MIC_FRAME_SIZE 2
+#endif
+#ifndef USBD_UAC1_SAMPLE_RATE
+#define USBD_UAC1_SAMPLE_RATE 48000
+#endif
+#ifndef USBD_UAC1_MAX_SAMPLE_RATE
+#define USBD_UAC1_MAX_SAMPLE_RATE USBD_UAC1_SAMPLE_RATE
+#endif
+
+#if USBD_UAC1_FEEDBACK_REFRESH < 1 || USBD_UAC1_FEEDBACK_REFRESH > 9
+#error "UAC1 feedback refresh period must be between 1 and 9"
+#endif
+
+#if USBD_UAC1_SAMPLE_RATE > USBD_UAC1_MAX_SAMPLE_RATE
+#error "UAC1 default sample rate is higher than the maximum sample rate"
+#endif
+
+// 10.14 samples per frame are computed with 32-bit math, from the sample rate in Hz.
+#if USBD_UAC1_MAX_SAMPLE_RATE >= (1 << 18)
+#error "UAC1 sample rates must be lower than 262144Hz"
+#endif
+
+#define MIC_MAX_FRAMES (USBD_UAC1_MAX_SAMPLE_RATE / 1000 + 1)
+
+#if USBD_UAC1_SPEAKER_EPT > 0
+static struct {
+    bool active;
+    uint32_t rate;
+} speaker;
+
+// feedback is measured over 2^USBD_UAC1_FEEDBACK_REFRESH frames, starting from the
+// sample count read at the first SOF after the stream is started.
+static struct {
+    uint32_t value;
+    uint32_t start;
+    uint16_t frames;
+    bool started;
+} feedback;
+#endif
+
+#if USBD_UAC1_MIC_EPT > 0
+static struct {
+    bool active;
+    uint32_t rate;
+    uint16_t acc;
+    uint8_t buf[MIC_MAX_FRAMES * USBD_UAC1_MIC_FRAME_SIZE];
+} mic;
+#endif
+
+static uint8_t ctrl_buf[3];
+
+
+uint32_t
+usbd_uac1_get_sample_rate(uint8_t ept)
+{
+#if USBD_UAC1_SPEAKER_EPT > 0
+    if (ept == USBD_UAC1_SPEAKER_EPT)
+        return speaker.rate;
+#endif
+#if USBD_UAC1_MIC_EPT > 0
+    if (ept == USBD_UAC1_MIC_EPT)
+        return mic.rate;
+#endif
+    return 0;
+}
+
+uint32_t
+usbd_uac1_get_feedback(void)
+{
+#if USBD_UAC1_SPEAKER_EPT > 0
+    return feedback.value;
+#else
+    return 0;
+#endif
+}
+
+
+#if USBD_UAC1_SPEAKER_EPT > 0
+static uint32_t
+feedback_nominal(void)
+{
+    return (speaker.rate << 14) / 1000;
+}
+
+static void
+feedback_reset(void)
+{
+    feedback.value = feedback_nominal();
+    feedback.frames = 0;
+    feedback.started = false;
+}
+
+static void
+feedback_task(void)
+{
+    if (!speaker.active || !usbd_uac1_get_sample_count_cb)
+        return;
+
+    uint32_t count = usbd_uac1_get_sample_count_cb();
+    if (!feedback.started) {
+        feedback.start = count;
+        feedback.started = true;
+        return;
+    }
+
+    if (++feedback.frames < (1 << USBD_UAC1_FEEDBACK_REFRESH))
+        return;
+
+    uint32_t delta = count - feedback.start;
+    feedback.start = count;
+    feedback.frames = 0;
+
+    // the dac is not consuming samples yet, keep the nominal rate until it starts
+    if (delta == 0) {
+        feedback.value = feedback_nominal();
+        return;
+    }
+
+    uint32_t value = ((uint64_t) delta << 14) >> (USBD_UAC1_FEEDBACK_REFRESH + USBD_UAC1_FEEDBACK_COUNT_SHIFT);
+
+    // hosts ignore values too far from the nominal rate. one sample per frame is enough
+    // to follow any sane clock drift and to recover from startup transients.
+    uint32_t nominal = feedback_nominal();
+    if (value > nominal + (1 << 14))
+        value = nominal + (1 << 14);
+    if (value < nominal - (1 << 14))
+        value = nominal - (1 << 14);
+    feedback.value = value;
+}
+#endif
+
+#if USBD_UAC1_MIC_EPT > 0
+static void
+mic_task(void)
+{
+    if (!mic.active)
+        return;
+
+    // the remainder of the samples per frame accumulates until a whole sample is due
+    mic.acc += mic.rate % 1000;
+    uint16_t frames = mic.rate / 1000;
+    if (mic.acc >= 1000) {
+        mic.acc -= 1000;
+        frames++;
+    }
+
+    uint16_t len = frames * USBD_UAC1_MIC_FRAME_SIZE;
+    if (usbd_uac1_mic_cb) {
+        uint16_t f = usbd_uac1_mic_cb(mic.buf, frames);
+        len = (f > frames ? frames : f) * USBD_UAC1_MIC_FRAME_SIZE;
+    }
+    else {
+        memset(mic.buf, 0, len);
+    }
+
+    usbd_in(USBD_UAC1_MIC_EPT, mic.buf, len);
+}
+#endif
+
+
+static bool
+set_sample_rate(usb_ctrl_request_t *req, uint16_t len)
+{
+    if (len != sizeof(ctrl_buf))
+        return false;
+
+    uint8_t ept = req->wIndex & 0x7;
+    uint32_t rate = ctrl_buf[0] | (ctrl_buf[1] << 8) | (ctrl_buf[2] << 16);
+    if (rate == 0 || rate > USBD_UAC1_MAX_SAMPLE_RATE)
+        return false;
+
+    if (usbd_uac1_set_sample_rate_cb && !usbd_uac1_set_sample_rate_cb(ept, rate))
+        return false;
+
+#if USBD_UAC1_SPEAKER_EPT > 0
+    if (ept == USBD_UAC1_SPEAKER_EPT) {
+        speaker.rate = rate;
+        feedback_reset();
+    }
+#endif
+#if USBD_UAC1_MIC_EPT > 0
+    if (ept == USBD_UAC1_MIC_EPT) {
+        mic.rate = rate;
+        mic.acc = 0;
+    }
+#endif
+    return true;
+}
+
+bool
+usbd_uac1_handle_ctrl_request(usb_ctrl_request_t *req)
+{
+    if (((req->bmRequestType & USB_REQ_RCPT_MASK) != USB_REQ_RCPT_ENDPOINT) ||
+        ((req->wValue >> 8) != USB_AUDIO_UAC1_EP_CONTROL_SAMPLING_FREQ))
+        return false;
+
+    switch (req->wIndex) {
+#if USBD_UAC1_SPEAKER_EPT > 0
+    case USBD_UAC1_SPEAKER_EPT:
+#endif
+#if USBD_UAC1_MIC_EPT > 0
+    case USB_DESCR_EPT_ADDR_DIR_IN | USBD_UAC1_MIC_EPT:
+#endif
+        break;
+
+    default:
+        return false;
+    }
+
+    switch (req->bRequest) {
+    case USB_REQ_AUDIO_UAC1_SET_CUR:
+        usbd_control_out(ctrl_buf, sizeof(ctrl_buf), req->wLength, set_sample_rate);
+        return true;
+
+    case USB_REQ_AUDIO_UAC1_GET_CUR:
+        {
+            uint32_t rate = usbd_uac1_get_sample_rate(req->wIndex & 0x7);
+            ctrl_buf[0] = rate;
+            ctrl_buf[1] = rate >> 8;
+            ctrl_buf[2] = rate >> 16;
+            usbd_control_in(ctrl_buf, sizeof(ctrl_buf), req->wLength);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void
+usbd_uac1_handle_set_interface(uint8_t itf, uint8_t alt)
+{
+#if USBD_UAC1_SPEAKER_EPT > 0
+    if (itf == USBD_UAC1_SPEAKER_ITF) {
+        speaker.active = alt != 0;
+        feedback_reset();
+        if (usbd_uac1_stream_cb)
+            usbd_uac1_stream_cb(USBD_UAC1_SPEAKER_EPT, speaker.active);
+    }
+#endif
+#if USBD_UAC1_MIC_EPT > 0
+    if (itf == USBD_UAC1_MIC_ITF) {
+        mic.active = alt != 0;
+        mic.acc = 0;
+        if (usbd_uac1_stream_cb)
+            usbd_uac1_stream_cb(USBD_UAC1_MIC_EPT, mic.active);
+    }
+#endif
+}
+
+void
+usbd_uac1_handle_in(uint8_t ept)
+{
+    // isochronous endpoints are double buffered, and the packet for the next frame is
+    // loaded while the current one is sent.
+#if USBD_UAC1_SPEAKER_EPT > 0 && USBD_UAC1_FEEDBACK_EPT > 0
+    if (ept == USBD_UAC1_FEEDBACK_EPT && speaker.active) {
+        usbd_in(USBD_UAC1_FEEDBACK_EPT, &feedback.value, 3);
+        return;
+    }
+#endif
+#if USBD_UAC1_MIC_EPT > 0
+    if (ept == USBD_UAC1_MIC_EPT)
+        mic_task();
+#endif
+}
+
+void
+usbd_uac1_handle_out(uint8_t ept)
+{
+#if USBD_UAC1_SPEAKER_EPT > 0
+    if (ept != USBD_UAC1_SPEAKER_EPT)
+        return;
+
+    const void *buf;
+    uint16_t len = usbd_out_peek(ept, &buf);
+    if (speaker.active && len > 0 && usbd_uac1_speaker_cb)
+        usbd_uac1_speaker_cb(buf, len - (len % USBD_UAC1_SPEAKER_FRAME_SIZE));
+    usbd_out_release(ept);
+#endif
+}
+
+void
+usbd_uac1_handle_sof(void)
+{
+#if USBD_UAC1_SPEAKER_EPT > 0
+    feedback_task();
+#endif
+}
+
+void
+usbd_uac1_handle_reset(void)
+{
+#if USBD_UAC1_SPEAKER_EPT > 0
+    speaker.active = false;
+    speaker.rate = USBD_UAC1_SAMPLE_RATE;
+    feedback_reset();
+#endif
+#if USBD_UAC1_MIC_EPT > 0
+    mic.active = false;
+    mic.rate = USBD_UAC1_SAMPLE_RATE;
+    mic.acc = 0;
+#endif
+}
@@ -0,0 +1,374 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <usbd.h>
+#include <usbd-uac2.h>
+
+#ifndef USBD_UAC2_AC_ITF
+#define USBD_UAC2_AC_ITF 0
+#endif
+#ifndef USBD_UAC2_CLOCK_ID
+#define USBD_UAC2_CLOCK_ID 1
+#endif
+#ifndef USBD_UAC2_SAMPLE_RATES
+#define USBD_UAC2_SAMPLE_RATES 48000
+#endif
+#ifndef USBD_UAC2_SPEAKER_ITF
+#define USBD_UAC2_SPEAKER_ITF 1
+#endif
+#ifndef USBD_UAC2_SPEAKER_EPT
+#define USBD_UAC2_SPEAKER_EPT 1
+#endif
+#ifndef USBD_UAC2_SPEAKER_FRAME_SIZES
+#define USBD_UAC2_SPEAKER_FRAME_SIZES 4
+#endif
+#ifndef USBD_UAC2_FEEDBACK_EPT
+#define USBD_UAC2_FEEDBACK_EPT 2
+#endif
+#ifndef USBD_UAC2_FEEDBACK_10_14
+#define USBD_UAC2_FEEDBACK_10_14 0
+#endif
+#ifndef USBD_UAC2_FEEDBACK_REFRESH
+#define USBD_UAC2_FEEDBACK_REFRESH 5
+#endif
+#ifndef USBD_UAC2_FEEDBACK_COUNT_SHIFT
+#define USBD_UAC2_FEEDBACK_COUNT_SHIFT 0
+#endif
+#ifndef USBD_UAC2_MIC_ITF
+#define USBD_UAC2_MIC_ITF 2
+#endif
+#ifndef USBD_UAC2_MIC_EPT
+#define USBD_UAC2_MIC_EPT 3
+#endif
+#ifndef USBD_UAC2_MIC_FRAME_SIZES
+#define USBD_UAC2_MIC_FRAME_SIZES 2
+#endif
+#ifndef USBD_UAC2_MIC_EPT_SIZE
+#define USBD_UAC2_MIC_EPT_SIZE 98
+#endif
+
+#if USBD_UAC2_FEEDBACK_REFRESH < 1 || USBD_UAC2_FEEDBACK_REFRESH > 9
+#error "UAC2 feedback refresh period must be between 1 and 9"
+#endif
+
+#if USBD_UAC2_FEEDBACK_10_14
+#define FB_FRAC_BITS 14
+#define FB_SIZE      3
+#else
+#define FB_FRAC_BITS 16
+#define FB_SIZE      4
+#endif
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
+
+static const uint32_t rates[] = {USBD_UAC2_SAMPLE_RATES};
+static uint32_t rate;
+
+static union {
+    uint8_t valid;
+    uint32_t cur;
+    struct __attribute__((packed)) {
+        uint16_t wNumSubRanges;
+        usb_audio2_subrange_4_t subranges[ARRAY_LEN(rates)];
+    } range;
+} ctrl_buf;
+
+#if USBD_UAC2_SPEAKER_EPT > 0
+static const uint8_t speaker_frame_sizes[] = {USBD_UAC2_SPEAKER_FRAME_SIZES};
+
+static struct {
+    uint8_t alt;
+} speaker;
+
+static struct {
+    uint32_t value;
+    uint32_t start;
+    uint16_t frames;
+    bool started;
+} feedback;
+#endif
+
+#if USBD_UAC2_MIC_EPT > 0
+static const uint8_t mic_frame_sizes[] = {USBD_UAC2_MIC_FRAME_SIZES};
+
+static struct {
+    uint8_t alt;
+    uint8_t frame_size;
+    uint16_t acc;
+    uint8_t buf[USBD_UAC2_MIC_EPT_SIZE];
+} mic;
+#endif
+
+
+uint32_t
+usbd_uac2_get_sample_rate(void)
+{
+    return rate;
+}
+
+uint32_t
+usbd_uac2_get_feedback(void)
+{
+#if USBD_UAC2_SPEAKER_EPT > 0
+    return feedback.value;
+#else
+    return 0;
+#endif
+}
+
+
+#if USBD_UAC2_SPEAKER_EPT > 0
+static uint32_t
+feedback_nominal(void)
+{
+    // rates above 64kHz don't fit 16.16 in 32 bits before the division
+    return ((rate / 1000) << FB_FRAC_BITS) + (((rate % 1000) << FB_FRAC_BITS) / 1000);
+}
+
+static void
+feedback_reset(void)
+{
+    feedback.value = feedback_nominal();
+    feedback.frames = 0;
+    feedback.started = false;
+}
+
+static void
+feedback_task(void)
+{
+    if (speaker.alt == 0 || !usbd_uac2_get_sample_count_cb)
+        return;
+
+    uint32_t count = usbd_uac2_get_sample_count_cb();
+    if (!feedback.started) {
+        feedback.start = count;
+        feedback.started = true;
+        return;
+    }
+
+    if (++feedback.frames < (1 << USBD_UAC2_FEEDBACK_REFRESH))
+        return;
+
+    uint32_t delta = count - feedback.start;
+    feedback.start = count;
+    feedback.frames = 0;
+
+    uint32_t nominal = feedback_nominal();
+    if (delta == 0) {
+        feedback.value = nominal;
+        return;
+    }
+
+    uint32_t value = ((uint64_t) delta << FB_FRAC_BITS) >> (USBD_UAC2_FEEDBACK_REFRESH + USBD_UAC2_FEEDBACK_COUNT_SHIFT);
+
+    // keep the host within one sample per frame from the nominal rate
+    if (value > nominal + (1 << FB_FRAC_BITS))
+        value = nominal + (1 << FB_FRAC_BITS);
+    if (value < nominal - (1 << FB_FRAC_BITS))
+        value = nominal - (1 << FB_FRAC_BITS);
+    feedback.value = value;
+}
+#endif
+
+#if USBD_UAC2_MIC_EPT > 0
+static void
+mic_task(void)
+{
+    if (mic.alt == 0)
+        return;
+
+    mic.acc += rate % 1000;
+    uint16_t frames = rate / 1000;
+    if (mic.acc >= 1000) {
+        mic.acc -= 1000;
+        frames++;
+    }
+
+    uint16_t max_frames = sizeof(mic.buf) / mic.frame_size;
+    if (frames > max_frames)
+        frames = max_frames;
+
+    uint16_t len = frames * mic.frame_size;
+    if (usbd_uac2_mic_cb) {
+        uint16_t f = usbd_uac2_mic_cb(mic.buf, frames);
+        len = (f > frames ? frames : f) * mic.frame_size;
+    }
+    else {
+        memset(mic.buf, 0, len);
+    }
+
+    usbd_in(USBD_UAC2_MIC_EPT, mic.buf, len);
+}
+#endif
+
+
+static bool
+set_sample_rate(usb_ctrl_request_t *req, uint16_t len)
+{
+    (void) req;
+    if (len != sizeof(ctrl_buf.cur))
+        return false;
+
+    uint32_t r = ctrl_buf.cur;
+    bool found = false;
+    for (uint8_t i = 0; i < ARRAY_LEN(rates); i++) {
+        if (rates[i] == r) {
+            found = true;
+            break;
+        }
+    }
+    if (!found)
+        return false;
+
+    if (usbd_uac2_set_sample_rate_cb && !usbd_uac2_set_sample_rate_cb(r))
+        return false;
+
+    rate = r;
+#if USBD_UAC2_SPEAKER_EPT > 0
+    feedback_reset();
+#endif
+#if USBD_UAC2_MIC_EPT > 0
+    mic.acc = 0;
+#endif
+    return true;
+}
+
+static bool
+sam_freq_request(usb_ctrl_request_t *req)
+{
+    switch (req->bRequest) {
+    case USB_REQ_AUDIO_UAC2_CUR:
+        if (req->bmRequestType & USB_REQ_DIR_DEVICE_TO_HOST) {
+            ctrl_buf.cur = rate;
+            usbd_control_in(&ctrl_buf.cur, sizeof(ctrl_buf.cur), req->wLength);
+            return true;
+        }
+        usbd_control_out(&ctrl_buf.cur, sizeof(ctrl_buf.cur), req->wLength, set_sample_rate);
+        return true;
+
+    case USB_REQ_AUDIO_UAC2_RANGE:
+        if (!(req->bmRequestType & USB_REQ_DIR_DEVICE_TO_HOST))
+            return false;
+
+        // discrete sample rates are reported as subranges with the same min and max
+        ctrl_buf.range.wNumSubRanges = ARRAY_LEN(rates);
+        for (uint8_t i = 0; i < ARRAY_LEN(rates); i++) {
+            ctrl_buf.range.subranges[i].dMIN = rates[i];
+            ctrl_buf.range.subranges[i].dMAX = rates[i];
+            ctrl_buf.range.subranges[i].dRES = 0;
+        }
+        usbd_control_in(&ctrl_buf.range, sizeof(ctrl_buf.range), req->wLength);
+        return true;
+    }
+
+    return false;
+}
+
+bool
+usbd_uac2_handle_ctrl_request(usb_ctrl_request_t *req)
+{
+    if (((req->bmRequestType & USB_REQ_RCPT_MASK) != USB_REQ_RCPT_INTERFACE) ||
+        ((req->wIndex & 0xff) != USBD_UAC2_AC_ITF) ||
+        ((req->wIndex >> 8) != USBD_UAC2_CLOCK_ID))
+        return false;
+
+    switch (req->wValue >> 8) {
+    case USB_AUDIO_UAC2_CS_CONTROL_SAM_FREQ:
+        return sam_freq_request(req);
+
+    case USB_AUDIO_UAC2_CS_CONTROL_CLOCK_VALID:
+        if ((req->bRequest != USB_REQ_AUDIO_UAC2_CUR) || !(req->bmRequestType & USB_REQ_DIR_DEVICE_TO_HOST))
+            return false;
+
+        ctrl_buf.valid = 1;
+        usbd_control_in(&ctrl_buf.valid, sizeof(ctrl_buf.valid), req->wLength);
+        return true;
+    }
+
+    return false;
+}
+
+void
+usbd_uac2_handle_set_interface(uint8_t itf, uint8_t alt)
+{
+#if USBD_UAC2_SPEAKER_EPT > 0
+    if (itf == USBD_UAC2_SPEAKER_ITF) {
+        speaker.alt = alt <= ARRAY_LEN(speaker_frame_sizes) ? alt : 0;
+        feedback_reset();
+        if (usbd_uac2_stream_cb)
+            usbd_uac2_stream_cb(USBD_UAC2_SPEAKER_EPT, speaker.alt,
+                speaker.alt != 0 ? speaker_frame_sizes[speaker.alt - 1] : 0);
+    }
+#endif
+#if USBD_UAC2_MIC_EPT > 0
+    if (itf == USBD_UAC2_MIC_ITF) {
+        mic.alt = alt <= ARRAY_LEN(mic_frame_sizes) ? alt : 0;
+        mic.frame_size = mic.alt != 0 ? mic_frame_sizes[mic.alt - 1] : 0;
+        mic.acc = 0;
+        if (usbd_uac2_stream_cb)
+            usbd_uac2_stream_cb(USBD_UAC2_MIC_EPT, mic.alt, mic.frame_size);
+    }
+#endif
+}
+
+void
+usbd_uac2_handle_in(uint8_t ept)
+{
+#if USBD_UAC2_SPEAKER_EPT > 0 && USBD_UAC2_FEEDBACK_EPT > 0
+    if (ept == USBD_UAC2_FEEDBACK_EPT && speaker.alt != 0) {
+        usbd_in(USBD_UAC2_FEEDBACK_EPT, &feedback.value, FB_SIZE);
+        return;
+    }
+#endif
+#if USBD_UAC2_MIC_EPT > 0
+    if (ept == USBD_UAC2_MIC_EPT)
+        mic_task();
+#endif
+}
+
+void
+usbd_uac2_handle_out(uint8_t ept)
+{
+#if USBD_UAC2_SPEAKER_EPT > 0
+    if (ept != USBD_UAC2_SPEAKER_EPT)
+        return;
+
+    const void *buf;
+    uint16_t len = usbd_out_peek(ept, &buf);
+    if (speaker.alt != 0 && len > 0 && usbd_uac2_speaker_cb) {
+        uint8_t fs = speaker_frame_sizes[speaker.alt - 1];
+        usbd_uac2_speaker_cb(buf, len - (len % fs));
+    }
+    usbd_out_release(ept);
+#endif
+}
+
+void
+usbd_uac2_handle_sof(void)
+{
+#if USBD_UAC2_SPEAKER_EPT > 0
+    feedback_task();
+#endif
+}
+
+void
+usbd_uac2_handle_reset(void)
+{
+    rate = rates[0];
+#if USBD_UAC2_SPEAKER_EPT > 0
+    speaker.alt = 0;
+    feedback_reset();
+#endif
+#if USBD_UAC2_MIC_EPT > 0
+    mic.alt = 0;
+    mic.frame_size = 0;
+    mic.acc = 0;
+#endif
+}
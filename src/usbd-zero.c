@@ -0,0 +1,181 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <usbd.h>
+#include <usbd-zero.h>
+
+#ifndef USBD_ZERO_BULK_EPT
+#define USBD_ZERO_BULK_EPT 1
+#endif
+#ifndef USBD_ZERO_BULK_EPT_SIZE
+#define USBD_ZERO_BULK_EPT_SIZE 64
+#endif
+#ifndef USBD_ZERO_INT_EPT
+#define USBD_ZERO_INT_EPT 0
+#endif
+#ifndef USBD_ZERO_INT_EPT_SIZE
+#define USBD_ZERO_INT_EPT_SIZE 64
+#endif
+#ifndef USBD_ZERO_LOOPBACK
+#define USBD_ZERO_LOOPBACK 0
+#endif
+#ifndef USBD_ZERO_PATTERN
+#define USBD_ZERO_PATTERN 0
+#endif
+#ifndef USBD_ZERO_CTRL_BUFFER_SIZE
+#define USBD_ZERO_CTRL_BUFFER_SIZE 256
+#endif
+
+#if (USBD_ZERO_PATTERN != 0) && (USBD_ZERO_PATTERN != 1)
+#error "Zero test pattern must be 0 or 1"
+#endif
+
+#if USBD_ZERO_INT_EPT == USBD_ZERO_BULK_EPT
+#error "Zero interrupt endpoint must not be the bulk endpoint"
+#endif
+
+#if USBD_ZERO_INT_EPT > 0 && USBD_ZERO_INT_EPT_SIZE > USBD_ZERO_BULK_EPT_SIZE
+#define PATTERN_SIZE USBD_ZERO_INT_EPT_SIZE
+#else
+#define PATTERN_SIZE USBD_ZERO_BULK_EPT_SIZE
+#endif
+
+#define USB_REQ_ZERO_CTRL_WRITE 0x5b
+#define USB_REQ_ZERO_CTRL_READ  0x5c
+
+// in loopback mode, the OUT packet is held until the IN transfer completes
+typedef struct {
+    bool held;
+} ept_state_t;
+
+static ept_state_t bulk;
+#if USBD_ZERO_INT_EPT > 0
+static ept_state_t intr;
+#endif
+
+// the pattern restarts on every packet, as checked by usbtest
+static uint8_t pattern[PATTERN_SIZE];
+static uint32_t errors = 0;
+
+static uint8_t ctrl_buf[USBD_ZERO_CTRL_BUFFER_SIZE];
+
+
+uint32_t
+usbd_zero_get_errors(void)
+{
+    return errors;
+}
+
+
+static ept_state_t*
+get_state(uint8_t ept, uint16_t *size)
+{
+    if (ept == USBD_ZERO_BULK_EPT) {
+        *size = USBD_ZERO_BULK_EPT_SIZE;
+        return &bulk;
+    }
+#if USBD_ZERO_INT_EPT > 0
+    if (ept == USBD_ZERO_INT_EPT) {
+        *size = USBD_ZERO_INT_EPT_SIZE;
+        return &intr;
+    }
+#endif
+    return NULL;
+}
+
+static bool
+ctrl_write_done(usb_ctrl_request_t *req, uint16_t len)
+{
+    return len == req->wLength;
+}
+
+bool
+usbd_zero_handle_ctrl_request(usb_ctrl_request_t *req)
+{
+    if (((req->bmRequestType & USB_REQ_RCPT_MASK) != USB_REQ_RCPT_DEVICE) ||
+        (req->wValue != 0) || (req->wIndex != 0) ||
+        (req->wLength > USBD_ZERO_CTRL_BUFFER_SIZE))
+        return false;
+
+    switch (req->bRequest) {
+    case USB_REQ_ZERO_CTRL_WRITE:
+        if ((req->bmRequestType & USB_REQ_DIR_MASK) != USB_REQ_DIR_HOST_TO_DEVICE)
+            return false;
+        if (req->wLength > 0)
+            usbd_control_out(ctrl_buf, sizeof(ctrl_buf), req->wLength, ctrl_write_done);
+        return true;
+
+    case USB_REQ_ZERO_CTRL_READ:
+        if ((req->bmRequestType & USB_REQ_DIR_MASK) != USB_REQ_DIR_DEVICE_TO_HOST)
+            return false;
+        usbd_control_in(ctrl_buf, req->wLength, req->wLength);
+        return true;
+    }
+
+    return false;
+}
+
+void
+usbd_zero_handle_in(uint8_t ept)
+{
+    uint16_t size;
+    ept_state_t *s = get_state(ept, &size);
+    if (s == NULL)
+        return;
+
+#if USBD_ZERO_LOOPBACK
+    if (s->held) {
+        s->held = false;
+        usbd_out_release(ept);
+    }
+#else
+    usbd_in(ept, pattern, size);
+#endif
+}
+
+void
+usbd_zero_handle_out(uint8_t ept)
+{
+    uint16_t size;
+    ept_state_t *s = get_state(ept, &size);
+    if (s == NULL)
+        return;
+
+    const uint8_t *buf;
+    uint16_t len = usbd_out_peek(ept, (const void**) &buf);
+
+#if USBD_ZERO_LOOPBACK
+    // the packet is sent back straight from the endpoint buffer
+    usbd_in(ept, buf, len);
+    s->held = true;
+#else
+    for (uint16_t i = 0; i < len; i++) {
+        if (buf[i] != pattern[i]) {
+            errors++;
+            break;
+        }
+    }
+    usbd_out_release(ept);
+#endif
+}
+
+void
+usbd_zero_handle_reset(void)
+{
+#if USBD_ZERO_PATTERN == 1
+    for (uint16_t i = 0; i < PATTERN_SIZE; i++)
+        pattern[i] = i % 63;
+#endif
+
+    bulk.held = false;
+#if USBD_ZERO_INT_EPT > 0
+    intr.held = false;
+#endif
+}
@@ -6,127 +6,115 @@
  */
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <usbd.h>
+#include <usbd-ept.h>
 
-#if defined(STM32F0) || defined(STM32F0xx)
-#include <stm32f0xx.h>
-#define USB_COUNT0_RX_BLSIZE        (0x1UL << (15U))
-#define USB_COUNT1_RX_0_COUNT1_RX_0 (0x000003FFU)
-#elif defined(STM32G4) || defined(STM32G4xx)
-#include <stm32g4xx.h>
-#else
-#error "Unsupported STM32 series"
-#endif
-
-#ifndef USB
-#error "No supported USB device available"
+#if defined(USBD_ENABLE_LPM) && !defined(USB_LPMCSR_LMPEN)
+#error "Link Power Management not supported by the USB device"
 #endif
 
-#ifndef USBD_EP1_IN_SIZE
-#define USBD_EP1_IN_SIZE 0
-#endif
-#ifndef USBD_EP1_OUT_SIZE
-#define USBD_EP1_OUT_SIZE 0
-#endif
-#ifndef USBD_EP2_IN_SIZE
-#define USBD_EP2_IN_SIZE 0
-#endif
-#ifndef USBD_EP2_OUT_SIZE
-#define USBD_EP2_OUT_SIZE 0
-#endif
-#ifndef USBD_EP3_IN_SIZE
-#define USBD_EP3_IN_SIZE 0
-#endif
-#ifndef USBD_EP3_OUT_SIZE
-#define USBD_EP3_OUT_SIZE 0
+#ifdef USBD_ENABLE_DMA
+#if !defined(STM32G4) && !defined(STM32G4xx)
+#error "DMA-assisted packet memory copies are only supported by STM32G4"
 #endif
-#ifndef USBD_EP4_IN_SIZE
-#define USBD_EP4_IN_SIZE 0
+#ifndef USBD_DMA_CHANNEL
+#define USBD_DMA_CHANNEL 1
 #endif
-#ifndef USBD_EP4_OUT_SIZE
-#define USBD_EP4_OUT_SIZE 0
+#ifndef USBD_DMA_MIN_SIZE
+#define USBD_DMA_MIN_SIZE 32
 #endif
-#ifndef USBD_EP5_IN_SIZE
-#define USBD_EP5_IN_SIZE 0
+#if (USBD_DMA_CHANNEL < 1) || (USBD_DMA_CHANNEL > 8)
+#error "Invalid DMA channel"
 #endif
-#ifndef USBD_EP5_OUT_SIZE
-#define USBD_EP5_OUT_SIZE 0
-#endif
-#ifndef USBD_EP6_IN_SIZE
-#define USBD_EP6_IN_SIZE 0
-#endif
-#ifndef USBD_EP6_OUT_SIZE
-#define USBD_EP6_OUT_SIZE 0
-#endif
-#ifndef USBD_EP7_IN_SIZE
-#define USBD_EP7_IN_SIZE 0
-#endif
-#ifndef USBD_EP7_OUT_SIZE
-#define USBD_EP7_OUT_SIZE 0
+#define __dma_channel(n) DMA1_Channel ## n
+#define _dma_channel(n)  __dma_channel(n)
+#define DMA_CHANNEL      _dma_channel(USBD_DMA_CHANNEL)
+#define DMA_ISR_TCIF     (DMA_ISR_TCIF1 << (4 * (USBD_DMA_CHANNEL - 1)))
+#define DMA_ISR_TEIF     (DMA_ISR_TEIF1 << (4 * (USBD_DMA_CHANNEL - 1)))
+#define DMA_IFCR_CGIF    (DMA_IFCR_CGIF1 << (4 * (USBD_DMA_CHANNEL - 1)))
 #endif
 
-#ifndef USBD_EP1_TYPE
-#define USBD_EP1_TYPE BULK
-#endif
-#ifndef USBD_EP2_TYPE
-#define USBD_EP2_TYPE BULK
-#endif
-#ifndef USBD_EP3_TYPE
-#define USBD_EP3_TYPE BULK
-#endif
-#ifndef USBD_EP4_TYPE
-#define USBD_EP4_TYPE BULK
-#endif
-#ifndef USBD_EP5_TYPE
-#define USBD_EP5_TYPE BULK
+#ifndef USBD_MAX_INTERFACES
+#define USBD_MAX_INTERFACES 8
 #endif
-#ifndef USBD_EP6_TYPE
-#define USBD_EP6_TYPE BULK
+
+#define ep_iso_bidir(EPT) (USBD_EP_IS_ISO(EPT) && \
+                           (USBD_EP ## EPT ## _IN_SIZE != 0) && (USBD_EP ## EPT ## _OUT_SIZE != 0))
+
+#if ep_iso_bidir(1) || ep_iso_bidir(2) || ep_iso_bidir(3) || ep_iso_bidir(4) || \
+    ep_iso_bidir(5) || ep_iso_bidir(6) || ep_iso_bidir(7)
+#error "Unsupported endpoint configuration, isochronous endpoints must be IN or OUT only"
 #endif
-#ifndef USBD_EP7_TYPE
-#define USBD_EP7_TYPE BULK
+
+#undef ep_iso_bidir
+
+// full speed bulk and interrupt packets are up to 64 bytes, isochronous packets up to
+// 1023 bytes.
+#define ep_max_size(EPT)     (USBD_EP_IS_ISO(EPT) ? 1023 : 64)
+#define ep_size_invalid(EPT) ((USBD_EP ## EPT ## _IN_SIZE > ep_max_size(EPT)) || \
+                              (USBD_EP ## EPT ## _OUT_SIZE > ep_max_size(EPT)))
+
+#if ep_size_invalid(1) || ep_size_invalid(2) || ep_size_invalid(3) || ep_size_invalid(4) || \
+    ep_size_invalid(5) || ep_size_invalid(6) || ep_size_invalid(7)
+#error "Unsupported endpoint configuration, bulk and interrupt endpoints must be up to 64 bytes, isochronous endpoints up to 1023 bytes"
 #endif
 
-#if (USBD_EP1_IN_SIZE + USBD_EP1_OUT_SIZE + USBD_EP2_IN_SIZE + USBD_EP2_OUT_SIZE + \
-     USBD_EP3_IN_SIZE + USBD_EP3_OUT_SIZE + USBD_EP4_IN_SIZE + USBD_EP4_OUT_SIZE + \
-     USBD_EP5_IN_SIZE + USBD_EP5_OUT_SIZE + USBD_EP6_IN_SIZE + USBD_EP6_OUT_SIZE + \
-     USBD_EP7_IN_SIZE + USBD_EP7_OUT_SIZE) > (1024 - 64 - USBD_EP0_SIZE - USBD_EP0_SIZE)
-#error "Unsupported endpoint configuration, not enough USB SRAM available"
+#undef ep_size_invalid
+#undef ep_max_size
+
+// the buffers are checked one endpoint at a time, with the sizes rounded as allocated
+// by the hardware, to point to the first endpoint that doesn't fit.
+#define ep_pma_overflow(EPT) ((USBD_EP ## EPT ## _PMA_OUT_ADDR + USBD_EP_PMA_OUT_SIZE(EPT)) > \
+                              USBD_PMA_SIZE)
+
+#if ep_pma_overflow(1)
+#error "Unsupported endpoint configuration, endpoint 1 buffers don't fit the USB SRAM"
+#elif ep_pma_overflow(2)
+#error "Unsupported endpoint configuration, endpoint 2 buffers don't fit the USB SRAM"
+#elif ep_pma_overflow(3)
+#error "Unsupported endpoint configuration, endpoint 3 buffers don't fit the USB SRAM"
+#elif ep_pma_overflow(4)
+#error "Unsupported endpoint configuration, endpoint 4 buffers don't fit the USB SRAM"
+#elif ep_pma_overflow(5)
+#error "Unsupported endpoint configuration, endpoint 5 buffers don't fit the USB SRAM"
+#elif ep_pma_overflow(6)
+#error "Unsupported endpoint configuration, endpoint 6 buffers don't fit the USB SRAM"
+#elif ep_pma_overflow(7)
+#error "Unsupported endpoint configuration, endpoint 7 buffers don't fit the USB SRAM"
 #endif
 
-typedef struct {
-    __IOM uint16_t addr;
-    __IOM uint16_t cnt;
-} __ALIGNED(2) pma_entry_t;
+#undef ep_pma_overflow
 
-static struct {
+// the endpoint layout is fixed at build time, and kept in flash memory.
+static const struct {
+    __IOM usbd_epr_t* reg;
     uint16_t type;
-    __IOM uint16_t* reg;
-    __IOM pma_entry_t* pma_in;
-    __IOM pma_entry_t* pma_out;
-    uint8_t size_in;
-    uint8_t size_out;
+    uint16_t addr_in;
+    uint16_t addr_out;
+    uint16_t size_in;
+    uint16_t size_out;
 } endpoints[] = {
     {
+        .reg      = USBD_EPR(0),
         .type     = USB_EP_CONTROL,
-        .reg      = (__IOM uint16_t*) &(USB->EP0R),
-        .pma_in   = (__IOM pma_entry_t*) USB_PMAADDR,
-        .pma_out  = (__IOM pma_entry_t*) (USB_PMAADDR + sizeof(pma_entry_t)),
+        .addr_in  = USBD_EP0_PMA_IN_ADDR,
+        .addr_out = USBD_EP0_PMA_OUT_ADDR,
         .size_in  = USBD_EP0_SIZE,
         .size_out = USBD_EP0_SIZE,
     },
 
-#define __endpoint(EPT, TYP)                                                               \
-    {                                                                                      \
-        .type     = USB_EP_ ## TYP,                                                        \
-        .reg      = (__IOM uint16_t*) &(USB->EP ## EPT ## R),                              \
-        .pma_in   = (__IOM pma_entry_t*) (USB_PMAADDR + (EPT << 3)),                       \
-        .pma_out  = (__IOM pma_entry_t*) (USB_PMAADDR + (EPT << 3) + sizeof(pma_entry_t)), \
-        .size_in  = USBD_EP ## EPT ## _IN_SIZE,                                            \
-        .size_out = USBD_EP ## EPT ## _OUT_SIZE,                                           \
+#define __endpoint(EPT, TYP)                                    \
+    {                                                           \
+        .reg      = USBD_EPR(EPT),                              \
+        .type     = USB_EP_ ## TYP,                             \
+        .addr_in  = USBD_EP ## EPT ## _PMA_IN_ADDR,             \
+        .addr_out = USBD_EP ## EPT ## _PMA_OUT_ADDR,            \
+        .size_in  = USBD_EP ## EPT ## _IN_SIZE,                 \
+        .size_out = USBD_EP ## EPT ## _OUT_SIZE,                \
     }
 #define _endpoint(EPT, TYP) __endpoint(EPT, TYP)
 #define endpoint(EPT)       _endpoint(EPT, USBD_EP ## EPT ## _TYPE)
@@ -145,84 +133,423 @@ static struct {
 };
 
 
+// rx buffer sizes are described by the number of blocks allocated, in bits 14:10: 2 byte
+// blocks up to 62 bytes, 32 byte blocks (encoded minus one) above that.
+static uint16_t
+pma_rx_count(uint16_t size)
+{
+    if (size > 62)
+        return USB_COUNT0_RX_BLSIZE | ((((size + 31) >> 5) - 1) << 10);
+    return ((size + 1) >> 1) << 10;
+}
+
 static void
 pma_init(void)
 {
-    uint32_t entry_addr = USB_PMAADDR;
-    uint32_t mem_addr = USB_PMAADDR + 16 * sizeof(pma_entry_t);  // right after entry table
-
     for (uint8_t i = 0; i < 8; i++) {
-        pma_entry_t *e = (pma_entry_t*) entry_addr;
-        uint8_t *m = (uint8_t*) mem_addr;
+        // both buffers are used by the single direction of isochronous endpoints
+        uint16_t cnt_in = 0;
+        uint16_t cnt_out = pma_rx_count(endpoints[i].size_out);
+        if (endpoints[i].type == USB_EP_ISOCHRONOUS)
+            cnt_in = cnt_out;
+
+        usbd_pma_set(i << 1, endpoints[i].addr_in, cnt_in);
+        usbd_pma_set((i << 1) + 1, endpoints[i].addr_out, cnt_out);
+    }
+
+#ifndef USBD_DRD
+    USB->BTABLE = 0;
+#endif
+}
+
 
-        e->addr = m - ((uint8_t*) USB_PMAADDR);
-        e->cnt = 0;
+static enum {
+    STATE_DEFAULT,
+    STATE_ADDRESS,
+    STATE_CONFIGURED,
+} state = STATE_DEFAULT;
+
+// isochronous endpoints can't nak, they are disabled unless enabled by the current
+// alternate setting of their interface.
+static uint8_t iso_enabled = 0;
+
+// endpoints other than endpoint 0 only get their address after SET_CONFIGURATION, and
+// must not be validated before that, not to answer to the address of endpoint 0.
+static inline bool
+in_ready(uint8_t ept)
+{
+    if (ept == 0)
+        return true;
+    if ((endpoints[ept].type == USB_EP_ISOCHRONOUS) && !(iso_enabled & (1 << ept)))
+        return false;
+    return (state == STATE_CONFIGURED) && (((*endpoints[ept].reg) & USB_EPADDR_FIELD) == ept);
+}
 
-        entry_addr += sizeof(pma_entry_t);
-        mem_addr += endpoints[i].size_in;
 
-        e = (pma_entry_t*) entry_addr;
-        m = (uint8_t*) mem_addr;
+#ifdef USBD_ENABLE_DMA
+static volatile uint8_t dma_ept = 0;
+static uint8_t dma_descr;
+static uint16_t dma_addr;
+static uint16_t dma_cnt;
 
-        e->addr = m - ((uint8_t*) USB_PMAADDR);
-        if (endpoints[i].size_out > 62)
-            e->cnt = USB_COUNT0_RX_BLSIZE | ((endpoints[i].size_out >> 6) & 0b11111);
-        else
-            e->cnt = ((endpoints[i].size_out >> 1) & 0b11111);
+void
+usbd_dma_irq_handler(void)
+{
+    uint32_t isr = DMA1->ISR;
+    if (!(isr & (DMA_ISR_TCIF | DMA_ISR_TEIF)))
+        return;
 
-        entry_addr += sizeof(pma_entry_t);
-        mem_addr += endpoints[i].size_out;
-    }
+    DMA1->IFCR = DMA_IFCR_CGIF;
+    DMA_CHANNEL->CCR = 0;
 
-    USB->BTABLE = 0;
+    uint8_t ept = dma_ept;
+    if (ept == 0)
+        return;
+
+    // the endpoint is only validated after the whole packet reaches the packet memory.
+    // packets not copied due to transfer errors are dropped, and the endpoint is
+    // reported as idle again.
+    if (!(isr & DMA_ISR_TEIF)) {
+        usbd_pma_set_count(dma_descr, dma_addr, dma_cnt);
+        __IO usbd_epr_t *ep = endpoints[ept].reg;
+        *ep = (*ep ^ USB_EP_TX_VALID) & (USB_EPREG_MASK | USB_EPTX_STAT);
+    }
+    dma_ept = 0;
 }
 
+static void
+dma_abort(void)
+{
+    DMA_CHANNEL->CCR = 0;
+    DMA1->IFCR = DMA_IFCR_CGIF;
+    dma_ept = 0;
+}
+#endif
 
 bool
 usbd_in(uint8_t ept, const void *buf, uint16_t buflen)
 {
-    if (ept >= 8)
-        return false;
+    return usbd_in_gather(ept, buf, buflen, NULL, 0);
+}
 
-    __IO pma_entry_t *e = endpoints[ept].pma_in;
-    if (e->addr == 0)
+bool
+usbd_in_gather(uint8_t ept, const void *buf1, uint16_t len1, const void *buf2, uint16_t len2)
+{
+    if ((ept >= 8) || (endpoints[ept].size_in == 0) || !in_ready(ept))
         return false;
 
-    const uint8_t *src = buf;
-    __IO uint16_t *dst = (uint16_t*) (USB_PMAADDR + e->addr);
+    __IO usbd_epr_t *ep = endpoints[ept].reg;
+    uint8_t descr = ept << 1;
+    uint16_t addr = endpoints[ept].addr_in;
 
-    uint16_t tmp;
-    for (uint16_t i = 0; i < ((buflen + 1) >> 1); i++) {
-        tmp = *(src++);
-        tmp |= (((uint16_t) *(src++)) << 8);
-        *(dst++) = tmp;
+    // the hardware sends the isochronous buffer selected by DTOG_TX, the other one is
+    // filled for the next frame.
+    if ((endpoints[ept].type == USB_EP_ISOCHRONOUS) && !(*ep & USB_EP_DTOG_TX)) {
+        descr++;
+        addr = endpoints[ept].addr_out;
     }
-    e->cnt = buflen;
 
-    __IO uint16_t *ep = endpoints[ept].reg;
+    usbd_pma_write(addr, buf1, len1, buf2, len2);
+    usbd_pma_set_count(descr, addr, len1 + len2);
+
     *ep = (*ep ^ USB_EP_TX_VALID) & (USB_EPREG_MASK | USB_EPTX_STAT);
     return true;
 }
 
+#ifdef USBD_ENABLE_DMA
+bool
+usbd_in_dma(uint8_t ept, const void *buf, uint16_t buflen)
+{
+    // short packets, unaligned buffers and packets sent while the channel is busy are
+    // copied by the cpu.
+    if ((ept == 0) || (ept >= 8) || (endpoints[ept].size_in == 0) || (dma_ept != 0) ||
+        (buflen < USBD_DMA_MIN_SIZE) || ((((uint32_t) buf) & 1) != 0))
+        return usbd_in(ept, buf, buflen);
+
+    if (!in_ready(ept))
+        return false;
+
+    __IO usbd_epr_t *ep = endpoints[ept].reg;
+    uint8_t descr = ept << 1;
+    uint16_t addr = endpoints[ept].addr_in;
+
+    if ((endpoints[ept].type == USB_EP_ISOCHRONOUS) && !(*ep & USB_EP_DTOG_TX)) {
+        descr++;
+        addr = endpoints[ept].addr_out;
+    }
+
+    __IO uint16_t *dst = (__IO uint16_t*) (USB_PMAADDR + addr);
+    const uint8_t *src = buf;
+    if (buflen & 1)
+        dst[buflen >> 1] = src[buflen - 1];
+
+    dma_ept = ept;
+    dma_descr = descr;
+    dma_addr = addr;
+    dma_cnt = buflen;
+    DMA_CHANNEL->CCR = 0;
+    DMA_CHANNEL->CPAR = (uint32_t) dst;
+    DMA_CHANNEL->CMAR = (uint32_t) buf;
+    DMA_CHANNEL->CNDTR = buflen >> 1;
+    DMA_CHANNEL->CCR = DMA_CCR_MEM2MEM | DMA_CCR_DIR | DMA_CCR_MINC | DMA_CCR_PINC |
+        DMA_CCR_PSIZE_0 | DMA_CCR_MSIZE_0 | DMA_CCR_TCIE | DMA_CCR_TEIE | DMA_CCR_EN;
+    return true;
+}
+#endif
+
+// the hardware receives into the isochronous buffer selected by DTOG_RX, the other one
+// holds the data of the previous frame.
+static uint16_t
+out_buffer(uint8_t ept, uint16_t *addr)
+{
+    if ((endpoints[ept].type == USB_EP_ISOCHRONOUS) && (*(endpoints[ept].reg) & USB_EP_DTOG_RX)) {
+        *addr = endpoints[ept].addr_in;
+        return usbd_pma_get_count(ept << 1);
+    }
+
+    *addr = endpoints[ept].addr_out;
+    return usbd_pma_get_count((ept << 1) + 1);
+}
+
+#if defined(USBD_DRD) || defined(USBD_PMA_2X16)
+// the packet memory only supports word accesses, or is not contiguous in the address
+// space, so data accessed in place is copied to a buffer that fits the largest OUT
+// endpoint.
+#define max(a, b)   ((a) > (b) ? (a) : (b))
+#define OUT_BUFSIZE max(USBD_EP0_SIZE,                                                \
+                        max(max(max(USBD_EP1_OUT_SIZE, USBD_EP2_OUT_SIZE),            \
+                                max(USBD_EP3_OUT_SIZE, USBD_EP4_OUT_SIZE)),           \
+                            max(max(USBD_EP5_OUT_SIZE, USBD_EP6_OUT_SIZE), USBD_EP7_OUT_SIZE)))
+
+static uint32_t out_buf[(OUT_BUFSIZE + 3) / 4];
+
+#undef OUT_BUFSIZE
+#undef max
+#endif
+
 uint16_t
-usbd_out(uint8_t ept, void *buf, uint16_t buflen)
+usbd_out_peek(uint8_t ept, const void **buf)
+{
+    if ((ept >= 8) || (endpoints[ept].size_out == 0))
+        return 0;
+
+    uint16_t addr;
+    uint16_t rv = out_buffer(ept, &addr);
+
+    if (buf != NULL) {
+#if defined(USBD_DRD) || defined(USBD_PMA_2X16)
+        usbd_pma_read(addr, out_buf, rv, NULL, 0);
+        *buf = out_buf;
+#else
+        *buf = (const void*) (USB_PMAADDR + addr);
+#endif
+    }
+    return rv;
+}
+
+void
+usbd_out_release(uint8_t ept)
 {
     if (ept >= 8)
-        return false;
+        return;
+
+    __IO usbd_epr_t *ep = endpoints[ept].reg;
+    *ep = (*ep ^ USB_EP_RX_VALID) & (USB_EPREG_MASK | USB_EPRX_STAT);
+}
 
-    __IO pma_entry_t *e = endpoints[ept].pma_out;
-    if (e->addr == 0)
+uint16_t
+usbd_out(uint8_t ept, void *buf, uint16_t buflen)
+{
+    if ((ept >= 8) || (endpoints[ept].size_out == 0))
         return 0;
 
-    uint16_t rv = e->cnt & USB_COUNT1_RX_0_COUNT1_RX_0;
+    uint16_t addr;
+    uint16_t rv = out_buffer(ept, &addr);
     rv = (rv > buflen) ? buflen : rv;
-    memcpy(buf, (void*) (USB_PMAADDR + e->addr), rv);
+    usbd_pma_read(addr, buf, rv, NULL, 0);
 
-    __IO uint16_t *ep = endpoints[ept].reg;
-    *ep = (*ep ^ USB_EP_RX_VALID) & (USB_EPREG_MASK | USB_EPRX_STAT);
+    usbd_out_release(ept);
     return rv;
 }
 
+bool
+usbd_stall(uint8_t addr)
+{
+    uint8_t ept = addr & 0x7;
+    if ((endpoints[ept].type != USB_EP_BULK) && (endpoints[ept].type != USB_EP_INTERRUPT))
+        return false;
+
+    if (addr & USB_DESCR_EPT_ADDR_DIR_IN) {
+        if (endpoints[ept].size_in != 0) {
+            *(endpoints[ept].reg) = (*(endpoints[ept].reg) ^ USB_EP_TX_STALL) &
+                (USB_EPREG_MASK | USB_EPTX_STAT);
+            return true;
+        }
+    }
+    else if (endpoints[ept].size_out != 0) {
+        *(endpoints[ept].reg) = (*(endpoints[ept].reg) ^ USB_EP_RX_STALL) &
+            (USB_EPREG_MASK | USB_EPRX_STAT);
+        return true;
+    }
+
+    return false;
+}
+
+
+#ifdef USBD_ENABLE_STREAM
+static struct {
+    const uint8_t *buf;
+    uint32_t len;
+    uint32_t cons;
+    uint32_t prod;
+    uint32_t avail;
+    uint32_t overruns;
+    usbd_stream_index_cb_t get_index;
+} stream_in[8];
+
+bool
+usbd_stream_in_start(uint8_t ept, const void *buf, uint32_t buflen, usbd_stream_index_cb_t get_index)
+{
+    if ((ept == 0) || (ept >= 8) || (endpoints[ept].size_in == 0) || (buf == NULL) ||
+        (buflen == 0) || (get_index == NULL))
+        return false;
+
+    stream_in[ept].get_index = NULL;
+    stream_in[ept].buf = buf;
+    stream_in[ept].len = buflen;
+    stream_in[ept].prod = get_index();
+    stream_in[ept].cons = stream_in[ept].prod;
+    stream_in[ept].avail = 0;
+    stream_in[ept].overruns = 0;
+    stream_in[ept].get_index = get_index;
+    return true;
+}
+
+void
+usbd_stream_in_stop(uint8_t ept)
+{
+    if (ept < 8)
+        stream_in[ept].get_index = NULL;
+}
+
+uint32_t
+usbd_stream_in_get_overruns(uint8_t ept)
+{
+    return ept < 8 ? stream_in[ept].overruns : 0;
+}
+
+static void
+stream_in_task(uint8_t ept)
+{
+    // the producer is assumed to move less than the whole buffer between packets, data
+    // not sent yet is overwritten when it moves further than the free space.
+    uint32_t prod = stream_in[ept].get_index();
+    stream_in[ept].avail += prod >= stream_in[ept].prod ? prod - stream_in[ept].prod :
+        prod + stream_in[ept].len - stream_in[ept].prod;
+    stream_in[ept].prod = prod;
+
+    if (stream_in[ept].avail >= stream_in[ept].len) {
+        stream_in[ept].overruns++;
+        stream_in[ept].cons = prod;
+        stream_in[ept].avail = 0;
+    }
+
+    uint16_t n = stream_in[ept].avail < endpoints[ept].size_in ? stream_in[ept].avail :
+        endpoints[ept].size_in;
+
+    // idle isochronous endpoints send zero length packets, to keep the completions going
+    if ((n == 0) && (endpoints[ept].type != USB_EP_ISOCHRONOUS))
+        return;
+
+    // packets are copied straight from the stream buffer, in two parts when wrapping
+    uint32_t cons = stream_in[ept].cons;
+    uint16_t first = stream_in[ept].len - cons < n ? stream_in[ept].len - cons : n;
+    if (!usbd_in_gather(ept, stream_in[ept].buf + cons, first, stream_in[ept].buf, n - first))
+        return;
+
+    cons += n;
+    if (cons >= stream_in[ept].len)
+        cons -= stream_in[ept].len;
+    stream_in[ept].cons = cons;
+    stream_in[ept].avail -= n;
+}
+
+static struct {
+    uint8_t *buf;
+    uint32_t len;
+    volatile uint32_t prod;
+    bool held;
+    usbd_stream_index_cb_t get_index;
+} stream_out[8];
+
+bool
+usbd_stream_out_start(uint8_t ept, void *buf, uint32_t buflen, usbd_stream_index_cb_t get_index)
+{
+    if ((ept == 0) || (ept >= 8) || (endpoints[ept].size_out == 0) ||
+        (endpoints[ept].type == USB_EP_ISOCHRONOUS) || (buf == NULL) ||
+        (buflen <= endpoints[ept].size_out) || (get_index == NULL))
+        return false;
+
+    stream_out[ept].get_index = NULL;
+    stream_out[ept].buf = buf;
+    stream_out[ept].len = buflen;
+    stream_out[ept].prod = get_index();
+    stream_out[ept].held = false;
+    stream_out[ept].get_index = get_index;
+    return true;
+}
+
+void
+usbd_stream_out_stop(uint8_t ept)
+{
+    if ((ept == 0) || (ept >= 8) || (stream_out[ept].get_index == NULL))
+        return;
+
+    stream_out[ept].get_index = NULL;
+
+    // the packet waiting for space is dropped
+    if (stream_out[ept].held) {
+        stream_out[ept].held = false;
+        usbd_out_release(ept);
+    }
+}
+
+uint32_t
+usbd_stream_out_get_index(uint8_t ept)
+{
+    return ept < 8 ? stream_out[ept].prod : 0;
+}
+
+static void
+stream_out_task(uint8_t ept)
+{
+    uint16_t addr;
+    uint16_t n = out_buffer(ept, &addr);
+
+    // one byte is always left free, so that a full buffer is not seen as empty
+    uint32_t prod = stream_out[ept].prod;
+    uint32_t cons = stream_out[ept].get_index();
+    uint32_t space = cons > prod ? cons - prod - 1 : cons + stream_out[ept].len - prod - 1;
+
+    // the endpoint is NAKed until the consumer frees enough space
+    if (space < n) {
+        stream_out[ept].held = true;
+        return;
+    }
+
+    uint32_t first = stream_out[ept].len - prod < n ? stream_out[ept].len - prod : n;
+    usbd_pma_read(addr, stream_out[ept].buf + prod, first, stream_out[ept].buf, n - first);
+
+    prod += n;
+    if (prod >= stream_out[ept].len)
+        prod -= stream_out[ept].len;
+    stream_out[ept].prod = prod;
+    stream_out[ept].held = false;
+
+    usbd_out_release(ept);
+}
+#endif
+
 
 static const uint8_t* ctrl_in_buf = NULL;
 static uint16_t ctrl_in_buflen = 0;
@@ -251,6 +578,46 @@ usbd_control_in_resume(void)
 }
 
 
+static usb_ctrl_request_t ctrl_req;
+static uint8_t *ctrl_out_buf = NULL;
+static uint16_t ctrl_out_buflen = 0;
+static uint16_t ctrl_out_len = 0;
+static usbd_control_out_cb_t ctrl_out_cb = NULL;
+
+void
+usbd_control_out(void *buf, uint16_t buflen, uint16_t reqlen, usbd_control_out_cb_t cb)
+{
+    ctrl_out_buf = buf;
+    ctrl_out_buflen = reqlen < buflen ? reqlen : buflen;
+    ctrl_out_len = 0;
+    ctrl_out_cb = cb;
+}
+
+static void
+ctrl_stall(void)
+{
+    *(endpoints[0].reg) = (*(endpoints[0].reg) ^ USB_EP_TX_STALL) & (USB_EPREG_MASK | USB_EPTX_STAT);
+    *(endpoints[0].reg) = (*(endpoints[0].reg) ^ USB_EP_RX_STALL) & (USB_EPREG_MASK | USB_EPRX_STAT);
+}
+
+static void
+usbd_control_out_resume(void)
+{
+    uint16_t l = usbd_out(0, ctrl_out_buf + ctrl_out_len, ctrl_out_buflen - ctrl_out_len);
+    ctrl_out_len += l;
+    if ((l == USBD_EP0_SIZE) && (ctrl_out_len < ctrl_out_buflen))
+        return;
+
+    usbd_control_out_cb_t cb = ctrl_out_cb;
+    ctrl_out_cb = NULL;
+
+    if (cb(&ctrl_req, ctrl_out_len))
+        usbd_control_in(NULL, 0, 0);
+    else
+        ctrl_stall();
+}
+
+
 __STATIC_FORCEINLINE uint8_t
 get_config_bConfigurationValue(void)
 {
@@ -260,7 +627,7 @@ get_config_bConfigurationValue(void)
     return cfg->bConfigurationValue;
 }
 
-__STATIC_FORCEINLINE bool
+static bool
 write_device_descriptor(usb_ctrl_request_t *req)
 {
     const usb_device_descriptor_t *dev = usbd_get_device_descriptor_cb();
@@ -271,7 +638,7 @@ write_device_descriptor(usb_ctrl_request_t *req)
     return true;
 }
 
-__STATIC_FORCEINLINE bool
+static bool
 write_config_descriptor(usb_ctrl_request_t *req)
 {
     const usb_config_descriptor_t *cfg = usbd_get_config_descriptor_cb();
@@ -282,7 +649,7 @@ write_config_descriptor(usb_ctrl_request_t *req)
     return true;
 }
 
-__STATIC_FORCEINLINE bool
+static bool
 write_string_descriptor(usb_ctrl_request_t *req)
 {
     const usb_string_descriptor_t *str = usbd_get_string_descriptor_cb(req->wIndex, req->wValue);
@@ -293,265 +660,544 @@ write_string_descriptor(usb_ctrl_request_t *req)
     return true;
 }
 
+static bool
+write_bos_descriptor(usb_ctrl_request_t *req)
+{
+    if (usbd_get_bos_descriptor_cb == NULL)
+        return false;
 
-static enum {
-    STATE_DEFAULT,
-    STATE_ADDRESS,
-    STATE_CONFIGURED,
-} state = STATE_DEFAULT;
+    const usb_bos_descriptor_t *bos = usbd_get_bos_descriptor_cb();
+    if (bos == NULL)
+        return false;
 
-static bool set_address = false;
-static uint16_t address = 0;
+    usbd_control_in(bos, bos->wTotalLength, req->wLength);
+    return true;
+}
+
+// every chapter 9 descriptor type is listed explicitly. a NULL entry means that the
+// descriptor does not exist for a full-speed only device (or can't be requested
+// directly), and the request is stalled right away.
+static bool (*const descriptor_handlers[])(usb_ctrl_request_t *req) = {
+    [USB_DESCR_TYPE_DEVICE]                    = write_device_descriptor,
+    [USB_DESCR_TYPE_CONFIGURATION]             = write_config_descriptor,
+    [USB_DESCR_TYPE_STRING]                    = write_string_descriptor,
+    [USB_DESCR_TYPE_INTERFACE]                 = NULL,
+    [USB_DESCR_TYPE_ENDPOINT]                  = NULL,
+    [USB_DESCR_TYPE_DEVICE_QUALIFIER]          = NULL,
+    [USB_DESCR_TYPE_OTHER_SPEED_CONFIGURATION] = NULL,
+    [USB_DESCR_TYPE_INTERFACE_POWER]           = NULL,
+    [USB_DESCR_TYPE_OTG]                       = NULL,
+    [USB_DESCR_TYPE_DEBUG]                     = NULL,
+    [USB_DESCR_TYPE_INTERFACE_ASSOCIATION]     = NULL,
+    [USB_DESCR_TYPE_BOS]                       = write_bos_descriptor,
+};
 
 static bool
-handle_ctrl_setup(usb_ctrl_request_t *req)
+write_msos20_descriptor_set(usb_ctrl_request_t *req)
 {
-    if ((req->bmRequestType & USB_REQ_TYPE_MASK) == USB_REQ_TYPE_CLASS) {
-        if (usbd_ctrl_request_handle_class_cb)
-            return usbd_ctrl_request_handle_class_cb(req);
+    if (usbd_get_msos20_descriptor_set_cb == NULL)
         return false;
-    }
 
-    if ((req->bmRequestType & USB_REQ_TYPE_MASK) == USB_REQ_TYPE_VENDOR) {
-        if (usbd_ctrl_request_handle_vendor_cb)
-            return usbd_ctrl_request_handle_vendor_cb(req);
+    const usb_msos20_set_header_descriptor_t *set = usbd_get_msos20_descriptor_set_cb();
+    if (set == NULL)
         return false;
-    }
 
-    switch (req->bRequest) {
-    case USB_REQ_GET_STATUS:
-        if (((req->bmRequestType & USB_REQ_DIR_MASK) == USB_REQ_DIR_HOST_TO_DEVICE) ||
-            (state != STATE_CONFIGURED))
-            break;
+    usbd_control_in(set, set->wTotalLength, req->wLength);
+    return true;
+}
 
-        uint8_t status[2] = {0, 0};
+static bool
+write_webusb_url_descriptor(usb_ctrl_request_t *req)
+{
+    if (usbd_get_webusb_url_descriptor_cb == NULL)
+        return false;
 
-        switch (req->bmRequestType & USB_REQ_RCPT_MASK) {
-        case USB_REQ_RCPT_DEVICE:
-            {
-                const usb_config_descriptor_t *cfg = usbd_get_config_descriptor_cb();
-                if (cfg != NULL && (cfg->bmAttributes & USB_DESCR_CONFIG_ATTR_SELF_POWERED))
-                    status[0] |= (1 << 0);
-            }
-            break;
+    const usb_webusb_url_descriptor_t *url = usbd_get_webusb_url_descriptor_cb(req->wValue);
+    if (url == NULL)
+        return false;
 
-        case USB_REQ_RCPT_INTERFACE:
-            if (usbd_get_interface_descriptor_cb(req->wIndex) == NULL)
-                return false;
-            break;
+    usbd_control_in(url, url->bLength, req->wLength);
+    return true;
+}
 
-        case USB_REQ_RCPT_ENDPOINT:
-            {
-                uint8_t ept = req->wIndex & 0x7;
-                if (req->wIndex & USB_DESCR_EPT_ADDR_DIR_IN) {
-                    if (endpoints[ept].size_in == 0)
-                        return false;
-                    if ((*(endpoints[ept].reg) & USB_EPTX_STAT) == USB_EP_TX_STALL)
-                        status[0] |= (1 << 0);
-                }
-                else {
-                    if (endpoints[ept].size_out == 0)
-                        return false;
-                    if ((*(endpoints[ept].reg) & USB_EPRX_STAT) == USB_EP_RX_STALL)
-                        status[0] |= (1 << 0);
-                }
-            }
+// vendor requests defined by platform capabilities. the vendor code is picked from the
+// platform capability descriptor found in the BOS descriptor, at the given offset.
+static const struct {
+    uint8_t uuid[16];
+    uint16_t wIndex;
+    uint8_t vendor_code_offset;
+    bool (*handler)(usb_ctrl_request_t *req);
+} platform_requests[] = {
+    {
+        .uuid               = USB_BOS_PLATFORM_UUID_MSOS20,
+        .wIndex             = USB_MSOS20_DESCRIPTOR_INDEX,
+        .vendor_code_offset = offsetof(usb_bos_platform_msos20_descriptor_t, bMS_VendorCode),
+        .handler            = write_msos20_descriptor_set,
+    },
+    {
+        .uuid               = USB_BOS_PLATFORM_UUID_WEBUSB,
+        .wIndex             = USB_WEBUSB_REQ_GET_URL,
+        .vendor_code_offset = offsetof(usb_bos_platform_webusb_descriptor_t, bVendorCode),
+        .handler            = write_webusb_url_descriptor,
+    },
+};
+
+static const uint8_t*
+find_bos_platform_capability(const uint8_t *uuid)
+{
+    if (usbd_get_bos_descriptor_cb == NULL)
+        return NULL;
+
+    const usb_bos_descriptor_t *bos = usbd_get_bos_descriptor_cb();
+    if (bos == NULL)
+        return NULL;
+
+    const uint8_t *p = (const uint8_t*) bos + bos->bLength;
+    const uint8_t *end = (const uint8_t*) bos + bos->wTotalLength;
+
+    while (p + sizeof(usb_bos_platform_descriptor_t) <= end) {
+        const usb_bos_platform_descriptor_t *cap = (const usb_bos_platform_descriptor_t*) p;
+        if (cap->bLength == 0)
             break;
-        }
 
-        usbd_control_in(status, sizeof(status), req->wLength);
-        return true;
+        if ((cap->bDescriptorType == USB_DESCR_TYPE_DEVICE_CAPABILITY) &&
+            (cap->bDevCapabilityType == USB_BOS_DEV_CAP_TYPE_PLATFORM) &&
+            (memcmp(cap->PlatformCapabilityUUID, uuid, sizeof(cap->PlatformCapabilityUUID)) == 0))
+            return p;
 
-    case USB_REQ_CLEAR_FEATURE:
-        {
-            if (((req->bmRequestType & USB_REQ_DIR_MASK) == USB_REQ_DIR_DEVICE_TO_HOST) ||
-                ((req->bmRequestType & USB_REQ_RCPT_MASK) != USB_REQ_RCPT_ENDPOINT) ||
-                (req->wValue != USB_DESCR_FEAT_ENDPOINT_HALT) ||
-                (state != STATE_CONFIGURED))
-                break;
+        p += cap->bLength;
+    }
 
-            uint8_t ept = req->wIndex & 0x7;
-            if ((endpoints[ept].type != USB_EP_BULK) && (endpoints[ept].type != USB_EP_INTERRUPT))
-                break;
+    return NULL;
+}
 
-            if (req->wIndex & USB_DESCR_EPT_ADDR_DIR_IN) {
-                if (endpoints[ept].size_in != 0) {
-                    *(endpoints[ept].reg) = (*(endpoints[ept].reg) ^ USB_EP_TX_NAK) &
-                        (USB_EPREG_MASK | USB_EPTX_STAT | USB_EP_DTOG_TX);
-                    return true;
-                }
-            }
-            else if (endpoints[ept].size_out != 0) {
-                *(endpoints[ept].reg) = (*(endpoints[ept].reg) ^ USB_EP_RX_VALID) &
-                    (USB_EPREG_MASK | USB_EPRX_STAT | USB_EP_DTOG_RX);
-                return true;
-            }
+static bool
+handle_ctrl_platform(usb_ctrl_request_t *req, bool *handled)
+{
+    *handled = false;
+
+    if (((req->bmRequestType & USB_REQ_DIR_MASK) != USB_REQ_DIR_DEVICE_TO_HOST) ||
+        ((req->bmRequestType & USB_REQ_RCPT_MASK) != USB_REQ_RCPT_DEVICE))
+        return false;
+
+    for (uint8_t i = 0; i < sizeof(platform_requests) / sizeof(platform_requests[0]); i++) {
+        if (req->wIndex != platform_requests[i].wIndex)
+            continue;
+
+        const uint8_t *cap = find_bos_platform_capability(platform_requests[i].uuid);
+        if ((cap == NULL) || (cap[platform_requests[i].vendor_code_offset] != req->bRequest))
+            continue;
+
+        *handled = true;
+        return platform_requests[i].handler(req);
+    }
+
+    return false;
+}
+
+
+static bool set_address = false;
+static uint16_t address = 0;
+static uint8_t interface_alt[USBD_MAX_INTERFACES];
+
+static bool suspended = false;
+static bool remote_wakeup = false;
+static uint8_t remote_wakeup_esof = 0;
+
+#ifdef USBD_ENABLE_LPM
+static bool suspended_l1 = false;
+#endif
+
+static bool
+handle_std_device_remote_wakeup(usb_ctrl_request_t *req, bool enable)
+{
+    if ((req->wValue != USB_DESCR_FEAT_DEVICE_REMOTE_WAKEUP) || (state == STATE_DEFAULT))
+        return false;
+
+    const usb_config_descriptor_t *cfg = usbd_get_config_descriptor_cb();
+    if (cfg == NULL || !(cfg->bmAttributes & USB_DESCR_CONFIG_ATTR_REMOTE_WAKEUP))
+        return false;
+
+    remote_wakeup = enable;
+    return true;
+}
+
+static bool
+handle_std_get_status(usb_ctrl_request_t *req)
+{
+    if (state != STATE_CONFIGURED)
+        return false;
+
+    uint8_t status[2] = {0, 0};
+
+    switch (req->bmRequestType & USB_REQ_RCPT_MASK) {
+    case USB_REQ_RCPT_DEVICE:
+        {
+            const usb_config_descriptor_t *cfg = usbd_get_config_descriptor_cb();
+            if (cfg != NULL && (cfg->bmAttributes & USB_DESCR_CONFIG_ATTR_SELF_POWERED))
+                status[0] |= (1 << 0);
+            if (remote_wakeup)
+                status[0] |= (1 << 1);
         }
         break;
 
-    case USB_REQ_SET_FEATURE:
-        {
-            if (((req->bmRequestType & USB_REQ_DIR_MASK) == USB_REQ_DIR_DEVICE_TO_HOST) ||
-                ((req->bmRequestType & USB_REQ_RCPT_MASK) != USB_REQ_RCPT_ENDPOINT) ||
-                (req->wValue != USB_DESCR_FEAT_ENDPOINT_HALT) ||
-                (state != STATE_CONFIGURED))
-                break;
+    case USB_REQ_RCPT_INTERFACE:
+        if (usbd_get_interface_descriptor_cb(req->wIndex) == NULL)
+            return false;
+        break;
 
+    case USB_REQ_RCPT_ENDPOINT:
+        {
             uint8_t ept = req->wIndex & 0x7;
-            if ((endpoints[ept].type != USB_EP_BULK) && (endpoints[ept].type != USB_EP_INTERRUPT))
-                break;
-
             if (req->wIndex & USB_DESCR_EPT_ADDR_DIR_IN) {
-                if (endpoints[ept].size_in != 0) {
-                    *(endpoints[ept].reg) = (*(endpoints[ept].reg) ^ USB_EP_TX_STALL) &
-                        (USB_EPREG_MASK | USB_EPTX_STAT);
-                    return true;
-                }
+                if (endpoints[ept].size_in == 0)
+                    return false;
+                if ((*(endpoints[ept].reg) & USB_EPTX_STAT) == USB_EP_TX_STALL)
+                    status[0] |= (1 << 0);
             }
-            else if (endpoints[ept].size_out != 0) {
-                *(endpoints[ept].reg) = (*(endpoints[ept].reg) ^ USB_EP_RX_STALL) &
-                    (USB_EPREG_MASK | USB_EPRX_STAT);
-                return true;
+            else {
+                if (endpoints[ept].size_out == 0)
+                    return false;
+                if ((*(endpoints[ept].reg) & USB_EPRX_STAT) == USB_EP_RX_STALL)
+                    status[0] |= (1 << 0);
             }
         }
         break;
+    }
 
-    case USB_REQ_SET_ADDRESS:
-        if (((req->bmRequestType & USB_REQ_DIR_MASK) == USB_REQ_DIR_DEVICE_TO_HOST) ||
-            ((req->bmRequestType & USB_REQ_RCPT_MASK) != USB_REQ_RCPT_DEVICE))
-            break;
+    usbd_control_in(status, sizeof(status), req->wLength);
+    return true;
+}
 
-        switch (state) {
-        case STATE_DEFAULT:
-            if (req->wValue == 0)
-                break;
-            // fall through
-
-        case STATE_ADDRESS:
-            address = (req->wValue & USB_DADDR_ADD);
-            set_address = true;
-            if (usbd_set_address_hook_cb)
-                usbd_set_address_hook_cb(address);
-            break;
+static bool
+handle_std_clear_feature(usb_ctrl_request_t *req)
+{
+    if ((req->bmRequestType & USB_REQ_RCPT_MASK) == USB_REQ_RCPT_DEVICE)
+        return handle_std_device_remote_wakeup(req, false);
 
-        case STATE_CONFIGURED:
-            break;
-        }
+    if ((req->wValue != USB_DESCR_FEAT_ENDPOINT_HALT) || (state != STATE_CONFIGURED))
+        return false;
 
+    uint8_t ept = req->wIndex & 0x7;
+    if ((endpoints[ept].type != USB_EP_BULK) && (endpoints[ept].type != USB_EP_INTERRUPT))
+        return false;
+
+    if (req->wIndex & USB_DESCR_EPT_ADDR_DIR_IN) {
+        if (endpoints[ept].size_in != 0) {
+            *(endpoints[ept].reg) = (*(endpoints[ept].reg) ^ USB_EP_TX_NAK) &
+                (USB_EPREG_MASK | USB_EPTX_STAT | USB_EP_DTOG_TX);
+            return true;
+        }
+    }
+    else if (endpoints[ept].size_out != 0) {
+        *(endpoints[ept].reg) = (*(endpoints[ept].reg) ^ USB_EP_RX_VALID) &
+            (USB_EPREG_MASK | USB_EPRX_STAT | USB_EP_DTOG_RX);
         return true;
+    }
 
-    case USB_REQ_GET_DESCRIPTOR:
-        if ((req->bmRequestType & USB_REQ_DIR_MASK) == USB_REQ_DIR_HOST_TO_DEVICE)
-            break;
+    return false;
+}
+
+static bool
+handle_std_set_feature(usb_ctrl_request_t *req)
+{
+    if ((req->bmRequestType & USB_REQ_RCPT_MASK) == USB_REQ_RCPT_DEVICE)
+        return handle_std_device_remote_wakeup(req, true);
 
-        switch (req->bmRequestType & USB_REQ_RCPT_MASK) {
-        case USB_REQ_RCPT_DEVICE:
-            switch (req->wValue >> 8) {
-            case USB_DESCR_TYPE_DEVICE:
-                return write_device_descriptor(req);
+    if ((req->wValue != USB_DESCR_FEAT_ENDPOINT_HALT) || (state != STATE_CONFIGURED))
+        return false;
 
-            case USB_DESCR_TYPE_CONFIGURATION:
-                return write_config_descriptor(req);
+    return usbd_stall(req->wIndex);
+}
 
-            case USB_DESCR_TYPE_STRING:
-                return write_string_descriptor(req);
-            }
+static bool
+handle_std_set_address(usb_ctrl_request_t *req)
+{
+    switch (state) {
+    case STATE_DEFAULT:
+        if (req->wValue == 0)
             break;
+        // fall through
 
-        case USB_REQ_RCPT_INTERFACE:
-            if (usbd_ctrl_request_get_descriptor_interface_cb)
-                return usbd_ctrl_request_get_descriptor_interface_cb(req);
-            break;
-        }
+    case STATE_ADDRESS:
+        address = (req->wValue & USB_DADDR_ADD);
+        set_address = true;
+        if (usbd_set_address_hook_cb)
+            usbd_set_address_hook_cb(address);
         break;
 
-    case USB_REQ_SET_DESCRIPTOR:
-        // not supported
+    case STATE_CONFIGURED:
         break;
+    }
 
-    case USB_REQ_GET_CONFIGURATION:
-        if (((req->bmRequestType & USB_REQ_DIR_MASK) == USB_REQ_DIR_HOST_TO_DEVICE) ||
-            ((req->bmRequestType & USB_REQ_RCPT_MASK) != USB_REQ_RCPT_DEVICE))
-            break;
+    return true;
+}
 
-        uint8_t config = state == STATE_CONFIGURED ? get_config_bConfigurationValue() : 0;
-        usbd_control_in(&config, sizeof(config), req->wLength);
-        return true;
+static bool
+handle_std_get_descriptor(usb_ctrl_request_t *req)
+{
+    switch (req->bmRequestType & USB_REQ_RCPT_MASK) {
+    case USB_REQ_RCPT_DEVICE:
+        {
+            uint8_t type = req->wValue >> 8;
+            if ((type >= sizeof(descriptor_handlers) / sizeof(descriptor_handlers[0])) ||
+                (descriptor_handlers[type] == NULL))
+                return false;
+            return descriptor_handlers[type](req);
+        }
 
-    case USB_REQ_SET_CONFIGURATION:
-        if (((req->bmRequestType & USB_REQ_DIR_MASK) == USB_REQ_DIR_DEVICE_TO_HOST) ||
-            ((req->bmRequestType & USB_REQ_RCPT_MASK) != USB_REQ_RCPT_DEVICE) ||
-            (state == STATE_DEFAULT))
-            break;
+    case USB_REQ_RCPT_INTERFACE:
+        if (usbd_ctrl_request_get_descriptor_interface_cb)
+            return usbd_ctrl_request_get_descriptor_interface_cb(req);
+        break;
+    }
 
-        if (req->wValue == 0) {
-            state = STATE_ADDRESS;
-            for (uint8_t i = 1; i < 8; i++)
-                *(endpoints[i].reg) &= ~USB_EPREG_MASK;
-        }
-        else if (((uint8_t) req->wValue) == get_config_bConfigurationValue()) {
-            state = STATE_CONFIGURED;
-
-            for (uint8_t i = 1; i < 8; i++) {
-                if (endpoints[i].size_in == 0 && endpoints[i].size_out == 0)
-                    continue;
-
-                __IO uint16_t *ep = endpoints[i].reg;
-                *ep &= ~USB_EPREG_MASK;
-                *ep |= endpoints[i].type | i;
-
-                if (endpoints[i].size_in != 0)
-                    *ep = (*ep ^ USB_EP_TX_NAK) &
-                        (USB_EPREG_MASK | USB_EPTX_STAT | USB_EP_DTOG_TX);
-                if (endpoints[i].size_out != 0)
-                    *ep = (*ep ^ USB_EP_RX_VALID) &
-                        (USB_EPREG_MASK | USB_EPRX_STAT | USB_EP_DTOG_RX);
-            }
-        }
-        else
-            break;
+    return false;
+}
 
+static bool
+handle_std_get_configuration(usb_ctrl_request_t *req)
+{
+    uint8_t config = state == STATE_CONFIGURED ? get_config_bConfigurationValue() : 0;
+    usbd_control_in(&config, sizeof(config), req->wLength);
+    return true;
+}
+
+static bool
+handle_std_set_configuration(usb_ctrl_request_t *req)
+{
+    if (state == STATE_DEFAULT)
+        return false;
+
+    if (req->wValue == 0) {
+        state = STATE_ADDRESS;
+        iso_enabled = 0;
+        for (uint8_t i = 1; i < 8; i++)
+            *(endpoints[i].reg) &= ~USB_EPREG_MASK;
         return true;
+    }
 
-    case USB_REQ_GET_INTERFACE:
-        {
-            if (((req->bmRequestType & USB_REQ_DIR_MASK) == USB_REQ_DIR_HOST_TO_DEVICE) ||
-                ((req->bmRequestType & USB_REQ_RCPT_MASK) != USB_REQ_RCPT_INTERFACE) ||
-                (state != STATE_CONFIGURED))
-                break;
+    if (((uint8_t) req->wValue) != get_config_bConfigurationValue())
+        return false;
 
-            const usb_interface_descriptor_t *itf = usbd_get_interface_descriptor_cb(req->wIndex);
-            if (itf == NULL)
-                break;
+    state = STATE_CONFIGURED;
+    memset(interface_alt, 0, sizeof(interface_alt));
+    iso_enabled = 0;
+
+    for (uint8_t i = 1; i < 8; i++) {
+        if (endpoints[i].size_in == 0 && endpoints[i].size_out == 0)
+            continue;
+
+        __IO usbd_epr_t *ep = endpoints[i].reg;
+        *ep &= ~USB_EPREG_MASK;
+        *ep |= endpoints[i].type | i;
+
+        // default alternate settings can't use isochronous bandwidth, these endpoints
+        // stay disabled until selected by SET_INTERFACE.
+        if (endpoints[i].type == USB_EP_ISOCHRONOUS)
+            continue;
+
+        if (endpoints[i].size_in != 0)
+            *ep = (*ep ^ USB_EP_TX_NAK) &
+                (USB_EPREG_MASK | USB_EPTX_STAT | USB_EP_DTOG_TX);
+        if (endpoints[i].size_out != 0)
+            *ep = (*ep ^ USB_EP_RX_VALID) &
+                (USB_EPREG_MASK | USB_EPRX_STAT | USB_EP_DTOG_RX);
+    }
 
-            usbd_control_in(&(itf->bAlternateSetting), sizeof(itf->bAlternateSetting), req->wLength);
-            return true;
-        }
-        break;
+    return true;
+}
 
-    case USB_REQ_SET_INTERFACE:
-        {
-            if (((req->bmRequestType & USB_REQ_DIR_MASK) == USB_REQ_DIR_DEVICE_TO_HOST) ||
-                ((req->bmRequestType & USB_REQ_RCPT_MASK) != USB_REQ_RCPT_INTERFACE) ||
-                (state != STATE_CONFIGURED))
-                break;
-
-            // no alternate setting supported, but someone may still try to re-set
-            const usb_interface_descriptor_t *itf = usbd_get_interface_descriptor_cb(req->wIndex);
-            if (itf == NULL)
-                break;
-
-            if (itf->bAlternateSetting == (uint8_t) req->wValue)
-                return true;
+static bool
+for_each_interface_endpoint(uint8_t itf, uint8_t alt, void (*fn)(uint8_t addr))
+{
+    const usb_config_descriptor_t *cfg = usbd_get_config_descriptor_cb();
+    if (cfg == NULL)
+        return false;
+
+    const uint8_t *p = (const uint8_t*) cfg + cfg->bLength;
+    const uint8_t *end = (const uint8_t*) cfg + cfg->wTotalLength;
+    bool found = false;
+    bool match = false;
+
+    for (; (p + 2 <= end) && (p[0] != 0); p += p[0]) {
+        if (p[1] == USB_DESCR_TYPE_INTERFACE) {
+            const usb_interface_descriptor_t *d = (const usb_interface_descriptor_t*) p;
+            match = (d->bInterfaceNumber == itf) && (d->bAlternateSetting == alt);
+            found |= match;
+            continue;
         }
-        break;
 
-    case USB_REQ_SYNCH_FRAME:
-        // isochronous endpoints not supported
-        break;
+        if (match && (fn != NULL) && (p[1] == USB_DESCR_TYPE_ENDPOINT))
+            fn(((const usb_endpoint_descriptor_t*) p)->bEndpointAddress);
     }
 
-    return false;
+    return found;
+}
+
+static void
+interface_endpoint_disable(uint8_t addr)
+{
+    uint8_t ept = addr & 0x7;
+    bool iso = endpoints[ept].type == USB_EP_ISOCHRONOUS;
+    if (iso)
+        iso_enabled &= ~(1 << ept);
+
+    if (addr & USB_DESCR_EPT_ADDR_DIR_IN)
+        *(endpoints[ept].reg) = (*(endpoints[ept].reg) ^ (iso ? USB_EP_TX_DIS : USB_EP_TX_NAK)) &
+            (USB_EPREG_MASK | USB_EPTX_STAT);
+    else
+        *(endpoints[ept].reg) = (*(endpoints[ept].reg) ^ (iso ? USB_EP_RX_DIS : USB_EP_RX_NAK)) &
+            (USB_EPREG_MASK | USB_EPRX_STAT);
+}
+
+static void
+interface_endpoint_enable(uint8_t addr)
+{
+    uint8_t ept = addr & 0x7;
+    bool iso = endpoints[ept].type == USB_EP_ISOCHRONOUS;
+    if (iso)
+        iso_enabled |= 1 << ept;
+
+    // isochronous IN endpoints stay disabled, and are reported as idle until the first
+    // packet is sent.
+    if (addr & USB_DESCR_EPT_ADDR_DIR_IN)
+        *(endpoints[ept].reg) = (*(endpoints[ept].reg) ^ (iso ? USB_EP_TX_DIS : USB_EP_TX_NAK)) &
+            (USB_EPREG_MASK | USB_EPTX_STAT | USB_EP_DTOG_TX);
+    else
+        *(endpoints[ept].reg) = (*(endpoints[ept].reg) ^ USB_EP_RX_VALID) &
+            (USB_EPREG_MASK | USB_EPRX_STAT | USB_EP_DTOG_RX);
+}
+
+static bool
+handle_std_get_interface(usb_ctrl_request_t *req)
+{
+    if ((state != STATE_CONFIGURED) || (req->wIndex >= USBD_MAX_INTERFACES))
+        return false;
+
+    if (usbd_get_interface_descriptor_cb(req->wIndex) == NULL)
+        return false;
+
+    usbd_control_in(&interface_alt[req->wIndex], sizeof(interface_alt[0]), req->wLength);
+    return true;
+}
+
+static bool
+handle_std_set_interface(usb_ctrl_request_t *req)
+{
+    if ((state != STATE_CONFIGURED) || (req->wIndex >= USBD_MAX_INTERFACES))
+        return false;
+
+    uint8_t itf = req->wIndex;
+    uint8_t alt = req->wValue;
+
+    if (!for_each_interface_endpoint(itf, alt, NULL))
+        return false;
+
+    // endpoints of the new alternate setting always restart from DATA0, even if it is
+    // the current one.
+    for_each_interface_endpoint(itf, interface_alt[itf], interface_endpoint_disable);
+    for_each_interface_endpoint(itf, alt, interface_endpoint_enable);
+    interface_alt[itf] = alt;
+
+    if (usbd_set_interface_hook_cb)
+        usbd_set_interface_hook_cb(itf, alt);
+    return true;
+}
+
+#define RCPT(r) (1 << (USB_REQ_RCPT_ ## r))
+
+// standard requests are validated (direction and recipient) and dispatched from this
+// table. requests without a handler (SET_DESCRIPTOR, SYNCH_FRAME, reserved codes) are
+// stalled right away.
+static const struct {
+    bool (*handler)(usb_ctrl_request_t *req);
+    uint8_t dir;
+    uint8_t rcpts;
+} std_requests[] = {
+    [USB_REQ_GET_STATUS] = {
+        .handler = handle_std_get_status,
+        .dir     = USB_REQ_DIR_DEVICE_TO_HOST,
+        .rcpts   = RCPT(DEVICE) | RCPT(INTERFACE) | RCPT(ENDPOINT),
+    },
+    [USB_REQ_CLEAR_FEATURE] = {
+        .handler = handle_std_clear_feature,
+        .dir     = USB_REQ_DIR_HOST_TO_DEVICE,
+        .rcpts   = RCPT(DEVICE) | RCPT(ENDPOINT),
+    },
+    [USB_REQ_SET_FEATURE] = {
+        .handler = handle_std_set_feature,
+        .dir     = USB_REQ_DIR_HOST_TO_DEVICE,
+        .rcpts   = RCPT(DEVICE) | RCPT(ENDPOINT),
+    },
+    [USB_REQ_SET_ADDRESS] = {
+        .handler = handle_std_set_address,
+        .dir     = USB_REQ_DIR_HOST_TO_DEVICE,
+        .rcpts   = RCPT(DEVICE),
+    },
+    [USB_REQ_GET_DESCRIPTOR] = {
+        .handler = handle_std_get_descriptor,
+        .dir     = USB_REQ_DIR_DEVICE_TO_HOST,
+        .rcpts   = RCPT(DEVICE) | RCPT(INTERFACE),
+    },
+    [USB_REQ_SET_DESCRIPTOR] = {
+        .handler = NULL,  // not supported
+    },
+    [USB_REQ_GET_CONFIGURATION] = {
+        .handler = handle_std_get_configuration,
+        .dir     = USB_REQ_DIR_DEVICE_TO_HOST,
+        .rcpts   = RCPT(DEVICE),
+    },
+    [USB_REQ_SET_CONFIGURATION] = {
+        .handler = handle_std_set_configuration,
+        .dir     = USB_REQ_DIR_HOST_TO_DEVICE,
+        .rcpts   = RCPT(DEVICE),
+    },
+    [USB_REQ_GET_INTERFACE] = {
+        .handler = handle_std_get_interface,
+        .dir     = USB_REQ_DIR_DEVICE_TO_HOST,
+        .rcpts   = RCPT(INTERFACE),
+    },
+    [USB_REQ_SET_INTERFACE] = {
+        .handler = handle_std_set_interface,
+        .dir     = USB_REQ_DIR_HOST_TO_DEVICE,
+        .rcpts   = RCPT(INTERFACE),
+    },
+    [USB_REQ_SYNCH_FRAME] = {
+        .handler = NULL,  // no implicit pattern synchronization on isochronous endpoints
+    },
+};
+
+#undef RCPT
+
+static bool
+handle_ctrl_setup(usb_ctrl_request_t *req)
+{
+    if ((req->bmRequestType & USB_REQ_TYPE_MASK) == USB_REQ_TYPE_CLASS) {
+        if (usbd_ctrl_request_handle_class_cb)
+            return usbd_ctrl_request_handle_class_cb(req);
+        return false;
+    }
+
+    if ((req->bmRequestType & USB_REQ_TYPE_MASK) == USB_REQ_TYPE_VENDOR) {
+        bool handled;
+        bool rv = handle_ctrl_platform(req, &handled);
+        if (handled)
+            return rv;
+        if (usbd_ctrl_request_handle_vendor_cb)
+            return usbd_ctrl_request_handle_vendor_cb(req);
+        return false;
+    }
+
+    if (req->bRequest >= sizeof(std_requests) / sizeof(std_requests[0]))
+        return false;
+
+    if ((std_requests[req->bRequest].handler == NULL) ||
+        ((req->bmRequestType & USB_REQ_DIR_MASK) != std_requests[req->bRequest].dir) ||
+        ((std_requests[req->bRequest].rcpts & (1 << (req->bmRequestType & USB_REQ_RCPT_MASK))) == 0))
+        return false;
+
+    return std_requests[req->bRequest].handler(req);
 }
 
 
@@ -564,42 +1210,194 @@ usbd_init(void)
     RCC->APB1RSTR &= ~RCC_APB1RSTR_USBRST;
 #endif
 
+#if defined(STM32F1) || defined(STM32F3) || defined(STM32L0)
+    RCC->APB1ENR |= RCC_APB1ENR_USBEN;
+    RCC->APB1RSTR |= RCC_APB1RSTR_USBRST;
+    RCC->APB1RSTR &= ~RCC_APB1RSTR_USBRST;
+#endif
+
 #ifdef STM32G4
     RCC->APB1ENR1 |= RCC_APB1ENR1_USBEN;
     RCC->APB1RSTR1 |= RCC_APB1RSTR1_USBRST;
     RCC->APB1RSTR1 &= ~RCC_APB1RSTR1_USBRST;
 #endif
 
+#ifdef STM32L4
+    RCC->APB1ENR1 |= RCC_APB1ENR1_USBFSEN;
+    RCC->APB1RSTR1 |= RCC_APB1RSTR1_USBFSRST;
+    RCC->APB1RSTR1 &= ~RCC_APB1RSTR1_USBFSRST;
+#endif
+
+#ifdef STM32L5
+    RCC->APB1ENR2 |= RCC_APB1ENR2_USBFSEN;
+    RCC->APB1RSTR2 |= RCC_APB1RSTR2_USBFSRST;
+    RCC->APB1RSTR2 &= ~RCC_APB1RSTR2_USBFSRST;
+#endif
+
+#if defined(STM32L4) || defined(STM32L5)
+    // the usb transceiver is isolated until VDDUSB is reported as valid
+    RCC->APB1ENR1 |= RCC_APB1ENR1_PWREN;
+    PWR->CR2 |= PWR_CR2_USV;
+#endif
+
+#if defined(STM32C0) || defined(STM32G0)
+    RCC->APBENR1 |= RCC_APBENR1_USBEN;
+    RCC->APBRSTR1 |= RCC_APBRSTR1_USBRST;
+    RCC->APBRSTR1 &= ~RCC_APBRSTR1_USBRST;
+#endif
+
+#if defined(STM32H5) || defined(STM32U5)
+    RCC->APB2ENR |= RCC_APB2ENR_USBEN;
+    RCC->APB2RSTR |= RCC_APB2RSTR_USBRST;
+    RCC->APB2RSTR &= ~RCC_APB2RSTR_USBRST;
+#endif
+
+#ifdef USBD_ENABLE_DMA
+    RCC->AHB1ENR |= RCC_AHB1ENR_DMA1EN;
+#endif
+
     USB->CNTR &= ~USB_CNTR_PDWN;
 
     pma_init();
 
     USB->ISTR = 0;
     USB->CNTR = USB_CNTR_CTRM | USB_CNTR_WKUPM | USB_CNTR_SUSPM | USB_CNTR_RESETM;
-    if (usbd_in_cb)
+    if (usbd_in_cb || usbd_sof_hook_cb)
         USB->CNTR |= USB_CNTR_SOFM;
+#ifdef USBD_ENABLE_STREAM
+    USB->CNTR |= USB_CNTR_SOFM;
+#endif
+#ifdef USBD_ENABLE_LPM
+    USB->LPMCSR = USB_LPMCSR_LMPEN | USB_LPMCSR_LPMACK;
+    USB->CNTR |= USB_CNTR_L1REQM;
+#endif
+
+    // devices without the embedded pull-up resistor need an external one on D+
+#ifdef USB_BCDR_DPPU
     USB->BCDR = USB_BCDR_DPPU;
+#endif
+}
+
+
+bool
+usbd_remote_wakeup(void)
+{
+#ifdef USBD_ENABLE_LPM
+    if (suspended_l1) {
+        // L1 remote wakeup is allowed by the host in the LPM token itself, and the
+        // resume signalling (50us) is timed by the hardware.
+        if (!(USB->LPMCSR & USB_LPMCSR_REMWAKE))
+            return false;
+
+        // the device leaves L1 right away, no WKUP interrupt is expected
+        USB->CNTR &= ~(USB_CNTR_FSUSP | USB_CNTR_LPMODE);
+        USB->CNTR |= USB_CNTR_L1RESUME;
+        suspended_l1 = false;
+        if (usbd_l1_resume_hook_cb)
+            usbd_l1_resume_hook_cb();
+        return true;
+    }
+#endif
+
+    if (!suspended || !remote_wakeup || remote_wakeup_esof != 0)
+        return false;
+
+    // resume signalling must be driven for 1 to 15ms. ESOF triggers every 1ms
+    // while there are no SOFs, so 4 ESOFs (3 to 4ms) are counted before releasing it.
+    remote_wakeup_esof = 4;
+    USB->CNTR &= ~USB_CNTR_FSUSP;
+    USB->CNTR |= USB_CNTR_RESUME | USB_CNTR_ESOFM;
+    return true;
 }
 
 
+static inline bool
+in_streaming(uint8_t ept)
+{
+#ifdef USBD_ENABLE_STREAM
+    return stream_in[ept].get_index != NULL;
+#else
+    (void) ept;
+    return false;
+#endif
+}
+
+static inline bool
+in_idle(uint8_t ept)
+{
+    // a completed transfer still waiting for its CTR_TX is not idle, neither is a
+    // packet still being copied by the dma channel.
+#ifdef USBD_ENABLE_DMA
+    if (dma_ept == ept)
+        return false;
+#endif
+    if (endpoints[ept].size_in == 0)
+        return false;
+
+    usbd_epr_t epr = (*endpoints[ept].reg) & (USB_EP_CTR_TX | USB_EPTX_STAT | USB_EPADDR_FIELD);
+
+    // isochronous endpoints are kept valid once started, and are disabled before that
+    if (endpoints[ept].type == USB_EP_ISOCHRONOUS)
+        return (iso_enabled & (1 << ept)) && (epr == (USB_EP_TX_DIS | ept));
+    return epr == (USB_EP_TX_NAK | ept);
+}
+
 void
 usbd_task(void)
 {
-    uint16_t istr = USB->ISTR & (USB_ISTR_CTR | USB_ISTR_WKUP | USB_ISTR_SUSP | USB_ISTR_RESET | USB_ISTR_SOF);
+    uint16_t istr = USB->ISTR & (USB_ISTR_CTR | USB_ISTR_WKUP | USB_ISTR_SUSP | USB_ISTR_RESET |
+#ifdef USBD_ENABLE_LPM
+        USB_ISTR_L1REQ |
+#endif
+        USB_ISTR_SOF | USB_ISTR_ESOF);
     if (istr == 0)
         return;
 
+    if (istr & USB_ISTR_ESOF) {
+        USB->ISTR &= ~USB_ISTR_ESOF;
+        if ((remote_wakeup_esof != 0) && (--remote_wakeup_esof == 0)) {
+            USB->CNTR &= ~(USB_CNTR_RESUME | USB_CNTR_ESOFM);
+            suspended = false;
+            if (usbd_resume_hook_cb)
+                usbd_resume_hook_cb();
+        }
+    }
+
     if (istr & USB_ISTR_WKUP) {
         USB->ISTR &= ~(USB_ISTR_SUSP | USB_ISTR_WKUP);
-        USB->CNTR &= ~USB_CNTR_FSUSP;
+        USB->CNTR &= ~(USB_CNTR_FSUSP | USB_CNTR_LPMODE);
+#ifdef USBD_ENABLE_LPM
+        if (suspended_l1) {
+            suspended_l1 = false;
+            if (usbd_l1_resume_hook_cb)
+                usbd_l1_resume_hook_cb();
+            return;
+        }
+#endif
+        suspended = false;
         if (usbd_resume_hook_cb)
             usbd_resume_hook_cb();
         return;
     }
 
+#ifdef USBD_ENABLE_LPM
+    if (istr & USB_ISTR_L1REQ) {
+        USB->ISTR &= ~USB_ISTR_L1REQ;
+        USB->CNTR |= USB_CNTR_FSUSP | USB_CNTR_LPMODE;
+        suspended_l1 = true;
+        if (usbd_l1_suspend_hook_cb)
+            usbd_l1_suspend_hook_cb((USB->LPMCSR & USB_LPMCSR_BESL) >> 4);
+        return;
+    }
+#endif
+
     if (istr & USB_ISTR_SUSP) {
         USB->ISTR &= ~USB_ISTR_SUSP;
         USB->CNTR |= USB_CNTR_FSUSP;
+        suspended = true;
+#ifdef USBD_ENABLE_LPM
+        suspended_l1 = false;
+#endif
         if (usbd_suspend_hook_cb)
             usbd_suspend_hook_cb();
         return;
@@ -611,15 +1409,32 @@ usbd_task(void)
         if (usbd_reset_hook_cb)
             usbd_reset_hook_cb(true);
 
-        for (uint8_t i = 0; i < 8; i++)
+#ifdef USBD_ENABLE_DMA
+        dma_abort();
+#endif
+
+        for (uint8_t i = 0; i < 8; i++) {
             *(endpoints[i].reg) &= ~USB_EPREG_MASK;
+#ifdef USBD_ENABLE_STREAM
+            stream_in[i].get_index = NULL;
+            stream_out[i].get_index = NULL;
+#endif
+        }
 
         state = STATE_DEFAULT;
+        iso_enabled = 0;
         address = 0;
+        suspended = false;
+        remote_wakeup = false;
+        remote_wakeup_esof = 0;
+#ifdef USBD_ENABLE_LPM
+        suspended_l1 = false;
+#endif
+        USB->CNTR &= ~(USB_CNTR_RESUME | USB_CNTR_ESOFM);
         USB->DADDR = USB_DADDR_EF | address;
 
-        USB->EP0R |= endpoints[0].type;
-        USB->EP0R = (USB->EP0R ^ (USB_EP_RX_VALID | USB_EP_TX_NAK)) &
+        *(endpoints[0].reg) |= endpoints[0].type;
+        *(endpoints[0].reg) = (*(endpoints[0].reg) ^ (USB_EP_RX_VALID | USB_EP_TX_NAK)) &
             (USB_EPREG_MASK | USB_EPRX_STAT | USB_EP_DTOG_RX | USB_EP_DTOG_TX);
 
         if (usbd_reset_hook_cb)
@@ -628,17 +1443,31 @@ usbd_task(void)
     }
 
     static uint8_t current_ep = 1;
-    if (usbd_in_cb && (istr & USB_ISTR_SOF)) {
+    if ((USB->CNTR & USB_CNTR_SOFM) && (istr & USB_ISTR_SOF)) {
         USB->ISTR &= ~USB_ISTR_SOF;
 
-        uint8_t ep = current_ep++;
-        if (current_ep >= 8)
-            current_ep = 1;
+        if (usbd_sof_hook_cb)
+            usbd_sof_hook_cb(USB->FNR & USB_FNR_FN);
 
-        if ((endpoints[ep].size_in != 0) &&
-            (((*endpoints[ep].reg) & (USB_EPTX_STAT | USB_EPADDR_FIELD)) == (USB_EP_TX_NAK | ep))) {
-            usbd_in_cb(ep);
-            return;
+#ifdef USBD_ENABLE_STREAM
+        // streams are restarted as soon as possible, including after data underruns
+        for (uint8_t i = 1; i < 8; i++) {
+            if (in_streaming(i) && in_idle(i))
+                stream_in_task(i);
+            if ((stream_out[i].get_index != NULL) && stream_out[i].held)
+                stream_out_task(i);
+        }
+#endif
+
+        if (usbd_in_cb) {
+            uint8_t ep = current_ep++;
+            if (current_ep >= 8)
+                current_ep = 1;
+
+            if (!in_streaming(ep) && in_idle(ep)) {
+                usbd_in_cb(ep);
+                return;
+            }
         }
     }
 
@@ -646,24 +1475,51 @@ usbd_task(void)
         uint8_t ep = USB->ISTR & USB_ISTR_EP_ID;
 
         if (ep == 0) {
-            if (USB->EP0R & (USB_EP_CTR_RX|USB_EP_SETUP)) {
-                USB->EP0R &= USB_EPREG_MASK ^ USB_EP_CTR_RX;
-
-                usb_ctrl_request_t req;
-                uint16_t len = usbd_out(0, &req, sizeof(usb_ctrl_request_t));
-                if ((len == sizeof(usb_ctrl_request_t)) && handle_ctrl_setup(&req)) {
-                    if ((req.bmRequestType & USB_REQ_DIR_MASK) == USB_REQ_DIR_HOST_TO_DEVICE)
-                        usbd_control_in(NULL, 0, req.wLength);
+            // SETUP bit is only valid while CTR_RX is set
+            usbd_epr_t ep0r = *(endpoints[0].reg);
+
+            if (ep0r & USB_EP_CTR_RX) {
+                *(endpoints[0].reg) &= USB_EPREG_MASK ^ USB_EP_CTR_RX;
+
+                if (ep0r & USB_EP_SETUP) {
+                    ctrl_out_cb = NULL;
+
+                    uint16_t len = usbd_out(0, &ctrl_req, sizeof(usb_ctrl_request_t));
+                    if ((len == sizeof(usb_ctrl_request_t)) && handle_ctrl_setup(&ctrl_req)) {
+                        if ((ctrl_req.bmRequestType & USB_REQ_DIR_MASK) == USB_REQ_DIR_HOST_TO_DEVICE) {
+                            // data stage requested by the handler, status is sent when completed
+                            if (ctrl_out_cb != NULL && ctrl_out_buflen > 0)
+                                return;
+
+                            // without data to receive the callback is called right away
+                            usbd_control_out_cb_t cb = ctrl_out_cb;
+                            ctrl_out_cb = NULL;
+                            if ((cb != NULL) && !cb(&ctrl_req, 0)) {
+                                ctrl_stall();
+                                return;
+                            }
+                            usbd_control_in(NULL, 0, ctrl_req.wLength);
+                        }
+                        return;
+                    }
+
+                    ctrl_out_cb = NULL;
+                    ctrl_stall();
+                    return;
+                }
+
+                if (ctrl_out_cb != NULL) {
+                    usbd_control_out_resume();
                     return;
                 }
 
-                USB->EP0R = (USB->EP0R ^ USB_EP_TX_STALL) & (USB_EPREG_MASK | USB_EPTX_STAT);
-                USB->EP0R = (USB->EP0R ^ USB_EP_RX_STALL) & (USB_EPREG_MASK | USB_EPRX_STAT);
+                // status stage of control IN transfers
+                usbd_out(0, NULL, 0);
                 return;
             }
 
-            if (USB->EP0R & USB_EP_CTR_TX) {
-                USB->EP0R &= USB_EPREG_MASK ^ USB_EP_CTR_TX;
+            if (ep0r & USB_EP_CTR_TX) {
+                *(endpoints[0].reg) &= USB_EPREG_MASK ^ USB_EP_CTR_TX;
 
                 if (set_address) {
                     USB->DADDR = USB_DADDR_EF | address;
@@ -671,22 +1527,35 @@ usbd_task(void)
                     state = STATE_ADDRESS;
                 }
 
-                if (usbd_control_in_resume())
-                    return;
+                usbd_control_in_resume();
             }
+            return;
         }
 
         if (*(endpoints[ep].reg) & USB_EP_CTR_RX) {
             *(endpoints[ep].reg) &= USB_EPREG_MASK ^ USB_EP_CTR_RX;
+#ifdef USBD_ENABLE_STREAM
+            if (stream_out[ep].get_index != NULL)
+                stream_out_task(ep);
+            else
+#endif
             if (usbd_out_cb)
                 usbd_out_cb(ep);
         }
-        if (*(endpoints[ep].reg) & USB_EP_CTR_TX)
+        if (*(endpoints[ep].reg) & USB_EP_CTR_TX) {
             *(endpoints[ep].reg) &= USB_EPREG_MASK ^ USB_EP_CTR_TX;
+#ifdef USBD_ENABLE_STREAM
+            if (in_streaming(ep)) {
+                stream_in_task(ep);
+                return;
+            }
+#endif
+            if (usbd_in_cb)
+                usbd_in_cb(ep);
+        }
     }
 }
 
-
 static inline uint8_t
 to_hex(uint8_t v)
 {
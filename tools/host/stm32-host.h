@@ -0,0 +1,157 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// register model used to build the library for the host, for the tools. the
+// USB peripheral registers and the packet memory are plain host memory, provided by
+// the tool, with the packet memory mapped to the address space as on the target: as
+// contiguous halfwords (1x16 bit access scheme), as halfwords in the low half of each
+// 32-bit word (2x16 bit access scheme, STM32F1) or as 32-bit words (USB DRD, STM32G0).
+
+#pragma once
+
+#include <stdint.h>
+
+#define __IO  volatile
+#define __IOM volatile
+
+#define __ALIGNED(x)         __attribute__((aligned(x)))
+#define __STATIC_FORCEINLINE static inline __attribute__((always_inline))
+
+#if defined(STM32G0)
+typedef struct {
+    __IO uint32_t CHEP0R, CHEP1R, CHEP2R, CHEP3R, CHEP4R, CHEP5R, CHEP6R, CHEP7R;
+    uint32_t RESERVED0[8];
+    __IO uint32_t CNTR, ISTR, FNR, DADDR;
+    uint32_t RESERVED1;
+    __IO uint32_t LPMCSR, BCDR;
+} USB_DRD_TypeDef;
+
+extern USB_DRD_TypeDef usbd_host_usb;
+extern uint8_t usbd_host_pma[];
+
+#define USB_DRD_FS      (&usbd_host_usb)
+#define USB_DRD_PMAADDR ((uintptr_t) usbd_host_pma)
+#else
+typedef struct {
+    __IO uint16_t EP0R; uint16_t RESERVED0;
+    __IO uint16_t EP1R; uint16_t RESERVED1;
+    __IO uint16_t EP2R; uint16_t RESERVED2;
+    __IO uint16_t EP3R; uint16_t RESERVED3;
+    __IO uint16_t EP4R; uint16_t RESERVED4;
+    __IO uint16_t EP5R; uint16_t RESERVED5;
+    __IO uint16_t EP6R; uint16_t RESERVED6;
+    __IO uint16_t EP7R; uint16_t RESERVED7[17];
+    __IO uint16_t CNTR; uint16_t RESERVED8;
+    __IO uint16_t ISTR; uint16_t RESERVED9;
+    __IO uint16_t FNR; uint16_t RESERVEDA;
+    __IO uint16_t DADDR; uint16_t RESERVEDB;
+    __IO uint16_t BTABLE; uint16_t RESERVEDC;
+    __IO uint16_t LPMCSR; uint16_t RESERVEDD;
+    __IO uint16_t BCDR; uint16_t RESERVEDE;
+} USB_TypeDef;
+
+extern USB_TypeDef usbd_host_usb;
+extern uint8_t usbd_host_pma[];
+
+#define USB         (&usbd_host_usb)
+#define USB_PMAADDR ((uintptr_t) usbd_host_pma)
+#endif
+
+// size of the packet memory in the address space, for all the access schemes
+#define USBD_HOST_PMA_SIZE 2048
+
+#define USB_EP_CTR_RX       0x8000U
+#define USB_EP_DTOG_RX      0x4000U
+#define USB_EPRX_STAT       0x3000U
+#define USB_EP_SETUP        0x0800U
+#define USB_EP_T_FIELD      0x0600U
+#define USB_EP_KIND         0x0100U
+#define USB_EP_CTR_TX       0x0080U
+#define USB_EP_DTOG_TX      0x0040U
+#define USB_EPTX_STAT       0x0030U
+#define USB_EPADDR_FIELD    0x000FU
+#define USB_EP_BULK         0x0000U
+#define USB_EP_CONTROL      0x0200U
+#define USB_EP_ISOCHRONOUS  0x0400U
+#define USB_EP_INTERRUPT    0x0600U
+#define USB_EP_TX_DIS       0x0000U
+#define USB_EP_TX_STALL     0x0010U
+#define USB_EP_TX_NAK       0x0020U
+#define USB_EP_TX_VALID     0x0030U
+#define USB_EP_RX_DIS       0x0000U
+#define USB_EP_RX_STALL     0x1000U
+#define USB_EP_RX_NAK       0x2000U
+#define USB_EP_RX_VALID     0x3000U
+#define USB_EP_REG_MASK     (USB_EP_CTR_RX | USB_EP_SETUP | USB_EP_T_FIELD | USB_EP_KIND | \
+                             USB_EP_CTR_TX | USB_EPADDR_FIELD)
+
+#if defined(STM32G0)
+#define USB_CHEP_REG_MASK   USB_EP_REG_MASK
+#else
+#define USB_EPREG_MASK      USB_EP_REG_MASK
+#endif
+
+#define USB_COUNT0_RX_BLSIZE        0x8000U
+#define USB_COUNT0_RX_NUM_BLOCK     0x7C00U
+#define USB_COUNT1_RX_0_COUNT1_RX_0 0x03FFU
+
+// peripheral controls, with the USB FS peripheral names, for host builds of src/usbd.c
+#define USB_CNTR_CTRM       0x8000U
+#define USB_CNTR_WKUPM      0x1000U
+#define USB_CNTR_SUSPM      0x0800U
+#define USB_CNTR_RESETM     0x0400U
+#define USB_CNTR_SOFM       0x0200U
+#define USB_CNTR_ESOFM      0x0100U
+#define USB_CNTR_L1REQM     0x0080U
+#define USB_CNTR_L1RESUME   0x0020U
+#define USB_CNTR_RESUME     0x0010U
+#define USB_CNTR_FSUSP      0x0008U
+#define USB_CNTR_LPMODE     0x0004U
+#define USB_CNTR_PDWN       0x0002U
+#define USB_CNTR_FRES       0x0001U
+
+#define USB_ISTR_CTR        0x8000U
+#define USB_ISTR_WKUP       0x1000U
+#define USB_ISTR_SUSP       0x0800U
+#define USB_ISTR_RESET      0x0400U
+#define USB_ISTR_SOF        0x0200U
+#define USB_ISTR_ESOF       0x0100U
+#define USB_ISTR_L1REQ      0x0080U
+#define USB_ISTR_DIR        0x0010U
+#define USB_ISTR_EP_ID      0x000FU
+
+#define USB_FNR_FN          0x07FFU
+#define USB_DADDR_EF        0x0080U
+#define USB_DADDR_ADD       0x007FU
+
+#define USB_LPMCSR_LMPEN    0x0001U
+#define USB_LPMCSR_LPMACK   0x0002U
+#define USB_LPMCSR_REMWAKE  0x0008U
+#define USB_LPMCSR_BESL     0x00F0U
+
+#define USB_BCDR_DPPU       0x8000U
+
+// reset and clock controls of the supported families, and the unique device id, that
+// is provided by the tool.
+typedef struct {
+    __IO uint32_t APB1ENR, APB1RSTR;
+    __IO uint32_t APB1ENR1, APB1RSTR1;
+    __IO uint32_t APBENR1, APBRSTR1;
+} RCC_TypeDef;
+
+extern RCC_TypeDef usbd_host_rcc;
+extern uint8_t usbd_host_uid[12];
+
+#define RCC      (&usbd_host_rcc)
+#define UID_BASE ((uintptr_t) usbd_host_uid)
+
+#define RCC_APB1ENR_USBEN     (1UL << 23)
+#define RCC_APB1RSTR_USBRST   (1UL << 23)
+#define RCC_APB1ENR1_USBEN    (1UL << 23)
+#define RCC_APB1RSTR1_USBRST  (1UL << 23)
+#define RCC_APBENR1_USBEN     (1UL << 13)
+#define RCC_APBRSTR1_USBRST   (1UL << 13)
@@ -0,0 +1,283 @@
+#!/usr/bin/env python3
+#
+# usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+#
+# SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+# SPDX-License-Identifier: BSD-3-Clause
+
+"""Host-side model of the DMA-assisted IN transfers (USBD_ENABLE_DMA).
+
+The model mirrors usbd_in(), usbd_in_dma(), usbd_dma_irq_handler(), in_idle() and
+the bus reset handling from src/usbd.c, and runs them against a model of the USB
+peripheral, the DMA channel and the host, in random interleavings. The DMA copies
+one halfword per step, and may fail with a transfer error at any step.
+
+The application sends a new packet to each endpoint whenever it is reported idle,
+using usbd_in() or usbd_in_dma() at random. It rewrites its buffer right after the
+call when it used usbd_in(), and only when the endpoint is reported idle again when
+it used usbd_in_dma(). The following properties are verified:
+
+- the endpoint is never valid while its packet is still being copied.
+- the host only receives complete packets, exactly as sent by the application.
+- every packet is received by the host once, unless dropped by a DMA transfer error
+  or a bus reset.
+- endpoints are always reported idle again, including after DMA transfer errors.
+"""
+
+import argparse
+import random
+import sys
+
+NAK = 'NAK'
+VALID = 'VALID'
+
+DMA_MIN_SIZE = 32
+
+
+class ModelError(Exception):
+    pass
+
+
+class Device:
+
+    def __init__(self, rng, endpoints, error_rate):
+        self.rng = rng
+        self.error_rate = error_rate
+
+        # usb peripheral: endpoint status, packet memory buffer and count
+        self.stat = {ept: NAK for ept in endpoints}
+        self.pma = {ept: [] for ept in endpoints}
+        self.count = {ept: 0 for ept in endpoints}
+
+        # dma channel
+        self.dma_enabled = False
+        self.dma_src = None
+        self.dma_dst = None
+        self.dma_done = 0
+        self.dma_len = 0
+        self.dma_tcif = False
+        self.dma_teif = False
+
+        # library state
+        self.dma_ept = 0
+        self.dma_cnt = 0
+
+        self.errors = {ept: 0 for ept in endpoints}
+
+    # src/usbd.c
+
+    def usbd_in(self, ept, buf):
+        self.pma[ept] = list(buf)
+        self.count[ept] = len(buf)
+        self.stat[ept] = VALID
+        return True
+
+    def usbd_in_dma(self, ept, buf):
+        if self.dma_ept != 0 or len(buf) < DMA_MIN_SIZE:
+            return self.usbd_in(ept, buf)
+
+        # the odd trailing byte is written by the cpu
+        self.pma[ept] = [None] * len(buf)
+        if len(buf) & 1:
+            self.pma[ept][-1] = buf[-1]
+
+        self.dma_ept = ept
+        self.dma_cnt = len(buf)
+        self.dma_src = buf
+        self.dma_dst = ept
+        self.dma_done = 0
+        self.dma_len = len(buf) >> 1
+        self.dma_enabled = True
+        return True
+
+    def usbd_dma_irq_handler(self):
+        if not (self.dma_tcif or self.dma_teif):
+            return
+
+        teif = self.dma_teif
+        self.dma_tcif = self.dma_teif = False
+        self.dma_enabled = False
+
+        ept = self.dma_ept
+        if ept == 0:
+            return
+
+        if not teif:
+            self.count[ept] = self.dma_cnt
+            self.stat[ept] = VALID
+        else:
+            self.errors[ept] += 1
+        self.dma_ept = 0
+
+    def dma_abort(self):
+        self.dma_enabled = False
+        self.dma_tcif = self.dma_teif = False
+        self.dma_ept = 0
+
+    def in_idle(self, ept):
+        if self.dma_ept == ept:
+            return False
+        return self.stat[ept] == NAK
+
+    def bus_reset(self):
+        self.dma_abort()
+        for ept in self.stat:
+            self.stat[ept] = NAK
+
+    # hardware
+
+    def dma_step(self):
+        if not self.dma_enabled or self.dma_done >= self.dma_len:
+            return
+
+        if self.rng.random() < self.error_rate:
+            self.dma_enabled = False
+            self.dma_teif = True
+            return
+
+        i = self.dma_done * 2
+        self.pma[self.dma_dst][i:i + 2] = self.dma_src[i:i + 2]
+        self.dma_done += 1
+        if self.dma_done == self.dma_len:
+            self.dma_enabled = False
+            self.dma_tcif = True
+
+    def host_in_token(self, ept):
+        if self.stat[ept] != VALID:
+            return None
+
+        if self.dma_ept == ept:
+            raise ModelError('endpoint %d valid while its packet is being copied' % ept)
+
+        data = self.pma[ept][:self.count[ept]]
+        if None in data:
+            raise ModelError('endpoint %d sent a packet not fully copied' % ept)
+
+        self.stat[ept] = NAK
+        return bytes(data)
+
+
+class Application:
+
+    def __init__(self, rng, ept, size):
+        self.rng = rng
+        self.ept = ept
+        self.size = size
+        self.buf = bytearray(size)
+        self.seq = 0
+        self.pending = False
+        self.in_flight = {}
+        self.sent = 0
+        self.dropped = 0
+
+    def scramble(self):
+        self.buf[:] = bytes(self.rng.randrange(256) for _ in range(self.size))
+
+    def in_cb(self, dev):
+        # the buffer of a dma packet can only be reused after the endpoint is idle
+        if self.pending:
+            self.scramble()
+            self.pending = False
+
+        # packets start with a sequence number
+        self.seq = (self.seq + 1) & 0xffff
+        n = self.rng.randint(2, self.size)
+        self.scramble()
+        self.buf[0:2] = self.seq.to_bytes(2, 'little')
+        self.in_flight[self.seq] = bytes(self.buf[:n])
+        self.sent += 1
+
+        if self.rng.random() < 0.5:
+            dev.usbd_in(self.ept, memoryview(self.buf)[:n])
+            self.scramble()
+        else:
+            dev.usbd_in_dma(self.ept, memoryview(self.buf)[:n])
+            self.pending = True
+
+    def received(self, packet):
+        seq = int.from_bytes(packet[0:2], 'little') if len(packet) >= 2 else None
+        if self.in_flight.get(seq) != packet:
+            raise ModelError('endpoint %d received a corrupted or duplicated packet' % self.ept)
+        del self.in_flight[seq]
+
+    def drop(self):
+        self.dropped += len(self.in_flight)
+        self.in_flight.clear()
+
+
+def run(seed, steps, error_rate, reset_rate):
+    rng = random.Random(seed)
+    endpoints = {1: 64, 2: 64, 3: 63}
+    dev = Device(rng, endpoints, error_rate)
+    apps = {ept: Application(rng, ept, size) for ept, size in endpoints.items()}
+    busy_steps = {ept: 0 for ept in endpoints}
+    errors = {ept: 0 for ept in endpoints}
+
+    for _ in range(steps):
+        event = rng.randrange(4)
+
+        if event == 0:
+            dev.dma_step()
+
+        elif event == 1:
+            dev.usbd_dma_irq_handler()
+
+        elif event == 2:
+            ept = rng.choice(list(endpoints))
+            packet = dev.host_in_token(ept)
+            if packet is not None:
+                apps[ept].received(packet)
+
+        elif event == 3:
+            ept = rng.choice(list(endpoints))
+            if dev.in_idle(ept):
+                # packets are only lost to dma transfer errors
+                if apps[ept].in_flight:
+                    if dev.errors[ept] == errors[ept]:
+                        raise ModelError('endpoint %d idle with a packet in flight' % ept)
+                    apps[ept].drop()
+                errors[ept] = dev.errors[ept]
+                apps[ept].in_cb(dev)
+
+        if rng.random() < reset_rate:
+            dev.bus_reset()
+            for app in apps.values():
+                app.drop()
+
+        for ept in endpoints:
+            busy_steps[ept] = 0 if dev.in_idle(ept) else busy_steps[ept] + 1
+            if busy_steps[ept] > 2000:
+                raise ModelError('endpoint %d never reported idle again' % ept)
+
+    return apps
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('--runs', type=int, default=100, help='number of runs')
+    parser.add_argument('--steps', type=int, default=20000, help='steps per run')
+    parser.add_argument('--seed', type=int, default=0, help='seed of the first run')
+    parser.add_argument('--error-rate', type=float, default=0.002,
+                        help='probability of a dma transfer error per halfword')
+    parser.add_argument('--reset-rate', type=float, default=0.0001,
+                        help='probability of a bus reset per step')
+    args = parser.parse_args()
+
+    sent = dropped = 0
+    for seed in range(args.seed, args.seed + args.runs):
+        try:
+            apps = run(seed, args.steps, args.error_rate, args.reset_rate)
+        except ModelError as e:
+            print('seed %d: %s' % (seed, e), file=sys.stderr)
+            return 1
+
+        sent += sum(app.sent for app in apps.values())
+        dropped += sum(app.dropped for app in apps.values())
+
+    print('%d runs, %d packets, %d dropped by dma errors or bus resets: ok' %
+          (args.runs, sent, dropped))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,289 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// host benchmark of usbd_in() and usbd_out() against their fast-path variants,
+// USBD_FAST_IN() and USBD_FAST_OUT(). built with src/usbd.c against the register
+// model from tools/host, with EP1 as a 64 byte bulk endpoint in both directions, by
+// tools/usbd-fast-bench.py.
+//
+// the device is configured by the host requests the library expects (bus reset,
+// SET_ADDRESS and SET_CONFIGURATION), and each operation is measured by the time
+// it takes, and on linux by the number of host instructions it executes, counted
+// by single stepping a child process with ptrace.
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <usbd.h>
+#include <usbd-ept.h>
+
+#ifdef __linux__
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#endif
+
+#if (USBD_EP1_IN_SIZE != 64) || (USBD_EP1_OUT_SIZE != 64)
+#error "EP1 must be built as a 64 byte bulk endpoint in both directions"
+#endif
+
+USB_TypeDef usbd_host_usb;
+RCC_TypeDef usbd_host_rcc;
+uint8_t usbd_host_pma[USBD_HOST_PMA_SIZE] __attribute__((aligned(4)));
+uint8_t usbd_host_uid[12];
+
+static const usb_device_descriptor_t device_descriptor = {
+    .bLength            = sizeof(usb_device_descriptor_t),
+    .bDescriptorType    = USB_DESCR_TYPE_DEVICE,
+    .bcdUSB             = 0x0200,
+    .bMaxPacketSize0    = USBD_EP0_SIZE,
+    .bNumConfigurations = 1,
+};
+
+static const struct __attribute__((packed)) {
+    usb_config_descriptor_t cfg;
+    usb_interface_descriptor_t itf;
+    usb_endpoint_descriptor_t ept_in;
+    usb_endpoint_descriptor_t ept_out;
+} config_descriptor = {
+    .cfg = {
+        .bLength             = sizeof(usb_config_descriptor_t),
+        .bDescriptorType     = USB_DESCR_TYPE_CONFIGURATION,
+        .wTotalLength        = sizeof(config_descriptor),
+        .bNumInterfaces      = 1,
+        .bConfigurationValue = 1,
+        .bmAttributes        = 0x80,
+        .bMaxPower           = 50,
+    },
+    .itf = {
+        .bLength            = sizeof(usb_interface_descriptor_t),
+        .bDescriptorType    = USB_DESCR_TYPE_INTERFACE,
+        .bNumEndpoints      = 2,
+        .bInterfaceClass    = 0xff,
+    },
+    .ept_in = {
+        .bLength          = sizeof(usb_endpoint_descriptor_t),
+        .bDescriptorType  = USB_DESCR_TYPE_ENDPOINT,
+        .bEndpointAddress = USB_DESCR_EPT_ADDR_DIR_IN | 1,
+        .bmAttributes     = 2,
+        .wMaxPacketSize   = USBD_EP1_IN_SIZE,
+    },
+    .ept_out = {
+        .bLength          = sizeof(usb_endpoint_descriptor_t),
+        .bDescriptorType  = USB_DESCR_TYPE_ENDPOINT,
+        .bEndpointAddress = 1,
+        .bmAttributes     = 2,
+        .wMaxPacketSize   = USBD_EP1_OUT_SIZE,
+    },
+};
+
+const usb_device_descriptor_t*
+usbd_get_device_descriptor_cb(void)
+{
+    return &device_descriptor;
+}
+
+const usb_config_descriptor_t*
+usbd_get_config_descriptor_cb(void)
+{
+    return &config_descriptor.cfg;
+}
+
+const usb_interface_descriptor_t*
+usbd_get_interface_descriptor_cb(uint16_t itf)
+{
+    return itf == 0 ? &config_descriptor.itf : NULL;
+}
+
+const usb_string_descriptor_t*
+usbd_get_string_descriptor_cb(uint16_t lang, uint8_t idx)
+{
+    (void) lang;
+    (void) idx;
+    return NULL;
+}
+
+
+static void
+host_setup(uint8_t bRequest, uint16_t wValue)
+{
+    usb_ctrl_request_t req = {
+        .bmRequestType = USB_REQ_DIR_HOST_TO_DEVICE | USB_REQ_TYPE_STANDARD | USB_REQ_RCPT_DEVICE,
+        .bRequest      = bRequest,
+        .wValue        = wValue,
+    };
+    usbd_pma_write(USBD_EP0_PMA_OUT_ADDR, &req, sizeof(req), NULL, 0);
+    usbd_pma_set(1, USBD_EP0_PMA_OUT_ADDR, sizeof(req));
+
+    USB->EP0R |= USB_EP_CTR_RX | USB_EP_SETUP;
+    USB->ISTR = USB_ISTR_CTR;
+    usbd_task();
+
+    // status stage
+    USB->EP0R = (USB->EP0R & ~USB_EP_SETUP) | USB_EP_CTR_TX;
+    USB->ISTR = USB_ISTR_CTR;
+    usbd_task();
+}
+
+static void
+host_configure(void)
+{
+    usbd_init();
+
+    USB->ISTR = USB_ISTR_RESET;
+    usbd_task();
+
+    host_setup(USB_REQ_SET_ADDRESS, 1);
+    host_setup(USB_REQ_SET_CONFIGURATION, 1);
+
+    if ((USB->DADDR != (USB_DADDR_EF | 1)) || ((USB->EP1R & USB_EPADDR_FIELD) != 1))
+        abort();
+}
+
+
+static uint8_t buf[64];
+static volatile uint16_t out_len;
+
+// a packet of the given size is waiting to be read from EP1
+static void
+host_out_packet(uint16_t len)
+{
+    usbd_pma_set_count((1 << 1) + 1, USBD_EP1_PMA_OUT_ADDR, USB_COUNT0_RX_BLSIZE | len);
+}
+
+#define op(name, prepare, call)                                                 \
+static void                                                                     \
+name(uint16_t len)                                                              \
+{                                                                               \
+    prepare;                                                                    \
+    call;                                                                       \
+}
+op(op_none, (void) len, (void) 0)
+op(op_in, (void) 0, if (!usbd_in(1, buf, len)) abort())
+op(op_fast_in, (void) 0, USBD_FAST_IN(1, buf, len))
+op(op_out, host_out_packet(len), out_len = usbd_out(1, buf, sizeof(buf)))
+op(op_fast_out, host_out_packet(len), out_len = USBD_FAST_OUT(1, buf, sizeof(buf)))
+#undef op
+
+static const struct {
+    const char *name;
+    void (*fn)(uint16_t len);
+    void (*prepare)(uint16_t len);
+} ops[] = {
+    {"usbd_in()", op_in, op_none},
+    {"USBD_FAST_IN()", op_fast_in, op_none},
+    {"usbd_out()", op_out, host_out_packet},
+    {"USBD_FAST_OUT()", op_fast_out, host_out_packet},
+};
+
+static const uint16_t sizes[] = {0, 8, 64};
+
+
+static double
+time_ns(void (*fn)(uint16_t len), void (*prepare)(uint16_t len), uint16_t len,
+    unsigned long iterations)
+{
+    struct timespec start, end;
+
+    // the calls and the preparation of the packet memory are measured apart
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned long i = 0; i < iterations; i++)
+        prepare(len);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double base = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned long i = 0; i < iterations; i++)
+        fn(len);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double total = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+    return (total - base) / iterations;
+}
+
+#ifdef __linux__
+// instructions executed between two stops of the child, by single stepping it
+static long
+count_steps(void (*fn)(uint16_t len), uint16_t len)
+{
+    pid_t pid = fork();
+    if (pid < 0)
+        return -1;
+
+    if (pid == 0) {
+        ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+        raise(SIGSTOP);
+        fn(len);
+        raise(SIGSTOP);
+        _exit(0);
+    }
+
+    int status;
+    long steps = 0;
+    waitpid(pid, &status, 0);
+    while (true) {
+        if (ptrace(PTRACE_SINGLESTEP, pid, NULL, NULL) < 0)
+            return -1;
+        waitpid(pid, &status, 0);
+        if (!WIFSTOPPED(status))
+            return -1;
+        if (WSTOPSIG(status) == SIGSTOP)
+            break;
+        steps++;
+    }
+
+    kill(pid, SIGKILL);
+    waitpid(pid, &status, 0);
+    return steps;
+}
+
+static long
+count_instructions(void (*fn)(uint16_t len), void (*prepare)(uint16_t len), uint16_t len)
+{
+    long total = count_steps(fn, len);
+    long base = count_steps(prepare, len);
+    if (total < 0 || base < 0)
+        return -1;
+
+    // the calls, the preparation of the packet memory and the stops are measured apart
+    return total - base;
+}
+#endif
+
+
+int
+main(int argc, char **argv)
+{
+    unsigned long iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+
+    host_configure();
+
+#ifdef __linux__
+    printf("%-17s %26s    %26s\n", "", "instructions", "ns per call");
+    printf("%-17s %8s %8s %8s    %8s %8s %8s\n", "", "0 B", "8 B", "64 B", "0 B", "8 B",
+        "64 B");
+#else
+    printf("%-17s %26s\n", "", "ns per call");
+    printf("%-17s %8s %8s %8s\n", "", "0 B", "8 B", "64 B");
+#endif
+
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        printf("%-17s", ops[i].name);
+#ifdef __linux__
+        for (size_t j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++)
+            printf(" %8ld", count_instructions(ops[i].fn, ops[i].prepare, sizes[j]));
+        printf("   ");
+#endif
+        for (size_t j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++)
+            printf(" %8.1f", time_ns(ops[i].fn, ops[i].prepare, sizes[j], iterations));
+        printf("\n");
+    }
+
+    return 0;
+}
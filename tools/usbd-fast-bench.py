@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+#
+# usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+#
+# SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+# SPDX-License-Identifier: BSD-3-Clause
+
+"""Host-side benchmark of the fast-path endpoint operations.
+
+Builds tools/usbd-fast-bench.c and src/usbd.c with the host C compiler, against the
+register model from tools/host (STM32G4, 1x16 bit access scheme), with EP1 as a 64
+byte bulk endpoint in both directions, and runs it. The benchmark configures the
+device, and compares usbd_in() and usbd_out() with USBD_FAST_IN() and
+USBD_FAST_OUT(), for packets of 0, 8 and 64 bytes:
+
+- by the number of host instructions executed per call, on linux.
+- by the time per call.
+
+The host instruction counts are a proxy of the code generated for the target, the
+cortex-m cycles must be measured on the target, e.g. with the DWT cycle counter.
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+
+def main():
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+    parser = argparse.ArgumentParser(description='Host-side benchmark of the fast-path '
+                                     'endpoint operations.')
+    parser.add_argument('--cc', default=os.environ.get('CC', 'cc'),
+                        help='host C compiler (default: $CC or cc)')
+    parser.add_argument('--opt', default='-Os', help='optimization flag (default: -Os)')
+    parser.add_argument('--iterations', type=int, default=1000000,
+                        help='number of timed calls per operation and packet size')
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as tmp:
+        binary = os.path.join(tmp, 'usbd-fast-bench')
+        try:
+            subprocess.run([args.cc, '-std=gnu11', args.opt, '-Wall', '-Wextra',
+                            '-Wno-pointer-to-int-cast', '-DSTM32G4',
+                            '-DUSBD_EP1_IN_SIZE=64', '-DUSBD_EP1_OUT_SIZE=64',
+                            '-I' + os.path.join(root, 'tools', 'host'),
+                            '-I' + os.path.join(root, 'include'),
+                            os.path.join(root, 'tools', 'usbd-fast-bench.c'),
+                            os.path.join(root, 'src', 'usbd.c'),
+                            '-o', binary], check=True)
+            subprocess.run([binary, str(args.iterations)], check=True)
+        except subprocess.CalledProcessError:
+            print('benchmark failed', file=sys.stderr)
+            return 1
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
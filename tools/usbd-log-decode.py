@@ -0,0 +1,216 @@
+#!/usr/bin/env python3
+#
+# usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+#
+# SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+# SPDX-License-Identifier: BSD-3-Clause
+
+"""Format the records of the binary logging driver (usbd-fs-stm32-log).
+
+The records are read from a capture of the data sent by the log endpoint (a file or
+the standard input), or straight from the device, using pyusb. The format strings are
+read from the ELF file of the firmware.
+
+The data is a stream of 32-bit little-endian words. Each record starts with a header
+word, containing the number of arguments in the 4 most significant bits and the address
+of the format string in the 28 least significant bits, followed by the arguments, one
+word each. The printf conversions d, i, u, o, x, X, c, s and p are supported, with the
+usual flags, width, precision and length modifiers. Each conversion takes one argument,
+and %s arguments are read from the ELF file as well.
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+SHF_ALLOC = 0x2
+SHT_NOBITS = 8
+
+HEADER_ADDR_MASK = 0x0fffffff
+
+
+class Elf:
+
+    def __init__(self, filename):
+        with open(filename, 'rb') as f:
+            self.data = f.read()
+
+        if self.data[:4] != b'\x7fELF':
+            raise ValueError('%s: not an ELF file' % filename)
+
+        bits = {1: 32, 2: 64}.get(self.data[4])
+        endian = {1: '<', 2: '>'}.get(self.data[5])
+        if bits is None or endian is None:
+            raise ValueError('%s: unsupported ELF class or data encoding' % filename)
+
+        if bits == 32:
+            shoff, = struct.unpack_from(endian + 'I', self.data, 0x20)
+            shentsize, shnum = struct.unpack_from(endian + 'HH', self.data, 0x2e)
+            shfmt = endian + 'IIIIIIIIII'
+        else:
+            shoff, = struct.unpack_from(endian + 'Q', self.data, 0x28)
+            shentsize, shnum = struct.unpack_from(endian + 'HH', self.data, 0x3a)
+            shfmt = endian + 'IIQQQQIIQQ'
+
+        # contents of the sections loaded to the device, by address
+        self.sections = []
+        for i in range(shnum):
+            _, sh_type, sh_flags, sh_addr, sh_offset, sh_size = \
+                struct.unpack_from(shfmt, self.data, shoff + i * shentsize)[:6]
+            if (sh_flags & SHF_ALLOC) and sh_type != SHT_NOBITS and sh_size > 0:
+                self.sections.append((sh_addr, sh_offset, sh_size))
+
+    def string(self, addr, mask=0xffffffff):
+        for sh_addr, sh_offset, sh_size in self.sections:
+            start = sh_addr & mask
+            if start <= addr < start + sh_size:
+                offset = sh_offset + addr - start
+                end = self.data.find(b'\0', offset, sh_offset + sh_size)
+                if end < 0:
+                    return None
+                return self.data[offset:end].decode('utf-8', errors='replace')
+        return None
+
+
+CONVERSION = re.compile(r'%(?P<flags>[-+ #0]*)(?P<width>\*|\d+)?(?:\.(?P<prec>\*|\d+))?'
+                        r'(?P<length>hh|h|ll|l|j|z|t)?(?P<conv>[diouxXcsp%])')
+
+
+def to_signed(value, bits):
+    value &= (1 << bits) - 1
+    return value - (1 << bits) if value & (1 << (bits - 1)) else value
+
+
+def format_record(elf, fmt, args):
+    args = list(args)
+
+    def next_arg():
+        return args.pop(0) if args else None
+
+    def replace(m):
+        conv = m.group('conv')
+        if conv == '%':
+            return '%'
+
+        width = m.group('width')
+        if width == '*':
+            width = next_arg()
+            width = '' if width is None else str(to_signed(width, 32))
+        prec = m.group('prec')
+        if prec == '*':
+            prec = next_arg()
+            prec = None if prec is None else str(max(to_signed(prec, 32), 0))
+
+        value = next_arg()
+        if value is None:
+            return '<missing>'
+
+        bits = {'hh': 8, 'h': 16}.get(m.group('length'), 32)
+        spec = '%' + m.group('flags') + (width or '') + ('.' + prec if prec is not None else '')
+
+        if conv in 'di':
+            return (spec + 'd') % to_signed(value, bits)
+        if conv == 'u':
+            return (spec + 'd') % (value & ((1 << bits) - 1))
+        if conv in 'oxX':
+            return (spec + conv) % (value & ((1 << bits) - 1))
+        if conv == 'c':
+            return (spec + 'c') % chr(value & 0xff)
+        if conv == 'p':
+            return (spec + 's') % ('0x%08x' % value)
+
+        s = elf.string(value)
+        return (spec + 's') % (s if s is not None else '<0x%08x>' % value)
+
+    rv = CONVERSION.sub(replace, fmt)
+    if args:
+        rv += ' <%d extra arguments>' % len(args)
+    return rv
+
+
+class Decoder:
+
+    def __init__(self, elf, out):
+        self.elf = elf
+        self.out = out
+        self.buf = b''
+        self.words = []
+
+    def feed(self, data):
+        self.buf += data
+        n = len(self.buf) // 4
+        self.words += struct.unpack_from('<%dI' % n, self.buf)
+        self.buf = self.buf[n * 4:]
+
+        while self.words:
+            hdr = self.words[0]
+            nargs = hdr >> 28
+            fmt = self.elf.string(hdr & HEADER_ADDR_MASK, HEADER_ADDR_MASK) if hdr != 0 else None
+
+            # captures may start in the middle of a record, words that are not a
+            # valid header are skipped until the stream is synchronized again
+            if fmt is None:
+                print('<skipped word 0x%08x>' % hdr, file=sys.stderr)
+                self.words.pop(0)
+                continue
+
+            if len(self.words) < 1 + nargs:
+                break
+
+            args = self.words[1:1 + nargs]
+            self.words = self.words[1 + nargs:]
+            self.out.write(format_record(self.elf, fmt.rstrip('\r\n'), args) + '\n')
+            self.out.flush()
+
+
+def read_usb(device, endpoint, decoder):
+    try:
+        import usb.core
+    except ImportError:
+        raise SystemExit('error: reading from the device requires pyusb')
+
+    vid, pid = (int(i, 16) for i in device.split(':'))
+    dev = usb.core.find(idVendor=vid, idProduct=pid)
+    if dev is None:
+        raise SystemExit('error: device %04x:%04x not found' % (vid, pid))
+
+    while True:
+        try:
+            decoder.feed(bytes(dev.read(endpoint, 4096, timeout=0)))
+        except usb.core.USBTimeoutError:
+            pass
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('elf', help='ELF file of the firmware')
+    parser.add_argument('input', nargs='?', default='-',
+                        help='capture of the data sent by the log endpoint (default: stdin)')
+    parser.add_argument('--usb', metavar='VID:PID', help='read from the device, using pyusb')
+    parser.add_argument('--endpoint', type=lambda x: int(x, 0), default=0x81,
+                        help='address of the log endpoint (default: 0x81)')
+    args = parser.parse_args()
+
+    decoder = Decoder(Elf(args.elf), sys.stdout)
+
+    try:
+        if args.usb is not None:
+            read_usb(args.usb, args.endpoint, decoder)
+            return 0
+
+        f = sys.stdin.buffer if args.input == '-' else open(args.input, 'rb')
+        with f:
+            while True:
+                data = f.read1(4096) if hasattr(f, 'read1') else f.read(4096)
+                if not data:
+                    break
+                decoder.feed(data)
+    except KeyboardInterrupt:
+        pass
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
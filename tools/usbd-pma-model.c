@@ -0,0 +1,289 @@
+/*
+ * usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+ *
+ * SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// host model of the packet memory access layer from include/usbd-ept.h. the buffer
+// descriptors and copy kernels are run against the packet memory as seen by the
+// cpu (tools/host/stm32-host.h), and checked against the packet memory as seen by
+// the peripheral, a contiguous array of bytes. built and run for each access scheme
+// by tools/usbd-pma-model.py.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// a layout with odd sizes, rx buffers rounded to both block sizes and a double
+// buffered isochronous endpoint, that fits the smallest packet memory.
+#define USBD_EP1_IN_SIZE  64
+#define USBD_EP1_OUT_SIZE 64
+#define USBD_EP2_IN_SIZE  10
+#define USBD_EP3_OUT_SIZE 100
+#define USBD_EP4_OUT_SIZE 9
+#define USBD_EP5_IN_SIZE  21
+#define USBD_EP5_TYPE     ISOCHRONOUS
+
+#include <usbd-ept.h>
+
+#if defined(USBD_DRD)
+#define SCHEME "DRD"
+#elif defined(USBD_PMA_2X16)
+#define SCHEME "2x16"
+#else
+#define SCHEME "1x16"
+#endif
+
+#define POISON 0xa5
+
+#if defined(USBD_DRD)
+USB_DRD_TypeDef usbd_host_usb;
+#else
+USB_TypeDef usbd_host_usb;
+#endif
+uint8_t usbd_host_pma[USBD_HOST_PMA_SIZE] __attribute__((aligned(4)));
+
+static uint32_t rng;
+
+
+static uint32_t
+rand32(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static uint32_t
+rand_range(uint32_t n)
+{
+    return rand32() % n;
+}
+
+#define fail(...) do {                                                          \
+    fprintf(stderr, "usbd-pma-model (" SCHEME "): " __VA_ARGS__);               \
+    fprintf(stderr, "\n");                                                      \
+    exit(1);                                                                    \
+} while (0)
+
+
+// offset of a packet memory byte in the address space
+static size_t
+cpu_offset(uint16_t i)
+{
+#if defined(USBD_PMA_2X16) && !defined(USBD_DRD)
+    return ((i >> 1) << 2) | (i & 1);
+#else
+    return i;
+#endif
+}
+
+static uint8_t
+pma_byte(uint16_t i)
+{
+    return usbd_host_pma[cpu_offset(i)];
+}
+
+static uint16_t
+pma_halfword(uint16_t i)
+{
+    return pma_byte(i) | (((uint16_t) pma_byte(i + 1)) << 8);
+}
+
+static void
+pma_set_halfword(uint16_t i, uint16_t v)
+{
+    usbd_host_pma[cpu_offset(i)] = v;
+    usbd_host_pma[cpu_offset(i + 1)] = v >> 8;
+}
+
+// every byte of the address space outside of the packet memory range [start, end) is
+// expected to be untouched, including the unused halfwords of the 2x16 bit scheme.
+static void
+check_untouched(uint16_t start, uint16_t end, const char *what)
+{
+    static bool used[USBD_HOST_PMA_SIZE];
+    memset(used, 0, sizeof(used));
+    for (uint16_t i = start; i < end; i++)
+        used[cpu_offset(i)] = true;
+
+    for (size_t i = 0; i < sizeof(usbd_host_pma); i++)
+        if (!used[i] && usbd_host_pma[i] != POISON)
+            fail("%s: address space offset %zu modified, outside of [%u, %u)", what, i,
+                start, end);
+}
+
+
+static void
+check_layout(void)
+{
+    static const struct {
+        uint16_t addr;
+        uint16_t size;
+    } buffers[] = {
+        {USBD_EP0_PMA_IN_ADDR, USBD_EP0_SIZE},
+        {USBD_EP0_PMA_OUT_ADDR, USBD_EP0_SIZE},
+#define buffer(EPT)                                                             \
+        {USBD_EP ## EPT ## _PMA_IN_ADDR, USBD_EP_PMA_IN_SIZE(EPT)},             \
+        {USBD_EP ## EPT ## _PMA_OUT_ADDR, USBD_EP_PMA_OUT_SIZE(EPT)}
+        buffer(1), buffer(2), buffer(3), buffer(4), buffer(5), buffer(6), buffer(7),
+#undef buffer
+    };
+
+    uint16_t end = 16 * 4;
+    for (size_t i = 0; i < sizeof(buffers) / sizeof(buffers[0]); i++) {
+        if (buffers[i].addr != end)
+            fail("layout: buffer %zu at %u, expected right after the previous one, at %u",
+                i, buffers[i].addr, end);
+        if (buffers[i].addr % USBD_PMA_ALIGN)
+            fail("layout: buffer %zu at %u, not aligned to %u bytes", i, buffers[i].addr,
+                USBD_PMA_ALIGN);
+        end += buffers[i].size;
+    }
+
+    if (end != USBD_PMA_END)
+        fail("layout: buffers end at %u, USBD_PMA_END is %u", end, USBD_PMA_END);
+    if (end > USBD_PMA_SIZE)
+        fail("layout: buffers end at %u, past the packet memory size, %u", end,
+            USBD_PMA_SIZE);
+
+    // rx buffers take whole blocks of 2 or 32 bytes
+    if ((USBD_EP_PMA_OUT_SIZE(3) != 128) || (USBD_EP_PMA_OUT_SIZE(4) != USBD_PMA_TX_SIZE(10)))
+        fail("layout: rx buffer sizes %u and %u", USBD_EP_PMA_OUT_SIZE(3),
+            USBD_EP_PMA_OUT_SIZE(4));
+
+    // both isochronous buffers hold a full packet
+    if ((USBD_EP_PMA_IN_SIZE(5) != USBD_PMA_TX_SIZE(21)) ||
+        (USBD_EP_PMA_OUT_SIZE(5) != USBD_PMA_TX_SIZE(21)))
+        fail("layout: isochronous buffer sizes %u and %u", USBD_EP_PMA_IN_SIZE(5),
+            USBD_EP_PMA_OUT_SIZE(5));
+}
+
+static void
+check_descriptors(void)
+{
+    for (uint8_t d = 0; d < 16; d++) {
+        uint16_t addr = (rand_range(USBD_PMA_SIZE) & ~(USBD_PMA_ALIGN - 1));
+        uint16_t cnt = rand32() & 0xffff;
+
+        memset(usbd_host_pma, POISON, sizeof(usbd_host_pma));
+        usbd_pma_set(d, addr, cnt);
+        if ((pma_halfword(d << 2) != addr) || (pma_halfword((d << 2) + 2) != cnt))
+            fail("descriptor %u: set to 0x%04x/0x%04x, got 0x%04x/0x%04x", d, addr, cnt,
+                pma_halfword(d << 2), pma_halfword((d << 2) + 2));
+        check_untouched(d << 2, (d << 2) + 4, "usbd_pma_set");
+
+        // the count is written as a whole, the address is kept
+        uint16_t cnt2 = rand_range(USBD_EP0_SIZE + 1);
+        usbd_pma_set_count(d, addr, cnt2);
+        if ((pma_halfword(d << 2) != addr) || (pma_halfword((d << 2) + 2) != cnt2))
+            fail("descriptor %u: count set to 0x%04x, got 0x%04x/0x%04x", d, cnt2,
+                pma_halfword(d << 2), pma_halfword((d << 2) + 2));
+        check_untouched(d << 2, (d << 2) + 4, "usbd_pma_set_count");
+
+        // received counts are reported next to the rx buffer size fields
+        uint16_t rx = rand_range(1024);
+        uint16_t blocks = rand32() & (USB_COUNT0_RX_BLSIZE | USB_COUNT0_RX_NUM_BLOCK);
+        pma_set_halfword((d << 2) + 2, blocks | rx);
+        if (usbd_pma_get_count(d) != rx)
+            fail("descriptor %u: received count 0x%04x, got 0x%04x", d, rx,
+                usbd_pma_get_count(d));
+    }
+}
+
+static void
+random_bytes(uint8_t *buf, uint16_t len)
+{
+    for (uint16_t i = 0; i < len; i++)
+        buf[i] = rand32();
+}
+
+static void
+check_write(void)
+{
+    static uint8_t src[2][256 + 4] __attribute__((aligned(4)));
+
+    uint16_t len1 = rand_range(130);
+    uint16_t len2 = rand_range(2) ? rand_range(130) : 0;
+    uint8_t *src1 = src[0] + rand_range(4);
+    uint8_t *src2 = src[1] + rand_range(4);
+    uint16_t addr = USBD_EP0_PMA_IN_ADDR +
+        (rand_range(USBD_PMA_SIZE - USBD_EP0_PMA_IN_ADDR - 260) & ~(USBD_PMA_ALIGN - 1));
+
+    random_bytes(src1, len1);
+    random_bytes(src2, len2);
+    memset(usbd_host_pma, POISON, sizeof(usbd_host_pma));
+
+    usbd_pma_write(addr, src1, len1, len2 > 0 ? src2 : NULL, len2);
+
+    for (uint16_t i = 0; i < len1 + len2; i++) {
+        uint8_t expected = i < len1 ? src1[i] : src2[i - len1];
+        if (pma_byte(addr + i) != expected)
+            fail("usbd_pma_write(%u, +%u, %u, +%u, %u): byte %u is 0x%02x, expected 0x%02x",
+                addr, (unsigned) (src1 - src[0]), len1, (unsigned) (src2 - src[1]), len2,
+                i, pma_byte(addr + i), expected);
+    }
+
+    // the padding of the last halfword or word may be written
+    check_untouched(addr, addr + USBD_PMA_TX_SIZE(len1 + len2), "usbd_pma_write");
+}
+
+static void
+check_read(void)
+{
+    static uint8_t dst[2][256 + 8] __attribute__((aligned(4)));
+
+    uint16_t len1 = rand_range(130);
+    uint16_t len2 = rand_range(2) ? rand_range(130) : 0;
+    uint8_t *dst1 = dst[0] + 4 + rand_range(4);
+    uint8_t *dst2 = dst[1] + 4 + rand_range(4);
+    uint16_t addr = USBD_EP0_PMA_IN_ADDR +
+        (rand_range(USBD_PMA_SIZE - USBD_EP0_PMA_IN_ADDR - 260) & ~(USBD_PMA_ALIGN - 1));
+
+    random_bytes(usbd_host_pma, sizeof(usbd_host_pma));
+    memset(dst, POISON, sizeof(dst));
+
+    usbd_pma_read(addr, dst1, len1, len2 > 0 ? dst2 : NULL, len2);
+
+    for (uint16_t i = 0; i < len1 + len2; i++) {
+        uint8_t got = i < len1 ? dst1[i] : dst2[i - len1];
+        if (got != pma_byte(addr + i))
+            fail("usbd_pma_read(%u, +%u, %u, +%u, %u): byte %u is 0x%02x, expected 0x%02x",
+                addr, (unsigned) (dst1 - dst[0]), len1, (unsigned) (dst2 - dst[1]), len2,
+                i, got, pma_byte(addr + i));
+    }
+
+    for (uint8_t b = 0; b < 2; b++) {
+        const uint8_t *start = b == 0 ? dst1 : dst2;
+        const uint8_t *end = start + (b == 0 ? len1 : len2);
+        for (const uint8_t *p = dst[b]; p < dst[b] + sizeof(dst[b]); p++)
+            if ((p < start || p >= end) && *p != POISON)
+                fail("usbd_pma_read(%u, +%u, %u, +%u, %u): buffer %u modified at %d",
+                    addr, (unsigned) (dst1 - dst[0]), len1, (unsigned) (dst2 - dst[1]),
+                    len2, b + 1, (int) (p - start));
+    }
+}
+
+
+int
+main(int argc, char **argv)
+{
+    unsigned long iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+    rng = argc > 2 ? strtoul(argv[2], NULL, 10) : 1;
+    if (rng == 0)
+        rng = 1;
+
+    check_layout();
+    check_descriptors();
+    for (unsigned long i = 0; i < iterations; i++) {
+        check_write();
+        check_read();
+    }
+
+    printf("usbd-pma-model (" SCHEME "): %lu writes and reads, 16 descriptors, layout "
+        "ending at %u of %u bytes: ok\n", iterations, USBD_PMA_END, USBD_PMA_SIZE);
+    return 0;
+}
@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+#
+# usbd-fs-stm32: A lightweight (and very opinionated) USB FS device stack for STM32.
+#
+# SPDX-FileCopyrightText: 2024 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+# SPDX-License-Identifier: BSD-3-Clause
+
+"""Host-side model of the packet memory access schemes.
+
+Builds tools/usbd-pma-model.c with the host C compiler, once for each packet memory
+access scheme, against the register model from tools/host, and runs it. The model
+runs the buffer descriptor accessors and the copy kernels from include/usbd-ept.h
+against the packet memory as seen by the cpu, and verifies that:
+
+- the endpoint buffers are aligned, contiguous and fit the packet memory.
+- buffer descriptors are written and read at the right place, with the received
+  count masked from the rx buffer size fields.
+- packets written from and read to buffers of any alignment, split in two buffers
+  or not, match the packet memory as seen by the peripheral.
+- nothing is written outside of the packet, except for the padding of its last
+  halfword or word, including the unused halfwords of the 2x16 bit access scheme.
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+SCHEMES = [
+    ('1x16', 'STM32G4'),
+    ('2x16', 'STM32F1'),
+    ('DRD', 'STM32G0'),
+]
+
+
+def main():
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+    parser = argparse.ArgumentParser(description='Host-side model of the packet '
+                                     'memory access schemes.')
+    parser.add_argument('--cc', default=os.environ.get('CC', 'cc'),
+                        help='host C compiler (default: $CC or cc)')
+    parser.add_argument('--iterations', type=int, default=100000,
+                        help='number of random writes and reads per scheme')
+    parser.add_argument('--seed', type=int, default=1, help='first random seed')
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as tmp:
+        for name, family in SCHEMES:
+            binary = os.path.join(tmp, 'usbd-pma-model-%s' % name)
+            try:
+                subprocess.run([args.cc, '-std=gnu11', '-O2', '-Wall', '-Wextra',
+                                '-Wno-pointer-to-int-cast', '-D' + family,
+                                '-I' + os.path.join(root, 'tools', 'host'),
+                                '-I' + os.path.join(root, 'include'),
+                                os.path.join(root, 'tools', 'usbd-pma-model.c'),
+                                '-o', binary], check=True)
+                subprocess.run([binary, str(args.iterations), str(args.seed)],
+                               check=True)
+            except subprocess.CalledProcessError:
+                print('%s (%s): failed' % (name, family), file=sys.stderr)
+                return 1
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())